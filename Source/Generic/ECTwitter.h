@@ -9,7 +9,10 @@
 #import "ECTwitterEngine.h"
 #import "ECTwitterHandler.h"
 #import "ECTwitterID.h"
+#import "ECTwitterIDSet.h"
+#import "ECTwitterParsing.h"
 #import "ECTwitterSearchTimeline.h"
+#import "ECTwitterStream.h"
 #import "ECTwitterTweet.h"
 #import "ECTwitterTimeline.h"
 #import "ECTwitterUser.h"
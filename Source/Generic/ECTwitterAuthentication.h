@@ -11,6 +11,7 @@
 @class ECTwitterHandler;
 @class ECTwitterEngine;
 @class ECTwitterConnection;
+@class ECTwitterRequestBuilder;
 
 extern NSString *const TwitterAuthenticationSucceeded;
 extern NSString *const TwitterAuthenticationFailed;
@@ -36,5 +37,6 @@ extern NSString *const TwitterAuthenticationFailed;
 - (void)authenticateForUser:(NSString*)user password:(NSString*)password handler:(void (^)(ECTwitterHandler* handler))handler;
 
 - (NSMutableURLRequest*)requestForURL:(NSURL*)url;
+- (NSMutableURLRequest*)requestWithBuilder:(ECTwitterRequestBuilder*)builder method:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters;
 
 @end
@@ -14,6 +14,7 @@
 #import <ECOAuthConsumer/ECOAuthConsumer.h>
 
 #import "ECTwitterConnection.h"
+#import "ECTwitterRequestBuilder.h"
 #import "MGTwitterEngine.h"
 
 // --------------------------------------------------------------------------
@@ -270,5 +271,17 @@ ECDefineDebugChannel(AuthenticationChannel);
     return [request autorelease];
 }
 
+// --------------------------------------------------------------------------
+/// Make a request signed for our consumer and token, using a builder.
+/// The builder keeps the signing state for each consumer/token pair, so
+/// this is much cheaper than signing from scratch with requestForURL.
+// --------------------------------------------------------------------------
+
+- (NSMutableURLRequest*)requestWithBuilder:(ECTwitterRequestBuilder*)builder method:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters
+{
+    OAToken* token = self.token;
+
+    return [builder requestWithMethod:method URL:url parameters:parameters consumerKey:self.engine.consumerKey consumerSecret:self.engine.consumerSecret tokenKey:token.key tokenSecret:token.secret];
+}
 
 @end
@@ -7,11 +7,29 @@
 //  liberal license: http://www.elegantchaos.com/license/liberal
 // --------------------------------------------------------------------------
 
-@class ECTwitterImage;
+#import "ECTwitterImage.h"
+
+@class ECTwitterCachedObject;
 @class ECTwitterTweet;
 @class ECTwitterUser;
 @class ECTwitterEngine;
 @class ECTwitterID;
+@class ECTwitterIDSet;
+
+// --------------------------------------------------------------------------
+/// The cache of tweets and users.
+///
+/// Looking up tweets and users that are already in memory can be done from
+/// any thread, and doesn't block - the maps are sharded, and each lookup
+/// only takes a shared lock on one shard. Everything else (making new
+/// objects, reading them in from disk, ingesting, indexing, eviction and
+/// saving) takes the cache's lock, so can also be called from any thread,
+/// but only one thread at a time gets to do it. When a lookup misses, it
+/// looks again with the lock held before making anything, so two threads
+/// asking for the same id always get the same object.
+///
+/// Notifications are posted on the thread that made the change.
+// --------------------------------------------------------------------------
 
 @interface ECTwitterCache : NSObject 
 
@@ -21,6 +39,33 @@
 
 @property (strong, nonatomic) ECTwitterEngine* engine;
 
+// Where the cache is saved. Defaults to a folder in the user's Caches
+// directory; must be set before the cache is loaded or saved.
+@property (strong, nonatomic) NSURL* cacheFolder;
+
+// If set, load just indexes the cache on disk, and tweets and users
+// are read in when they're first asked for.
+@property (assign, nonatomic) BOOL loadsLazily;
+
+// Eviction budgets - zero means unlimited.
+@property (assign, nonatomic) NSUInteger maxTweets;
+@property (assign, nonatomic) NSUInteger maxTweetBytes;
+@property (assign, nonatomic) NSUInteger maxUsers;
+
+// How long to wait while collecting missing users into one lookup request.
+@property (assign, nonatomic) NSTimeInterval userLookupDelay;
+
+// Eviction statistics.
+@property (assign, nonatomic, readonly) NSUInteger tweetCount;
+@property (assign, nonatomic, readonly) NSUInteger tweetBytes;
+@property (assign, nonatomic, readonly) NSUInteger userCount;
+@property (assign, nonatomic, readonly) NSUInteger evictedTweets;
+@property (assign, nonatomic, readonly) NSUInteger evictedUsers;
+
+// Lookup statistics.
+@property (assign, nonatomic, readonly) NSUInteger userLookupRequests;
+@property (assign, nonatomic, readonly) NSUInteger usersLookedUp;
+
 // --------------------------------------------------------------------------
 // Public Methods
 // --------------------------------------------------------------------------
@@ -29,12 +74,16 @@
 
 - (ECTwitterUser*)addOrRefreshUserWithInfo:(NSDictionary*)info;
 - (ECTwitterTweet*)addOrRefreshTweetWithInfo:(NSDictionary*)info;
+- (NSArray*)addOrRefreshUsers:(NSArray*)infos;
+- (NSArray*)addOrRefreshTweets:(NSArray*)infos;
 
 
 - (ECTwitterTweet*)tweetWithID:(ECTwitterID*)tweetID;
 - (ECTwitterUser*)userWithID:(ECTwitterID*)userID;
 - (ECTwitterUser*)userWithID:(ECTwitterID*)userID requestIfMissing:(BOOL)requestIfMissing;
+- (NSArray*)usersWithIDs:(ECTwitterIDSet*)userIDs range:(NSRange)range;
 - (ECTwitterImage*)imageWithID:(ECTwitterID*)imageID URL:(NSURL*)url;
+- (ECTwitterImage*)imageWithURL:(NSURL*)url handler:(ECTwitterImageHandler)handler;
 
 - (ECTwitterTweet*)existingTweetWithID:(ECTwitterID*)tweetID;
 - (ECTwitterUser*)existingUserWithID:(ECTwitterID*)userID;
@@ -46,12 +95,29 @@
 - (void)authenticateUserWithName:(NSString*)name password:(NSString*)password;
 - (void)setDefaultAuthenticatedUser:(ECTwitterUser*)user;
 
+- (void)evictIfNeeded;
+- (void)objectDidChange:(ECTwitterCachedObject*)object;
+- (BOOL)materializeObjects:(NSArray*)objects;
+
+- (void)indexTweet:(ECTwitterTweet*)tweet;
+- (void)unindexTweet:(ECTwitterTweet*)tweet;
+- (NSSet*)tweetIDsMentioningName:(NSString*)name;
+- (NSSet*)tweetIDsWithHashtag:(NSString*)hashtag;
+- (NSArray*)tweetsMentioningName:(NSString*)name;
+- (NSArray*)tweetsWithHashtag:(NSString*)hashtag;
+- (NSArray*)tweetIDsMatchingSearch:(NSString*)query;
+- (NSArray*)tweetsMatchingSearch:(NSString*)query;
+- (NSArray*)tweetsWithSortedIDs:(NSArray*)tweetIDs;
+
+- (void)socialGraphDidChange:(ECTwitterUser*)user;
+- (NSDictionary*)savedSocialGraphForUserID:(ECTwitterID*)userID;
+
 - (void)setFavouritedStateForTweet:(ECTwitterTweet*)tweet to:(BOOL) state;
 
 - (void)save;
 - (void)load;
 
-+ (ECTwitterCache*)decodingCache;
++ (ECTwitterCache*)cacheForCoder:(NSCoder*)coder;
 
 // --------------------------------------------------------------------------
 // Notifications
@@ -62,5 +128,10 @@ extern NSString *const ECTwitterUserAuthenticated;
 extern NSString *const ECTwitterUserAuthenticationFailed;
 extern NSString *const ECTwitterTweetUpdated;
 extern NSString *const ECTwitterTimelineUpdated;
+extern NSString *const ECTwitterCacheUpdated;
+
+// Keys in the ECTwitterCacheUpdated user info: sets of the new or changed objects.
+extern NSString *const ECTwitterCacheUpdatedTweetsKey;
+extern NSString *const ECTwitterCacheUpdatedUsersKey;
 
 @end
@@ -10,14 +10,22 @@
 #import "ECTwitterCache.h"
 
 #import "ECTwitterAuthentication.h"
+#import "ECTwitterCacheClock.h"
+#import "ECTwitterCacheMap.h"
+#import "ECTwitterCacheStore.h"
+#import "ECTwitterCacheUnarchiver.h"
+#import "ECTwitterRecordCoder.h"
+#import "ECTwitterTextIndex.h"
 #import "ECTwitterHandler.h"
 #import "ECTwitterEngine.h"
 #import "ECTwitterUser.h"
 #import "ECTwitterTweet.h"
 #import "ECTwitterID.h"
+#import "ECTwitterIDSet.h"
 #import "ECTwitterTimeline.h"
 #import "ECTwitterUserMentionsTimeline.h"
 #import "ECTwitterImage.h"
+#import "ECTwitterImageCache.h"
 
 
 // --------------------------------------------------------------------------
@@ -26,24 +34,64 @@
 
 @interface ECTwitterCache()
 
-@property (strong, nonatomic) NSMutableDictionary* tweets;
-@property (strong, nonatomic) NSMutableDictionary* usersByID;
-@property (strong, nonatomic) NSMutableDictionary* usersByName;
-@property (strong, nonatomic) NSMutableDictionary* authenticated;
-@property (nonatomic, assign) NSUInteger maxCached;
+@property (strong, nonatomic) ECTwitterCacheMap* tweets;
+@property (strong, nonatomic) ECTwitterCacheMap* usersByID;
+@property (strong, nonatomic) ECTwitterCacheMap* usersByName;
+@property (strong, nonatomic) ECTwitterCacheMap* authenticated;
+@property (strong, nonatomic) NSMutableSet* dirtyObjects;
+@property (strong, nonatomic) NSMutableSet* dirtyGraphs;
+@property (assign, nonatomic) BOOL authenticatedChanged;
+@property (strong, nonatomic) ECTwitterCacheStore* store;
+@property (strong, nonatomic) ECTwitterCacheClock* tweetClock;
+@property (strong, nonatomic) ECTwitterCacheClock* userClock;
+@property (assign, nonatomic) BOOL loading;
+@property (assign, nonatomic) BOOL ingesting;
+@property (strong, nonatomic) ECTwitterCacheMap* pendingTweets;
+@property (strong, nonatomic) ECTwitterCacheMap* pendingUsers;
+@property (strong, nonatomic) NSMutableArray* queuedLookups;
+@property (strong, nonatomic) NSMutableSet* requestedLookups;
+@property (strong, nonatomic) NSMutableDictionary* mentionIndex;
+@property (strong, nonatomic) NSMutableDictionary* hashtagIndex;
+@property (strong, nonatomic) NSMutableDictionary* mentionChanges;
+@property (strong, nonatomic) NSMutableDictionary* hashtagChanges;
+@property (assign, nonatomic) uint64_t lastEntityDelta;
+@property (assign, nonatomic) NSUInteger entityDeltas;
+@property (strong, nonatomic) ECTwitterTextIndex* textIndex;
+@property (strong, nonatomic) ECTwitterImageCache* imageCache;
+@property (assign, nonatomic, readwrite) NSUInteger userLookupRequests;
+@property (assign, nonatomic, readwrite) NSUInteger usersLookedUp;
+
+- (ECTwitterTweet*)residentTweetWithID:(ECTwitterID*)tweetID;
+- (ECTwitterUser*)residentUserWithID:(ECTwitterID*)userID;
+- (void)removeTweet:(ECTwitterTweet*)tweet;
+- (void)removeUser:(ECTwitterUser*)user;
+- (void)evictTweet:(ECTwitterTweet*)tweet;
+- (void)evictUser:(ECTwitterUser*)user;
+- (ECTwitterTweet*)ingestTweetWithInfo:(NSDictionary*)info changes:(NSMutableSet*)changes userChanges:(NSMutableSet*)userChanges authors:(NSMutableSet*)authors;
+- (ECTwitterUser*)ingestUserWithInfo:(NSDictionary*)info changes:(NSMutableSet*)changes;
+- (void)postUpdateForTweets:(NSSet*)tweets users:(NSSet*)users;
+- (NSArray*)tweetsWithIDs:(NSSet*)tweetIDs;
+- (void)loadEntityIndex;
+- (void)saveEntityIndex;
+- (void)materializeRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID;
+- (id)decodeRecordData:(NSData*)data;
+- (void)decodeTweetRecords:(NSArray*)payloads;
 
 - (void)requestUserByID:(ECTwitterID*)userID;
-- (void)userInfoHandler:(ECTwitterHandler*)handler;
+- (void)scheduleUserLookups;
+- (void)flushUserLookups;
+- (void)userLookupHandler:(ECTwitterHandler*)handler;
 - (void)makeFavouriteHandler:(ECTwitterHandler*)handler;
 
 - (NSURL*)baseCacheFolder;
 - (NSURL*)mainCacheFile;
+- (NSURL*)legacyCacheFile;
+- (NSURL*)textIndexFile;
+- (void)loadLegacyCache;
 - (NSURL*)imageCacheFolder;
 
 @end
 
-// TODO: use twitterIDs as keys directly
-
 @implementation ECTwitterCache
 
 // ==============================================
@@ -57,9 +105,33 @@ ECDefineDebugChannel(TwitterCacheChannel);
 // ==============================================
 
 @synthesize authenticated = _authenticated;
+@synthesize authenticatedChanged = _authenticatedChanged;
+@synthesize cacheFolder = _cacheFolder;
+@synthesize dirtyGraphs = _dirtyGraphs;
+@synthesize dirtyObjects = _dirtyObjects;
 @synthesize engine = _engine;
-@synthesize maxCached = _maxCached;
+@synthesize entityDeltas = _entityDeltas;
+@synthesize hashtagChanges = _hashtagChanges;
+@synthesize hashtagIndex = _hashtagIndex;
+@synthesize imageCache = _imageCache;
+@synthesize ingesting = _ingesting;
+@synthesize loading = _loading;
+@synthesize lastEntityDelta = _lastEntityDelta;
+@synthesize loadsLazily = _loadsLazily;
+@synthesize mentionChanges = _mentionChanges;
+@synthesize mentionIndex = _mentionIndex;
+@synthesize pendingTweets = _pendingTweets;
+@synthesize pendingUsers = _pendingUsers;
+@synthesize queuedLookups = _queuedLookups;
+@synthesize requestedLookups = _requestedLookups;
+@synthesize store = _store;
+@synthesize textIndex = _textIndex;
+@synthesize tweetClock = _tweetClock;
 @synthesize tweets = _tweets;
+@synthesize userClock = _userClock;
+@synthesize userLookupDelay = _userLookupDelay;
+@synthesize userLookupRequests = _userLookupRequests;
+@synthesize usersLookedUp = _usersLookedUp;
 @synthesize usersByID = _usersByID;
 @synthesize usersByName = _usersByName;
 
@@ -72,12 +144,10 @@ NSString *const ECTwitterUserAuthenticationFailed = @"UserAuthenticationFailed";
 NSString *const ECTwitterUserUpdated = @"UserUpdated";
 NSString *const ECTwitterTweetUpdated = @"TweetUpdated";
 NSString *const ECTwitterTimelineUpdated = @"TimelineUpdated";
+NSString *const ECTwitterCacheUpdated = @"CacheUpdated";
 
-// ==============================================
-// Globals
-// ==============================================
-
-static ECTwitterCache* gDecodingCache = nil;
+NSString *const ECTwitterCacheUpdatedTweetsKey = @"tweets";
+NSString *const ECTwitterCacheUpdatedUsersKey = @"users";
 
 // ==============================================
 // Constants
@@ -88,6 +158,18 @@ NSString *const kProvider = @"ECTwitterEngine";
 NSString *const AuthenticatedIDKey = @"id";
 NSString *const AuthenticatedTokenKey = @"token";
 
+static const NSUInteger kDefaultMaxTweets = 5000;
+static const NSUInteger kDefaultMaxTweetBytes = 8 * 1024 * 1024;
+static const NSUInteger kDefaultMaxUsers = 2000;
+
+// users/lookup takes at most this many IDs per request
+static const NSUInteger kMaxUsersPerLookup = 100;
+static const NSTimeInterval kDefaultUserLookupDelay = 0.1;
+
+// once this many changes to the mention and hashtag index have been saved,
+// the next save writes the whole index again, and throws the changes away
+static const NSUInteger kMaxEntityDeltas = 64;
+
 // ==============================================
 // Methods
 // ==============================================
@@ -97,11 +179,33 @@ NSString *const AuthenticatedTokenKey = @"token";
 	if ((self = [super init]) != nil)
 	{
 		self.engine = engineIn;
-		self.tweets = [NSMutableDictionary dictionary];
-		self.usersByID = [NSMutableDictionary dictionary];
-		self.usersByName = [NSMutableDictionary dictionary];
-		self.authenticated = [NSMutableDictionary dictionary];
-        self.maxCached = 100; // temporary
+		self.tweets = [[[ECTwitterCacheMap alloc] init] autorelease];
+		self.usersByID = [[[ECTwitterCacheMap alloc] init] autorelease];
+		self.usersByName = [[[ECTwitterCacheMap alloc] init] autorelease];
+		self.authenticated = [[[ECTwitterCacheMap alloc] init] autorelease];
+        self.dirtyObjects = [NSMutableSet set];
+        self.dirtyGraphs = [NSMutableSet set];
+        self.loadsLazily = YES;
+        self.pendingTweets = [[[ECTwitterCacheMap alloc] init] autorelease];
+        self.pendingUsers = [[[ECTwitterCacheMap alloc] init] autorelease];
+        self.queuedLookups = [NSMutableArray array];
+        self.requestedLookups = [NSMutableSet set];
+        self.mentionIndex = [NSMutableDictionary dictionary];
+        self.hashtagIndex = [NSMutableDictionary dictionary];
+        self.mentionChanges = [NSMutableDictionary dictionary];
+        self.hashtagChanges = [NSMutableDictionary dictionary];
+        self.userLookupDelay = kDefaultUserLookupDelay;
+
+        ECTwitterCacheClock* tweetClock = [[ECTwitterCacheClock alloc] init];
+        tweetClock.maxCount = kDefaultMaxTweets;
+        tweetClock.maxBytes = kDefaultMaxTweetBytes;
+        self.tweetClock = tweetClock;
+        [tweetClock release];
+
+        ECTwitterCacheClock* userClock = [[ECTwitterCacheClock alloc] init];
+        userClock.maxCount = kDefaultMaxUsers;
+        self.userClock = userClock;
+        [userClock release];
  	}
 	
 	return self;
@@ -110,150 +214,1189 @@ NSString *const AuthenticatedTokenKey = @"token";
 - (void)dealloc 
 {
     [_authenticated release];
+    [_cacheFolder release];
+    [_dirtyGraphs release];
+    [_dirtyObjects release];
     [_engine release];
+    [_hashtagChanges release];
+    [_hashtagIndex release];
+    [_imageCache release];
+    [_mentionChanges release];
+    [_mentionIndex release];
+    [_pendingTweets release];
+    [_pendingUsers release];
+    [_queuedLookups release];
+    [_requestedLookups release];
+    [_store release];
+    [_textIndex release];
+    [_tweetClock release];
     [_tweets release];
+    [_userClock release];
     [_usersByName release];
     [_usersByID release];
 
     [super dealloc];
 }
 
+// --------------------------------------------------------------------------
+/// Budgets and statistics.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)maxTweets
+{
+    return self.tweetClock.maxCount;
+}
+
+- (void)setMaxTweets:(NSUInteger)maxTweets
+{
+    @synchronized(self)
+    {
+        self.tweetClock.maxCount = maxTweets;
+        [self evictIfNeeded];
+    }
+}
+
+- (NSUInteger)maxTweetBytes
+{
+    return self.tweetClock.maxBytes;
+}
+
+- (void)setMaxTweetBytes:(NSUInteger)maxTweetBytes
+{
+    @synchronized(self)
+    {
+        self.tweetClock.maxBytes = maxTweetBytes;
+        [self evictIfNeeded];
+    }
+}
+
+- (NSUInteger)maxUsers
+{
+    return self.userClock.maxCount;
+}
+
+- (void)setMaxUsers:(NSUInteger)maxUsers
+{
+    @synchronized(self)
+    {
+        self.userClock.maxCount = maxUsers;
+        [self evictIfNeeded];
+    }
+}
+
+- (NSUInteger)tweetCount
+{
+    return self.tweetClock.count;
+}
+
+- (NSUInteger)tweetBytes
+{
+    return self.tweetClock.bytes;
+}
+
+- (NSUInteger)userCount
+{
+    return self.userClock.count;
+}
+
+- (NSUInteger)evictedTweets
+{
+    return self.tweetClock.evictions;
+}
+
+- (NSUInteger)evictedUsers
+{
+    return self.userClock.evictions;
+}
+
+// --------------------------------------------------------------------------
+/// Return a tweet or user that's already in memory, and doesn't need
+/// reading in from disk first, or nil.
+/// This doesn't take the cache's lock, so any number of threads can look
+/// things up at once. Anything else has to be done with the lock held.
+// --------------------------------------------------------------------------
+
+- (ECTwitterTweet*)residentTweetWithID:(ECTwitterID*)tweetID
+{
+    ECTwitterTweet* tweet = [self.tweets objectForKey:tweetID];
+    if (tweet && ![self.pendingTweets containsKey:tweetID])
+    {
+        [self.tweetClock touchObject:tweet];
+    }
+    else
+    {
+        tweet = nil;
+    }
+
+    return tweet;
+}
+
+- (ECTwitterUser*)residentUserWithID:(ECTwitterID*)userID
+{
+    ECTwitterUser* user = [self.usersByID objectForKey:userID];
+    if (user && ![self.pendingUsers containsKey:userID])
+    {
+        [self.userClock touchObject:user];
+    }
+    else
+    {
+        user = nil;
+    }
+
+    return user;
+}
+
+// --------------------------------------------------------------------------
+/// Return the tweet with a given id, making a placeholder if we don't have it.
+/// If it isn't in memory we look again with the lock held before making
+/// one, so threads asking for the same id at once all get the same tweet.
+// --------------------------------------------------------------------------
+
 - (ECTwitterTweet*)tweetWithID:(ECTwitterID*)tweetID
 {
-	ECTwitterTweet* tweet = [self.tweets objectForKey:tweetID.string];
+	ECTwitterTweet* tweet = [self residentTweetWithID:tweetID];
 	if (!tweet)
 	{
-		tweet = [[[ECTwitterTweet alloc] initWithID:tweetID inCache:self] autorelease];
-		[self.tweets setObject:tweet forKey:tweetID.string];
+		@synchronized(self)
+		{
+			[self materializeRecordOfKind:RecordTweet recordID:tweetID];
+			tweet = [self.tweets objectForKey:tweetID];
+			if (!tweet)
+			{
+				tweet = [[[ECTwitterTweet alloc] initWithID:tweetID inCache:self] autorelease];
+				[self addTweet:tweet withID:tweetID];
+			}
+			else
+			{
+				[self.tweetClock touchObject:tweet];
+			}
+		}
 	}
 	
 	return tweet;
 }
 
-- (ECTwitterUser*)userWithID:(ECTwitterID*)userID
+- (ECTwitterUser*)userWithID:(ECTwitterID*)userID
+{
+    return [self userWithID:userID requestIfMissing:YES];
+}
+
+- (ECTwitterUser*)userWithID:(ECTwitterID *)userID requestIfMissing:(BOOL)requestIfMissing
+{
+    if (userID == nil)
+    {
+        NSLog(@"nil userID found");
+    }
+    ECAssertNonNil(userID);
+    
+	ECTwitterUser* user = [self residentUserWithID:userID];
+	if (!user)
+	{
+		@synchronized(self)
+		{
+			[self materializeRecordOfKind:RecordUser recordID:userID];
+			user = [self.usersByID objectForKey:userID];
+			if (!user)
+			{
+				user = [[[ECTwitterUser alloc] initWithID:userID inCache:self] autorelease];
+				[self addUser:user withID:userID];
+				if (requestIfMissing)
+				{
+					[self requestUserByID:userID];
+				}
+			}
+			else
+			{
+				[self.userClock touchObject:user];
+			}
+		}
+	}
+	
+	return user;
+}
+
+// --------------------------------------------------------------------------
+/// Return users for some of a set of IDs.
+/// Users we haven't got yet come back as placeholders, and are looked up
+/// in batches, so paging through a big follower list only fetches the
+/// users that are actually looked at.
+// --------------------------------------------------------------------------
+
+- (NSArray*)usersWithIDs:(ECTwitterIDSet*)userIDs range:(NSRange)range
+{
+    NSArray* ids = [userIDs idsInRange:range];
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:[ids count]];
+    for (ECTwitterID* userID in ids)
+    {
+        [result addObject:[self userWithID:userID]];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the tweet or user with a given id if we've got it, reading it
+/// in from disk if necessary, or nil.
+/// We only need the lock if there's something to read in.
+// --------------------------------------------------------------------------
+
+- (ECTwitterTweet*)existingTweetWithID:(ECTwitterID*)tweetID
+{
+    ECTwitterTweet* tweet = [self residentTweetWithID:tweetID];
+    if (!tweet && [self.pendingTweets containsKey:tweetID])
+    {
+        @synchronized(self)
+        {
+            [self materializeRecordOfKind:RecordTweet recordID:tweetID];
+            tweet = [self.tweets objectForKey:tweetID];
+            [self.tweetClock touchObject:tweet];
+        }
+    }
+
+    return tweet;
+}
+
+- (ECTwitterUser*)existingUserWithID:(ECTwitterID*)userID
+{
+    ECTwitterUser* user = [self residentUserWithID:userID];
+    if (!user && [self.pendingUsers containsKey:userID])
+    {
+        @synchronized(self)
+        {
+            [self materializeRecordOfKind:RecordUser recordID:userID];
+            user = [self.usersByID objectForKey:userID];
+            [self.userClock touchObject:user];
+        }
+    }
+
+    return user;
+}
+
+- (void)addTweet:(ECTwitterTweet*)tweet withID:(ECTwitterID*)tweetID
+{
+    @synchronized(self)
+    {
+        ECTwitterTweet* existing = [self.tweets objectForKey:tweetID];
+        if (existing != tweet)
+        {
+            [self.tweetClock removeObject:existing];
+            [self unindexTweet:existing];
+            [self.tweets setObject:tweet forKey:tweetID];
+            [self indexTweet:tweet];
+            [self.tweetClock addObject:tweet];
+            [self evictIfNeeded];
+        }
+    }
+}
+
+- (void)addUser:(ECTwitterUser*)user withID:(ECTwitterID*)userID
+{
+    @synchronized(self)
+    {
+        ECTwitterUser* existing = [self.usersByID objectForKey:userID];
+        if (existing != user)
+        {
+            [self.userClock removeObject:existing];
+            [self.usersByID setObject:user forKey:userID];
+            [self.userClock addObject:user];
+        }
+        [self cacheUserName:user];
+        [self evictIfNeeded];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove a tweet from the cache.
+// --------------------------------------------------------------------------
+
+- (void)removeTweet:(ECTwitterTweet*)tweet
+{
+    [self.tweetClock removeObject:tweet];
+    [self.dirtyObjects removeObject:tweet];
+    [self.pendingTweets removeObjectForKey:tweet.twitterID];
+    [self.store removeRecordOfKind:RecordTweet recordID:tweet.twitterID];
+    [self unindexTweet:tweet];
+    [self.textIndex removeDocumentWithID:tweet.twitterID];
+    [self.tweets removeObjectForKey:tweet.twitterID];
+}
+
+// --------------------------------------------------------------------------
+/// Remove a user from the cache.
+// --------------------------------------------------------------------------
+
+- (void)removeUser:(ECTwitterUser*)user
+{
+    [self.userClock removeObject:user];
+    [self.dirtyObjects removeObject:user];
+    [self.pendingUsers removeObjectForKey:user.twitterID];
+    [self.dirtyGraphs removeObject:user];
+    [self.store removeRecordOfKind:RecordUser recordID:user.twitterID];
+    [self.store removeRecordOfKind:RecordSocialGraph recordID:user.twitterID];
+    [self.usersByName removeObject:user forKey:user.twitterName];
+    [self.usersByID removeObjectForKey:user.twitterID];
+}
+
+// --------------------------------------------------------------------------
+/// Return the record to save for a tweet or user.
+/// Tweets are saved as compact records; users refer to timelines and other
+/// objects in the cache, so they're still archived.
+// --------------------------------------------------------------------------
+
+static NSData* recordForObject(ECTwitterCachedObject* object)
+{
+    NSData* result = nil;
+    if ([object isKindOfClass:[ECTwitterTweet class]])
+    {
+        result = [(ECTwitterTweet*) object compactRecord];
+    }
+
+    if (!result)
+    {
+        result = [NSKeyedArchiver archivedDataWithRootObject:object];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Read back a tweet record, standalone.
+/// Older caches have keyed archives rather than compact records.
+// --------------------------------------------------------------------------
+
+static ECTwitterTweet* tweetFromRecord(NSData* data)
+{
+    ECTwitterTweet* result;
+    if ([ECTwitterRecordCoder isCompactData:data])
+    {
+        result = [ECTwitterTweet tweetWithCompactRecord:data];
+    }
+    else
+    {
+        result = [ECTwitterCacheUnarchiver unarchiveObjectWithData:data cache:nil];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Drop a tweet from memory.
+/// Unsaved changes are written out first; if it's on disk it'll be
+/// read back in next time it's asked for.
+// --------------------------------------------------------------------------
+
+- (void)evictTweet:(ECTwitterTweet*)tweet
+{
+    ECTwitterID* tweetID = tweet.twitterID;
+    ECTwitterCacheStore* store = self.store;
+    if (tweet.dirty)
+    {
+        [store appendRecordOfKind:RecordTweet recordID:tweetID data:recordForObject(tweet)];
+        [self.dirtyObjects removeObject:tweet];
+        tweet.dirty = NO;
+    }
+
+    if ([store containsRecordOfKind:RecordTweet recordID:tweetID])
+    {
+        [self.pendingTweets addKey:tweetID];
+    }
+
+    [self.tweetClock removeObject:tweet];
+    [self.tweets removeObjectForKey:tweetID];
+}
+
+// --------------------------------------------------------------------------
+/// Drop a user from memory.
+/// Unsaved changes are written out first; if it's on disk it'll be
+/// read back in next time it's asked for.
+// --------------------------------------------------------------------------
+
+- (void)evictUser:(ECTwitterUser*)user
+{
+    ECTwitterID* userID = user.twitterID;
+    ECTwitterCacheStore* store = self.store;
+    if (user.dirty)
+    {
+        [store appendRecordOfKind:RecordUser recordID:userID data:recordForObject(user)];
+        [self.dirtyObjects removeObject:user];
+        user.dirty = NO;
+    }
+
+    if ([self.dirtyGraphs containsObject:user])
+    {
+        [store appendRecordOfKind:RecordSocialGraph recordID:userID data:[NSKeyedArchiver archivedDataWithRootObject:[user socialGraph]]];
+        [self.dirtyGraphs removeObject:user];
+    }
+
+    if ([store containsRecordOfKind:RecordUser recordID:userID])
+    {
+        [self.pendingUsers addKey:userID];
+    }
+
+    [self.userClock removeObject:user];
+    [self.usersByName removeObject:user forKey:user.twitterName];
+    [self.usersByID removeObjectForKey:userID];
+}
+
+// --------------------------------------------------------------------------
+/// If we've got an unread record on disk for a tweet or user, read it in.
+/// References to other objects found whilst decoding just create placeholders;
+/// they're filled in themselves when they're asked for.
+///
+/// Must be called with the lock held. The id stays pending until the
+/// object has been filled in, so that lookups on other threads wait for
+/// it rather than finding a half-decoded object.
+// --------------------------------------------------------------------------
+
+- (void)materializeRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID
+{
+    ECTwitterCacheMap* pending = (kind == RecordTweet) ? self.pendingTweets : self.pendingUsers;
+    if (!self.loading && recordID && [pending containsKey:recordID])
+    {
+        NSData* data = [self.store dataForRecordOfKind:kind recordID:recordID];
+        if (data)
+        {
+            ECDebug(TwitterCacheChannel, @"materializing %@", recordID);
+            if (kind == RecordTweet)
+            {
+                [self decodeTweetRecords:[NSArray arrayWithObject:data]];
+            }
+            else
+            {
+                [self decodeRecordData:data];
+            }
+        }
+        [pending removeObjectForKey:recordID];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Make sure that some tweets or users have been read in from disk.
+/// Returns NO if this can't be done yet because we're in the middle of decoding.
+// --------------------------------------------------------------------------
+
+- (BOOL)materializeObjects:(NSArray*)objects
+{
+    @synchronized(self)
+    {
+        BOOL ok = !self.loading;
+        if (ok)
+        {
+            NSMutableArray* tweetPayloads = [NSMutableArray array];
+            NSMutableSet* tweetIDs = [NSMutableSet set];
+            ECTwitterCacheStore* store = self.store;
+            for (id object in objects)
+            {
+                ECTwitterID* objectID = [object twitterID];
+                if ([object isKindOfClass:[ECTwitterTweet class]])
+                {
+                    if ([self.pendingTweets containsKey:objectID] && ![tweetIDs containsObject:objectID])
+                    {
+                        [tweetIDs addObject:objectID];
+                        NSData* data = [store dataForRecordOfKind:RecordTweet recordID:objectID];
+                        if (data)
+                        {
+                            [tweetPayloads addObject:data];
+                        }
+                        else
+                        {
+                            [self.pendingTweets removeObjectForKey:objectID];
+                        }
+                    }
+                }
+                else
+                {
+                    [self materializeRecordOfKind:RecordUser recordID:objectID];
+                }
+            }
+
+            [self decodeTweetRecords:tweetPayloads];
+        }
+
+        return ok;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Decode an archived object.
+/// Decoding an object is enough to add it to the cache.
+// --------------------------------------------------------------------------
+
+- (id)decodeRecordData:(NSData*)data
+{
+    self.loading = YES;
+    id result = [ECTwitterCacheUnarchiver unarchiveObjectWithData:data cache:self];
+    self.loading = NO;
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Decode a batch of saved tweet records.
+///
+/// Tweets don't refer to anything else in the cache, so we can decode them
+/// standalone, spread across all the cores. Once they're all done we merge
+/// them into the cache in the order they were given, so the result doesn't
+/// depend on which thread finished first. Any placeholder for a tweet that's
+/// already in the cache is filled in, rather than being replaced.
+///
+/// Must be called with the lock held. Each tweet stops being pending as it's
+/// merged, and before anything can be evicted again.
+// --------------------------------------------------------------------------
+
+- (void)decodeTweetRecords:(NSArray*)payloads
+{
+    NSUInteger count = [payloads count];
+    if (count > 0)
+    {
+        ECTwitterTweet** decoded = calloc(count, sizeof(ECTwitterTweet*));
+        dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t n) {
+            @autoreleasepool
+            {
+                decoded[n] = [tweetFromRecord([payloads objectAtIndex:n]) retain];
+            }
+        });
+
+        self.loading = YES;
+        for (NSUInteger n = 0; n < count; ++n)
+        {
+            ECTwitterTweet* tweet = decoded[n];
+            ECTwitterID* tweetID = tweet.twitterID;
+            if (tweetID)
+            {
+                ECTwitterTweet* existing = [self.tweets objectForKey:tweetID];
+                if (existing)
+                {
+                    [existing refreshWithTweet:tweet];
+                    [self.tweetClock resizeObject:existing];
+                }
+                else
+                {
+                    [tweet setCache:self];
+                    [self addTweet:tweet withID:tweetID];
+                }
+                [self.pendingTweets removeObjectForKey:tweetID];
+            }
+            [tweet release];
+        }
+        self.loading = NO;
+        free(decoded);
+
+        [self evictIfNeeded];
+        ECDebug(TwitterCacheChannel, @"decoded %ld tweets", (long) count);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Note that a cached tweet or user needs saving.
+/// Changes made while we're loading are ignored, since they're
+/// already on disk.
+// --------------------------------------------------------------------------
+
+- (void)objectDidChange:(ECTwitterCachedObject*)object
+{
+    @synchronized(self)
+    {
+        if (!self.loading && !object.dirty && ([object isKindOfClass:[ECTwitterTweet class]] || [object isKindOfClass:[ECTwitterUser class]]))
+        {
+            object.dirty = YES;
+            [self.dirtyObjects addObject:object];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Throw away tweets and users until we're back within our budgets.
+///
+/// Tweets that are in a timeline, and users that are referenced by a tweet or
+/// a user list, are pinned and will be skipped. Authenticated users are
+/// never evicted.
+// --------------------------------------------------------------------------
+
+- (void)evictIfNeeded
+{
+    @synchronized(self)
+    {
+        if (!self.loading && !self.ingesting)
+        {
+            [self.tweetClock evictUsingBlock:^BOOL(ECTwitterCachedObject* object) {
+                [self evictTweet:(ECTwitterTweet*) object];
+                return YES;
+            }];
+
+            [self.userClock evictUsingBlock:^BOOL(ECTwitterCachedObject* object) {
+                ECTwitterUser* user = (ECTwitterUser*) object;
+                BOOL evict = (user.authentication == nil);
+                if (evict)
+                {
+                    [self evictUser:user];
+                }
+                
+                return evict;
+            }];
+        }
+    }
+}
+
+- (ECTwitterTweet*)addOrRefreshTweetWithInfo:(NSDictionary*)info
+{
+	NSMutableSet* userChanges = [NSMutableSet set];
+	ECTwitterTweet* tweet;
+	@synchronized(self)
+	{
+		tweet = [self ingestTweetWithInfo:info changes:nil userChanges:userChanges authors:nil];
+	}
+
+	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+	for (ECTwitterUser* user in userChanges)
+	{
+		[nc postNotificationName:ECTwitterUserUpdated object:user];
+	}
+	[nc postNotificationName:ECTwitterTweetUpdated object:tweet];
+
+	return tweet;
+}
+
+- (ECTwitterUser*)addOrRefreshUserWithInfo:(NSDictionary*)info
+{
+	ECTwitterUser* user;
+	@synchronized(self)
+	{
+		user = [self ingestUserWithInfo:info changes:nil];
+	}
+
+	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+	[nc postNotificationName:ECTwitterUserUpdated object:user];
+
+	return user;
+}
+
+// --------------------------------------------------------------------------
+/// Add or refresh a batch of tweets.
+/// Each author is only refreshed once, however many of the tweets are by
+/// them, and eviction is put off until the whole batch is in.
+/// Rather than a notification for each tweet and author, we post a single
+/// ECTwitterCacheUpdated notification, listing the tweets and users that 
+/// are new or have actually changed (if there are any).
+/// Returns the tweets, in the same order as the info.
+// --------------------------------------------------------------------------
+
+- (NSArray*)addOrRefreshTweets:(NSArray*)infos
+{
+	NSUInteger count = [infos count];
+	NSMutableArray* result = [NSMutableArray arrayWithCapacity:count];
+	NSMutableSet* changes = [NSMutableSet setWithCapacity:count];
+	NSMutableSet* userChanges = [NSMutableSet setWithCapacity:count];
+	NSMutableSet* authors = [NSMutableSet setWithCapacity:count];
+
+	@synchronized(self)
+	{
+		BOOL wasIngesting = self.ingesting;
+		self.ingesting = YES;
+		for (NSDictionary* info in infos)
+		{
+			[result addObject:[self ingestTweetWithInfo:info changes:changes userChanges:userChanges authors:authors]];
+		}
+		self.ingesting = wasIngesting;
+		[self evictIfNeeded];
+	}
+
+	[self postUpdateForTweets:changes users:userChanges];
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Add or refresh a batch of users.
+/// As with tweets, we post a single ECTwitterCacheUpdated notification
+/// for the whole batch.
+/// Returns the users, in the same order as the info.
+// --------------------------------------------------------------------------
+
+- (NSArray*)addOrRefreshUsers:(NSArray*)infos
+{
+	NSUInteger count = [infos count];
+	NSMutableArray* result = [NSMutableArray arrayWithCapacity:count];
+	NSMutableSet* changes = [NSMutableSet setWithCapacity:count];
+
+	@synchronized(self)
+	{
+		BOOL wasIngesting = self.ingesting;
+		self.ingesting = YES;
+		for (NSDictionary* info in infos)
+		{
+			[result addObject:[self ingestUserWithInfo:info changes:changes]];
+		}
+		self.ingesting = wasIngesting;
+		[self evictIfNeeded];
+	}
+
+	[self postUpdateForTweets:nil users:changes];
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Post a change-set notification, if anything has changed.
+// --------------------------------------------------------------------------
+
+- (void)postUpdateForTweets:(NSSet*)tweets users:(NSSet*)users
+{
+	if (([tweets count] > 0) || ([users count] > 0))
+	{
+		NSDictionary* info = [NSDictionary dictionaryWithObjectsAndKeys:
+							  tweets ? tweets : [NSSet set], ECTwitterCacheUpdatedTweetsKey,
+							  users ? users : [NSSet set], ECTwitterCacheUpdatedUsersKey,
+							  nil];
+
+		NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+		[nc postNotificationName:ECTwitterCacheUpdated object:self userInfo:info];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet, or refresh an existing one, along with its author.
+/// If the existing tweet was set from the same info, we leave it alone.
+/// We can't compare with its data, since that's rebuilt from just the
+/// fields we keep, so we compare a hash of the info it was set from.
+/// Tweets and users that are new or changed are added to the change sets,
+/// if we're given them. Authors that are already in the authors set
+/// aren't refreshed again.
+// --------------------------------------------------------------------------
+
+- (ECTwitterTweet*)ingestTweetWithInfo:(NSDictionary*)info changes:(NSMutableSet*)changes userChanges:(NSMutableSet*)userChanges authors:(NSMutableSet*)authors
+{
+	ECTwitterID* tweetID = [ECTwitterID idFromDictionary:info];
+	[self materializeRecordOfKind:RecordTweet recordID:tweetID];
+	ECTwitterTweet* tweet = [self.tweets objectForKey:tweetID];
+	if (!tweet)
+	{
+		tweet = [[ECTwitterTweet alloc] initWithInfo:info inCache:self];
+		[self addTweet:tweet withID:tweetID];
+		[tweet autorelease];
+		[changes addObject:tweet];
+	}
+	else if (tweet.infoHash != [ECTwitterCachedObject hashForInfo:info])
+	{
+		[tweet refreshWithInfo:info];
+		[self.tweetClock resizeObject:tweet];
+		[changes addObject:tweet];
+	}
+	else
+	{
+		[self.tweetClock touchObject:tweet];
+	}
+	
+	NSDictionary* authorData = [info objectForKey:@"user"];
+	if ([authorData count] > 2)
+	{
+		ECTwitterID* authorID = [ECTwitterID idFromDictionary:authorData];
+		if (![authors containsObject:authorID])
+		{
+			[authors addObject:authorID];
+			[self ingestUserWithInfo:authorData changes:userChanges];
+		}
+	}
+
+	return tweet;
+}
+
+// --------------------------------------------------------------------------
+/// Add a user, or refresh an existing one.
+/// If the existing user was set from the same info, we leave it alone
+/// (see ingestTweetWithInfo:). Users that are new or changed are added
+/// to the change set, if we're given one.
+// --------------------------------------------------------------------------
+
+- (ECTwitterUser*)ingestUserWithInfo:(NSDictionary*)info changes:(NSMutableSet*)changes
+{
+	ECTwitterID* userID = [ECTwitterID idFromDictionary:info];
+	[self materializeRecordOfKind:RecordUser recordID:userID];
+	ECTwitterUser* user = [self.usersByID objectForKey:userID];
+	if (!user)
+	{
+		user = [[ECTwitterUser alloc] initWithInfo:info inCache:self];
+		[self addUser:user withID:userID];
+		[user autorelease];
+		[changes addObject:user];
+	}
+	else if (user.infoHash != [ECTwitterCachedObject hashForInfo:info])
+	{
+		[user refreshWithInfo:info];
+		[self.userClock resizeObject:user];
+        [self cacheUserName:user];
+		[changes addObject:user];
+	}
+	else
+	{
+		[self.userClock touchObject:user];
+	}
+
+	return user;
+}
+
+- (void)cacheUserName:(ECTwitterUser*)user
+{
+    // update cache of user names
+    NSString* name = user.twitterName;
+    if (name)
+    {
+        [self.usersByName setObject:user forKey:name];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the set of tweet ids for a name or tag, making it if necessary.
+// --------------------------------------------------------------------------
+
+static NSMutableSet* indexEntry(NSMutableDictionary* index, NSString* key)
+{
+    NSMutableSet* tweetIDs = [index objectForKey:key];
+    if (!tweetIDs)
+    {
+        tweetIDs = [[NSMutableSet alloc] initWithCapacity:1];
+        [index setObject:tweetIDs forKey:key];
+        [tweetIDs release];
+    }
+
+    return tweetIDs;
+}
+
+// --------------------------------------------------------------------------
+/// Note that a tweet's id has been added to, or removed from, the index
+/// entry for a name or tag.
+/// The changes are kept per name or tag, as a set of ids added and a set
+/// removed, so that only what's changed needs saving.
+// --------------------------------------------------------------------------
+
+static void noteIndexChange(NSMutableDictionary* changes, NSString* key, ECTwitterID* tweetID, BOOL added)
+{
+    NSMutableDictionary* change = [changes objectForKey:key];
+    if (!change)
+    {
+        change = [NSMutableDictionary dictionaryWithObjectsAndKeys:[NSMutableSet set], @"added", [NSMutableSet set], @"removed", nil];
+        [changes setObject:change forKey:key];
+    }
+
+    [[change objectForKey:added ? @"removed" : @"added"] removeObject:tweetID];
+    [[change objectForKey:added ? @"added" : @"removed"] addObject:tweetID];
+}
+
+// --------------------------------------------------------------------------
+/// Apply a set of saved changes to an index.
+// --------------------------------------------------------------------------
+
+static void applyIndexChanges(NSMutableDictionary* index, NSDictionary* changes)
+{
+    for (NSString* key in changes)
+    {
+        NSDictionary* change = [changes objectForKey:key];
+        NSMutableSet* tweetIDs = indexEntry(index, key);
+        [tweetIDs minusSet:[change objectForKey:@"removed"]];
+        [tweetIDs unionSet:[change objectForKey:@"added"]];
+        if ([tweetIDs count] == 0)
+        {
+            [index removeObjectForKey:key];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet's id to the index entries for each name or tag in a list.
+// --------------------------------------------------------------------------
+
+static void addToIndex(NSMutableDictionary* index, NSMutableDictionary* changes, NSArray* keys, ECTwitterID* tweetID)
+{
+    for (NSString* key in keys)
+    {
+        NSMutableSet* tweetIDs = indexEntry(index, key);
+        if (![tweetIDs containsObject:tweetID])
+        {
+            [tweetIDs addObject:tweetID];
+            noteIndexChange(changes, key, tweetID, YES);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove a tweet's id from the index entries for each name or tag in a list.
+// --------------------------------------------------------------------------
+
+static void removeFromIndex(NSMutableDictionary* index, NSMutableDictionary* changes, NSArray* keys, ECTwitterID* tweetID)
+{
+    for (NSString* key in keys)
+    {
+        NSMutableSet* tweetIDs = [index objectForKey:key];
+        if ([tweetIDs containsObject:tweetID])
+        {
+            [tweetIDs removeObject:tweetID];
+            if ([tweetIDs count] == 0)
+            {
+                [index removeObjectForKey:key];
+            }
+            noteIndexChange(changes, key, tweetID, NO);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet to the index of who it mentions and which hashtags it uses,
+/// and to the full text index.
+/// Tweets call this themselves when their data is set.
+///
+/// The index maps to ids rather than tweets, and isn't touched when a tweet
+/// is evicted, since it can be read back in from disk when it's asked for.
+/// It's saved along with everything else (as just the changes since the
+/// last save), so tweets that haven't been read in yet are still found.
+// --------------------------------------------------------------------------
+
+- (void)indexTweet:(ECTwitterTweet*)tweet
+{
+    ECTwitterID* tweetID = tweet.twitterID;
+    if (tweetID)
+    {
+        @synchronized(self)
+        {
+            addToIndex(self.mentionIndex, self.mentionChanges, tweet.mentionedNames, tweetID);
+            addToIndex(self.hashtagIndex, self.hashtagChanges, tweet.hashtags, tweetID);
+
+            // the text of a tweet never changes, so it only needs indexing once
+            NSString* text = tweet.text;
+            ECTwitterTextIndex* textIndex = self.textIndex;
+            if (text && ![textIndex containsDocumentWithID:tweetID])
+            {
+                [textIndex addDocumentWithID:tweetID text:text];
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove a tweet from the mention and hashtag index.
+// --------------------------------------------------------------------------
+
+- (void)unindexTweet:(ECTwitterTweet*)tweet
+{
+    ECTwitterID* tweetID = tweet.twitterID;
+    if (tweetID)
+    {
+        @synchronized(self)
+        {
+            removeFromIndex(self.mentionIndex, self.mentionChanges, tweet.mentionedNames, tweetID);
+            removeFromIndex(self.hashtagIndex, self.hashtagChanges, tweet.hashtags, tweetID);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the ids of the tweets that mention a screen name.
+// --------------------------------------------------------------------------
+
+- (NSSet*)tweetIDsMentioningName:(NSString*)name
+{
+    NSSet* result = nil;
+    if (name)
+    {
+        @synchronized(self)
+        {
+            result = [[[self.mentionIndex objectForKey:[name lowercaseString]] copy] autorelease];
+        }
+    }
+
+    return result ? result : [NSSet set];
+}
+
+// --------------------------------------------------------------------------
+/// Return the ids of the tweets that use a hashtag (given without the #).
+// --------------------------------------------------------------------------
+
+- (NSSet*)tweetIDsWithHashtag:(NSString*)hashtag
+{
+    NSSet* result = nil;
+    if (hashtag)
+    {
+        @synchronized(self)
+        {
+            result = [[[self.hashtagIndex objectForKey:[hashtag lowercaseString]] copy] autorelease];
+        }
+    }
+
+    return result ? result : [NSSet set];
+}
+
+// --------------------------------------------------------------------------
+/// Return the tweets that mention a screen name, newest first.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetsMentioningName:(NSString*)name
+{
+    return [self tweetsWithIDs:[self tweetIDsMentioningName:name]];
+}
+
+// --------------------------------------------------------------------------
+/// Return the tweets that use a hashtag, newest first.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetsWithHashtag:(NSString*)hashtag
 {
-    return [self userWithID:userID requestIfMissing:YES];
+    return [self tweetsWithIDs:[self tweetIDsWithHashtag:hashtag]];
 }
 
-- (ECTwitterUser*)userWithID:(ECTwitterID *)userID requestIfMissing:(BOOL)requestIfMissing
+// --------------------------------------------------------------------------
+/// Return the ids of the tweets that match a search of the local
+/// full text index, newest first.
+/// See ECTwitterTextIndex for the query syntax.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetIDsMatchingSearch:(NSString*)query
 {
-    if ((userID == nil) || (userID.string == nil))
+    @synchronized(self)
     {
-        NSLog(@"nil userID or userID.string found");
+        return [self.textIndex documentIDsMatchingQuery:query];
     }
-    ECAssertNonNil(userID);
-    ECAssertNonNil(userID.string);
-    
-	ECTwitterUser* user = [self.usersByID objectForKey:userID.string];
-	if (!user)
-	{
-		user = [[[ECTwitterUser alloc] initWithID:userID inCache:self] autorelease];
-		[self.usersByID setObject:user forKey:userID.string];
-        if (requestIfMissing)
-        {
-            [self requestUserByID:userID];
-        }
-	}
-	
-	return user;
 }
 
-- (ECTwitterTweet*)existingTweetWithID:(ECTwitterID*)tweetID
-{
-    return [self.tweets objectForKey:tweetID.string];
-}
+// --------------------------------------------------------------------------
+/// Return the tweets that match a search of the local full text index,
+/// newest first.
+// --------------------------------------------------------------------------
 
-- (ECTwitterUser*)existingUserWithID:(ECTwitterID*)userID
+- (NSArray*)tweetsMatchingSearch:(NSString*)query
 {
-    return [self.usersByID objectForKey:userID.string];
+    return [self tweetsWithSortedIDs:[self tweetIDsMatchingSearch:query]];
 }
 
-- (void)addTweet:(ECTwitterTweet*)tweet withID:(ECTwitterID*)tweetID
-{
-    [self.tweets setObject:tweetID forKey:tweetID.string];
-}
+// --------------------------------------------------------------------------
+/// Note that a user's friends or followers have changed.
+/// The social graph is saved as its own record, so that a user with a big
+/// follower list doesn't have to rewrite it whenever their details change.
+// --------------------------------------------------------------------------
 
-- (void)addUser:(ECTwitterUser*)user withID:(ECTwitterID*)userID
+- (void)socialGraphDidChange:(ECTwitterUser*)user
 {
-    [self.usersByID setObject:user forKey:userID.string];
-    [self cacheUserName:user];
+    @synchronized(self)
+    {
+        [self.dirtyGraphs addObject:user];
+    }
 }
 
-- (ECTwitterTweet*)addOrRefreshTweetWithInfo:(NSDictionary*)info
+// --------------------------------------------------------------------------
+/// Return the friends and followers that were saved for a user, if any.
+// --------------------------------------------------------------------------
+
+- (NSDictionary*)savedSocialGraphForUserID:(ECTwitterID*)userID
 {
-	ECTwitterID* tweetID = [ECTwitterID idFromDictionary:info];
-	ECTwitterTweet* tweet = [self.tweets objectForKey:tweetID.string];
-	if (!tweet)
-	{
-		tweet = [[ECTwitterTweet alloc] initWithInfo:info inCache:self];
-		[self.tweets setObject:tweet forKey:tweetID.string];
-		[tweet release];
-	}
-	else
-	{
-		[tweet refreshWithInfo:info];
-	}
-	
-	NSDictionary* authorData = [info objectForKey:@"user"];
-	if ([authorData count] > 2)
-	{
-		[self addOrRefreshUserWithInfo:authorData];
-	}
+    NSData* data;
+    @synchronized(self)
+    {
+        data = [self.store dataForRecordOfKind:RecordSocialGraph recordID:userID];
+    }
 
-	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
-	[nc postNotificationName:ECTwitterTweetUpdated object:tweet];
+    return data ? [NSKeyedUnarchiver unarchiveObjectWithData:data] : nil;
+}
 
-	return tweet;
+// --------------------------------------------------------------------------
+/// Return the tweets for a set of ids, newest first.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetsWithIDs:(NSSet*)tweetIDs
+{
+    NSArray* sortedIDs = [[tweetIDs allObjects] sortedArrayUsingSelector:@selector(compare:)];
+    return [self tweetsWithSortedIDs:[[sortedIDs reverseObjectEnumerator] allObjects]];
 }
 
-- (void)cacheUserName:(ECTwitterUser*)user
+// --------------------------------------------------------------------------
+/// Return the tweets for a list of ids, in the same order.
+/// Any that have been evicted are read back in.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetsWithSortedIDs:(NSArray*)sortedIDs
 {
-    // update cache of user names
-    NSString* name = user.twitterName;
-    if (name)
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:[sortedIDs count]];
+    for (ECTwitterID* tweetID in sortedIDs)
     {
-        [self.usersByName setObject:user forKey:name];
+        ECTwitterTweet* tweet = [self existingTweetWithID:tweetID];
+        if (tweet)
+        {
+            [result addObject:tweet];
+        }
     }
+    
+    return result;
 }
 
-- (ECTwitterUser*)addOrRefreshUserWithInfo:(NSDictionary*)info
+// --------------------------------------------------------------------------
+/// Request info about a given user id.
+/// Rather than asking for each user on its own, we queue up the id
+/// and look up everything queued in one go, after a short delay.
+/// An id that's already queued or in flight isn't asked for again.
+// --------------------------------------------------------------------------
+
+- (void) requestUserByID:(ECTwitterID*)userID
 {
-	ECTwitterID* userID = [ECTwitterID idFromDictionary:info];
-	ECTwitterUser* user = [self.usersByID objectForKey:userID.string];
-	if (!user)
-	{
-		user = [[ECTwitterUser alloc] initWithInfo:info inCache:self];
-		[self.usersByID setObject:user forKey:userID.string];
-		[user release];
-	}
-	else
-	{
-		[user refreshWithInfo:info];
-	}
+    ECAssertNonNil(userID);
 
-    [self cacheUserName:user];
+    @synchronized(self)
+    {
+        if (![self.requestedLookups containsObject:userID])
+        {
+            ECDebug(TwitterCacheChannel, @"queuing user info request for %@", userID);
+            [self.requestedLookups addObject:userID];
+            [self.queuedLookups addObject:userID];
+            if ([self.queuedLookups count] == 1)
+            {
+                if ([NSThread isMainThread])
+                {
+                    [self scheduleUserLookups];
+                }
+                else
+                {
+                    [self performSelectorOnMainThread:@selector(scheduleUserLookups) withObject:nil waitUntilDone:NO];
+                }
+            }
+        }
+    }
+}
 
-	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
-	[nc postNotificationName:ECTwitterUserUpdated object:user];
+// --------------------------------------------------------------------------
+/// Start the delay before the queued lookups are sent.
+/// The requests are always sent from the main thread, whichever
+/// thread asked for the users.
+// --------------------------------------------------------------------------
 
-	return user;
+- (void)scheduleUserLookups
+{
+    [self performSelector:@selector(flushUserLookups) withObject:nil afterDelay:self.userLookupDelay];
 }
 
 // --------------------------------------------------------------------------
-/// Request info about a given user id
+/// Send off lookup requests for all the queued user ids,
+/// in batches of as many as the API allows.
 // --------------------------------------------------------------------------
 
-- (void) requestUserByID:(ECTwitterID*)userID
+- (void)flushUserLookups
 {
-	ECDebug(TwitterCacheChannel, @"requesting user info");
-    ECAssertNonNil(userID.string);
-	
-	NSDictionary* parameters = [NSDictionary dictionaryWithObjectsAndKeys:
-								userID.string, @"user_id",
-								nil];
-	[self.engine callGetMethod:@"users/show" parameters:parameters target:self selector:@selector(userInfoHandler:)];
-}
+    NSArray* queued;
+    @synchronized(self)
+    {
+        queued = [[self.queuedLookups retain] autorelease];
+        self.queuedLookups = [NSMutableArray array];
+    }
 
+    NSUInteger count = [queued count];
+    for (NSUInteger n = 0; n < count; n += kMaxUsersPerLookup)
+    {
+        NSArray* batch = [queued subarrayWithRange:NSMakeRange(n, MIN(kMaxUsersPerLookup, count - n))];
+        NSString* ids = [[batch valueForKey:@"string"] componentsJoinedByString:@","];
+        NSDictionary* parameters = [NSDictionary dictionaryWithObjectsAndKeys:
+                                    ids, @"user_id",
+                                    @"false", @"include_entities",
+                                    nil];
+
+        ECDebug(TwitterCacheChannel, @"requesting info for %ld users", (long) [batch count]);
+        ++self.userLookupRequests;
+        [self.engine callGetMethod:@"users/lookup" parameters:parameters target:self selector:@selector(userLookupHandler:) extra:batch];
+    }
+}
 
 // --------------------------------------------------------------------------
 /// Modify the favourited state of a tweet.
@@ -271,27 +1414,37 @@ NSString *const AuthenticatedTokenKey = @"token";
 }
 
 // --------------------------------------------------------------------------
-/// Handle confirmation that we've authenticated ok as a given user.
-/// We fire off a request for the list of friends for the user.
+/// Handle the results of a batch of user lookups.
+/// Whether or not it worked, the ids in the batch are no longer in flight,
+/// so they can be asked for again later (users that the API didn't
+/// return, because they're suspended or whatever, will be).
 // --------------------------------------------------------------------------
 
-- (void) userInfoHandler:(ECTwitterHandler*)handler
+- (void) userLookupHandler:(ECTwitterHandler*)handler
 {
+    NSArray* batch = handler.extra;
+    @synchronized(self)
+    {
+        for (ECTwitterID* userID in batch)
+        {
+            [self.requestedLookups removeObject:userID];
+        }
+    }
+
 	if (handler.status == StatusResults)
 	{
-        ECAssertIsKindOfClass(handler.result, NSDictionary);
-
-        NSDictionary* userData = handler.result;
-        ECTwitterID* userID = [ECTwitterID idFromDictionary:userData];
-        
-        ECTwitterUser* user = [self.usersByID objectForKey:userID.string];
-        [user refreshWithInfo:userData];
-        
-        NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
-        [nc postNotificationName:ECTwitterUserUpdated object:user];
+        ECAssertIsKindOfClass(handler.result, NSArray);
 
-        ECDebug(TwitterCacheChannel, @"user info received:%@", user.name);
+        // the whole batch goes in under one lock, with one update posted for it
+        NSArray* results = handler.result;
+        NSArray* users = [self addOrRefreshUsers:results];
+        ECDebug(TwitterCacheChannel, @"user info received for %ld users", (long) [users count]); ECUnusedInRelease(users);
+        self.usersLookedUp += [results count];
 	}
+    else
+    {
+        ECDebug(TwitterCacheChannel, @"error looking up %ld users", (long) [batch count]);
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -316,15 +1469,44 @@ NSString *const AuthenticatedTokenKey = @"token";
 
 // --------------------------------------------------------------------------
 /// Return image for object with a given ID, at a given URL.
-/// The image may be cached locally, or may be fetched. 
-/// The cached version may be refreshed if it is old.
+/// If the image isn't in memory, we return nil and start loading it, from
+/// disk or from the network; ask again once it has arrived.
 // --------------------------------------------------------------------------
 
 - (ECTwitterImage*)imageWithID:(ECTwitterID*)imageID URL:(NSURL*)url
 {
-	ECTwitterImage* image = [[ECTwitterImage alloc] initWithContentsOfURL:url];
-	
-	return [image autorelease];
+	return [self.imageCache imageForURL:url handler:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Return the image at a URL.
+/// If it's in memory, it's returned straight away (and the handler is also 
+/// called). If not, we return nil, and call the handler on the main thread
+/// once it has been loaded.
+// --------------------------------------------------------------------------
+
+- (ECTwitterImage*)imageWithURL:(NSURL*)url handler:(ECTwitterImageHandler)handler
+{
+	return [self.imageCache imageForURL:url handler:handler];
+}
+
+// --------------------------------------------------------------------------
+/// Return the cache that images are loaded through.
+/// It's made on first use (so that the cache folder can be set first),
+/// which can happen on any thread.
+// --------------------------------------------------------------------------
+
+- (ECTwitterImageCache*)imageCache
+{
+    @synchronized(self)
+    {
+        if (!_imageCache)
+        {
+            _imageCache = [[ECTwitterImageCache alloc] initWithURL:[self imageCacheFolder]];
+        }
+
+        return _imageCache;
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -346,115 +1528,300 @@ NSString *const AuthenticatedTokenKey = @"token";
     }
     
     NSArray* allTweets = [self.tweets allValues];
-    NSUInteger n = [allTweets count];
-    while (n--)
+    for (ECTwitterTweet* tweet in allTweets)
+    {
+        if (![tweet gotData] && ![tweet isPinned])
+        {
+            [self removeTweet:tweet];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the full text index of the cached tweets.
+// --------------------------------------------------------------------------
+
+- (ECTwitterTextIndex*)textIndex
+{
+    @synchronized(self)
     {
-        ECTwitterTweet* tweet = [allTweets objectAtIndex:0];
-        if (![tweet gotData])
+        if (!_textIndex)
         {
-            [self.tweets removeObjectForKey:tweet.twitterID.string];
+            _textIndex = [[ECTwitterTextIndex alloc] initWithURL:[self textIndexFile]];
         }
+
+        return _textIndex;
     }
+}
+
+// --------------------------------------------------------------------------
+/// Return the journal that the cache is saved to.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCacheStore*)store
+{
+    @synchronized(self)
+    {
+        if (!_store)
+        {
+            _store = [[ECTwitterCacheStore alloc] initWithURL:[self mainCacheFile]];
+        }
 
+        return _store;
+    }
 }
+
 // --------------------------------------------------------------------------
-/// Save current users and tweets to a local cache.
+/// Save any users and tweets that have changed since the last save.
+/// Only the changed objects are archived; they're appended to the journal
+/// in the background, and the journal is compacted once enough of it is stale.
 // --------------------------------------------------------------------------
 
 - (void) save
 {
-    NSMutableData *data = [[NSMutableData alloc] init];
-    NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:data];
+    @synchronized(self)
+    {
+        ECTwitterCacheStore* store = self.store;
+        for (ECTwitterCachedObject* object in self.dirtyObjects)
+        {
+            ECTwitterCacheRecordKind kind = [object isKindOfClass:[ECTwitterTweet class]] ? RecordTweet : RecordUser;
+            ECTwitterID* objectID = [(id) object twitterID];
+            [store appendRecordOfKind:kind recordID:objectID data:recordForObject(object)];
+            object.dirty = NO;
+        }
+        ECDebug(TwitterCacheChannel, @"saved %ld changed objects", (long) [self.dirtyObjects count]);
+        [self.dirtyObjects removeAllObjects];
 
-    [archiver encodeObject:self.usersByID forKey:@"users"];
+        for (ECTwitterUser* user in self.dirtyGraphs)
+        {
+            NSData* data = [NSKeyedArchiver archivedDataWithRootObject:[user socialGraph]];
+            [store appendRecordOfKind:RecordSocialGraph recordID:user.twitterID data:data];
+        }
+        [self.dirtyGraphs removeAllObjects];
 
-    // save recent tweets
-    NSArray* allTweets = [self.tweets allValues];
-    NSArray* sortedTweets = [allTweets sortedArrayUsingSelector:@selector(compareByViewsDateDescending:)];
-    NSUInteger count = [sortedTweets count];
-    count = MIN(count, self.maxCached);
-    NSMutableDictionary* recentTweets = [NSMutableDictionary dictionaryWithCapacity:count];
-    for (ECTwitterTweet* tweet in sortedTweets)
+        if (self.authenticatedChanged)
+        {
+            NSData* data = [NSKeyedArchiver archivedDataWithRootObject:[self.authenticated dictionary]];
+            [store appendRecordOfKind:RecordAuthenticated recordID:nil data:data];
+            self.authenticatedChanged = NO;
+        }
+
+        [self saveEntityIndex];
+
+        [self.textIndex save];
+
+        [store compactIfNeeded];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Load users and tweets from a local cache.
+// --------------------------------------------------------------------------
+
+- (void) load
+{
+    @synchronized(self)
+    {
+        [self.textIndex load];
+
+        ECTwitterCacheStore* store = self.store;
+        if (store.liveRecords == 0)
+        {
+            [self loadLegacyCache];
+        }
+        else
+        {
+            NSData* authenticated = [store dataForRecordOfKind:RecordAuthenticated recordID:nil];
+            if (authenticated)
+            {
+                [self.authenticated setDictionary:[NSKeyedUnarchiver unarchiveObjectWithData:authenticated]];
+            }
+            [self loadEntityIndex];
+
+            [self.pendingTweets removeAllObjects];
+            [self.pendingTweets addKeys:[store recordIDsOfKind:RecordTweet]];
+            [self.pendingUsers removeAllObjects];
+            [self.pendingUsers addKeys:[store recordIDsOfKind:RecordUser]];
+            if (self.loadsLazily)
+            {
+                ECDebug(TwitterCacheChannel, @"indexed %ld cached users and %ld cached tweets", (long) [self.pendingUsers count], (long) [self.pendingTweets count]);
+            }
+            else
+            {
+                // users are decoded as we go, tweets are saved up and decoded in parallel
+                // (and stop being pending as they're merged in)
+                NSMutableArray* tweetPayloads = [NSMutableArray arrayWithCapacity:[self.pendingTweets count]];
+                [store enumerateRecordsUsingBlock:^(ECTwitterCacheRecordKind kind, ECTwitterID* recordID, NSData* data) {
+                    if (kind == RecordTweet)
+                    {
+                        [tweetPayloads addObject:data];
+                    }
+                    else if (kind == RecordUser)
+                    {
+                        [self decodeRecordData:data];
+                        [self.pendingUsers removeObjectForKey:recordID];
+                    }
+                }];
+                [self decodeTweetRecords:tweetPayloads];
+
+                [self removeMissingTweets];
+                [self evictIfNeeded];
+        
+                ECDebug(TwitterCacheChannel, @"loaded cached users %@", self.usersByID);
+                ECDebug(TwitterCacheChannel, @"loaded cached tweets %@", self.tweets);
+            }
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Save the changes to the mention and hashtag index since the last save.
+///
+/// The changes are appended to the journal as a record of their own, each
+/// with a higher id than the last. Once there are enough of them, the
+/// whole index is written instead, along with the id of the last change
+/// it includes, and the changes are removed.
+// --------------------------------------------------------------------------
+
+- (void)saveEntityIndex
+{
+    ECTwitterCacheStore* store = self.store;
+    if (self.entityDeltas >= kMaxEntityDeltas)
     {
-        [recentTweets setObject:tweet forKey:tweet.twitterID.string];
-        if (--count == 0)
+        NSDictionary* index = [NSDictionary dictionaryWithObjectsAndKeys:self.mentionIndex, @"mentions", self.hashtagIndex, @"hashtags", [NSNumber numberWithUnsignedLongLong:self.lastEntityDelta], @"through", nil];
+        [store appendRecordOfKind:RecordEntityIndex recordID:nil data:[NSKeyedArchiver archivedDataWithRootObject:index]];
+        for (ECTwitterID* deltaID in [store recordIDsOfKind:RecordEntityDelta])
         {
-            break;
+            [store removeRecordOfKind:RecordEntityDelta recordID:deltaID];
         }
+        ECDebug(TwitterCacheChannel, @"saved index of %ld names and %ld hashtags", (long) [self.mentionIndex count], (long) [self.hashtagIndex count]);
+
+        self.entityDeltas = 0;
+        [self.mentionChanges removeAllObjects];
+        [self.hashtagChanges removeAllObjects];
     }
+    else if (([self.mentionChanges count] > 0) || ([self.hashtagChanges count] > 0))
+    {
+        NSDictionary* changes = [NSDictionary dictionaryWithObjectsAndKeys:self.mentionChanges, @"mentions", self.hashtagChanges, @"hashtags", nil];
+        self.lastEntityDelta = self.lastEntityDelta + 1;
+        [store appendRecordOfKind:RecordEntityDelta recordID:[ECTwitterID idFromValue:self.lastEntityDelta] data:[NSKeyedArchiver archivedDataWithRootObject:changes]];
+        ECDebug(TwitterCacheChannel, @"saved index changes for %ld names and %ld hashtags", (long) [self.mentionChanges count], (long) [self.hashtagChanges count]);
+
+        ++self.entityDeltas;
+        [self.mentionChanges removeAllObjects];
+        [self.hashtagChanges removeAllObjects];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Read back the saved mention and hashtag index, and the changes saved
+/// since, merging them with anything that's already been indexed.
+/// Changes that the saved index already includes (left behind if we
+/// stopped while removing them) are skipped.
+// --------------------------------------------------------------------------
 
-    // save mentions of authenticated users
-    for (ECTwitterUser* user in [self.authenticated allValues])
+- (void)loadEntityIndex
+{
+    ECTwitterCacheStore* store = self.store;
+    uint64_t through = 0;
+    NSData* data = [store dataForRecordOfKind:RecordEntityIndex recordID:nil];
+    if (data)
     {
-        NSArray* mentions = user.mentions.tweets;
-        for (ECTwitterTweet* tweet in mentions)
+        NSDictionary* saved = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+        NSDictionary* mentions = [saved objectForKey:@"mentions"];
+        NSDictionary* hashtags = [saved objectForKey:@"hashtags"];
+        for (NSString* name in mentions)
         {
-            [recentTweets setObject:tweet forKey:tweet.twitterID.string];
+            [indexEntry(self.mentionIndex, name) unionSet:[mentions objectForKey:name]];
         }
+        for (NSString* tag in hashtags)
+        {
+            [indexEntry(self.hashtagIndex, tag) unionSet:[hashtags objectForKey:tag]];
+        }
+        through = [[saved objectForKey:@"through"] unsignedLongLongValue];
     }
-    
-    [archiver encodeObject:recentTweets forKey:@"tweets"];
-    [archiver encodeObject:self.authenticated forKey:@"authenticated"];
-    [archiver finishEncoding];
-    
-    NSURL* url = [self mainCacheFile];
-	BOOL ok = [data writeToURL:url atomically:YES];
-    if (!ok)
+
+    NSArray* deltaIDs = [[[store recordIDsOfKind:RecordEntityDelta] allObjects] sortedArrayUsingSelector:@selector(compare:)];
+    NSUInteger applied = 0;
+    for (ECTwitterID* deltaID in deltaIDs)
     {
-		ECDebug(TwitterCacheChannel, @"failed to write cache to %@", url);
+        if (deltaID.value > through)
+        {
+            NSDictionary* changes = [NSKeyedUnarchiver unarchiveObjectWithData:[store dataForRecordOfKind:RecordEntityDelta recordID:deltaID]];
+            applyIndexChanges(self.mentionIndex, [changes objectForKey:@"mentions"]);
+            applyIndexChanges(self.hashtagIndex, [changes objectForKey:@"hashtags"]);
+            ++applied;
+        }
     }
-    
-    [archiver release];
-    [data release];
+    self.lastEntityDelta = MAX(through, ((ECTwitterID*) [deltaIDs lastObject]).value);
+    self.entityDeltas = [deltaIDs count];
 
+    ECDebug(TwitterCacheChannel, @"loaded index of %ld names and %ld hashtags, with %ld sets of changes", (long) [self.mentionIndex count], (long) [self.hashtagIndex count], (long) applied);
 }
 
 // --------------------------------------------------------------------------
-/// Load users and tweets from a local cache.
+/// Load users and tweets from an old-style single file cache.
+/// Everything we load is marked as changed, so that the next save
+/// moves it all into the journal; the old file is then removed.
 // --------------------------------------------------------------------------
 
-- (void) load
+- (void)loadLegacyCache
 {
-    NSURL* url = [self mainCacheFile];
+    NSURL* url = [self legacyCacheFile];
     NSData* data = [NSData dataWithContentsOfURL:url];
     if (data)
     {
-        NSKeyedUnarchiver* unarchiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
+        ECTwitterCacheUnarchiver* unarchiver = [[ECTwitterCacheUnarchiver alloc] initForReadingWithData:data];
+        unarchiver.cache = self;
 
         NSDictionary* authenticated = [unarchiver decodeObjectForKey:@"authenticated"];
         if (authenticated)
         {
-            self.authenticated = [authenticated mutableCopy];
+            [self.authenticated setDictionary:authenticated];
         }
 
-        // unarchive the users & tweets
-        // just loading them in is enough to add them to the cache,
-        // so we don't actually have to do anything with the result of the decode calls
-        @synchronized(self)
-        {
-            gDecodingCache = self;
-            [unarchiver decodeObjectForKey:@"users"];
-            [unarchiver decodeObjectForKey:@"tweets"];
-            gDecodingCache = nil;
-        }
+        // eviction is held off until everything is loaded, so that
+        // timelines get a chance to pin their tweets first
+        self.loading = YES;
+        [unarchiver decodeObjectForKey:@"users"];
+        [unarchiver decodeObjectForKey:@"tweets"];
+        self.loading = NO;
         
         [unarchiver release];
         
         [self removeMissingTweets];
+        [self evictIfNeeded];
+
+        for (ECTwitterUser* user in [self.usersByID allValues])
+        {
+            [user markDirty];
+        }
+        for (ECTwitterTweet* tweet in [self.tweets allValues])
+        {
+            [tweet markDirty];
+        }
+        self.authenticatedChanged = YES;
+        [self save];
+        [[NSFileManager defaultManager] removeItemAtURL:url error:nil];
         
-        ECDebug(TwitterCacheChannel, @"loaded cached users %@", self.usersByID);
-        ECDebug(TwitterCacheChannel, @"loaded cached tweets %@", self.tweets);
+        ECDebug(TwitterCacheChannel, @"converted legacy cache with users %@", self.usersByID);
     }
 }
 
 // --------------------------------------------------------------------------
-/// Return the current decoding cache - used to provide some context
-/// when decoding cached objects.
+/// Return the cache that objects being decoded by a coder belong to.
+/// Returns nil if the objects are being decoded standalone.
 // --------------------------------------------------------------------------
 
-+ (ECTwitterCache*)decodingCache
++ (ECTwitterCache*)cacheForCoder:(NSCoder*)coder
 {
-    return gDecodingCache;
+    ECTwitterCache* result = nil;
+    if ([coder isKindOfClass:[ECTwitterCacheUnarchiver class]])
+    {
+        result = ((ECTwitterCacheUnarchiver*) coder).cache;
+    }
+
+    return result;
 }
 
 // --------------------------------------------------------------------------
@@ -463,9 +1830,13 @@ NSString *const AuthenticatedTokenKey = @"token";
 
 - (NSURL*)baseCacheFolder
 {
-    NSArray* urls = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask];
-    NSURL* root = [urls objectAtIndex:0];
-    NSURL* url = [root URLByAppendingPathComponent:@"com.elegantchaos.ambientweet"];
+    NSURL* url = self.cacheFolder;
+    if (!url)
+    {
+        NSArray* urls = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask];
+        NSURL* root = [urls objectAtIndex:0];
+        url = [root URLByAppendingPathComponent:@"com.elegantchaos.ambientweet"];
+    }
 
     return url;
 }
@@ -476,6 +1847,18 @@ NSString *const AuthenticatedTokenKey = @"token";
 // --------------------------------------------------------------------------
 
 - (NSURL*)mainCacheFile
+{
+    NSURL* root = [self baseCacheFolder];
+    NSURL* url = [root URLByAppendingPathComponent:@"ECTwitterEngine Cache V6.journal"];
+    
+	return url;
+}
+
+// --------------------------------------------------------------------------
+/// Return the path to the old-style single file cache.
+// --------------------------------------------------------------------------
+
+- (NSURL*)legacyCacheFile
 {
     NSURL* root = [self baseCacheFolder];
     NSURL* url = [root URLByAppendingPathComponent:@"ECTwitterEngine Cache V5.cache"];
@@ -483,6 +1866,18 @@ NSString *const AuthenticatedTokenKey = @"token";
 	return url;
 }
 
+// --------------------------------------------------------------------------
+/// Return the path to the full text index.
+// --------------------------------------------------------------------------
+
+- (NSURL*)textIndexFile
+{
+    NSURL* root = [self baseCacheFolder];
+    NSURL* url = [root URLByAppendingPathComponent:@"ECTwitterEngine Cache V6.index"];
+
+	return url;
+}
+
 // --------------------------------------------------------------------------
 /// Return the path to the image cache folder.
 // --------------------------------------------------------------------------
@@ -572,7 +1967,11 @@ NSString *const AuthenticatedTokenKey = @"token";
                               userID, AuthenticatedIDKey,
                               userToken, AuthenticatedTokenKey,
                               nil];
-    [self.authenticated setObject:authenticationInfo forKey:name];
+    @synchronized(self)
+    {
+        [self.authenticated setObject:authenticationInfo forKey:name];
+        self.authenticatedChanged = YES;
+    }
 
     [[NSNotificationCenter defaultCenter] postNotificationName:ECTwitterUserAuthenticated object:name];
 }
@@ -0,0 +1,49 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterCachedObject;
+
+// --------------------------------------------------------------------------
+/// Eviction policy for cached objects.
+///
+/// Objects are kept in a circular list, threaded through the objects
+/// themselves, so adding, touching and removing are all O(1).
+/// When the list goes over budget, a clock hand sweeps round it, taking
+/// credit away from each object it passes. Objects that have run out of credit
+/// are evicted; pinned objects are skipped. If everything left is pinned,
+/// the sweep stops early, and doesn't try again for a while.
+///
+/// The list doesn't retain the objects - the cache does that.
+// --------------------------------------------------------------------------
+
+typedef BOOL (^ECTwitterCacheEvictBlock)(ECTwitterCachedObject* object);
+
+@interface ECTwitterCacheClock : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic) NSUInteger maxCount;
+@property (assign, nonatomic) NSUInteger maxBytes;
+@property (assign, nonatomic, readonly) NSUInteger count;
+@property (assign, nonatomic, readonly) NSUInteger bytes;
+@property (assign, nonatomic, readonly) NSUInteger evictions;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (void)addObject:(ECTwitterCachedObject*)object;
+- (void)removeObject:(ECTwitterCachedObject*)object;
+- (void)removeAllObjects;
+- (void)touchObject:(ECTwitterCachedObject*)object;
+- (void)resizeObject:(ECTwitterCachedObject*)object;
+- (BOOL)containsObject:(ECTwitterCachedObject*)object;
+- (BOOL)isOverBudget;
+- (NSUInteger)evictUsingBlock:(ECTwitterCacheEvictBlock)block;
+
+@end
@@ -0,0 +1,314 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterCacheClock.h"
+#import "ECTwitterCachedObject.h"
+
+// ==============================================
+// Private Methods
+// ==============================================
+
+#pragma mark -
+#pragma mark Private Methods
+
+@interface ECTwitterCacheClock()
+
+@property (assign, nonatomic) ECTwitterCachedObject* hand;
+@property (assign, nonatomic, readwrite) NSUInteger count;
+@property (assign, nonatomic, readwrite) NSUInteger bytes;
+@property (assign, nonatomic, readwrite) NSUInteger evictions;
+@property (assign, nonatomic) NSUInteger backoff;
+
+@end
+
+
+@implementation ECTwitterCacheClock
+
+// ==============================================
+// Debug Channels
+// ==============================================
+
+ECDefineDebugChannel(TwitterCacheClockChannel);
+
+// ==============================================
+// Properties
+// ==============================================
+
+#pragma mark -
+#pragma mark Properties
+
+@synthesize backoff = _backoff;
+@synthesize bytes = _bytes;
+@synthesize count = _count;
+@synthesize evictions = _evictions;
+@synthesize hand = _hand;
+@synthesize maxBytes = _maxBytes;
+@synthesize maxCount = _maxCount;
+
+// ==============================================
+// Constants
+// ==============================================
+
+#pragma mark -
+#pragma mark Constants
+
+// The most credit that an object's weighting can add.
+// Keeps heavily viewed objects from living forever.
+static const NSUInteger kMaxWeightCredit = 3;
+
+// After a sweep that couldn't get us back under budget, we wait for this
+// fraction of the list to be added before sweeping again.
+static const NSUInteger kStalledBackoffFraction = 8;
+
+// ==============================================
+// Lifecycle
+// ==============================================
+
+#pragma mark -
+#pragma mark Methods
+
+// --------------------------------------------------------------------------
+/// Clean up.
+/// Objects can outlive us, so make sure they don't point into the list.
+// --------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    [self removeAllObjects];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+/// Return the credit to give an object when it's used.
+// --------------------------------------------------------------------------
+
+static inline NSUInteger creditForObject(ECTwitterCachedObject* object)
+{
+    return 1 + MIN([object evictionWeight], kMaxWeightCredit);
+}
+
+// --------------------------------------------------------------------------
+/// Add an object to the list.
+/// New objects go just behind the hand, so they're the last thing it visits.
+// --------------------------------------------------------------------------
+
+- (void)addObject:(ECTwitterCachedObject*)object
+{
+    ECAssert(![self containsObject:object]);
+
+    ECTwitterCachedObject* hand = self.hand;
+    if (hand)
+    {
+        ECTwitterCachedObject* previous = hand.clockPrevious;
+        object.clockNext = hand;
+        object.clockPrevious = previous;
+        previous.clockNext = object;
+        hand.clockPrevious = object;
+    }
+    else
+    {
+        object.clockNext = object;
+        object.clockPrevious = object;
+        self.hand = object;
+    }
+
+    NSUInteger size = [object estimatedSize];
+    object.clockSize = size;
+    object.clockCredit = creditForObject(object);
+    self.bytes += size;
+    ++self.count;
+
+    if (self.backoff > 0)
+    {
+        --self.backoff;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove an object from the list.
+// --------------------------------------------------------------------------
+
+- (void)removeObject:(ECTwitterCachedObject*)object
+{
+    if ([self containsObject:object])
+    {
+        ECTwitterCachedObject* next = object.clockNext;
+        if (next == object)
+        {
+            self.hand = nil;
+        }
+        else
+        {
+            ECTwitterCachedObject* previous = object.clockPrevious;
+            previous.clockNext = next;
+            next.clockPrevious = previous;
+            if (self.hand == object)
+            {
+                self.hand = next;
+            }
+        }
+
+        self.bytes -= object.clockSize;
+        --self.count;
+
+        object.clockNext = nil;
+        object.clockPrevious = nil;
+        object.clockSize = 0;
+        object.clockCredit = 0;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Empty the list.
+// --------------------------------------------------------------------------
+
+- (void)removeAllObjects
+{
+    while (self.hand)
+    {
+        [self removeObject:self.hand];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Note that an object has been used, which tops up its credit.
+///
+/// Unlike everything else here, the cache calls this without holding its
+/// lock, from whichever thread did the lookup. That's safe because it only
+/// stores the credit, and never changes the list: at worst a touch that
+/// races with the hand is lost, or lands on an object just after it has
+/// been removed (the credit is reset when it's added again).
+// --------------------------------------------------------------------------
+
+- (void)touchObject:(ECTwitterCachedObject*)object
+{
+    if ([self containsObject:object])
+    {
+        object.clockCredit = creditForObject(object);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Note that an object's contents have changed, and re-estimate its size.
+// --------------------------------------------------------------------------
+
+- (void)resizeObject:(ECTwitterCachedObject*)object
+{
+    if ([self containsObject:object])
+    {
+        NSUInteger size = [object estimatedSize];
+        self.bytes = self.bytes - object.clockSize + size;
+        object.clockSize = size;
+        object.clockCredit = creditForObject(object);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Is the object in the list?
+// --------------------------------------------------------------------------
+
+- (BOOL)containsObject:(ECTwitterCachedObject*)object
+{
+    return object.clockNext != nil;
+}
+
+// --------------------------------------------------------------------------
+/// Change the budgets.
+/// Any backoff is forgotten, since what we can evict may have changed.
+// --------------------------------------------------------------------------
+
+- (void)setMaxCount:(NSUInteger)maxCount
+{
+    _maxCount = maxCount;
+    self.backoff = 0;
+}
+
+- (void)setMaxBytes:(NSUInteger)maxBytes
+{
+    _maxBytes = maxBytes;
+    self.backoff = 0;
+}
+
+// --------------------------------------------------------------------------
+/// Are we over either budget?
+/// A budget of zero means unlimited.
+// --------------------------------------------------------------------------
+
+- (BOOL)isOverBudget
+{
+    return ((self.maxCount > 0) && (self.count > self.maxCount)) || ((self.maxBytes > 0) && (self.bytes > self.maxBytes));
+}
+
+// --------------------------------------------------------------------------
+/// Sweep the hand round until we're back under budget.
+///
+/// Each unpinned object that's out of credit is offered to the block, which
+/// should discard it and return YES, or return NO to keep it.
+/// The sweep gives up after enough steps to drain every object's credit,
+/// or as soon as the hand has been all the way round without finding
+/// anything to take credit from or evict - everything left is pinned.
+///
+/// If we're still over budget after that, sweeping again straight away
+/// would just go round the same pinned objects, so we back off until a
+/// good fraction of the list has been added (or the budget changes).
+///
+/// Returns the number of objects evicted.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)evictUsingBlock:(ECTwitterCacheEvictBlock)block
+{
+    if ((self.backoff > 0) || ![self isOverBudget])
+    {
+        return 0;
+    }
+
+    NSUInteger evicted = 0;
+    NSUInteger idle = 0;
+    NSUInteger steps = self.count * (kMaxWeightCredit + 2);
+    while ([self isOverBudget] && (steps-- > 0) && (idle < self.count))
+    {
+        ECTwitterCachedObject* object = self.hand;
+        self.hand = object.clockNext;
+        ++idle;
+
+        if (![object isPinned])
+        {
+            NSUInteger credit = object.clockCredit;
+            if (credit > 0)
+            {
+                object.clockCredit = credit - 1;
+                idle = 0;
+            }
+            else
+            {
+                [[object retain] autorelease];
+                if (block(object))
+                {
+                    [self removeObject:object];
+                    ++evicted;
+                    idle = 0;
+                }
+            }
+        }
+    }
+
+    if (evicted)
+    {
+        self.evictions += evicted;
+        ECDebug(TwitterCacheClockChannel, @"evicted %ld objects, %ld left using %ld bytes", (long) evicted, (long) self.count, (long) self.bytes);
+    }
+
+    if ([self isOverBudget])
+    {
+        self.backoff = MAX(self.count / kStalledBackoffFraction, 1);
+        ECDebug(TwitterCacheClockChannel, @"can't get under budget, backing off for %ld additions", (long) self.backoff);
+    }
+
+    return evicted;
+}
+
+@end
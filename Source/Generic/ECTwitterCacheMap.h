@@ -0,0 +1,55 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// A dictionary that can be used from more than one thread at once.
+///
+/// The keys are spread across a fixed number of shards by their hash,
+/// each with its own dictionary and read/write lock. Lookups only take
+/// a shared lock on one shard, so any number of threads can read at
+/// once, and a write only holds up readers of the same shard.
+///
+/// Objects are retained and autoreleased before the shard is unlocked,
+/// so they stay valid even if another thread removes them straight away.
+///
+/// Each call is atomic on its own, but a sequence of calls isn't - callers
+/// that need to check-then-add have to serialise their writers themselves.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCacheMap : NSObject
+{
+    struct ECTwitterCacheMapShard* mShards;
+}
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)objectForKey:(id)key;
+- (BOOL)containsKey:(id)key;
+- (void)setObject:(id)object forKey:(id)key;
+- (void)removeObjectForKey:(id)key;
+- (BOOL)removeObject:(id)object forKey:(id)key;
+- (void)removeAllObjects;
+
+// For using the map as a set: each key maps to itself.
+- (void)addKey:(id)key;
+- (void)addKeys:(id<NSFastEnumeration>)keys;
+
+// Snapshots - each shard is copied under its lock, but the result
+// as a whole isn't a single point-in-time view.
+- (NSArray*)allKeys;
+- (NSArray*)allValues;
+- (NSDictionary*)dictionary;
+- (void)setDictionary:(NSDictionary*)dictionary;
+
+@end
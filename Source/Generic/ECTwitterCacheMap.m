@@ -0,0 +1,269 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterCacheMap.h"
+
+#include <pthread.h>
+
+// --------------------------------------------------------------------------
+// Constants
+// --------------------------------------------------------------------------
+
+// Must be a power of two.
+// Comfortably more than the number of cores, so that two threads rarely
+// want the same shard.
+static const NSUInteger kShardCount = 16;
+
+typedef struct ECTwitterCacheMapShard
+{
+    pthread_rwlock_t lock;
+    NSMutableDictionary* dictionary;
+} Shard;
+
+@implementation ECTwitterCacheMap
+
+// --------------------------------------------------------------------------
+// Debug Channels
+// --------------------------------------------------------------------------
+
+ECDefineDebugChannel(TwitterCacheMapChannel);
+
+// --------------------------------------------------------------------------
+// Methods
+// --------------------------------------------------------------------------
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        mShards = calloc(kShardCount, sizeof(Shard));
+        for (NSUInteger n = 0; n < kShardCount; ++n)
+        {
+            pthread_rwlock_init(&mShards[n].lock, NULL);
+            mShards[n].dictionary = [[NSMutableDictionary alloc] init];
+        }
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        [mShards[n].dictionary release];
+        pthread_rwlock_destroy(&mShards[n].lock);
+    }
+    free(mShards);
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+/// Return the shard that a key lives in.
+/// The hash is mixed first, since twitter ids (and so their hashes) tend
+/// to go up in steps rather than being spread evenly.
+// --------------------------------------------------------------------------
+
+static inline Shard* shardForKey(Shard* shards, id key)
+{
+    uint32_t hash = (uint32_t) [key hash];
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+
+    return &shards[hash & (kShardCount - 1)];
+}
+
+- (id)objectForKey:(id)key
+{
+    id result = nil;
+    if (key)
+    {
+        Shard* shard = shardForKey(mShards, key);
+        pthread_rwlock_rdlock(&shard->lock);
+        result = [[shard->dictionary objectForKey:key] retain];
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return [result autorelease];
+}
+
+- (BOOL)containsKey:(id)key
+{
+    BOOL result = NO;
+    if (key)
+    {
+        Shard* shard = shardForKey(mShards, key);
+        pthread_rwlock_rdlock(&shard->lock);
+        result = [shard->dictionary objectForKey:key] != nil;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return result;
+}
+
+- (void)setObject:(id)object forKey:(id)key
+{
+    ECAssertNonNil(object);
+    ECAssertNonNil(key);
+
+    Shard* shard = shardForKey(mShards, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    id old = [[shard->dictionary objectForKey:key] retain];
+    [shard->dictionary setObject:object forKey:key];
+    pthread_rwlock_unlock(&shard->lock);
+
+    // the old object is released outside the lock, in case it deallocs
+    // and calls back in here
+    [old release];
+}
+
+- (void)removeObjectForKey:(id)key
+{
+    if (key)
+    {
+        Shard* shard = shardForKey(mShards, key);
+        pthread_rwlock_wrlock(&shard->lock);
+        id old = [[shard->dictionary objectForKey:key] retain];
+        [shard->dictionary removeObjectForKey:key];
+        pthread_rwlock_unlock(&shard->lock);
+        [old release];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove the entry for a key, but only if it's this object.
+/// Returns YES if it was removed.
+// --------------------------------------------------------------------------
+
+- (BOOL)removeObject:(id)object forKey:(id)key
+{
+    BOOL removed = NO;
+    if (key)
+    {
+        Shard* shard = shardForKey(mShards, key);
+        pthread_rwlock_wrlock(&shard->lock);
+        removed = ([shard->dictionary objectForKey:key] == object);
+        if (removed)
+        {
+            [object retain];
+            [shard->dictionary removeObjectForKey:key];
+        }
+        pthread_rwlock_unlock(&shard->lock);
+
+        if (removed)
+        {
+            [object release];
+        }
+    }
+
+    return removed;
+}
+
+- (void)removeAllObjects
+{
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        Shard* shard = &mShards[n];
+        NSMutableDictionary* empty = [[NSMutableDictionary alloc] init];
+        pthread_rwlock_wrlock(&shard->lock);
+        NSMutableDictionary* old = shard->dictionary;
+        shard->dictionary = empty;
+        pthread_rwlock_unlock(&shard->lock);
+        [old release];
+    }
+}
+
+- (void)addKey:(id)key
+{
+    [self setObject:key forKey:key];
+}
+
+- (void)addKeys:(id<NSFastEnumeration>)keys
+{
+    for (id key in keys)
+    {
+        [self setObject:key forKey:key];
+    }
+}
+
+- (NSUInteger)count
+{
+    NSUInteger result = 0;
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        Shard* shard = &mShards[n];
+        pthread_rwlock_rdlock(&shard->lock);
+        result += [shard->dictionary count];
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return result;
+}
+
+- (NSArray*)allKeys
+{
+    NSMutableArray* result = [NSMutableArray array];
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        Shard* shard = &mShards[n];
+        pthread_rwlock_rdlock(&shard->lock);
+        [result addObjectsFromArray:[shard->dictionary allKeys]];
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return result;
+}
+
+- (NSArray*)allValues
+{
+    NSMutableArray* result = [NSMutableArray array];
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        Shard* shard = &mShards[n];
+        pthread_rwlock_rdlock(&shard->lock);
+        [result addObjectsFromArray:[shard->dictionary allValues]];
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return result;
+}
+
+- (NSDictionary*)dictionary
+{
+    NSMutableDictionary* result = [NSMutableDictionary dictionary];
+    for (NSUInteger n = 0; n < kShardCount; ++n)
+    {
+        Shard* shard = &mShards[n];
+        pthread_rwlock_rdlock(&shard->lock);
+        [result addEntriesFromDictionary:shard->dictionary];
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Replace everything in the map with the contents of a dictionary.
+// --------------------------------------------------------------------------
+
+- (void)setDictionary:(NSDictionary*)dictionary
+{
+    [self removeAllObjects];
+    for (id key in dictionary)
+    {
+        [self setObject:[dictionary objectForKey:key] forKey:key];
+    }
+    ECDebug(TwitterCacheMapChannel, @"set %ld entries", (long) [dictionary count]);
+}
+
+- (NSString*)description
+{
+    return [[self dictionary] description];
+}
+
+@end
@@ -0,0 +1,70 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterID;
+
+typedef enum
+{
+    RecordRemoved = 0,
+    RecordTweet = 1,
+    RecordUser = 2,
+    RecordAuthenticated = 3,
+    RecordEntityIndex = 4,
+    RecordSocialGraph = 5,
+    RecordEntityDelta = 6,
+    
+    RecordKindCount
+} ECTwitterCacheRecordKind;
+
+typedef void (^ECTwitterCacheRecordBlock)(ECTwitterCacheRecordKind kind, ECTwitterID* recordID, NSData* data);
+
+// --------------------------------------------------------------------------
+/// Append-only journal of archived tweets and users.
+///
+/// Each save appends records for just the objects that have changed.
+/// A later record for an ID supersedes any earlier ones; removals are
+/// recorded with a tombstone. An index of where the live record for each ID
+/// lives is kept in memory.
+///
+/// The file is memory mapped, so individual records can be read back on
+/// demand without loading the rest of the journal.
+///
+/// All file access happens on a private serial queue, so appends don't
+/// block the caller. Once enough records have been superseded, the journal
+/// is compacted on that queue by copying the live records into a new file.
+///
+/// A copy of the index is saved in the journal when it's compacted, and
+/// every so often in between. Opening the journal reads that, and only has
+/// to read through the records written after it. Records are checked
+/// against their checksums as they're read back.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCacheStore : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (strong, nonatomic, readonly) NSURL* url;
+@property (assign, nonatomic, readonly) NSUInteger liveRecords;
+@property (assign, nonatomic, readonly) NSUInteger staleRecords;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url;
+
+- (void)appendRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID data:(NSData*)data;
+- (void)removeRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID;
+- (void)enumerateRecordsUsingBlock:(ECTwitterCacheRecordBlock)block;
+- (NSData*)dataForRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID;
+- (BOOL)containsRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID;
+- (NSMutableSet*)recordIDsOfKind:(ECTwitterCacheRecordKind)kind;
+- (void)compactIfNeeded;
+- (void)synchronize;
+
+@end
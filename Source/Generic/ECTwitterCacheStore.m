@@ -0,0 +1,765 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterCacheStore.h"
+#import "ECTwitterID.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+// ==============================================
+// File Format
+// ==============================================
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t indexOffset;
+} ECTwitterCacheFileHeader;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t kind;
+    uint64_t identifier;
+    uint32_t length;
+    uint32_t checksum;
+} ECTwitterCacheRecordHeader;
+
+typedef struct
+{
+    uint64_t offset;
+    uint64_t identifier;
+    uint32_t kind;
+} ECTwitterCacheStoreEntry;
+
+// ==============================================
+// Private Methods
+// ==============================================
+
+#pragma mark -
+#pragma mark Private Methods
+
+@interface ECTwitterCacheStore()
+
+@property (strong, nonatomic, readwrite) NSURL* url;
+@property (assign, nonatomic, readwrite) NSUInteger liveRecords;
+@property (assign, nonatomic, readwrite) NSUInteger staleRecords;
+@property (strong, nonatomic) NSFileHandle* file;
+@property (strong, nonatomic) NSArray* index;
+@property (strong, nonatomic) NSData* mapping;
+@property (assign, nonatomic) dispatch_queue_t queue;
+@property (assign, nonatomic) uint64_t indexOffset;
+@property (assign, nonatomic) NSUInteger unindexedRecords;
+
+- (void)openJournal;
+- (void)createJournal;
+- (void)compact;
+- (void)writeIndex;
+- (NSData*)mappingForLength:(uint64_t)length;
+- (NSMutableDictionary*)indexForKind:(ECTwitterCacheRecordKind)kind;
+
+@end
+
+
+@implementation ECTwitterCacheStore
+
+// ==============================================
+// Debug Channels
+// ==============================================
+
+ECDefineDebugChannel(TwitterCacheStoreChannel);
+
+// ==============================================
+// Properties
+// ==============================================
+
+#pragma mark -
+#pragma mark Properties
+
+@synthesize file = _file;
+@synthesize index = _index;
+@synthesize indexOffset = _indexOffset;
+@synthesize liveRecords = _liveRecords;
+@synthesize mapping = _mapping;
+@synthesize queue = _queue;
+@synthesize staleRecords = _staleRecords;
+@synthesize unindexedRecords = _unindexedRecords;
+@synthesize url = _url;
+
+// ==============================================
+// Constants
+// ==============================================
+
+#pragma mark -
+#pragma mark Constants
+
+static const uint32_t kFileMagic = 'ECTJ';
+static const uint32_t kFileVersion = 2;
+static const uint32_t kRecordMagic = 'ECTR';
+
+// the kind of the record that holds a saved copy of the index
+// (its identifier is the number of stale records there were when it was saved)
+static const uint32_t kIndexKind = 'ECTI';
+
+// don't bother compacting until at least this many records are stale
+static const NSUInteger kMinStaleRecords = 256;
+
+// don't bother saving the index again until at least this many records
+// have been written since it was last saved
+static const NSUInteger kMinUnindexedRecords = 256;
+
+// ==============================================
+// Lifecycle
+// ==============================================
+
+#pragma mark -
+#pragma mark Methods
+
+// --------------------------------------------------------------------------
+/// Set up, opening (or creating) the journal at the given location.
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url
+{
+    if ((self = [super init]) != nil)
+    {
+        self.url = url;
+        NSMutableArray* index = [NSMutableArray arrayWithCapacity:RecordKindCount];
+        for (NSUInteger n = 0; n < RecordKindCount; ++n)
+        {
+            [index addObject:[NSMutableDictionary dictionary]];
+        }
+        self.index = index;
+        self.queue = dispatch_queue_create("com.elegantchaos.ectwitter.cachestore", DISPATCH_QUEUE_SERIAL);
+
+        dispatch_sync(self.queue, ^{
+            [self openJournal];
+        });
+    }
+
+    return self;
+}
+
+// --------------------------------------------------------------------------
+/// Clean up, making sure any pending writes have finished first.
+// --------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    if (_queue)
+    {
+        dispatch_sync(_queue, ^{
+            [_file synchronizeFile];
+            [_file closeFile];
+        });
+        dispatch_release(_queue);
+    }
+
+    [_file release];
+    [_index release];
+    [_mapping release];
+    [_url release];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+/// Checksum for record payloads (32 bit FNV-1a).
+// --------------------------------------------------------------------------
+
+static inline uint32_t checksum(const void* bytes, NSUInteger length)
+{
+    const uint8_t* byte = bytes;
+    uint32_t hash = 2166136261U;
+    while (length--)
+    {
+        hash = (hash ^ *byte++) * 16777619U;
+    }
+
+    return hash;
+}
+
+// --------------------------------------------------------------------------
+/// Return the header for a record.
+// --------------------------------------------------------------------------
+
+static inline ECTwitterCacheRecordHeader recordHeader(uint32_t kind, uint64_t identifier, const void* bytes, NSUInteger length)
+{
+    ECTwitterCacheRecordHeader header = { kRecordMagic, kind, identifier, (uint32_t) length, checksum(bytes, length) };
+
+    return header;
+}
+
+// --------------------------------------------------------------------------
+/// Return the index for a given kind of record.
+// --------------------------------------------------------------------------
+
+- (NSMutableDictionary*)indexForKind:(ECTwitterCacheRecordKind)kind
+{
+    return [self.index objectAtIndex:kind];
+}
+
+// --------------------------------------------------------------------------
+/// Record that the live version of a record is at a given offset.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)indexRecordOfKind:(ECTwitterCacheRecordKind)kind identifier:(uint64_t)identifier offset:(uint64_t)offset
+{
+    ECTwitterID* recordID = [ECTwitterID idFromValue:identifier];
+    NSMutableDictionary* index = [self indexForKind:kind];
+    if ([index objectForKey:recordID])
+    {
+        ++self.staleRecords;
+    }
+    else
+    {
+        ++self.liveRecords;
+    }
+
+    [index setObject:[NSNumber numberWithUnsignedLongLong:offset] forKey:recordID];
+    ++self.unindexedRecords;
+}
+
+// --------------------------------------------------------------------------
+/// Record that a record has been removed.
+/// Both the old record and the tombstone itself are now stale.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)unindexRecordOfKind:(ECTwitterCacheRecordKind)kind identifier:(uint64_t)identifier
+{
+    ECTwitterID* recordID = [ECTwitterID idFromValue:identifier];
+    NSMutableDictionary* index = [self indexForKind:kind];
+    if ([index objectForKey:recordID])
+    {
+        [index removeObjectForKey:recordID];
+        --self.liveRecords;
+        ++self.staleRecords;
+    }
+    ++self.staleRecords;
+    ++self.unindexedRecords;
+}
+
+// --------------------------------------------------------------------------
+/// Create an empty journal.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)createJournal
+{
+    NSFileManager* fm = [NSFileManager defaultManager];
+    NSError* error = nil;
+    [fm createDirectoryAtURL:[self.url URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:&error];
+
+    ECTwitterCacheFileHeader header = { kFileMagic, kFileVersion, 0 };
+    NSData* data = [NSData dataWithBytes:&header length:sizeof(header)];
+    if (![data writeToURL:self.url options:NSDataWritingAtomic error:&error])
+    {
+        ECDebug(TwitterCacheStoreChannel, @"failed to create journal %@: %@", self.url, error);
+    }
+
+    for (NSMutableDictionary* index in self.index)
+    {
+        [index removeAllObjects];
+    }
+    self.liveRecords = 0;
+    self.staleRecords = 0;
+    self.unindexedRecords = 0;
+    self.indexOffset = 0;
+}
+
+// --------------------------------------------------------------------------
+/// Read in the saved copy of the index from the record at a given offset.
+/// The index is only used if the whole record is intact; the records it
+/// points to are checked as they're read.
+/// Returns the offset of the end of the record, or zero if it couldn't be
+/// used.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (uint64_t)readIndexAtOffset:(uint64_t)offset data:(NSData*)data
+{
+    const uint8_t* bytes = [data bytes];
+    uint64_t length = [data length];
+    if ((offset < sizeof(ECTwitterCacheFileHeader)) || (offset + sizeof(ECTwitterCacheRecordHeader) > length))
+    {
+        return 0;
+    }
+
+    const ECTwitterCacheRecordHeader* header = (const ECTwitterCacheRecordHeader*) (bytes + offset);
+    uint64_t end = offset + sizeof(ECTwitterCacheRecordHeader) + header->length;
+    if ((header->magic != kRecordMagic) || (header->kind != kIndexKind) || (end > length) || ((header->length % sizeof(ECTwitterCacheStoreEntry)) != 0) || (header->checksum != checksum(header + 1, header->length)))
+    {
+        ECDebug(TwitterCacheStoreChannel, @"saved index is damaged");
+        return 0;
+    }
+
+    const ECTwitterCacheStoreEntry* entries = (const ECTwitterCacheStoreEntry*) (header + 1);
+    NSUInteger count = header->length / sizeof(ECTwitterCacheStoreEntry);
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        const ECTwitterCacheStoreEntry* entry = &entries[n];
+        if (entry->kind < RecordKindCount)
+        {
+            [[self indexForKind:entry->kind] setObject:[NSNumber numberWithUnsignedLongLong:entry->offset] forKey:[ECTwitterID idFromValue:entry->identifier]];
+            ++self.liveRecords;
+        }
+    }
+    self.staleRecords = (NSUInteger) header->identifier;
+    self.indexOffset = offset;
+
+    return end;
+}
+
+// --------------------------------------------------------------------------
+/// Index the records from a given offset to the end of the journal.
+/// We stop at the first record that's incomplete or damaged, and return
+/// its offset.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (uint64_t)scanRecordsFromOffset:(uint64_t)offset data:(NSData*)data
+{
+    const uint8_t* bytes = [data bytes];
+    uint64_t length = [data length];
+    while (offset + sizeof(ECTwitterCacheRecordHeader) <= length)
+    {
+        const ECTwitterCacheRecordHeader* header = (const ECTwitterCacheRecordHeader*) (bytes + offset);
+        uint64_t end = offset + sizeof(ECTwitterCacheRecordHeader) + header->length;
+        if ((header->magic != kRecordMagic) || (end > length) || (header->checksum != checksum(header + 1, header->length)))
+        {
+            break;
+        }
+
+        if (header->kind == RecordRemoved)
+        {
+            const uint32_t* removedKind = (const uint32_t*) (header + 1);
+            if (*removedKind < RecordKindCount)
+            {
+                [self unindexRecordOfKind:*removedKind identifier:header->identifier];
+            }
+        }
+        else if (header->kind < RecordKindCount)
+        {
+            [self indexRecordOfKind:header->kind identifier:header->identifier offset:offset];
+        }
+
+        offset = end;
+    }
+
+    return offset;
+}
+
+// --------------------------------------------------------------------------
+/// Open the journal and rebuild the index from it.
+/// If there's a saved copy of the index we start from that, and only read
+/// through the records written after it. Otherwise we read through the
+/// whole journal.
+/// A partially written record at the end (from a crash during an append)
+/// is discarded.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)openJournal
+{
+    NSData* data = [NSData dataWithContentsOfURL:self.url options:NSDataReadingMappedAlways error:nil];
+    const ECTwitterCacheFileHeader* fileHeader = [data bytes];
+    if (([data length] < sizeof(ECTwitterCacheFileHeader)) || (fileHeader->magic != kFileMagic) || (fileHeader->version != kFileVersion))
+    {
+        [self createJournal];
+    }
+    else
+    {
+        uint64_t length = [data length];
+        uint64_t offset = fileHeader->indexOffset ? [self readIndexAtOffset:fileHeader->indexOffset data:data] : 0;
+        if (!offset)
+        {
+            offset = sizeof(ECTwitterCacheFileHeader);
+        }
+        NSUInteger indexed = self.liveRecords;
+
+        offset = [self scanRecordsFromOffset:offset data:data];
+        if (offset != length)
+        {
+            ECDebug(TwitterCacheStoreChannel, @"discarding %lld bytes of damaged journal", (long long) (length - offset));
+            truncate([[self.url path] fileSystemRepresentation], (off_t) offset);
+        }
+        else
+        {
+            self.mapping = data;
+        }
+
+        ECDebug(TwitterCacheStoreChannel, @"opened journal with %ld live and %ld stale records (%ld from the saved index, %ld read)", (long) self.liveRecords, (long) self.staleRecords, (long) indexed, (long) self.unindexedRecords);
+    }
+
+    NSError* error = nil;
+    self.file = [NSFileHandle fileHandleForUpdatingURL:self.url error:&error];
+    if (!self.file)
+    {
+        ECDebug(TwitterCacheStoreChannel, @"failed to open journal %@: %@", self.url, error);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return a mapping of the journal that's at least a given length.
+/// Records appended since the file was last mapped aren't covered by the
+/// old mapping, so we remap if necessary.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (NSData*)mappingForLength:(uint64_t)length
+{
+    NSData* mapping = self.mapping;
+    if ([mapping length] < length)
+    {
+        mapping = [NSData dataWithContentsOfURL:self.url options:NSDataReadingMappedAlways error:nil];
+        self.mapping = mapping;
+    }
+
+    return mapping;
+}
+
+// --------------------------------------------------------------------------
+/// Return the payload of the record at a given offset.
+/// Records that came from the saved index weren't checked when the journal
+/// was opened, so we check each one as it's read. A damaged record is
+/// dropped from the index, and we return nil.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (NSData*)payloadAtOffset:(uint64_t)offset
+{
+    NSData* result = nil;
+    uint64_t start = offset + sizeof(ECTwitterCacheRecordHeader);
+    NSData* mapping = [self mappingForLength:start];
+    if ([mapping length] >= start)
+    {
+        const ECTwitterCacheRecordHeader* header = (const ECTwitterCacheRecordHeader*) ((const uint8_t*) [mapping bytes] + offset);
+        if ((header->magic == kRecordMagic) && ([mapping length] >= start + header->length) && (header->checksum == checksum(header + 1, header->length)))
+        {
+            result = [mapping subdataWithRange:NSMakeRange((NSUInteger) start, header->length)];
+        }
+        else
+        {
+            ECDebug(TwitterCacheStoreChannel, @"record at %lld is damaged", (long long) offset);
+            for (NSMutableDictionary* index in self.index)
+            {
+                NSArray* keys = [index allKeysForObject:[NSNumber numberWithUnsignedLongLong:offset]];
+                if ([keys count])
+                {
+                    [index removeObjectsForKeys:keys];
+                    self.liveRecords -= [keys count];
+                    self.staleRecords += [keys count];
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Append a record to the journal.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (uint64_t)writeRecordOfKind:(uint32_t)kind identifier:(uint64_t)identifier payload:(NSData*)payload
+{
+    NSUInteger length = [payload length];
+    ECTwitterCacheRecordHeader header = recordHeader(kind, identifier, [payload bytes], length);
+    NSMutableData* record = [NSMutableData dataWithCapacity:sizeof(header) + length];
+    [record appendBytes:&header length:sizeof(header)];
+    [record appendData:payload];
+
+    uint64_t offset = [self.file seekToEndOfFile];
+    [self.file writeData:record];
+
+    return offset;
+}
+
+// --------------------------------------------------------------------------
+/// Append a new version of a record.
+/// The write happens asynchronously.
+// --------------------------------------------------------------------------
+
+- (void)appendRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID data:(NSData*)data
+{
+    ECAssert(kind != RecordRemoved);
+    uint64_t identifier = recordID.value;
+    dispatch_async(self.queue, ^{
+        uint64_t offset = [self writeRecordOfKind:kind identifier:identifier payload:data];
+        [self indexRecordOfKind:kind identifier:identifier offset:offset];
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Append a tombstone for a record.
+/// The write happens asynchronously.
+// --------------------------------------------------------------------------
+
+- (void)removeRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID
+{
+    ECAssert(kind != RecordRemoved);
+    uint64_t identifier = recordID.value;
+    dispatch_async(self.queue, ^{
+        if ([[self indexForKind:kind] objectForKey:[ECTwitterID idFromValue:identifier]])
+        {
+            uint32_t removedKind = kind;
+            [self writeRecordOfKind:RecordRemoved identifier:identifier payload:[NSData dataWithBytes:&removedKind length:sizeof(removedKind)]];
+            [self unindexRecordOfKind:kind identifier:identifier];
+        }
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Collect the live records, in the order they appear in the file.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+static int compareEntries(const void* e1, const void* e2)
+{
+    uint64_t o1 = ((const ECTwitterCacheStoreEntry*) e1)->offset;
+    uint64_t o2 = ((const ECTwitterCacheStoreEntry*) e2)->offset;
+
+    return (o1 < o2) ? -1 : ((o1 > o2) ? 1 : 0);
+}
+
+- (ECTwitterCacheStoreEntry*)copyEntries:(NSUInteger*)count
+{
+    ECTwitterCacheStoreEntry* entries = calloc(MAX(self.liveRecords, 1), sizeof(ECTwitterCacheStoreEntry));
+    NSUInteger n = 0;
+    uint32_t kind = 0;
+    for (NSDictionary* index in self.index)
+    {
+        for (ECTwitterID* recordID in index)
+        {
+            ECTwitterCacheStoreEntry* entry = &entries[n++];
+            entry->offset = [[index objectForKey:recordID] unsignedLongLongValue];
+            entry->identifier = recordID.value;
+            entry->kind = kind;
+        }
+        ++kind;
+    }
+    ECAssert(n == self.liveRecords);
+
+    qsort(entries, n, sizeof(ECTwitterCacheStoreEntry), compareEntries);
+    *count = n;
+
+    return entries;
+}
+
+// --------------------------------------------------------------------------
+/// Call a block for each live record, in the order they were written.
+/// Any pending writes are finished first.
+// --------------------------------------------------------------------------
+
+- (void)enumerateRecordsUsingBlock:(ECTwitterCacheRecordBlock)block
+{
+    __block ECTwitterCacheStoreEntry* entries = NULL;
+    __block NSUInteger count = 0;
+    dispatch_sync(self.queue, ^{
+        entries = [self copyEntries:&count];
+    });
+
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        ECTwitterCacheStoreEntry* entry = &entries[n];
+        __block NSData* payload = nil;
+        dispatch_sync(self.queue, ^{
+            payload = [[self payloadAtOffset:entry->offset] retain];
+        });
+        if (payload)
+        {
+            block(entry->kind, [ECTwitterID idFromValue:entry->identifier], payload);
+            [payload release];
+        }
+    }
+
+    free(entries);
+}
+
+// --------------------------------------------------------------------------
+/// Return the payload of the live record for an ID, or nil if there isn't one.
+/// Any pending writes are finished first.
+// --------------------------------------------------------------------------
+
+- (NSData*)dataForRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID
+{
+    ECTwitterID* key = recordID ? recordID : [ECTwitterID idFromValue:0];
+    __block NSData* result = nil;
+    dispatch_sync(self.queue, ^{
+        NSNumber* offset = [[self indexForKind:kind] objectForKey:key];
+        if (offset)
+        {
+            result = [[self payloadAtOffset:[offset unsignedLongLongValue]] retain];
+        }
+    });
+
+    return [result autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Is there a live record for an ID?
+// --------------------------------------------------------------------------
+
+- (BOOL)containsRecordOfKind:(ECTwitterCacheRecordKind)kind recordID:(ECTwitterID*)recordID
+{
+    __block BOOL result = NO;
+    dispatch_sync(self.queue, ^{
+        result = [[self indexForKind:kind] objectForKey:recordID] != nil;
+    });
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of all the live records of a given kind.
+// --------------------------------------------------------------------------
+
+- (NSMutableSet*)recordIDsOfKind:(ECTwitterCacheRecordKind)kind
+{
+    __block NSMutableSet* result = nil;
+    dispatch_sync(self.queue, ^{
+        result = [[NSMutableSet alloc] initWithArray:[[self indexForKind:kind] allKeys]];
+    });
+
+    return [result autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Compact the journal in the background if enough of it is stale.
+/// Otherwise, if enough has been written since the index was last saved,
+/// save it again, so that opening the journal doesn't have to read through
+/// all of those records.
+// --------------------------------------------------------------------------
+
+- (void)compactIfNeeded
+{
+    dispatch_async(self.queue, ^{
+        if ((self.staleRecords >= kMinStaleRecords) && (self.staleRecords > self.liveRecords))
+        {
+            [self compact];
+        }
+        else if (self.unindexedRecords >= MAX(kMinUnindexedRecords, self.liveRecords / 4))
+        {
+            [self writeIndex];
+        }
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Append a copy of the index to the journal, and point the file header
+/// at it.
+/// The record is flushed before the header is changed, so a crash leaves
+/// the header pointing at either the old index or the new one.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)writeIndex
+{
+    NSUInteger count;
+    ECTwitterCacheStoreEntry* entries = [self copyEntries:&count];
+    NSData* payload = [NSData dataWithBytesNoCopy:entries length:sizeof(ECTwitterCacheStoreEntry) * count freeWhenDone:YES];
+    if (self.indexOffset)
+    {
+        ++self.staleRecords;
+    }
+    uint64_t offset = [self writeRecordOfKind:kIndexKind identifier:self.staleRecords payload:payload];
+    [self.file synchronizeFile];
+
+    [self.file seekToFileOffset:offsetof(ECTwitterCacheFileHeader, indexOffset)];
+    [self.file writeData:[NSData dataWithBytes:&offset length:sizeof(offset)]];
+
+    self.indexOffset = offset;
+    self.unindexedRecords = 0;
+
+    ECDebug(TwitterCacheStoreChannel, @"saved index of %ld records", (long) count);
+}
+
+// --------------------------------------------------------------------------
+/// Rewrite the journal with just the live records, followed by a copy of
+/// the index.
+/// Must be called on the queue.
+// --------------------------------------------------------------------------
+
+- (void)compact
+{
+    ECDebug(TwitterCacheStoreChannel, @"compacting journal: %ld live, %ld stale", (long) self.liveRecords, (long) self.staleRecords);
+
+    [self.file synchronizeFile];
+    NSData* data = [self mappingForLength:[self.file seekToEndOfFile]];
+    NSURL* compactedURL = [self.url URLByAppendingPathExtension:@"compacting"];
+    const char* compactedPath = [[compactedURL path] fileSystemRepresentation];
+
+    FILE* compacted = fopen(compactedPath, "wb");
+    if (compacted)
+    {
+        NSUInteger count;
+        ECTwitterCacheStoreEntry* entries = [self copyEntries:&count];
+
+        ECTwitterCacheFileHeader fileHeader = { kFileMagic, kFileVersion, 0 };
+        BOOL ok = fwrite(&fileHeader, sizeof(fileHeader), 1, compacted) == 1;
+        uint64_t offset = sizeof(fileHeader);
+        const uint8_t* bytes = [data bytes];
+        for (NSUInteger n = 0; ok && (n < count); ++n)
+        {
+            ECTwitterCacheStoreEntry* entry = &entries[n];
+            const ECTwitterCacheRecordHeader* header = (const ECTwitterCacheRecordHeader*) (bytes + entry->offset);
+            size_t size = sizeof(ECTwitterCacheRecordHeader) + header->length;
+            ok = fwrite(header, size, 1, compacted) == 1;
+            entry->offset = offset;
+            offset += size;
+        }
+
+        // the index goes after the records, and the header points at it
+        size_t indexLength = sizeof(ECTwitterCacheStoreEntry) * count;
+        ECTwitterCacheRecordHeader indexHeader = recordHeader(kIndexKind, 0, entries, indexLength);
+        fileHeader.indexOffset = offset;
+        ok = ok && (fwrite(&indexHeader, sizeof(indexHeader), 1, compacted) == 1);
+        ok = ok && ((indexLength == 0) || (fwrite(entries, indexLength, 1, compacted) == 1));
+        ok = ok && (fseek(compacted, 0, SEEK_SET) == 0) && (fwrite(&fileHeader, sizeof(fileHeader), 1, compacted) == 1);
+        ok = (fclose(compacted) == 0) && ok;
+
+        if (ok && (rename(compactedPath, [[self.url path] fileSystemRepresentation]) == 0))
+        {
+            for (NSUInteger n = 0; n < count; ++n)
+            {
+                ECTwitterCacheStoreEntry* entry = &entries[n];
+                [[self indexForKind:entry->kind] setObject:[NSNumber numberWithUnsignedLongLong:entry->offset] forKey:[ECTwitterID idFromValue:entry->identifier]];
+            }
+            self.staleRecords = 0;
+            self.unindexedRecords = 0;
+            self.indexOffset = fileHeader.indexOffset;
+            self.mapping = nil;
+
+            [self.file closeFile];
+            self.file = [NSFileHandle fileHandleForUpdatingURL:self.url error:nil];
+        }
+        else
+        {
+            ECDebug(TwitterCacheStoreChannel, @"failed to compact journal");
+            unlink(compactedPath);
+        }
+
+        free(entries);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Wait for any pending writes, and flush them to disk.
+// --------------------------------------------------------------------------
+
+- (void)synchronize
+{
+    dispatch_sync(self.queue, ^{
+        [self.file synchronizeFile];
+    });
+}
+
+@end
@@ -0,0 +1,32 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterCache;
+
+// --------------------------------------------------------------------------
+/// Unarchiver that carries the cache that decoded objects belong to.
+///
+/// Cached objects ask for it with +[ECTwitterCache cacheForCoder:] in their
+/// initWithCoder: methods. If there's no cache, objects are decoded
+/// standalone, without touching any cache, which makes it safe to decode
+/// on multiple threads at once.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCacheUnarchiver : NSKeyedUnarchiver
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic) ECTwitterCache* cache;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
++ (id)unarchiveObjectWithData:(NSData*)data cache:(ECTwitterCache*)cache;
+
+@end
@@ -0,0 +1,52 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterCacheUnarchiver.h"
+
+@implementation ECTwitterCacheUnarchiver
+
+// ==============================================
+// Properties
+// ==============================================
+
+#pragma mark -
+#pragma mark Properties
+
+@synthesize cache = _cache;
+
+// ==============================================
+// Constants
+// ==============================================
+
+#pragma mark -
+#pragma mark Constants
+
+// the key that +[NSKeyedArchiver archivedDataWithRootObject:] uses
+static NSString *const kRootObjectKey = @"root";
+
+// ==============================================
+// Methods
+// ==============================================
+
+#pragma mark -
+#pragma mark Methods
+
+// --------------------------------------------------------------------------
+/// Decode the root object from some archived data, in the context of a cache.
+// --------------------------------------------------------------------------
+
++ (id)unarchiveObjectWithData:(NSData*)data cache:(ECTwitterCache*)cache
+{
+    ECTwitterCacheUnarchiver* unarchiver = [[ECTwitterCacheUnarchiver alloc] initForReadingWithData:data];
+    unarchiver.cache = cache;
+    id result = [unarchiver decodeObjectForKey:kRootObjectKey];
+    [unarchiver finishDecoding];
+    [unarchiver release];
+
+    return result;
+}
+
+@end
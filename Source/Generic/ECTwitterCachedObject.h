@@ -14,12 +14,29 @@
 {
 @protected
 	ECTwitterCache*	mCache;
+@private
+	volatile int32_t mPinCount; // changed atomically, since objects can be pinned from any thread
 }
 
 // --------------------------------------------------------------------------
 // Public Properties
 // --------------------------------------------------------------------------
 
+// Eviction bookkeeping - maintained by the cache.
+@property (assign, nonatomic) ECTwitterCachedObject* clockNext;
+@property (assign, nonatomic) ECTwitterCachedObject* clockPrevious;
+@property (assign, nonatomic) NSUInteger clockCredit;
+@property (assign, nonatomic) NSUInteger clockSize;
+@property (assign, nonatomic, readonly) NSUInteger pinCount;
+
+// Set by the cache when the object has changed since it was last saved.
+@property (assign, nonatomic, getter=isDirty) BOOL dirty;
+
+// A hash of the info that the object's data was last set from, so that the
+// cache can tell whether fresh info from twitter is any different without
+// rebuilding the data. Zero if the object wasn't set from raw info.
+@property (assign) uint64_t infoHash;
+
 - (id) initWithCache:(ECTwitterCache*)cache;
 
 // --------------------------------------------------------------------------
@@ -28,5 +45,16 @@
 
 - (ECTwitterEngine*)engine;
 - (ECTwitterCache*)cache;
+- (void)setCache:(ECTwitterCache*)cache;
+
++ (uint64_t)hashForInfo:(NSDictionary*)info;
+
+- (void)markDirty;
+
+- (void)pin;
+- (void)unpin;
+- (BOOL)isPinned;
+- (NSUInteger)estimatedSize;
+- (NSUInteger)evictionWeight;
 
 @end
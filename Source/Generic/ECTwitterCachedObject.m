@@ -11,6 +11,9 @@
 #import "ECTwitterCache.h"
 #import "ECTwitterEngine.h"
 
+#import <objc/runtime.h>
+#import <libkern/OSAtomic.h>
+
 // ==============================================
 // Private Methods
 // ==============================================
@@ -32,6 +35,13 @@
 #pragma mark -
 #pragma mark Properties
 
+@synthesize clockCredit = _clockCredit;
+@synthesize clockNext = _clockNext;
+@synthesize clockPrevious = _clockPrevious;
+@synthesize clockSize = _clockSize;
+@synthesize dirty = _dirty;
+@synthesize infoHash = _infoHash;
+
 // ==============================================
 // Constants
 // ==============================================
@@ -87,4 +97,176 @@
     return mCache;
 }
 
+// --------------------------------------------------------------------------
+/// Attach an object that was decoded standalone to a cache.
+// --------------------------------------------------------------------------
+
+- (void)setCache:(ECTwitterCache*)cache
+{
+    ECAssert((mCache == nil) || (mCache == cache));
+    mCache = cache;
+}
+
+// --------------------------------------------------------------------------
+/// Mix the bits of a hash (the splitmix64 finaliser).
+// --------------------------------------------------------------------------
+
+static inline uint64_t mixHash(uint64_t hash)
+{
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+
+    return hash;
+}
+
+// --------------------------------------------------------------------------
+/// Hash a value from some parsed info, by its whole contents.
+/// Dictionary entries are combined by adding them up, so that the order
+/// they happen to be enumerated in doesn't matter.
+// --------------------------------------------------------------------------
+
+static uint64_t hashForValue(id value)
+{
+    uint64_t hash;
+    if ([value isKindOfClass:[NSString class]])
+    {
+        // FNV-1a over the UTF-16 characters
+        hash = 0xcbf29ce484222325ULL;
+        NSUInteger length = [value length];
+        unichar buffer[128];
+        for (NSUInteger start = 0; start < length; start += 128)
+        {
+            NSUInteger count = MIN(length - start, (NSUInteger) 128);
+            [value getCharacters:buffer range:NSMakeRange(start, count)];
+            for (NSUInteger n = 0; n < count; ++n)
+            {
+                hash = (hash ^ buffer[n]) * 0x100000001b3ULL;
+            }
+        }
+        hash = mixHash(hash ^ 1);
+    }
+    else if ([value isKindOfClass:[NSNumber class]])
+    {
+        CFNumberRef number = (CFNumberRef) value;
+        if (CFGetTypeID(number) == CFBooleanGetTypeID())
+        {
+            hash = [value boolValue] ? 2 : 3;
+        }
+        else if (CFNumberIsFloatType(number))
+        {
+            double real = [value doubleValue];
+            memcpy(&hash, &real, sizeof(hash));
+        }
+        else
+        {
+            hash = [value unsignedLongLongValue];
+        }
+        hash = mixHash(hash ^ 4);
+    }
+    else if ([value isKindOfClass:[NSDictionary class]])
+    {
+        hash = 0;
+        for (id key in value)
+        {
+            hash += mixHash(hashForValue(key) * 31 + hashForValue([value objectForKey:key]));
+        }
+        hash = mixHash(hash ^ ([value count] << 8) ^ 5);
+    }
+    else if ([value isKindOfClass:[NSArray class]])
+    {
+        hash = 6;
+        for (id item in value)
+        {
+            hash = mixHash(hash * 31 + hashForValue(item));
+        }
+    }
+    else
+    {
+        hash = mixHash([value hash] ^ 7);
+    }
+
+    return hash;
+}
+
+// --------------------------------------------------------------------------
+/// Return a hash of some info, for comparing against infoHash.
+/// Never returns zero, which is kept to mean "unknown".
+// --------------------------------------------------------------------------
+
++ (uint64_t)hashForInfo:(NSDictionary*)info
+{
+    uint64_t hash = info ? hashForValue(info) : 0;
+
+    return hash ? hash : 1;
+}
+
+// --------------------------------------------------------------------------
+/// Let the cache know that we've changed and need saving.
+// --------------------------------------------------------------------------
+
+- (void)markDirty
+{
+    [mCache objectDidChange:self];
+}
+
+// --------------------------------------------------------------------------
+/// Mark the object as being in use by something other than the cache.
+/// Pinned objects are never evicted.
+// --------------------------------------------------------------------------
+
+- (void)pin
+{
+    OSAtomicIncrement32Barrier(&mPinCount);
+}
+
+// --------------------------------------------------------------------------
+/// Undo a previous call to pin.
+// --------------------------------------------------------------------------
+
+- (void)unpin
+{
+    int32_t count = OSAtomicDecrement32Barrier(&mPinCount);
+    ECAssert(count >= 0); ECUnusedInRelease(count);
+}
+
+// --------------------------------------------------------------------------
+/// Can the object be evicted?
+// --------------------------------------------------------------------------
+
+- (BOOL)isPinned
+{
+    return mPinCount > 0;
+}
+
+// --------------------------------------------------------------------------
+/// How many things have the object pinned?
+// --------------------------------------------------------------------------
+
+- (NSUInteger)pinCount
+{
+    return (NSUInteger) MAX(mPinCount, 0);
+}
+
+// --------------------------------------------------------------------------
+/// Return a rough idea of how much memory the object is using.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)estimatedSize
+{
+    return class_getInstanceSize([self class]);
+}
+
+// --------------------------------------------------------------------------
+/// Return an extra weighting to give the object when deciding whether
+/// to evict it. Objects with a higher weight survive longer.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)evictionWeight
+{
+    return 0;
+}
+
 @end
@@ -7,10 +7,20 @@
 //  liberal license: http://www.elegantchaos.com/license/liberal
 // --------------------------------------------------------------------------
 
+@class ECTwitterCachedResponse;
+@class ECTwitterParser;
+
 @interface ECTwitterConnection : NSURLConnection
 
 @property (strong, nonatomic) NSMutableData* data;
+@property (strong, nonatomic) NSString* host;
 @property (strong, nonatomic) NSString* identifier;
+@property (strong, nonatomic) ECTwitterParser* parser;
+@property (strong, nonatomic) NSString* rateLimitKey;
+@property (strong, nonatomic) NSString* cacheKey;
+@property (strong, nonatomic) ECTwitterCachedResponse* cachedResponse;
+@property (assign, nonatomic) BOOL silent;
+@property (assign, nonatomic, readonly) dispatch_queue_t parseQueue;
 @property (strong, nonatomic) NSHTTPURLResponse* response;
 
 // Initializer
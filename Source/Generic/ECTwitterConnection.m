@@ -8,6 +8,7 @@
 // --------------------------------------------------------------------------
 
 #import "ECTwitterConnection.h"
+#import "ECTwitterParser.h"
 
 
 
@@ -30,8 +31,15 @@
 
 @implementation ECTwitterConnection
 
+@synthesize cacheKey;
+@synthesize cachedResponse;
 @synthesize data;
+@synthesize host;
 @synthesize identifier;
+@synthesize parser;
+@synthesize parseQueue;
+@synthesize rateLimitKey;
+@synthesize silent;
 @synthesize response;
 
 #pragma mark Initializer
@@ -46,6 +54,10 @@
     {
         self.data = [NSMutableData dataWithCapacity:0];
         self.identifier = [NSString stringWithNewUUID];
+
+        // the response is parsed in the background, a chunk at a time, in order
+        parseQueue = dispatch_queue_create("com.elegantchaos.ectwitter.parse", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(parseQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
     }
     
     return self;
@@ -54,8 +66,14 @@
 
 - (void)dealloc
 {
+    [cacheKey release];
+    [cachedResponse release];
     [data release];
+    [host release];
     [identifier release];
+    [parser release];
+    dispatch_release(parseQueue);
+    [rateLimitKey release];
     [response release];
 
     [super dealloc];
@@ -45,17 +45,25 @@
 
 - (id) initWithConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret clientName:(NSString*)clientName version:(NSString*)clientVersion url:(NSURL*)clientURL;
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector;
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra;
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector;
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra;
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector;
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra;
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector;
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra;
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler;
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler;
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler;
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler;
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler;
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler;
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler;
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler;
+
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler;
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler;
+
+- (void)setPriority:(MGTwitterRequestPriority)priority forMethod:(NSString*)method;
+- (void)cancelRequest:(NSString*)request;
+- (NSUInteger)remainingRequestsForMethod:(NSString*)method;
+- (void)setMaxStaleAge:(NSTimeInterval)age forMethod:(NSString*)method;
 
 - (void)registerError:(NSError*)error inContext:(NSObject*)context;
 
@@ -21,11 +21,14 @@
 
 @interface ECTwitterEngine()
 
+@property (strong, nonatomic) NSMutableDictionary* priorities;
+
 - (void)setHandler:(ECTwitterHandler*)handler forRequest:(NSString*)request;
 - (ECTwitterHandler*)handlerForRequest:(NSString*)request;
 - (void)doneRequest:(NSString*)request;
-- (void)callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters target:(id)target selector:(SEL)selector extra:(NSObject*)extra;
-- (void) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler;
+- (MGTwitterRequestPriority)priorityForMethod:(NSString*)method httpMethod:(NSString*)httpMethod;
+- (NSString*)callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters target:(id)target selector:(SEL)selector extra:(NSObject*)extra;
+- (NSString*) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler;
 
 @end
 
@@ -49,6 +52,7 @@ ECDeclareLogChannel(ErrorChannel);
 
 @synthesize authentication;
 @synthesize engine;
+@synthesize priorities;
 @synthesize requests;
 
 // ==============================================
@@ -76,6 +80,15 @@ ECDeclareLogChannel(ErrorChannel);
         
 		self.requests = [NSMutableDictionary dictionary];
 
+        // filling in user details, and the social graph, can wait
+        self.priorities = [NSMutableDictionary dictionary];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"users/show"];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"users/lookup"];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"friends/ids"];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"followers/ids"];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"statuses/friends"];
+        [self setPriority:MGTwitterRequestPriorityBackground forMethod:@"statuses/followers"];
+
 		ECDebug(TwitterChannel, @"initialised engine");
 	}
 	
@@ -91,6 +104,7 @@ ECDeclareLogChannel(ErrorChannel);
 {
     [authentication release];
 	[engine release];
+	[priorities release];
 	[requests release];
     
     [super dealloc];
@@ -107,11 +121,16 @@ ECDeclareLogChannel(ErrorChannel);
 
 // --------------------------------------------------------------------------
 /// Remember a request id and associate it with a handler.
+/// Requests can be made and cancelled from any thread, so we lock around
+/// any access to them.
 // --------------------------------------------------------------------------
 
 - (void) setHandler:(ECTwitterHandler*)handler forRequest:(NSString*)request
 {
-	[self.requests setObject: handler forKey: request];
+	@synchronized(self)
+	{
+		[self.requests setObject: handler forKey: request];
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -120,7 +139,10 @@ ECDeclareLogChannel(ErrorChannel);
 
 - (ECTwitterHandler*)handlerForRequest:(NSString*)request
 {
-	return [self.requests objectForKey: request];
+	@synchronized(self)
+	{
+		return [[[self.requests objectForKey: request] retain] autorelease];
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -129,9 +151,12 @@ ECDeclareLogChannel(ErrorChannel);
 
 - (void) doneRequest:(NSString*)request
 {
-	ECTwitterHandler* handler = [self.requests objectForKey: request];
-	handler.operation = nil;
-	[self.requests removeObjectForKey: request];
+	@synchronized(self)
+	{
+		ECTwitterHandler* handler = [self.requests objectForKey: request];
+		handler.operation = nil;
+		[self.requests removeObjectForKey: request];
+	}
 }
 
 // --------------------------------------------------------------------------
@@ -170,6 +195,34 @@ ECDeclareLogChannel(ErrorChannel);
 }
 
 
+// --------------------------------------------------------------------------
+/// Handle receiving an individual result.
+/// This is only called if the engine has been set up to deliver results
+/// one at a time, in which case the handler may be invoked more than once.
+// --------------------------------------------------------------------------
+
+- (void)receivedObject:(NSDictionary*)result forRequest:(NSString*)request
+{
+	ECDebug(TwitterChannel, @"individual result %@ for request %@", result, request);
+    
+	ECTwitterHandler* handler = [self handlerForRequest: request];
+	[handler invokeWithResult: result];
+}
+
+// --------------------------------------------------------------------------
+/// Handle receiving a batch of individual results.
+/// The handler is invoked once for each of them, but they're all delivered
+/// together.
+// --------------------------------------------------------------------------
+
+- (void)receivedObjects:(NSArray*)results forRequest:(NSString*)request
+{
+	ECDebug(TwitterChannel, @"%ld individual results for request %@", (long) [results count], request);
+    
+	ECTwitterHandler* handler = [self handlerForRequest: request];
+	[handler invokeWithResults: results];
+}
+
 // --------------------------------------------------------------------------
 /// Handle receiving generic results.
 // --------------------------------------------------------------------------
@@ -179,10 +232,7 @@ ECDeclareLogChannel(ErrorChannel);
 	ECDebug(TwitterChannel, @"generic results %@ for request %@", results, request);
     
 	ECTwitterHandler* handler = [self handlerForRequest: request];
-    for (NSObject* result in results)
-    {
-        [handler invokeWithResult: result];
-    }
+	[handler invokeWithResults: results];
 	
 	[self doneRequest: request];
 }
@@ -199,9 +249,9 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector
 {
-	[self callMethod: method httpMethod: nil parameters: parameters target: target selector: selector extra: nil];
+	return [self callMethod: method httpMethod: nil parameters: parameters target: target selector: selector extra: nil];
 }
 
 // --------------------------------------------------------------------------
@@ -209,9 +259,9 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
 {
-	[self callMethod: method httpMethod: nil parameters: parameters target: target selector: selector extra: extra];
+	return [self callMethod: method httpMethod: nil parameters: parameters target: target selector: selector extra: extra];
 }
 
 // --------------------------------------------------------------------------
@@ -219,9 +269,9 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector
 {
-	[self callMethod: method httpMethod: @"POST" parameters: parameters target: target selector: selector extra: nil];
+	return [self callMethod: method httpMethod: @"POST" parameters: parameters target: target selector: selector extra: nil];
 }
 
 // --------------------------------------------------------------------------
@@ -229,29 +279,45 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
+{
+	return [self callMethod: method httpMethod:@"POST" parameters: parameters target: target selector: selector extra: extra];
+}
+
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler
+{
+    return [self callMethod:method httpMethod:nil parameters:parameters extra:nil queue:nil handler:handler];
+}
+
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler
 {
-	[self callMethod: method httpMethod:@"POST" parameters: parameters target: target selector: selector extra: extra];
+    return [self callMethod:method httpMethod:@"POST" parameters:parameters extra:nil queue:nil handler:handler];
 }
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler
 {
-    [self callMethod:method httpMethod:nil parameters:parameters extra:nil handler:handler];
+    return [self callMethod:method httpMethod:nil parameters:parameters extra:extra queue:nil handler:handler];
 }
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters handler:(void (^)(ECTwitterHandler* handler))handler
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler
 {
-    [self callMethod:method httpMethod:@"POST" parameters:parameters extra:nil handler:handler];
+    return [self callMethod:method httpMethod:@"POST" parameters:parameters extra:extra queue:nil handler:handler];
 }
 
-- (void) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler
+// --------------------------------------------------------------------------
+/// Call a twitter method. 
+/// When it's done, the engine will call the handler block on the given
+/// queue. Use this to process large results in the background.
+// --------------------------------------------------------------------------
+
+- (NSString*) callGetMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler
 {
-    [self callMethod:method httpMethod:nil parameters:parameters extra:extra handler:handler];
+    return [self callMethod:method httpMethod:nil parameters:parameters extra:extra queue:queue handler:handler];
 }
 
-- (void) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler
+- (NSString*) callPostMethod:(NSString*)method parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler
 {
-    [self callMethod:method httpMethod:@"POST" parameters:parameters extra:extra handler:handler];
+    return [self callMethod:method httpMethod:@"POST" parameters:parameters extra:extra queue:queue handler:handler];
 }
 
 
@@ -260,12 +326,18 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters extra:(NSObject*)extra handler:(void (^)(ECTwitterHandler* handler))handler
+- (NSString*) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters extra:(NSObject*)extra queue:(NSOperationQueue*)queue handler:(void (^)(ECTwitterHandler* handler))handler
 {
 	ECTwitterHandler* internalHandler = [[ECTwitterHandler alloc] initWithEngine:self handler:handler];
 	internalHandler.extra = extra;
-    [self callMethod:method httpMethod:httpMethod parameters:parameters internalHandler:internalHandler];
+	if (queue)
+	{
+		internalHandler.deliveryQueue = queue;
+	}
+    NSString* request = [self callMethod:method httpMethod:httpMethod parameters:parameters internalHandler:internalHandler];
     [internalHandler release];
+
+    return request;
 }
 
 
@@ -274,12 +346,14 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
+- (NSString*) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters target:(id) target selector:(SEL) selector extra:(NSObject*)extra
 {
 	ECTwitterHandler* internalHandler = [[ECTwitterHandler alloc] initWithEngine: self target: target selector: selector];
 	internalHandler.extra = extra;
-    [self callMethod:method httpMethod:httpMethod parameters:parameters internalHandler:internalHandler];
+    NSString* request = [self callMethod:method httpMethod:httpMethod parameters:parameters internalHandler:internalHandler];
     [internalHandler release];
+
+    return request;
 }
 
 // --------------------------------------------------------------------------
@@ -287,15 +361,92 @@ ECDeclareLogChannel(ErrorChannel);
 /// When it's done, the engine will call back to the specified target/selector.
 // --------------------------------------------------------------------------
 
-- (void) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters internalHandler:(ECTwitterHandler*)internalHandler
+- (NSString*) callMethod:(NSString*)method httpMethod:(NSString*)httpMethod parameters:(NSDictionary*)parameters internalHandler:(ECTwitterHandler*)internalHandler
 {
 	if (parameters == nil)
 	{
 		parameters = [NSDictionary dictionary];
 	}
 	
-    NSString* request = [self.engine request:method parameters:parameters method:httpMethod authentication:self.authentication];
-	[self setHandler:internalHandler forRequest:request];
+    MGTwitterRequestPriority priority = [self priorityForMethod:method httpMethod:httpMethod];
+    NSString* request = [self.engine request:method parameters:parameters method:httpMethod authentication:self.authentication priority:priority];
+    if (request)
+    {
+        [self setHandler:internalHandler forRequest:request];
+    }
+
+    return request;
+}
+
+// --------------------------------------------------------------------------
+/// Return the priority to use for a twitter method.
+/// Anything that posts is something the user has just done, so it goes
+/// first. Other methods are treated as refreshes, unless they've been
+/// given a priority explicitly.
+// --------------------------------------------------------------------------
+
+- (MGTwitterRequestPriority)priorityForMethod:(NSString*)method httpMethod:(NSString*)httpMethod
+{
+    MGTwitterRequestPriority result;
+    NSNumber* priority = [self.priorities objectForKey:method];
+    if (priority)
+    {
+        result = (MGTwitterRequestPriority) [priority unsignedIntegerValue];
+    }
+    else if ([httpMethod isEqualToString:@"POST"])
+    {
+        result = MGTwitterRequestPriorityInteractive;
+    }
+    else
+    {
+        result = MGTwitterRequestPriorityRefresh;
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Set the priority to use for a twitter method.
+// --------------------------------------------------------------------------
+
+- (void)setPriority:(MGTwitterRequestPriority)priority forMethod:(NSString*)method
+{
+    [self.priorities setObject:[NSNumber numberWithUnsignedInteger:priority] forKey:method];
+}
+
+// --------------------------------------------------------------------------
+/// Cancel a request that we've made.
+/// If it's still queued it'll never be sent; if it's in progress the
+/// connection is dropped. Either way, the handler won't be called.
+// --------------------------------------------------------------------------
+
+- (void)cancelRequest:(NSString*)request
+{
+    ECDebug(TwitterChannel, @"cancelling request %@", request);
+    [self.engine closeConnection:request];
+    [self doneRequest:request];
+}
+
+// --------------------------------------------------------------------------
+/// Return how many more times we can call a method (or any other method
+/// in the same family) for the current user, before the rate limit is 
+/// reset. Returns NSNotFound if we don't know yet.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)remainingRequestsForMethod:(NSString*)method
+{
+    return [self.engine remainingRequestsForPath:method authentication:self.authentication];
+}
+
+// --------------------------------------------------------------------------
+/// Opt in to being given a cached response for a method straight away,
+/// if it's no older than a given age, while it's revalidated in the
+/// background. Pass a negative age to opt out again.
+// --------------------------------------------------------------------------
+
+- (void)setMaxStaleAge:(NSTimeInterval)age forMethod:(NSString*)method
+{
+    [self.engine setMaxStaleAge:age forPath:method];
 }
 
 // --------------------------------------------------------------------------
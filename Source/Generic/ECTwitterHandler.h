@@ -31,6 +31,7 @@ typedef void (^ECTwitterHandlerBlock)(ECTwitterHandler *);
 // --------------------------------------------------------------------------
 
 @property (strong, nonatomic) ECTwitterEngine* engine;
+@property (strong, nonatomic) NSOperationQueue* deliveryQueue;
 @property (strong, nonatomic) NSError* error;
 @property (strong, nonatomic) id extra;
 @property (strong, nonatomic) NSOperation* operation;
@@ -45,6 +46,7 @@ typedef void (^ECTwitterHandlerBlock)(ECTwitterHandler *);
 - (id)initWithEngine:(ECTwitterEngine*)engine handler:(ECTwitterHandlerBlock)handler;
 - (void)invokeWithStatus:(ECTwitterStatus) status;
 - (void)invokeWithResult:(id)result;
+- (void)invokeWithResults:(NSArray*)results;
 
 - (NSString*)errorString;
 
@@ -16,6 +16,14 @@
 
 @interface ECTwitterHandler()
 
+@property (strong, nonatomic) id target;
+@property (assign, nonatomic) SEL selector;
+@property (copy, nonatomic) ECTwitterHandlerBlock block;
+
+- (ECTwitterHandler*)snapshot;
+- (NSOperation*)operationForSnapshot:(ECTwitterHandler*)snapshot;
+- (void)deliverSnapshot:(ECTwitterHandler*)snapshot;
+
 @end
 
 
@@ -25,12 +33,16 @@
 // Properties
 // ==============================================
 
+@synthesize deliveryQueue = _deliveryQueue;
 @synthesize engine = _engine;
 @synthesize error = _error;
 @synthesize extra = _extra;
 @synthesize operation = _operation;
 @synthesize result = _result;
 @synthesize status = _status;
+@synthesize target = _target;
+@synthesize selector = _selector;
+@synthesize block = _block;
 
 // ==============================================
 // Lifecycle
@@ -47,10 +59,11 @@
 {
 	if ((self = [super init]) != nil)
 	{
-		NSOperation* newOperation = [[NSInvocationOperation alloc] initWithTarget: target selector: selector object: self];
-		self.operation = newOperation;
+		self.target = target;
+		self.selector = selector;
 		self.engine = engineIn;
-		[newOperation release];
+		self.deliveryQueue = [NSOperationQueue mainQueue];
+		self.operation = [self operationForSnapshot:self];
 	}
 	
 	return self;
@@ -62,18 +75,14 @@
 
 - (id) initWithEngine:(ECTwitterEngine*)engineIn handler:(ECTwitterHandlerBlock)handler
 {
-    ECTwitterHandlerBlock handlerCopy = [handler copy];
 	if ((self = [super init]) != nil)
 	{
-        NSOperation* newOperation = [NSBlockOperation blockOperationWithBlock:^{
-            handlerCopy(self);
-        }];
-		self.operation = newOperation;
+		self.block = handler;
 		self.engine = engineIn;
+		self.deliveryQueue = [NSOperationQueue mainQueue];
+		self.operation = [self operationForSnapshot:self];
 	}
 
-    [handlerCopy release];
-
 	return self;
 }
 
@@ -83,11 +92,14 @@
 
 - (void) dealloc
 {
+	[_deliveryQueue release];
 	[_operation release];
 	[_engine release];
 	[_result release];
 	[_extra release];
 	[_error release];
+	[_target release];
+	[_block release];
 
 	[super dealloc];
 }
@@ -106,7 +118,16 @@
 - (void) invokeWithStatus:(ECTwitterStatus)statusIn
 {
 	self.status = statusIn;
-	[[NSOperationQueue mainQueue] addOperation:self.operation];
+	NSOperation* operation = self.operation;
+	if (!operation)
+	{
+		// we've been invoked before (for example, because results are being
+		// delivered one at a time), so the earlier invocation may not have run
+		// yet - give this one its own copy of the state
+		operation = [self operationForSnapshot:[self snapshot]];
+	}
+	
+	[self.deliveryQueue addOperation:operation];
     self.operation = nil;
 }
 
@@ -120,6 +141,101 @@
 	[self invokeWithStatus: StatusResults];
 }
 
+// --------------------------------------------------------------------------
+/// Invoke the handler once for each of a set of results.
+/// All of the invocations are delivered together, as a single operation,
+/// rather than each of them going through the delivery queue separately.
+// --------------------------------------------------------------------------
+
+- (void) invokeWithResults:(NSArray*)results
+{
+	NSUInteger count = [results count];
+	if (count == 1)
+	{
+		[self invokeWithResult:[results objectAtIndex:0]];
+	}
+	else if (count > 1)
+	{
+		NSMutableArray* snapshots = [NSMutableArray arrayWithCapacity:count];
+		for (id resultIn in results)
+		{
+			self.result = resultIn;
+			self.status = StatusResults;
+			[snapshots addObject:[self snapshot]];
+		}
+		
+		NSOperation* operation = [NSBlockOperation blockOperationWithBlock:^{
+			for (ECTwitterHandler* snapshot in snapshots)
+			{
+				[self deliverSnapshot:snapshot];
+			}
+		}];
+		[self.deliveryQueue addOperation:operation];
+		self.operation = nil;
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Return a copy of the handler, in its current state.
+// --------------------------------------------------------------------------
+
+- (ECTwitterHandler*)snapshot
+{
+	ECTwitterHandler* result = [[ECTwitterHandler alloc] init];
+	result.engine = self.engine;
+	result.error = self.error;
+	result.extra = self.extra;
+	result.result = self.result;
+	result.deliveryQueue = self.deliveryQueue;
+	result.status = self.status;
+	result.target = self.target;
+	result.selector = self.selector;
+	result.block = self.block;
+	
+	return [result autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Return an operation which calls the handler's target/selector or block
+/// with the given handler.
+// --------------------------------------------------------------------------
+
+- (NSOperation*)operationForSnapshot:(ECTwitterHandler*)snapshot
+{
+	NSOperation* result;
+	ECTwitterHandlerBlock block = self.block;
+	if (block)
+	{
+		result = [NSBlockOperation blockOperationWithBlock:^{
+			block(snapshot);
+		}];
+	}
+	else
+	{
+		result = [[[NSInvocationOperation alloc] initWithTarget:self.target selector:self.selector object:snapshot] autorelease];
+	}
+	
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Call the handler's target/selector or block with the given handler, 
+/// right now.
+// --------------------------------------------------------------------------
+
+- (void)deliverSnapshot:(ECTwitterHandler*)snapshot
+{
+	ECTwitterHandlerBlock block = self.block;
+	if (block)
+	{
+		block(snapshot);
+	}
+	else
+	{
+		[self.target performSelector:self.selector withObject:snapshot];
+	}
+}
+
 // --------------------------------------------------------------------------
 /// Return an error string.
 // --------------------------------------------------------------------------
@@ -7,13 +7,26 @@
 //  liberal license: http://www.elegantchaos.com/license/liberal
 // --------------------------------------------------------------------------
 
-@interface ECTwitterID : NSObject
+/// --------------------------------------------------------------------------
+/// An identifier for a twitter object.
+/// IDs are stored as 64-bit integers, and are interned: there is only ever
+/// one instance for a given value, so they are cheap to compare and to use
+/// as dictionary keys.
+/// IDs that are no longer used are let go from time to time.
+/// --------------------------------------------------------------------------
+
+@interface ECTwitterID : NSObject<NSCoding, NSCopying>
+{
+@private
+    uint64_t mValue;
+}
 
 // --------------------------------------------------------------------------
 // Public Properties
 // --------------------------------------------------------------------------
 
-@property (strong, nonatomic) NSString* string;
+@property (nonatomic, readonly) NSString* string;
+@property (nonatomic, readonly) uint64_t value;
 
 // --------------------------------------------------------------------------
 // Public Methods
@@ -22,7 +35,11 @@
 + (ECTwitterID*)idFromKey:(NSString*)key dictionary:(NSDictionary*)dictionary;
 + (ECTwitterID*)idFromDictionary:(NSDictionary*)dictionary;
 + (ECTwitterID*)idFromString:(NSString*)string;
++ (ECTwitterID*)idFromValue:(uint64_t)value;
++ (NSUInteger)purgeUnusedIDs;
 
 - (id) initWithString:(NSString*)string;
 
+- (NSComparisonResult)compare:(ECTwitterID*)other;
+
 @end
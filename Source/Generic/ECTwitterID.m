@@ -9,6 +9,7 @@
 
 #import "ECTwitterID.h"
 
+#include <pthread.h>
 
 // --------------------------------------------------------------------------
 // Private Methods
@@ -16,35 +17,187 @@
 
 @interface ECTwitterID()
 
+- (id)initWithValue:(uint64_t)value;
++ (BOOL)getValue:(uint64_t*)value fromString:(NSString*)string;
+
 @end
 
 
 @implementation ECTwitterID
 
 // --------------------------------------------------------------------------
-// Properties
+// Debug Channels
+// --------------------------------------------------------------------------
+
+ECDefineDebugChannel(TwitterIDChannel);
+
 // --------------------------------------------------------------------------
+// Globals
+// --------------------------------------------------------------------------
+
+// Table of all IDs, keyed by a pointer to their value.
+// The table is split into shards, each with its own lock, so that threads
+// making IDs at the same time rarely have to wait for each other.
+// The table owns a reference to each ID. An ID that nobody else holds
+// on to any more is only let go when its shard is purged, which happens
+// whenever the shard has doubled in size since the last purge.
+// A new reference to an ID can only be made through the table, under the
+// shard lock, so an ID that the table is the only owner of can't come
+// back to life while we're purging it.
+
+#define kInternedShardBits 4
+#define kInternedShardCount (1 << kInternedShardBits)
+
+static const CFIndex kInternedMinimumPurge = 1024;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    CFMutableDictionaryRef table;
+    CFIndex purgeAt;
+} InternedShard;
+
+static InternedShard gInterned[kInternedShardCount];
+
+static Boolean internedValueEqual(const void* value1, const void* value2)
+{
+    return *(const uint64_t*)value1 == *(const uint64_t*)value2;
+}
 
-@synthesize string;
+static CFHashCode internedValueHash(const void* value)
+{
+    uint64_t v = *(const uint64_t*)value;
+    return (CFHashCode)(v ^ (v >> 32));
+}
+
+static inline InternedShard* internedShardForValue(uint64_t value)
+{
+    // the low bits of a twitter id aren't very well spread, so we mix them first
+    return &gInterned[(value * 0x9E3779B97F4A7C15ULL) >> (64 - kInternedShardBits)];
+}
 
 // --------------------------------------------------------------------------
-// Constants
+/// Release any IDs in a shard that only the table is holding on to.
+/// The shard must be locked. Returns the number released.
 // --------------------------------------------------------------------------
 
+static NSUInteger internedShardPurge(InternedShard* shard)
+{
+    CFIndex count = CFDictionaryGetCount(shard->table);
+    ECTwitterID** ids = malloc(sizeof(ECTwitterID*) * (size_t) count);
+    CFDictionaryGetKeysAndValues(shard->table, NULL, (const void**) ids);
+
+    NSUInteger purged = 0;
+    for (CFIndex n = 0; n < count; ++n)
+    {
+        ECTwitterID* item = ids[n];
+        if ([item retainCount] == 1)
+        {
+            // the key points into the ID, so it has to come out of the table first
+            uint64_t value = item.value;
+            CFDictionaryRemoveValue(shard->table, &value);
+            [item release];
+            ++purged;
+        }
+    }
+    free(ids);
+
+    shard->purgeAt = MAX(CFDictionaryGetCount(shard->table) * 2, kInternedMinimumPurge);
+
+    return purged;
+}
+
 // --------------------------------------------------------------------------
 // Methods
 // --------------------------------------------------------------------------
 
++ (void)initialize
+{
+    if (self == [ECTwitterID class])
+    {
+        CFDictionaryKeyCallBacks callbacks = { 0, NULL, NULL, NULL, internedValueEqual, internedValueHash };
+        for (NSUInteger n = 0; n < kInternedShardCount; ++n)
+        {
+            pthread_mutex_init(&gInterned[n].lock, NULL);
+            gInterned[n].table = CFDictionaryCreateMutable(NULL, 0, &callbacks, NULL);
+            gInterned[n].purgeAt = kInternedMinimumPurge;
+        }
+    }
+}
+
++ (ECTwitterID*)idFromValue:(uint64_t)value
+{
+    InternedShard* shard = internedShardForValue(value);
+    pthread_mutex_lock(&shard->lock);
+    ECTwitterID* result = (ECTwitterID*) CFDictionaryGetValue(shard->table, &value);
+    if (!result)
+    {
+        // the table keeps the reference that we get here
+        result = [[ECTwitterID alloc] initWithValue:value];
+        CFDictionarySetValue(shard->table, &result->mValue, result);
+    }
+
+    // our reference has to be taken before the lock is dropped, or a purge could get in first
+    [[result retain] autorelease];
+    if (CFDictionaryGetCount(shard->table) >= shard->purgeAt)
+    {
+        NSUInteger purged = internedShardPurge(shard);
+        ECDebug(TwitterIDChannel, @"purged %ld unused ids", (long) purged);
+        ECUnusedInRelease(purged);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Release all the IDs that nobody is using any more.
+/// This happens by itself as the table grows, but it can be done sooner
+/// (when memory is short, say).
+/// Returns the number of IDs released.
+// --------------------------------------------------------------------------
+
++ (NSUInteger)purgeUnusedIDs
+{
+    NSUInteger purged = 0;
+    for (NSUInteger n = 0; n < kInternedShardCount; ++n)
+    {
+        InternedShard* shard = &gInterned[n];
+        pthread_mutex_lock(&shard->lock);
+        purged += internedShardPurge(shard);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return purged;
+}
+
+// --------------------------------------------------------------------------
+/// Return the ID for a string of decimal digits.
+/// Returns nil if the string isn't a valid ID.
+// --------------------------------------------------------------------------
+
 + (ECTwitterID*)idFromString:(NSString *)string
 {
-    ECTwitterID* result = [[ECTwitterID alloc] initWithString: string];
-	return [result autorelease];
+    ECAssertNonNil(string);
+
+    uint64_t value;
+    return [self getValue:&value fromString:string] ? [self idFromValue:value] : nil;
 }
 
 + (ECTwitterID*)idFromKey:(NSString *)key dictionary:(NSDictionary *)dictionary
 {
-	NSString* string = [dictionary objectForKey: key];
-    return [self idFromString:string];
+    ECTwitterID* result = nil;
+	id value = [dictionary objectForKey: key];
+    if ([value isKindOfClass:[NSString class]])
+    {
+        result = [self idFromString:value];
+    }
+    else if ([value isKindOfClass:[NSNumber class]])
+    {
+        result = [self idFromValue:[value unsignedLongLongValue]];
+    }
+    
+    return result;
 }
 
 + (ECTwitterID*)idFromDictionary:(NSDictionary *)dictionary
@@ -52,17 +205,68 @@
     return [self idFromKey:@"id_str" dictionary:dictionary];
 }
 
-- (id) initWithString:(NSString*)stringIn
+// --------------------------------------------------------------------------
+/// Convert a string of decimal digits into a value.
+/// We do this by hand to avoid making any intermediate strings.
+/// Returns NO if the string is empty, has anything other than digits 
+/// in it, or is too big to fit.
+// --------------------------------------------------------------------------
+
++ (BOOL)getValue:(uint64_t*)value fromString:(NSString*)string
 {
-    if (stringIn == nil)
+    static const NSUInteger kMaxDigits = 20;
+    
+    NSUInteger length = [string length];
+    if ((length == 0) || (length > kMaxDigits))
     {
-        NSLog(@"nil string detected");
+        ECDebug(TwitterIDChannel, @"id string %@ is the wrong length", string);
+        return NO;
     }
+
+    unichar digits[kMaxDigits];
+    [string getCharacters:digits range:NSMakeRange(0, length)];
+    uint64_t result = 0;
+    for (NSUInteger n = 0; n < length; ++n)
+    {
+        unichar c = digits[n];
+        if ((c < '0') || (c > '9'))
+        {
+            ECDebug(TwitterIDChannel, @"id string %@ isn't a number", string);
+            return NO;
+        }
+
+        uint64_t digit = c - '0';
+        if (result > (UINT64_MAX - digit) / 10)
+        {
+            ECDebug(TwitterIDChannel, @"id string %@ is too big", string);
+            return NO;
+        }
+        result = (result * 10) + digit;
+    }
+
+    *value = result;
+    return YES;
+}
+
+// --------------------------------------------------------------------------
+/// Return the interned instance for a string.
+/// (any existing instance is used instead of the receiver).
+/// Returns nil if the string isn't a valid ID.
+// --------------------------------------------------------------------------
+
+- (id) initWithString:(NSString*)stringIn
+{
     ECAssertNonNil(stringIn);
 
+    [self release];
+    return [[ECTwitterID idFromString:stringIn] retain];
+}
+
+- (id) initWithValue:(uint64_t)value
+{
 	if ((self = [super init]) != nil)
 	{
-		self.string = stringIn;
+		mValue = value;
 	}
 	
 	return self;
@@ -70,27 +274,74 @@
 
 - (id)initWithCoder:(NSCoder*)coder
 {
-    if ((self = [super init]) != nil)
+    uint64_t value;
+    if ([coder containsValueForKey:@"value"])
     {
-        self.string = [coder decodeObjectForKey:@"id"];
+        value = (uint64_t) [coder decodeInt64ForKey:@"value"];
+    }
+    else
+    {
+        // older caches stored the id as a string
+        NSString* string = [coder decodeObjectForKey:@"id"];
+        if (![string isKindOfClass:[NSString class]] || ![ECTwitterID getValue:&value fromString:string])
+        {
+            [self release];
+            return nil;
+        }
     }
     
-    ECAssertNonNil(self.string);
-    
-    return self;
+    [self release];
+    return [[ECTwitterID idFromValue:value] retain];
 }
 
-- (void) dealloc
+- (void)encodeWithCoder:(NSCoder*)coder
 {
-	[string release];
-	
-	[super dealloc];
+    [coder encodeInt64:(int64_t) mValue forKey:@"value"];
 }
 
-- (void)encodeWithCoder:(NSCoder*)coder
+// --------------------------------------------------------------------------
+/// IDs are immutable and interned, so copying is just retaining.
+// --------------------------------------------------------------------------
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return [self retain];
+}
+
+- (uint64_t)value
 {
-    ECAssertNonNil(self.string);
-    [coder encodeObject:self.string forKey:@"id"];
+    return mValue;
+}
+
+- (NSString*)string
+{
+    return [NSString stringWithFormat:@"%llu", (unsigned long long) mValue];
+}
+
+- (NSUInteger)hash
+{
+    return (NSUInteger)(mValue ^ (mValue >> 32));
+}
+
+- (BOOL)isEqual:(id)object
+{
+    return (object == self) || ([object isKindOfClass:[ECTwitterID class]] && (((ECTwitterID*)object)->mValue == mValue));
+}
+
+// --------------------------------------------------------------------------
+/// Compare two IDs by value.
+/// Any ID comes after nil.
+// --------------------------------------------------------------------------
+
+- (NSComparisonResult)compare:(ECTwitterID*)other
+{
+    if (!other)
+    {
+        return NSOrderedDescending;
+    }
+
+    uint64_t otherValue = other->mValue;
+    return (mValue < otherValue) ? NSOrderedAscending : ((mValue > otherValue) ? NSOrderedDescending : NSOrderedSame);
 }
 
 // --------------------------------------------------------------------------
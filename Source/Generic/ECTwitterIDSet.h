@@ -0,0 +1,46 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterID;
+
+/// --------------------------------------------------------------------------
+/// An immutable set of twitter IDs.
+/// The IDs are kept as a sorted, packed array of 64-bit values, so a set
+/// of 100,000 followers takes 800K rather than 100,000 objects, and set
+/// operations are a single pass over each side.
+/// --------------------------------------------------------------------------
+
+@interface ECTwitterIDSet : NSObject<NSCoding, NSCopying>
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic, readonly) NSUInteger count;
+@property (assign, nonatomic, readonly) const uint64_t* values;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
++ (ECTwitterIDSet*)set;
++ (ECTwitterIDSet*)setWithValues:(const uint64_t*)values count:(NSUInteger)count;
++ (ECTwitterIDSet*)setWithIDs:(NSArray*)ids;
+
+- (id)initWithValues:(const uint64_t*)values count:(NSUInteger)count;
+
+- (BOOL)containsValue:(uint64_t)value;
+- (BOOL)containsID:(ECTwitterID*)twitterID;
+- (ECTwitterID*)idAtIndex:(NSUInteger)index;
+- (NSArray*)idsInRange:(NSRange)range;
+
+- (ECTwitterIDSet*)setByIntersectingSet:(ECTwitterIDSet*)other;
+- (ECTwitterIDSet*)setByUnioningSet:(ECTwitterIDSet*)other;
+- (ECTwitterIDSet*)setBySubtractingSet:(ECTwitterIDSet*)other;
+
+- (BOOL)isEqualToSet:(ECTwitterIDSet*)other;
+
+@end
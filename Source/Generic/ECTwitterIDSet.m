@@ -0,0 +1,419 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterIDSet.h"
+
+#import "ECTwitterID.h"
+
+// --------------------------------------------------------------------------
+// Private Methods
+// --------------------------------------------------------------------------
+
+@interface ECTwitterIDSet()
+
+@property (strong, nonatomic) NSData* data;
+
+- (id)initWithSortedValues:(uint64_t*)values count:(NSUInteger)count;
+
+@end
+
+
+@implementation ECTwitterIDSet
+
+// --------------------------------------------------------------------------
+// Properties
+// --------------------------------------------------------------------------
+
+@synthesize data = _data;
+
+// --------------------------------------------------------------------------
+// Constants
+// --------------------------------------------------------------------------
+
+// if one side of an intersection is this many times bigger than the
+// other, we search for the smaller side's values instead of merging
+static const NSUInteger kGallopRatio = 16;
+
+// --------------------------------------------------------------------------
+// Helpers
+// --------------------------------------------------------------------------
+
+static int compareValues(const void* value1, const void* value2)
+{
+    uint64_t v1 = *(const uint64_t*) value1;
+    uint64_t v2 = *(const uint64_t*) value2;
+    return (v1 < v2) ? -1 : ((v1 > v2) ? 1 : 0);
+}
+
+// --------------------------------------------------------------------------
+/// Sort some values and remove any duplicates, in place.
+/// Returns how many values are left.
+// --------------------------------------------------------------------------
+
+static NSUInteger sortAndUnique(uint64_t* values, NSUInteger count)
+{
+    BOOL sorted = YES;
+    for (NSUInteger n = 1; sorted && (n < count); ++n)
+    {
+        sorted = values[n - 1] < values[n];
+    }
+
+    if (sorted)
+    {
+        return count;
+    }
+
+    qsort(values, count, sizeof(uint64_t), compareValues);
+
+    NSUInteger unique = 0;
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        if ((unique == 0) || (values[unique - 1] != values[n]))
+        {
+            values[unique++] = values[n];
+        }
+    }
+
+    return unique;
+}
+
+// --------------------------------------------------------------------------
+/// Return the index of the first value at or after start that isn't less
+/// than target. We look at exponentially growing steps first, then do a
+/// binary search of the last step, so finding a value near start is cheap.
+// --------------------------------------------------------------------------
+
+static NSUInteger gallop(const uint64_t* values, NSUInteger start, NSUInteger count, uint64_t target)
+{
+    NSUInteger low = start;
+    NSUInteger high = start;
+    NSUInteger step = 1;
+    while ((high < count) && (values[high] < target))
+    {
+        low = high + 1;
+        high += step;
+        step <<= 1;
+    }
+
+    if (high > count)
+    {
+        high = count;
+    }
+
+    while (low < high)
+    {
+        NSUInteger middle = low + (high - low) / 2;
+        if (values[middle] < target)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+// --------------------------------------------------------------------------
+// Lifecycle
+// --------------------------------------------------------------------------
+
++ (ECTwitterIDSet*)set
+{
+    return [[[ECTwitterIDSet alloc] initWithValues:NULL count:0] autorelease];
+}
+
++ (ECTwitterIDSet*)setWithValues:(const uint64_t*)values count:(NSUInteger)count
+{
+    return [[[ECTwitterIDSet alloc] initWithValues:values count:count] autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Make a set from an array of ECTwitterIDs, or the NSNumbers or NSStrings
+/// that twitter sends IDs as.
+// --------------------------------------------------------------------------
+
++ (ECTwitterIDSet*)setWithIDs:(NSArray*)ids
+{
+    NSUInteger count = [ids count];
+    uint64_t* values = malloc(MAX(count, (NSUInteger) 1) * sizeof(uint64_t));
+    NSUInteger n = 0;
+    for (id item in ids)
+    {
+        if ([item isKindOfClass:[ECTwitterID class]])
+        {
+            values[n++] = [(ECTwitterID*) item value];
+        }
+        else if ([item isKindOfClass:[NSNumber class]])
+        {
+            values[n++] = [(NSNumber*) item unsignedLongLongValue];
+        }
+        else if ([item isKindOfClass:[NSString class]])
+        {
+            values[n++] = strtoull([(NSString*) item UTF8String], NULL, 10);
+        }
+    }
+
+    ECTwitterIDSet* result = [[ECTwitterIDSet alloc] initWithSortedValues:values count:sortAndUnique(values, n)];
+    return [result autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Set up with a copy of some values, which don't need to be sorted.
+// --------------------------------------------------------------------------
+
+- (id)initWithValues:(const uint64_t*)valuesIn count:(NSUInteger)count
+{
+    uint64_t* values = malloc(MAX(count, (NSUInteger) 1) * sizeof(uint64_t));
+    if (count)
+    {
+        memcpy(values, valuesIn, count * sizeof(uint64_t));
+    }
+
+    return [self initWithSortedValues:values count:sortAndUnique(values, count)];
+}
+
+// --------------------------------------------------------------------------
+/// Set up with some sorted, unique values.
+/// We take ownership of the buffer, which must have come from malloc.
+// --------------------------------------------------------------------------
+
+- (id)initWithSortedValues:(uint64_t*)values count:(NSUInteger)count
+{
+    if ((self = [super init]) != nil)
+    {
+        NSData* data = [[NSData alloc] initWithBytesNoCopy:values length:count * sizeof(uint64_t) freeWhenDone:YES];
+        self.data = data;
+        [data release];
+    }
+    else
+    {
+        free(values);
+    }
+
+    return self;
+}
+
+- (id)initWithCoder:(NSCoder*)coder
+{
+    NSUInteger length = 0;
+    const uint8_t* bytes = [coder decodeBytesForKey:@"values" returnedLength:&length];
+
+    return [self initWithValues:(const uint64_t*) bytes count:length / sizeof(uint64_t)];
+}
+
+- (void)encodeWithCoder:(NSCoder*)coder
+{
+    [coder encodeBytes:[self.data bytes] length:[self.data length] forKey:@"values"];
+}
+
+- (void)dealloc
+{
+    [_data release];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+/// Sets are immutable, so copying is just retaining.
+// --------------------------------------------------------------------------
+
+- (id)copyWithZone:(NSZone*)zone
+{
+    return [self retain];
+}
+
+// --------------------------------------------------------------------------
+// Access
+// --------------------------------------------------------------------------
+
+- (NSUInteger)count
+{
+    return [self.data length] / sizeof(uint64_t);
+}
+
+- (const uint64_t*)values
+{
+    return [self.data bytes];
+}
+
+- (BOOL)containsValue:(uint64_t)value
+{
+    NSUInteger count = self.count;
+    NSUInteger index = gallop(self.values, 0, count, value);
+
+    return (index < count) && (self.values[index] == value);
+}
+
+- (BOOL)containsID:(ECTwitterID*)twitterID
+{
+    return twitterID && [self containsValue:twitterID.value];
+}
+
+- (ECTwitterID*)idAtIndex:(NSUInteger)index
+{
+    ECAssert(index < self.count);
+
+    return [ECTwitterID idFromValue:self.values[index]];
+}
+
+// --------------------------------------------------------------------------
+/// Return some of the IDs as objects.
+/// Useful for paging through a big set without making objects for all of it.
+// --------------------------------------------------------------------------
+
+- (NSArray*)idsInRange:(NSRange)range
+{
+    ECAssert(NSMaxRange(range) <= self.count);
+
+    const uint64_t* values = self.values;
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:range.length];
+    for (NSUInteger n = range.location; n < NSMaxRange(range); ++n)
+    {
+        [result addObject:[ECTwitterID idFromValue:values[n]]];
+    }
+
+    return result;
+}
+
+- (BOOL)isEqualToSet:(ECTwitterIDSet*)other
+{
+    return (other == self) || [self.data isEqualToData:other.data];
+}
+
+- (BOOL)isEqual:(id)object
+{
+    return [object isKindOfClass:[ECTwitterIDSet class]] && [self isEqualToSet:object];
+}
+
+- (NSUInteger)hash
+{
+    NSUInteger count = self.count;
+    return count ? (NSUInteger) (count ^ self.values[0] ^ self.values[count - 1]) : 0;
+}
+
+- (NSString*)description
+{
+    return [NSString stringWithFormat:@"<ECTwitterIDSet: %ld ids>", (long) self.count];
+}
+
+// --------------------------------------------------------------------------
+// Set Operations
+//
+// These are all merges of the two sorted arrays. The inner loops are
+// written without branches on the comparisons - each step writes a value
+// and then advances the output and inputs by the results of the compares -
+// so they run at the same speed however the two sides interleave.
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Return the IDs that are in both sets.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*)setByIntersectingSet:(ECTwitterIDSet*)other
+{
+    const uint64_t* small = self.values;
+    const uint64_t* large = other.values;
+    NSUInteger smallCount = self.count;
+    NSUInteger largeCount = other.count;
+    if (smallCount > largeCount)
+    {
+        const uint64_t* values = small; small = large; large = values;
+        NSUInteger count = smallCount; smallCount = largeCount; largeCount = count;
+    }
+
+    uint64_t* result = malloc(MAX(smallCount, (NSUInteger) 1) * sizeof(uint64_t));
+    NSUInteger k = 0;
+    if (smallCount * kGallopRatio < largeCount)
+    {
+        NSUInteger j = 0;
+        for (NSUInteger i = 0; (i < smallCount) && (j < largeCount); ++i)
+        {
+            uint64_t value = small[i];
+            j = gallop(large, j, largeCount, value);
+            result[k] = value;
+            k += (j < largeCount) && (large[j] == value);
+        }
+    }
+    else
+    {
+        NSUInteger i = 0, j = 0;
+        while ((i < smallCount) && (j < largeCount))
+        {
+            uint64_t a = small[i];
+            uint64_t b = large[j];
+            result[k] = a;
+            k += (a == b);
+            i += (a <= b);
+            j += (b <= a);
+        }
+    }
+
+    return [[[ECTwitterIDSet alloc] initWithSortedValues:result count:k] autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs that are in either set.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*)setByUnioningSet:(ECTwitterIDSet*)other
+{
+    const uint64_t* values1 = self.values;
+    const uint64_t* values2 = other.values;
+    NSUInteger count1 = self.count;
+    NSUInteger count2 = other.count;
+
+    uint64_t* result = malloc(MAX(count1 + count2, (NSUInteger) 1) * sizeof(uint64_t));
+    NSUInteger i = 0, j = 0, k = 0;
+    while ((i < count1) && (j < count2))
+    {
+        uint64_t a = values1[i];
+        uint64_t b = values2[j];
+        result[k++] = (a < b) ? a : b;
+        i += (a <= b);
+        j += (b <= a);
+    }
+
+    memcpy(result + k, values1 + i, (count1 - i) * sizeof(uint64_t));
+    k += count1 - i;
+    memcpy(result + k, values2 + j, (count2 - j) * sizeof(uint64_t));
+    k += count2 - j;
+
+    return [[[ECTwitterIDSet alloc] initWithSortedValues:result count:k] autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs that are in this set, but not the other one.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*)setBySubtractingSet:(ECTwitterIDSet*)other
+{
+    const uint64_t* values1 = self.values;
+    const uint64_t* values2 = other.values;
+    NSUInteger count1 = self.count;
+    NSUInteger count2 = other.count;
+
+    uint64_t* result = malloc(MAX(count1, (NSUInteger) 1) * sizeof(uint64_t));
+    NSUInteger i = 0, j = 0, k = 0;
+    while ((i < count1) && (j < count2))
+    {
+        uint64_t a = values1[i];
+        uint64_t b = values2[j];
+        result[k] = a;
+        k += (a < b);
+        i += (a <= b);
+        j += (b <= a);
+    }
+
+    memcpy(result + k, values1 + i, (count1 - i) * sizeof(uint64_t));
+    k += count1 - i;
+
+    return [[[ECTwitterIDSet alloc] initWithSortedValues:result count:k] autorelease];
+}
+
+@end
@@ -16,4 +16,10 @@
 
 - (id)initWithContentsOfURL:(NSURL *)url;
 
++ (ECTwitterImage*)decodedImageWithData:(NSData*)data;
+- (NSUInteger)decodedSize;
+
 @end
+
+// Called when an image has been fetched - the image is nil if it couldn't be.
+typedef void (^ECTwitterImageHandler)(ECTwitterImage* image, NSError* error);
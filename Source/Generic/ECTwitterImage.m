@@ -18,6 +18,48 @@
     return self;
 }
 
+// --------------------------------------------------------------------------
+/// Make an image from some data, decompressing it straight away.
+/// Normally this would happen the first time the image is drawn, on the
+/// main thread; doing it here means it can be done in the background.
+// --------------------------------------------------------------------------
+
++ (ECTwitterImage*)decodedImageWithData:(NSData*)data
+{
+    ECTwitterImage* result = nil;
+    UIImage* image = [[UIImage alloc] initWithData:data];
+    CGImageRef imageRef = image.CGImage;
+    if (imageRef)
+    {
+        size_t width = CGImageGetWidth(imageRef);
+        size_t height = CGImageGetHeight(imageRef);
+        CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+        CGContextRef context = CGBitmapContextCreate(NULL, width, height, 8, width * 4, colorSpace, kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
+        CGColorSpaceRelease(colorSpace);
+        if (context)
+        {
+            CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+            CGImageRef decoded = CGBitmapContextCreateImage(context);
+            CGContextRelease(context);
+            result = [[[ECTwitterImage alloc] initWithCGImage:decoded scale:image.scale orientation:image.imageOrientation] autorelease];
+            CGImageRelease(decoded);
+        }
+    }
+    [image release];
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Roughly how much memory the decoded image takes up.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)decodedSize
+{
+    CGImageRef imageRef = self.CGImage;
+    return imageRef ? CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef) : 0;
+}
+
 #else
 
 - (id)initWithContentsOfURL:(NSURL *)url
@@ -25,7 +67,40 @@
     return [super initWithContentsOfURL:url];
 }
 
+// --------------------------------------------------------------------------
+/// Make an image from some data, decompressing it straight away.
+// --------------------------------------------------------------------------
+
++ (ECTwitterImage*)decodedImageWithData:(NSData*)data
+{
+    ECTwitterImage* result = nil;
+    NSBitmapImageRep* rep = [[NSBitmapImageRep alloc] initWithData:data];
+    if (rep && [rep bitmapData])
+    {
+        result = [[[ECTwitterImage alloc] initWithSize:[rep size]] autorelease];
+        [result addRepresentation:rep];
+    }
+    [rep release];
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Roughly how much memory the decoded image takes up.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)decodedSize
+{
+    NSUInteger result = 0;
+    for (NSImageRep* rep in [self representations])
+    {
+        result += [rep pixelsWide] * [rep pixelsHigh] * 4;
+    }
+
+    return result;
+}
+
 #endif
 
 
-@end
\ No newline at end of file
+@end
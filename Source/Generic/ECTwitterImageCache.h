@@ -0,0 +1,57 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterImage.h"
+
+// --------------------------------------------------------------------------
+/// Two level cache of images, keyed by URL.
+///
+/// Decoded images are kept in memory, up to a limit on how much memory
+/// they take up. The downloaded data is also stored on disk, in a file
+/// named after a hash of the URL, so it survives between launches.
+///
+/// Loading happens in the background - reading from disk or downloading,
+/// and then decoding - so the main thread never waits. Disk reads have
+/// a queue of their own, so cached images never wait behind downloads.
+/// If an image is asked for again whilst it's still loading, the request
+/// is added to the one in progress rather than starting another.
+///
+/// The oldest images on disk are thrown away once the disk budget is used
+/// up. We check at startup, and again each time a good fraction of the
+/// budget has been written.
+///
+/// Should only be called from the main thread (the loads in progress
+/// aren't locked); handlers are called on the main thread too.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterImageCache : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic) NSUInteger maxMemoryBytes;
+@property (assign, nonatomic) NSUInteger maxDiskBytes;
+@property (assign, nonatomic) NSUInteger maxConcurrentLoads;
+
+// Statistics.
+@property (assign, nonatomic, readonly) NSUInteger memoryHits;
+@property (assign, nonatomic, readonly) NSUInteger diskHits;
+@property (assign, nonatomic, readonly) NSUInteger downloads;
+@property (assign, nonatomic, readonly) NSUInteger joinedLoads;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url;
+
+- (ECTwitterImage*)cachedImageForURL:(NSURL*)url;
+- (ECTwitterImage*)imageForURL:(NSURL*)url handler:(ECTwitterImageHandler)handler;
+- (void)trimDiskCache;
+- (void)removeAllImages;
+
+@end
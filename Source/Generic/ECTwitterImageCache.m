@@ -0,0 +1,407 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterImageCache.h"
+
+#pragma mark - Private Interface
+
+@interface ECTwitterImageCache()
+
+@property (strong, nonatomic) NSURL* url;
+@property (strong, nonatomic) NSCache* memory;
+@property (strong, nonatomic) NSMutableDictionary* pending;    // only touched on the main thread
+@property (strong, nonatomic) NSOperationQueue* loadQueue;
+@property (assign, nonatomic) dispatch_queue_t diskQueue;
+@property (assign, nonatomic) NSUInteger bytesWritten;         // only touched on the disk queue
+@property (assign, nonatomic, readwrite) NSUInteger memoryHits;
+@property (assign, nonatomic, readwrite) NSUInteger diskHits;
+@property (assign, nonatomic, readwrite) NSUInteger downloads;
+@property (assign, nonatomic, readwrite) NSUInteger joinedLoads;
+
+- (NSURL*)fileForURL:(NSURL*)url;
+- (void)downloadURL:(NSURL*)url toFile:(NSURL*)file;
+- (void)writeData:(NSData*)data toFile:(NSURL*)file;
+- (void)trimFilesToBytes:(NSUInteger)maxBytes;
+- (void)finishLoadingURL:(NSURL*)url image:(ECTwitterImage*)image error:(NSError*)error fromDisk:(BOOL)fromDisk;
+
+@end
+
+@implementation ECTwitterImageCache
+
+#pragma mark - Debug Channels
+
+ECDefineDebugChannel(TwitterImageCacheChannel);
+
+#pragma mark - Properties
+
+@synthesize bytesWritten = _bytesWritten;
+@synthesize diskHits = _diskHits;
+@synthesize diskQueue = _diskQueue;
+@synthesize downloads = _downloads;
+@synthesize joinedLoads = _joinedLoads;
+@synthesize loadQueue = _loadQueue;
+@synthesize maxDiskBytes = _maxDiskBytes;
+@synthesize memory = _memory;
+@synthesize memoryHits = _memoryHits;
+@synthesize pending = _pending;
+@synthesize url = _url;
+
+#pragma mark - Constants
+
+static NSString *const kErrorDomain = @"ECTwitterImageCache";
+
+static const NSUInteger kDefaultMaxMemoryBytes = 8 * 1024 * 1024;
+static const NSUInteger kDefaultMaxDiskBytes = 32 * 1024 * 1024;
+static const NSUInteger kDefaultMaxConcurrentLoads = 4;
+static const NSUInteger kTrimFraction = 8;
+static const NSTimeInterval kDownloadTimeout = 30.0;
+
+#pragma mark - Lifecycle
+
+// --------------------------------------------------------------------------
+/// Set up a cache which stores its images in the given folder.
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url
+{
+    if ((self = [super init]) != nil)
+    {
+        self.url = url;
+        self.pending = [NSMutableDictionary dictionary];
+        self.diskQueue = dispatch_queue_create("com.elegantchaos.ectwitter.imagecache", DISPATCH_QUEUE_SERIAL);
+
+        NSCache* memory = [[NSCache alloc] init];
+        self.memory = memory;
+        [memory release];
+
+        NSOperationQueue* loadQueue = [[NSOperationQueue alloc] init];
+        self.loadQueue = loadQueue;
+        [loadQueue release];
+
+        self.maxMemoryBytes = kDefaultMaxMemoryBytes;
+        self.maxDiskBytes = kDefaultMaxDiskBytes;
+        self.maxConcurrentLoads = kDefaultMaxConcurrentLoads;
+
+        NSError* error = nil;
+        if (![[NSFileManager defaultManager] createDirectoryAtURL:url withIntermediateDirectories:YES attributes:nil error:&error])
+        {
+            ECDebug(TwitterImageCacheChannel, @"couldn't make image cache folder %@", error);
+        }
+
+        [self trimDiskCache];
+    }
+
+    return self;
+}
+
+// --------------------------------------------------------------------------
+/// Clean up.
+// --------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    [_loadQueue cancelAllOperations];
+    dispatch_release(_diskQueue);
+    [_loadQueue release];
+    [_memory release];
+    [_pending release];
+    [_url release];
+
+    [super dealloc];
+}
+
+#pragma mark - Limits
+
+- (NSUInteger)maxMemoryBytes
+{
+    return self.memory.totalCostLimit;
+}
+
+- (void)setMaxMemoryBytes:(NSUInteger)maxMemoryBytes
+{
+    self.memory.totalCostLimit = maxMemoryBytes;
+}
+
+- (NSUInteger)maxConcurrentLoads
+{
+    return (NSUInteger) self.loadQueue.maxConcurrentOperationCount;
+}
+
+- (void)setMaxConcurrentLoads:(NSUInteger)maxConcurrentLoads
+{
+    self.loadQueue.maxConcurrentOperationCount = (NSInteger) maxConcurrentLoads;
+}
+
+#pragma mark - Images
+
+// --------------------------------------------------------------------------
+/// Return the file to use for an image.
+// --------------------------------------------------------------------------
+
+- (NSURL*)fileForURL:(NSURL*)url
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const char* bytes = [[url absoluteString] UTF8String];
+    while (*bytes)
+    {
+        hash ^= (uint8_t) *bytes++;
+        hash *= 1099511628211ULL;
+    }
+
+    NSString* name = [NSString stringWithFormat:@"%016llx.image", (unsigned long long) hash];
+    return [self.url URLByAppendingPathComponent:name];
+}
+
+// --------------------------------------------------------------------------
+/// Return an image if it's already in memory, or nil if it isn't.
+/// Never blocks, and doesn't start loading the image.
+// --------------------------------------------------------------------------
+
+- (ECTwitterImage*)cachedImageForURL:(NSURL*)url
+{
+    return url ? [self.memory objectForKey:url] : nil;
+}
+
+// --------------------------------------------------------------------------
+/// Fetch an image.
+/// If it's in memory, the handler is called (if there is one) and the image
+/// is returned straight away. Otherwise we return nil, and call the
+/// handler once the image has been loaded.
+// --------------------------------------------------------------------------
+
+- (ECTwitterImage*)imageForURL:(NSURL*)url handler:(ECTwitterImageHandler)handler
+{
+    ECTwitterImage* image = [self cachedImageForURL:url];
+    if (image || !url)
+    {
+        if (image)
+        {
+            ++self.memoryHits;
+        }
+        if (handler)
+        {
+            handler(image, nil);
+        }
+
+        return image;
+    }
+
+    ECAssert([NSThread isMainThread]);
+    NSMutableArray* handlers = [self.pending objectForKey:url];
+    if (handlers)
+    {
+        ECDebug(TwitterImageCacheChannel, @"joining load in progress for %@", url);
+        ++self.joinedLoads;
+    }
+    else
+    {
+        handlers = [NSMutableArray array];
+        [self.pending setObject:handlers forKey:url];
+
+        // we look on disk first - on its own queue, so that cached images
+        // never wait behind slow downloads - and only download if it's not there
+        NSURL* file = [self fileForURL:url];
+        dispatch_async(self.diskQueue, ^{
+            NSData* data = [NSData dataWithContentsOfURL:file];
+            ECTwitterImage* loaded = data ? [ECTwitterImage decodedImageWithData:data] : nil;
+            if (loaded)
+            {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    [self finishLoadingURL:url image:loaded error:nil fromDisk:YES];
+                });
+            }
+            else
+            {
+                if (data)
+                {
+                    ECDebug(TwitterImageCacheChannel, @"image file for %@ is damaged", url);
+                    [[NSFileManager defaultManager] removeItemAtURL:file error:nil];
+                }
+                [self downloadURL:url toFile:file];
+            }
+        });
+    }
+
+    if (handler)
+    {
+        ECTwitterImageHandler copied = [handler copy];
+        [handlers addObject:copied];
+        [copied release];
+    }
+
+    return nil;
+}
+
+// --------------------------------------------------------------------------
+/// Download an image, and store it on disk if it's any good.
+// --------------------------------------------------------------------------
+
+- (void)downloadURL:(NSURL*)url toFile:(NSURL*)file
+{
+    [self.loadQueue addOperationWithBlock:^{
+        NSError* error = nil;
+        NSURLRequest* request = [NSURLRequest requestWithURL:url cachePolicy:NSURLRequestReloadIgnoringLocalCacheData timeoutInterval:kDownloadTimeout];
+        NSURLResponse* response = nil;
+        NSData* data = [NSURLConnection sendSynchronousRequest:request returningResponse:&response error:&error];
+        if ([response isKindOfClass:[NSHTTPURLResponse class]])
+        {
+            NSInteger status = [(NSHTTPURLResponse*) response statusCode];
+            if (status != 200)
+            {
+                error = [NSError errorWithDomain:kErrorDomain code:status userInfo:nil];
+                data = nil;
+            }
+        }
+
+        ECTwitterImage* loaded = data ? [ECTwitterImage decodedImageWithData:data] : nil;
+        if (loaded)
+        {
+            [self writeData:data toFile:file];
+        }
+
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self finishLoadingURL:url image:loaded error:error fromDisk:NO];
+        });
+    }];
+}
+
+// --------------------------------------------------------------------------
+/// Store downloaded data on disk, in the background.
+/// Once a good fraction of our budget has been written, we trim.
+// --------------------------------------------------------------------------
+
+- (void)writeData:(NSData*)data toFile:(NSURL*)file
+{
+    NSUInteger maxBytes = self.maxDiskBytes;
+    dispatch_async(self.diskQueue, ^{
+        if ([data writeToURL:file atomically:YES])
+        {
+            self.bytesWritten += [data length];
+            if (self.bytesWritten > maxBytes / kTrimFraction)
+            {
+                [self trimFilesToBytes:maxBytes];
+            }
+        }
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Called on the main thread when an image has finished loading.
+// --------------------------------------------------------------------------
+
+- (void)finishLoadingURL:(NSURL*)url image:(ECTwitterImage*)image error:(NSError*)error fromDisk:(BOOL)fromDisk
+{
+    NSArray* handlers = [[self.pending objectForKey:url] retain];
+    [self.pending removeObjectForKey:url];
+
+    if (image)
+    {
+        [self.memory setObject:image forKey:url cost:[image decodedSize]];
+        if (fromDisk)
+        {
+            ++self.diskHits;
+        }
+        else
+        {
+            ++self.downloads;
+        }
+    }
+    else
+    {
+        ECDebug(TwitterImageCacheChannel, @"failed to load image %@: %@", url, error);
+    }
+
+    for (ECTwitterImageHandler handler in handlers)
+    {
+        handler(image, error);
+    }
+    [handlers release];
+}
+
+// --------------------------------------------------------------------------
+/// Throw away the oldest images on disk, until we're within our budget.
+/// Happens in the background.
+// --------------------------------------------------------------------------
+
+- (void)trimDiskCache
+{
+    NSUInteger maxBytes = self.maxDiskBytes;
+    dispatch_async(self.diskQueue, ^{
+        [self trimFilesToBytes:maxBytes];
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Do the work of trimming the disk cache.
+/// Must be called on the disk queue.
+// --------------------------------------------------------------------------
+
+- (void)trimFilesToBytes:(NSUInteger)maxBytes
+{
+    NSFileManager* fm = [NSFileManager defaultManager];
+    NSArray* keys = [NSArray arrayWithObjects:NSURLContentModificationDateKey, NSURLFileSizeKey, nil];
+    NSArray* files = [fm contentsOfDirectoryAtURL:self.url includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+
+    NSUInteger total = 0;
+    NSMutableArray* entries = [NSMutableArray arrayWithCapacity:[files count]];
+    for (NSURL* file in files)
+    {
+        NSDictionary* values = [file resourceValuesForKeys:keys error:nil];
+        NSDate* modified = [values objectForKey:NSURLContentModificationDateKey];
+        NSNumber* size = [values objectForKey:NSURLFileSizeKey];
+        if (modified && size)
+        {
+            total += [size unsignedIntegerValue];
+            [entries addObject:[NSArray arrayWithObjects:modified, size, file, nil]];
+        }
+    }
+
+    if (total > maxBytes)
+    {
+        [entries sortUsingComparator:^NSComparisonResult(NSArray* e1, NSArray* e2) {
+            return [[e1 objectAtIndex:0] compare:[e2 objectAtIndex:0]];
+        }];
+
+        NSUInteger removed = 0;
+        for (NSArray* entry in entries)
+        {
+            if (total <= maxBytes)
+            {
+                break;
+            }
+
+            if ([fm removeItemAtURL:[entry objectAtIndex:2] error:nil])
+            {
+                total -= [[entry objectAtIndex:1] unsignedIntegerValue];
+                ++removed;
+            }
+        }
+        ECDebug(TwitterImageCacheChannel, @"trimmed %ld images from disk cache", (long) removed);
+    }
+
+    self.bytesWritten = 0;
+}
+
+// --------------------------------------------------------------------------
+/// Throw away everything.
+// --------------------------------------------------------------------------
+
+- (void)removeAllImages
+{
+    [self.memory removeAllObjects];
+
+    NSURL* url = self.url;
+    dispatch_async(self.diskQueue, ^{
+        NSFileManager* fm = [NSFileManager defaultManager];
+        NSArray* files = [fm contentsOfDirectoryAtURL:url includingPropertiesForKeys:nil options:0 error:nil];
+        for (NSURL* file in files)
+        {
+            [fm removeItemAtURL:file error:nil];
+        }
+    });
+}
+
+@end
@@ -0,0 +1,301 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#include "ECTwitterLZ.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------
+// Format
+//
+// A block is a list of sequences. Each one is a token byte - the number of
+// literals in the top four bits, the match length (less kMinMatch) in the
+// bottom four - then any extra length bytes for the literals, the literals
+// themselves, a two byte little-endian offset back to the match, and any
+// extra length bytes for the match. A length of 15 in the token means more
+// bytes follow, each added on, until one that isn't 255.
+//
+// The last sequence is just literals. To keep the format's guarantees,
+// the last kLastLiterals bytes are always literals, and no match starts
+// within kMatchLimit bytes of the end.
+// --------------------------------------------------------------------------
+
+static const size_t kMinMatch = 4;
+static const size_t kLastLiterals = 5;
+static const size_t kMatchLimit = 12;
+static const size_t kMaxOffset = 65535;
+
+#define kHashBits 12
+
+// --------------------------------------------------------------------------
+// Helpers
+// --------------------------------------------------------------------------
+
+static inline uint32_t read32(const uint8_t* bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t value)
+{
+    return (value * 2654435761U) >> (32 - kHashBits);
+}
+
+// --------------------------------------------------------------------------
+/// Write the extra bytes for a length that didn't fit in its token.
+/// Returns NULL if we ran out of room.
+// --------------------------------------------------------------------------
+
+static uint8_t* writeLength(uint8_t* output, const uint8_t* end, size_t length)
+{
+    while (length >= 255)
+    {
+        if (output >= end)
+        {
+            return NULL;
+        }
+        *output++ = 255;
+        length -= 255;
+    }
+
+    if (output >= end)
+    {
+        return NULL;
+    }
+    *output++ = (uint8_t) length;
+
+    return output;
+}
+
+// --------------------------------------------------------------------------
+/// Write out a sequence. A match length of zero means this is the last
+/// sequence, which has no match.
+/// Returns NULL if we ran out of room.
+// --------------------------------------------------------------------------
+
+static uint8_t* writeSequence(uint8_t* output, const uint8_t* end, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+    if (output >= end)
+    {
+        return NULL;
+    }
+
+    size_t extraMatch = matchLength ? matchLength - kMinMatch : 0;
+    uint8_t* token = output++;
+    *token = (uint8_t) (((literalLength < 15 ? literalLength : 15) << 4) | (extraMatch < 15 ? extraMatch : 15));
+
+    if (literalLength >= 15)
+    {
+        output = writeLength(output, end, literalLength - 15);
+        if (!output)
+        {
+            return NULL;
+        }
+    }
+
+    if ((size_t) (end - output) < literalLength)
+    {
+        return NULL;
+    }
+    memcpy(output, literals, literalLength);
+    output += literalLength;
+
+    if (matchLength)
+    {
+        if (end - output < 2)
+        {
+            return NULL;
+        }
+        *output++ = (uint8_t) (offset & 0xFF);
+        *output++ = (uint8_t) (offset >> 8);
+
+        if (extraMatch >= 15)
+        {
+            output = writeLength(output, end, extraMatch - 15);
+        }
+    }
+
+    return output;
+}
+
+// --------------------------------------------------------------------------
+/// Read the extra bytes for a length, adding them on.
+/// Returns zero if the block ends first, or the length is absurd.
+// --------------------------------------------------------------------------
+
+static int readLength(const uint8_t** input, const uint8_t* end, size_t* length)
+{
+    unsigned byte;
+    do
+    {
+        if (*input >= end)
+        {
+            return 0;
+        }
+        byte = *(*input)++;
+        *length += byte;
+        if (*length > (SIZE_MAX >> 1))
+        {
+            return 0;
+        }
+    } while (byte == 255);
+
+    return 1;
+}
+
+// --------------------------------------------------------------------------
+// Public Functions
+// --------------------------------------------------------------------------
+
+size_t ECTwitterLZCompressBound(size_t length)
+{
+    return length + (length / 255) + 16;
+}
+
+// --------------------------------------------------------------------------
+/// Compress a block.
+///
+/// We hash every four bytes we look at, and check the last place that
+/// the same hash was seen for a match. The further we go without finding
+/// one, the bigger the steps we take, so incompressible data goes through
+/// quickly.
+// --------------------------------------------------------------------------
+
+size_t ECTwitterLZCompress(const void* source, size_t length, void* destination, size_t capacity)
+{
+    const uint8_t* start = source;
+    const uint8_t* anchor = start;
+    uint8_t* output = destination;
+    const uint8_t* end = output + capacity;
+
+    if (length > kMatchLimit)
+    {
+        uint32_t table[1 << kHashBits];
+        memset(table, 0, sizeof(table));
+
+        const uint8_t* matchEnd = start + length - kLastLiterals;
+        const uint8_t* searchEnd = start + length - kMatchLimit;
+        const uint8_t* input = start + 1;
+        while (input <= searchEnd)
+        {
+            uint32_t sequence = read32(input);
+            uint32_t hash = hash32(sequence);
+            const uint8_t* candidate = start + table[hash];
+            table[hash] = (uint32_t) (input - start);
+
+            if ((candidate < input) && ((size_t) (input - candidate) <= kMaxOffset) && (read32(candidate) == sequence))
+            {
+                // the match may well have started earlier than where we spotted it
+                while ((input > anchor) && (candidate > start) && (input[-1] == candidate[-1]))
+                {
+                    --input;
+                    --candidate;
+                }
+
+                const uint8_t* matchInput = input + kMinMatch;
+                const uint8_t* matchCandidate = candidate + kMinMatch;
+                while ((matchInput < matchEnd) && (*matchInput == *matchCandidate))
+                {
+                    ++matchInput;
+                    ++matchCandidate;
+                }
+
+                output = writeSequence(output, end, anchor, (size_t) (input - anchor), (size_t) (input - candidate), (size_t) (matchInput - input));
+                if (!output)
+                {
+                    return 0;
+                }
+
+                // remember somewhere near the end of the match, since the
+                // next match is quite likely to be from around there
+                table[hash32(read32(matchInput - 2))] = (uint32_t) (matchInput - 2 - start);
+                input = anchor = matchInput;
+            }
+            else
+            {
+                input += 1 + ((size_t) (input - anchor) >> 6);
+            }
+        }
+    }
+
+    output = writeSequence(output, end, anchor, (size_t) (start + length - anchor), 0, 0);
+
+    return output ? (size_t) (output - (uint8_t*) destination) : 0;
+}
+
+// --------------------------------------------------------------------------
+/// Decompress a block.
+/// Everything is bounds checked, so corrupt input fails rather than
+/// reading or writing out of range.
+// --------------------------------------------------------------------------
+
+int ECTwitterLZDecompress(const void* source, size_t length, void* destination, size_t originalLength)
+{
+    const uint8_t* input = source;
+    const uint8_t* inputEnd = input + length;
+    uint8_t* output = destination;
+    uint8_t* outputStart = output;
+    uint8_t* outputEnd = output + originalLength;
+
+    while (input < inputEnd)
+    {
+        unsigned token = *input++;
+
+        size_t literalLength = token >> 4;
+        if ((literalLength == 15) && !readLength(&input, inputEnd, &literalLength))
+        {
+            return 0;
+        }
+        if (((size_t) (inputEnd - input) < literalLength) || ((size_t) (outputEnd - output) < literalLength))
+        {
+            return 0;
+        }
+        memcpy(output, input, literalLength);
+        input += literalLength;
+        output += literalLength;
+
+        if (input == inputEnd)
+        {
+            // the last sequence has no match
+            break;
+        }
+
+        if (inputEnd - input < 2)
+        {
+            return 0;
+        }
+        size_t offset = (size_t) input[0] | ((size_t) input[1] << 8);
+        input += 2;
+        if ((offset == 0) || (offset > (size_t) (output - outputStart)))
+        {
+            return 0;
+        }
+
+        size_t matchLength = token & 15;
+        if ((matchLength == 15) && !readLength(&input, inputEnd, &matchLength))
+        {
+            return 0;
+        }
+        matchLength += kMinMatch;
+        if ((size_t) (outputEnd - output) < matchLength)
+        {
+            return 0;
+        }
+
+        // the match can overlap what it's writing, so this has to go a byte at a time
+        const uint8_t* match = output - offset;
+        while (matchLength--)
+        {
+            *output++ = *match++;
+        }
+    }
+
+    return output == outputEnd;
+}
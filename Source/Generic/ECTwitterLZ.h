@@ -0,0 +1,43 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#ifndef ECTwitterLZ_h
+#define ECTwitterLZ_h
+
+#include <stddef.h>
+
+// --------------------------------------------------------------------------
+/// A small, self contained LZ77 block compressor.
+///
+/// The output is in the LZ4 block format, so it can be checked against
+/// (or swapped for) the reference implementation, but there's nothing
+/// here apart from the C library - no framing, no streaming, no
+/// dictionaries. It's built for speed rather than ratio: a single pass,
+/// a small hash table on the stack, and a decoder which is just copies.
+///
+/// Safe to call from any number of threads at once.
+// --------------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// The most that compressing a block of the given length can produce.
+size_t ECTwitterLZCompressBound(size_t length);
+
+/// Compress a block, returning the compressed length,
+/// or zero if it wouldn't fit in the capacity given.
+size_t ECTwitterLZCompress(const void* source, size_t length, void* destination, size_t capacity);
+
+/// Decompress a block into a buffer of exactly the original length.
+/// Returns zero if the block is malformed, or doesn't fill the buffer exactly.
+int ECTwitterLZDecompress(const void* source, size_t length, void* destination, size_t originalLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
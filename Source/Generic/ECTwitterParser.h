@@ -13,11 +13,16 @@
 {
 	__weak id<MGTwitterEngineDelegate>  mDelegate;
 	MGTwitterEngineDeliveryOptions      mOptions;
+	struct yajl_handle_t*               mHandle;
+	struct ECTwitterParserKey*          mKeys;
 }
 
 - (id)initWithDelegate:(id<MGTwitterEngineDelegate>)theDelegate options:(MGTwitterEngineDeliveryOptions)options;
 
 - (void)parseData:(NSData*)data identifier:(NSString*)identifier;
 
+- (void)beginParsingWithIdentifier:(NSString*)identifier;
+- (BOOL)parseChunk:(NSData*)data;
+- (void)finishParsing;
 
 @end
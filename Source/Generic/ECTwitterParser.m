@@ -8,6 +8,7 @@
 // --------------------------------------------------------------------------
 
 #import "ECTwitterParser.h"
+#import "ECTwitterParsing.h"
 
 #include <yajl/yajl_parse.h>
 
@@ -18,14 +19,23 @@
 @property (strong, nonatomic) NSString* currentKey;
 @property (strong, nonatomic) NSString* identifier;
 @property (strong, nonatomic) NSMutableArray* parsedObjects;
+@property (strong, nonatomic) NSMutableArray* batchedObjects;
 @property (strong, nonatomic) NSMutableArray* stack;
+@property (strong, nonatomic) NSMutableData* pending;
+@property (assign, nonatomic) BOOL failed;
+@property (assign, nonatomic) BOOL streamingRootArray;
 
 - (void)parseSimpleData:(NSData*)data;
 - (void)parseJSONData:(NSData*)data;
+- (void)startJSONParser;
+- (void)stopJSONParser;
+- (void)reportError:(yajl_status)status data:(NSData*)data;
+- (NSString*)keyWithBytes:(const unsigned char*)bytes length:(NSUInteger)length;
 
 - (void)addValue:(id)value;
 
 - (void)parsedObject:(NSDictionary *)dictionary;
+- (void)deliverBatchedObjects;
 
 
 @end
@@ -48,7 +58,38 @@ ECDefineDebugChannel(MGTwitterEngineParsingChannel);
 @synthesize currentKey;
 @synthesize identifier;
 @synthesize parsedObjects;
+@synthesize batchedObjects;
 @synthesize stack;
+@synthesize pending;
+@synthesize failed;
+@synthesize streamingRootArray;
+
+// --------------------------------------------------------------------------
+#pragma mark - Constants
+// --------------------------------------------------------------------------
+
+static const NSUInteger kSimpleDataLimit = 5; // responses this short are not legal JSON, and need special handling
+
+static const NSUInteger kInternedKeyCount = 256; // must be a power of two
+static const NSUInteger kInternedKeyProbes = 8;
+static const NSUInteger kInternedKeyMaxLength = 40;
+
+// --------------------------------------------------------------------------
+#pragma mark - Types
+// --------------------------------------------------------------------------
+
+// A response is mostly made up of the same few dozen keys, repeated for
+// every tweet or user in it. We keep one string for each distinct key,
+// so that we don't have to make a new one each time, and so that all of 
+// the dictionaries we build end up sharing them.
+
+struct ECTwitterParserKey
+{
+    NSUInteger      hash;
+    NSUInteger      length;
+    unsigned char   bytes[kInternedKeyMaxLength];
+    NSString*       key;
+};
 
 // --------------------------------------------------------------------------
 #pragma mark - Prototypes
@@ -106,11 +147,27 @@ static yajl_callbacks callbacks = {
 
 - (void)dealloc
 {
+    if (mHandle)
+    {
+        yajl_free(mHandle);
+    }
+    
+    if (mKeys)
+    {
+        for (NSUInteger n = 0; n < kInternedKeyCount; ++n)
+        {
+            [mKeys[n].key release];
+        }
+        free(mKeys);
+    }
+    
     [currentDictionary release];
     [currentArray release];
     [currentKey release];
     [identifier release];
     [parsedObjects release];
+    [batchedObjects release];
+    [pending release];
     [stack release];
 	
 	mDelegate = nil;
@@ -121,11 +178,26 @@ static yajl_callbacks callbacks = {
 
 // --------------------------------------------------------------------------
 /// Parse some data.
+/// This is equivalent to streaming it all in as a single chunk.
 // --------------------------------------------------------------------------
 
 - (void)parseData:(NSData*)data identifier:(NSString*)identifierIn
+{
+    [self beginParsingWithIdentifier:identifierIn];
+    [self parseChunk:data];
+    [self finishParsing];
+}
+
+// --------------------------------------------------------------------------
+/// Prepare to receive a response in chunks.
+// --------------------------------------------------------------------------
+
+- (void)beginParsingWithIdentifier:(NSString*)identifierIn
 {
     self.identifier = identifierIn;
+    self.failed = NO;
+    self.streamingRootArray = NO;
+    self.pending = [NSMutableData dataWithCapacity:kSimpleDataLimit + 1];
     
     if (mOptions & MGTwitterEngineDeliveryAllResultsOption)
     {
@@ -133,18 +205,85 @@ static yajl_callbacks callbacks = {
         self.parsedObjects = parsed;
         [parsed release];
     }
+
+    if ((mOptions & MGTwitterEngineDeliveryIndividualResultsOption) && [mDelegate respondsToSelector:@selector(receivedObjects:forRequest:)])
+    {
+        NSMutableArray* batched = [[NSMutableArray alloc] initWithCapacity:0];
+        self.batchedObjects = batched;
+        [batched release];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Parse the next chunk of a response.
+/// We hold on to the first few bytes until we know whether the response is
+/// proper JSON or one of the short special cases. After that, each chunk is 
+/// handed straight to yajl and thrown away.
+/// Any individual results that the chunk completed are delivered together 
+/// at the end of it.
+/// Returns NO if the parse has failed.
+// --------------------------------------------------------------------------
+
+- (BOOL)parseChunk:(NSData*)data
+{
+    if (!self.failed)
+    {
+        if (!mHandle)
+        {
+            [self.pending appendData:data];
+            if ([self.pending length] > kSimpleDataLimit)
+            {
+                [self startJSONParser];
+                [self parseJSONData:self.pending];
+                self.pending = nil;
+            }
+        }
+        else
+        {
+            [self parseJSONData:data];
+        }
+        [self deliverBatchedObjects];
+    }
     
-    if ([data length] <= 5)
+    return !self.failed;
+}
+
+// --------------------------------------------------------------------------
+/// Finish parsing the response, and report the results.
+/// The delegate is told that the request succeeded only once we know 
+/// that all of it parsed; if it didn't, it will have been told that the
+/// request failed instead.
+// --------------------------------------------------------------------------
+
+- (void)finishParsing
+{
+    if (mHandle)
     {
-        [self parseSimpleData:data];
+        if (!self.failed)
+        {
+            yajl_status status = yajl_parse_complete(mHandle);
+            if (status != yajl_status_ok)
+            {
+                [self reportError:status data:nil];
+            }
+        }
+        [self stopJSONParser];
     }
-    else
+    else if (self.pending)
     {
-        [self parseJSONData:data];
+        [self parseSimpleData:self.pending];
     }
+    self.pending = nil;
     
     // notify the delegate that parsing completed
-    [mDelegate genericResultsReceived:self.parsedObjects forRequest:self.identifier];
+    if (!self.failed)
+    {
+        [self deliverBatchedObjects];
+        [mDelegate requestSucceeded:self.identifier];
+        [mDelegate genericResultsReceived:self.parsedObjects forRequest:self.identifier];
+    }
+    self.parsedObjects = nil;
+    self.batchedObjects = nil;
 }
 
 // --------------------------------------------------------------------------
@@ -178,10 +317,10 @@ static yajl_callbacks callbacks = {
 }
 
 // --------------------------------------------------------------------------
-/// Parse proper JSON.
+/// Set up the yajl parser.
 // --------------------------------------------------------------------------
 
-- (void)parseJSONData:(NSData*)data
+- (void)startJSONParser
 {
     self.stack = [NSMutableArray array];
     
@@ -190,26 +329,55 @@ static yajl_callbacks callbacks = {
         0, // allowComments: if nonzero, javascript style comments will be allowed in the input (both /* */ and //)
         0  // checkUTF8: if nonzero, invalid UTF8 strings will cause a parse error
     };
-    yajl_handle handle = yajl_alloc(&callbacks, &cfg, NULL, self);
-    if (handle)
+    mHandle = yajl_alloc(&callbacks, &cfg, NULL, self);
+}
+
+// --------------------------------------------------------------------------
+/// Clean up the yajl parser.
+// --------------------------------------------------------------------------
+
+- (void)stopJSONParser
+{
+    if (mHandle)
     {
-        yajl_status status = yajl_parse(handle, [data bytes], (unsigned int) [data length]);
-        if (status != yajl_status_insufficient_data && status != yajl_status_ok)
-        {
-            unsigned char *errorMessage = yajl_get_error(handle, 0, [data bytes], (unsigned int) [data length]);
-            ECDebug(MGTwitterEngineParsingChannel, @"MGTwitterYAJLParser: error = %s", errorMessage);
-            NSError* error = [NSError errorWithDomain:@"YAJL" code:status userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithUTF8String:(char *)errorMessage] forKey:@"errorMessage"]];
-            [mDelegate requestFailed:self.identifier withError:error];
-            yajl_free_error(handle, errorMessage);
-        }
-        
-        // free the yajl parser
-        yajl_free(handle);
+        yajl_free(mHandle);
+        mHandle = NULL;
     }
     
     self.stack = nil;
     self.currentDictionary = nil;
     self.currentArray = nil;
+    self.currentKey = nil;
+}
+
+// --------------------------------------------------------------------------
+/// Parse proper JSON.
+// --------------------------------------------------------------------------
+
+- (void)parseJSONData:(NSData*)data
+{
+    if (mHandle)
+    {
+        yajl_status status = yajl_parse(mHandle, [data bytes], (unsigned int) [data length]);
+        if (status != yajl_status_insufficient_data && status != yajl_status_ok)
+        {
+            [self reportError:status data:data];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Report a parsing error to the delegate.
+// --------------------------------------------------------------------------
+
+- (void)reportError:(yajl_status)status data:(NSData*)data
+{
+    unsigned char *errorMessage = yajl_get_error(mHandle, 0, [data bytes], (unsigned int) [data length]);
+    ECDebug(MGTwitterEngineParsingChannel, @"MGTwitterYAJLParser: error = %s", errorMessage);
+    NSError* error = [NSError errorWithDomain:@"YAJL" code:status userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithUTF8String:(char *)errorMessage] forKey:@"errorMessage"]];
+    [mDelegate requestFailed:self.identifier withError:error];
+    yajl_free_error(mHandle, errorMessage);
+    self.failed = YES;
 }
 
 #pragma mark - Parsing Stack
@@ -277,7 +445,13 @@ static yajl_callbacks callbacks = {
 - (void)addValue:(id)value
 {
     
-    if (self.currentArray)
+    if (self.streamingRootArray && self.currentArray && ([self.stack count] == 0))
+    {
+        // items in a top level array are handed out one by one as soon as they're complete
+        ECDebug(MGTwitterEngineParsingChannel, @"root array item: %@ (%@)", value, [value class]);
+        [self parsedObject:value];
+    }
+    else if (self.currentArray)
     {
         ECDebug(MGTwitterEngineParsingChannel, @"added item: %@ (%@) to array", value, [value class]);
         [self.currentArray addObject:value];
@@ -305,13 +479,64 @@ static yajl_callbacks callbacks = {
     self.currentKey = nil;
 }
 
+// --------------------------------------------------------------------------
+/// Return a string for a key.
+/// If we've seen the key before, we return the same string as last time.
+// --------------------------------------------------------------------------
+
+- (NSString*)keyWithBytes:(const unsigned char*)bytes length:(NSUInteger)length
+{
+    if (length <= kInternedKeyMaxLength)
+    {
+        if (!mKeys)
+        {
+            mKeys = calloc(kInternedKeyCount, sizeof(struct ECTwitterParserKey));
+        }
+        
+        // FNV-1a
+        NSUInteger hash = 2166136261U;
+        for (NSUInteger n = 0; n < length; ++n)
+        {
+            hash = (hash ^ bytes[n]) * 16777619U;
+        }
+        
+        for (NSUInteger probe = 0; probe < kInternedKeyProbes; ++probe)
+        {
+            struct ECTwitterParserKey* entry = &mKeys[(hash + probe) & (kInternedKeyCount - 1)];
+            if (!entry->key)
+            {
+                entry->key = [[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding];
+                entry->hash = hash;
+                entry->length = length;
+                memcpy(entry->bytes, bytes, length);
+                return entry->key;
+            }
+            else if ((entry->hash == hash) && (entry->length == length) && (memcmp(entry->bytes, bytes, length) == 0))
+            {
+                return entry->key;
+            }
+        }
+    }
+    
+    // key is too long or the table is too crowded, so just make a new string
+    return [[[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding] autorelease];
+}
+
 #pragma mark Delegate callbacks
 
 - (void)parsedObject:(NSDictionary *)dictionary
 {
 	if (mOptions & MGTwitterEngineDeliveryIndividualResultsOption)
     {
-        [mDelegate receivedObject:dictionary forRequest:self.identifier];
+        NSMutableArray* batched = self.batchedObjects;
+        if (batched)
+        {
+            [batched addObject:dictionary];
+        }
+        else
+        {
+            [mDelegate receivedObject:dictionary forRequest:self.identifier];
+        }
     }
     else
     {
@@ -319,6 +544,27 @@ static yajl_callbacks callbacks = {
     }
 }
 
+// --------------------------------------------------------------------------
+/// Hand over any individual results that we've been saving up.
+/// If the parse has failed, the delegate has already been told, so 
+/// they're just thrown away.
+// --------------------------------------------------------------------------
+
+- (void)deliverBatchedObjects
+{
+    NSMutableArray* batched = self.batchedObjects;
+    if ([batched count] > 0)
+    {
+        NSArray* objects = [batched copy];
+        [batched removeAllObjects];
+        if (!self.failed)
+        {
+            [mDelegate receivedObjects:objects forRequest:self.identifier];
+        }
+        [objects release];
+    }
+}
+
 #pragma mark - YAJL Callbacks
 
 int process_yajl_null(void *ctx)
@@ -363,35 +609,17 @@ int process_yajl_string(void *ctx, const unsigned char * stringVal, unsigned int
 {
 	ECTwitterParser* parser = ctx;
 	
-    NSMutableString *value = [[[NSMutableString alloc] initWithBytes:stringVal length:stringLen encoding:NSUTF8StringEncoding] autorelease];
-    
-    [value replaceOccurrencesOfString:@"&gt;" withString:@">" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
-    [value replaceOccurrencesOfString:@"&lt;" withString:@"<" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
-    [value replaceOccurrencesOfString:@"&amp;" withString:@"&" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
-    [value replaceOccurrencesOfString:@"&quot;" withString:@"\"" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
-    
     if ([parser.currentKey isEqualToString:@"created_at"])
     {
         // we have a priori knowledge that the value for created_at is a date, not a string
-        struct tm theTime;
-        if ([value hasSuffix:@"+0000"])
-        {
-            // format for Search API: "Fri, 06 Feb 2009 07:28:06 +0000"
-            strptime([value UTF8String], "%a, %d %b %Y %H:%M:%S +0000", &theTime);
-        }
-        else
-        {
-            // format for REST API: "Thu Jan 15 02:04:38 +0000 2009"
-            strptime([value UTF8String], "%a %b %d %H:%M:%S +0000 %Y", &theTime);
-        }
-        time_t epochTime = timegm(&theTime);
         // save the date as a long with the number of seconds since the epoch in 1970
-        [parser addValue:[NSNumber numberWithLong:epochTime]];
         // this value can be converted to a date with [NSDate dateWithTimeIntervalSince1970:epochTime]
+        NSTimeInterval epochTime = ECTwitterTimeFromBytes((const char*) stringVal, stringLen);
+        [parser addValue:[NSNumber numberWithLong:(long) epochTime]];
     }
     else
     {
-        [parser addValue:value];
+        [parser addValue:ECTwitterStringWithEntitiesDecoded(stringVal, stringLen)];
     }
     
     return 1;
@@ -400,9 +628,7 @@ int process_yajl_string(void *ctx, const unsigned char * stringVal, unsigned int
 int process_yajl_map_key(void *ctx, const unsigned char * stringVal, unsigned int stringLen)
 {
 	ECTwitterParser* parser = ctx;
-    NSString* newKey = [[NSString alloc] initWithBytes:stringVal length:stringLen encoding:NSUTF8StringEncoding];
-	parser.currentKey = newKey;
-    [newKey release];
+	parser.currentKey = [parser keyWithBytes:stringVal length:stringLen];
     
     return 1;
 }
@@ -442,6 +668,11 @@ int process_yajl_start_array(void *ctx)
 
 	
 	NSMutableArray* newArray = [NSMutableArray array];
+    if ((parser->mOptions & MGTwitterEngineDeliveryIndividualResultsOption) && !parser.currentArray && !parser.currentDictionary)
+    {
+        // this is the root array, so deliver its contents individually rather than collecting them
+        parser.streamingRootArray = YES;
+    }
     [parser pushStack];
     parser.currentDictionary = nil;
     parser.currentArray = newArray;
@@ -455,8 +686,17 @@ int process_yajl_end_array(void *ctx)
 	ECDebug(MGTwitterEngineParsingChannel, @"array end %@", parser.currentArray);
 	
     NSMutableArray* array = [parser.currentArray retain];
+    BOOL endOfRoot = parser.streamingRootArray && ([parser.stack count] == 0);
     [parser popStack];
-    [parser addValue:array];
+    if (endOfRoot)
+    {
+        // the items have already been delivered, so there's nothing left to report
+        parser.streamingRootArray = NO;
+    }
+    else
+    {
+        [parser addValue:array];
+    }
     [array release];
 	
     return 1;
@@ -0,0 +1,22 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Low level helpers for turning the raw bytes of a response into values.
+/// These are on the hot path when parsing timelines, so they work directly
+/// on UTF8 bytes, and avoid making intermediate objects.
+// --------------------------------------------------------------------------
+
+// Make a string from UTF8 bytes, decoding the HTML entities that twitter
+// escapes (&gt; &lt; &amp; &quot;) in a single pass.
+// If there's no '&' in the bytes, the string is made from them directly.
+extern NSString* ECTwitterStringWithEntitiesDecoded(const unsigned char* bytes, NSUInteger length);
+
+// Parse a twitter date, in either the REST format ("Thu Jan 15 02:04:38 +0000 2009")
+// or the search format ("Fri, 06 Feb 2009 07:28:06 +0000").
+// Returns the number of seconds since 1970, or 0 if the date couldn't be parsed.
+extern NSTimeInterval ECTwitterTimeFromBytes(const char* bytes, NSUInteger length);
+extern NSTimeInterval ECTwitterTimeFromString(NSString* string);
@@ -0,0 +1,215 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterParsing.h"
+
+#pragma mark - Entities
+
+// --------------------------------------------------------------------------
+/// If the bytes at a given position start with an entity name (ignoring
+/// case), return its length.
+// --------------------------------------------------------------------------
+
+static NSUInteger matchEntity(const unsigned char* bytes, const unsigned char* end, const char* name)
+{
+    NSUInteger length = strlen(name);
+    if ((NSUInteger) (end - bytes) < length)
+    {
+        return 0;
+    }
+
+    for (NSUInteger n = 0; n < length; ++n)
+    {
+        unsigned char c = bytes[n];
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c += 'a' - 'A';
+        }
+        if (c != (unsigned char) name[n])
+        {
+            return 0;
+        }
+    }
+
+    return length;
+}
+
+// --------------------------------------------------------------------------
+/// Make a string from some bytes, decoding entities as we go.
+/// Decoding only ever makes the text shorter, so we can decode into a 
+/// buffer the same size as the input.
+// --------------------------------------------------------------------------
+
+NSString* ECTwitterStringWithEntitiesDecoded(const unsigned char* bytes, NSUInteger length)
+{
+    const unsigned char* amp = memchr(bytes, '&', length);
+    if (!amp)
+    {
+        return [[[NSString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding] autorelease];
+    }
+
+    unsigned char* decoded = malloc(length);
+    NSUInteger prefix = (NSUInteger) (amp - bytes);
+    memcpy(decoded, bytes, prefix);
+    unsigned char* out = decoded + prefix;
+    const unsigned char* in = amp;
+    const unsigned char* end = bytes + length;
+    while (in < end)
+    {
+        unsigned char c = *in++;
+        if (c == '&')
+        {
+            NSUInteger matched;
+            if ((matched = matchEntity(in, end, "gt;")) != 0)
+                c = '>';
+            else if ((matched = matchEntity(in, end, "lt;")) != 0)
+                c = '<';
+            else if ((matched = matchEntity(in, end, "amp;")) != 0)
+                c = '&';
+            else if ((matched = matchEntity(in, end, "quot;")) != 0)
+                c = '"';
+            in += matched;
+        }
+        *out++ = c;
+    }
+
+    return [[[NSString alloc] initWithBytesNoCopy:decoded length:(NSUInteger) (out - decoded) encoding:NSUTF8StringEncoding freeWhenDone:YES] autorelease];
+}
+
+#pragma mark - Dates
+
+// --------------------------------------------------------------------------
+/// Read a fixed number of digits. Returns -1 if they're not all digits.
+// --------------------------------------------------------------------------
+
+static long readDigits(const char* bytes, NSUInteger count)
+{
+    long result = 0;
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        char c = bytes[n];
+        if ((c < '0') || (c > '9'))
+        {
+            return -1;
+        }
+        result = (result * 10) + (c - '0');
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Read a three letter English month name. Returns 1-12, or 0 if it's
+/// not a month.
+// --------------------------------------------------------------------------
+
+static int readMonth(const char* bytes)
+{
+    static const char* const kMonths = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    for (int month = 0; month < 12; ++month)
+    {
+        const char* name = kMonths + (month * 3);
+        if ((bytes[0] == name[0]) && (bytes[1] == name[1]) && (bytes[2] == name[2]))
+        {
+            return month + 1;
+        }
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+/// Read a "+hhmm" timezone offset, as a number of seconds.
+// --------------------------------------------------------------------------
+
+static BOOL readOffset(const char* bytes, long* offset)
+{
+    long hhmm = readDigits(bytes + 1, 4);
+    if ((hhmm < 0) || ((bytes[0] != '+') && (bytes[0] != '-')))
+    {
+        return NO;
+    }
+
+    *offset = ((hhmm / 100) * 3600) + ((hhmm % 100) * 60);
+    if (bytes[0] == '-')
+    {
+        *offset = -*offset;
+    }
+
+    return YES;
+}
+
+// --------------------------------------------------------------------------
+/// Return the number of days from 1970-01-01 to a given date.
+/// (The proleptic Gregorian calendar, which is what timegm uses).
+// --------------------------------------------------------------------------
+
+static long daysFromCivil(long year, long month, long day)
+{
+    year -= (month <= 2);
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yearOfEra = year - (era * 400);
+    long dayOfYear = ((153 * (month + (month > 2 ? -3 : 9))) + 2) / 5 + day - 1;
+    long dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) - (yearOfEra / 100) + dayOfYear;
+
+    return (era * 146097) + dayOfEra - 719468;
+}
+
+// --------------------------------------------------------------------------
+/// Parse a date in one of the two fixed formats that twitter uses.
+/// The formats only differ in the order of the fields, so we just work 
+/// out where each field lives, and then read them all the same way.
+// --------------------------------------------------------------------------
+
+NSTimeInterval ECTwitterTimeFromBytes(const char* bytes, NSUInteger length)
+{
+    NSUInteger dayAt, monthAt, yearAt, timeAt, offsetAt;
+    if ((length >= 31) && (bytes[3] == ','))
+    {
+        // search: "Fri, 06 Feb 2009 07:28:06 +0000"
+        dayAt = 5; monthAt = 8; yearAt = 12; timeAt = 17; offsetAt = 26;
+    }
+    else if (length >= 30)
+    {
+        // REST: "Thu Jan 15 02:04:38 +0000 2009"
+        monthAt = 4; dayAt = 8; timeAt = 11; offsetAt = 20; yearAt = 26;
+    }
+    else
+    {
+        return 0;
+    }
+
+    long day = readDigits(bytes + dayAt, 2);
+    int month = readMonth(bytes + monthAt);
+    long year = readDigits(bytes + yearAt, 4);
+    long hours = readDigits(bytes + timeAt, 2);
+    long minutes = readDigits(bytes + timeAt + 3, 2);
+    long seconds = readDigits(bytes + timeAt + 6, 2);
+    long offset = 0;
+    if ((day < 0) || (month == 0) || (year < 0) || (hours < 0) || (minutes < 0) || (seconds < 0) || !readOffset(bytes + offsetAt, &offset))
+    {
+        return 0;
+    }
+
+    long days = daysFromCivil(year, month, day);
+    return (NSTimeInterval) ((days * 86400) + (hours * 3600) + (minutes * 60) + seconds - offset);
+}
+
+// --------------------------------------------------------------------------
+/// Parse a date from a string.
+// --------------------------------------------------------------------------
+
+NSTimeInterval ECTwitterTimeFromString(NSString* string)
+{
+    char buffer[64];
+    NSTimeInterval result = 0;
+    if ([string getCString:buffer maxLength:sizeof(buffer) encoding:NSUTF8StringEncoding])
+    {
+        result = ECTwitterTimeFromBytes(buffer, strlen(buffer));
+    }
+
+    return result;
+}
@@ -0,0 +1,37 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Compact binary encoding for tweet and user payloads.
+///
+/// Payloads are the property lists that come out of the parser -
+/// dictionaries, arrays, strings, numbers, dates, data and null.
+/// Each value is a one byte tag followed by its contents, with
+/// lengths and integers as varints.
+///
+/// Most of the size of a keyed archive of a tweet is its keys. Here,
+/// any string in a fixed table of the keys (and a few of the values)
+/// that twitter uses is written as a single byte. Any other string is
+/// written out in full the first time it appears in a payload, and as
+/// a reference back to that after.
+///
+/// Packed data is the compact encoding compressed with ECTwitterLZ,
+/// if that makes it any smaller.
+///
+/// All methods are safe to call from any thread. Decoding returns nil
+/// for anything that isn't valid, rather than throwing.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterRecordCoder : NSObject
+
++ (NSData*)dataWithPayload:(id)payload;
++ (id)payloadWithData:(NSData*)data;
++ (BOOL)isCompactData:(NSData*)data;
+
++ (NSData*)packedDataWithPayload:(id)payload;
++ (id)payloadWithPackedData:(NSData*)data;
+
+@end
@@ -0,0 +1,662 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterRecordCoder.h"
+
+#include "ECTwitterLZ.h"
+
+@implementation ECTwitterRecordCoder
+
+// ==============================================
+// Debug Channels
+// ==============================================
+
+ECDefineDebugChannel(TwitterRecordCoderChannel);
+
+// ==============================================
+// Format
+// ==============================================
+
+#pragma mark -
+#pragma mark Format
+
+// Compact data is [kCompactMagic, kVersion, value].
+// Packed data is [kPackedMagic, kVersion, method, varint length of the compact data, body].
+// Keyed archives start with "bplist" or "<?xml", so neither magic byte can be mistaken for one.
+static const uint8_t kCompactMagic = 0xEC;
+static const uint8_t kPackedMagic = 0xED;
+static const uint8_t kVersion = 1;
+
+typedef enum
+{
+    PackedStored = 0,
+    PackedLZ = 1
+} ECTwitterPackedMethod;
+
+typedef enum
+{
+    TagNull = 0,
+    TagFalse = 1,
+    TagTrue = 2,
+    TagInteger = 3,         // zigzag varint
+    TagUnsigned = 4,        // varint, for values too big to be signed
+    TagDouble = 5,          // 8 bytes, little endian
+    TagString = 6,          // varint length, UTF-8 bytes
+    TagStringReference = 7, // varint index of an earlier TagString in this payload
+    TagArray = 8,           // varint count, values
+    TagDictionary = 9,      // varint count, key/value pairs
+    TagData = 10,           // varint length, bytes
+    TagDate = 11,           // as TagDouble, seconds since 1970
+
+    TagKnownString = 0x80   // low bits are an index into kKnownStrings
+} ECTwitterRecordTag;
+
+// Don't bother trying to compress anything smaller than this.
+static const NSUInteger kMinPackedLength = 48;
+
+// Nesting any deeper than this has to be corrupt data.
+static const NSUInteger kMaxDepth = 64;
+
+// --------------------------------------------------------------------------
+/// Strings that are written as a single byte.
+/// These are part of the format: new ones can only go on the end,
+/// and there can be at most 128.
+// --------------------------------------------------------------------------
+
+static NSString* const kKnownStrings[] =
+{
+    // tweets
+    @"id", @"id_str", @"text", @"created_at", @"source", @"truncated",
+    @"in_reply_to_status_id", @"in_reply_to_status_id_str", @"in_reply_to_user_id", @"in_reply_to_user_id_str", @"in_reply_to_screen_name",
+    @"user", @"geo", @"coordinates", @"place", @"contributors", @"retweet_count", @"favorited", @"retweeted", @"retweeted_status", @"possibly_sensitive",
+
+    // entities
+    @"entities", @"hashtags", @"urls", @"user_mentions", @"media", @"indices", @"url", @"expanded_url", @"display_url",
+    @"media_url", @"media_url_https", @"sizes", @"w", @"h", @"resize", @"thumb", @"small", @"medium", @"large",
+
+    // places
+    @"type", @"full_name", @"country", @"country_code", @"bounding_box", @"attributes", @"place_type",
+
+    // users
+    @"screen_name", @"name", @"description", @"location", @"protected", @"verified",
+    @"followers_count", @"friends_count", @"listed_count", @"favourites_count", @"statuses_count",
+    @"utc_offset", @"time_zone", @"geo_enabled", @"lang", @"contributors_enabled", @"is_translator",
+    @"profile_background_color", @"profile_background_image_url", @"profile_background_image_url_https", @"profile_background_tile",
+    @"profile_image_url", @"profile_image_url_https", @"profile_link_color", @"profile_sidebar_border_color",
+    @"profile_sidebar_fill_color", @"profile_text_color", @"profile_use_background_image", @"show_all_inline_media",
+    @"default_profile", @"default_profile_image", @"following", @"follow_request_sent", @"notifications", @"status",
+
+    // search results
+    @"from_user", @"from_user_id", @"from_user_id_str", @"from_user_name",
+    @"to_user", @"to_user_id", @"to_user_id_str", @"to_user_name", @"iso_language_code", @"metadata", @"result_type",
+
+    // common values
+    @"recent", @"popular", @"Point", @"Polygon", @"city", @"admin", @"poi", @"fit", @"crop", @"photo", @"en", @"web",
+
+    // our own records
+    @"viewed", @"extras", @"has_data", @"author_id_str", @"source_name", @"source_url"
+};
+
+static const NSUInteger kKnownStringCount = sizeof(kKnownStrings) / sizeof(kKnownStrings[0]);
+
+// --------------------------------------------------------------------------
+/// Return a map from each known string to its index plus one.
+// --------------------------------------------------------------------------
+
+static CFDictionaryRef knownStringIndexes(void)
+{
+    static CFMutableDictionaryRef indexes = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        ECAssert(kKnownStringCount <= 128);
+        indexes = CFDictionaryCreateMutable(NULL, (CFIndex) kKnownStringCount, &kCFTypeDictionaryKeyCallBacks, NULL);
+        for (NSUInteger n = 0; n < kKnownStringCount; ++n)
+        {
+            CFDictionarySetValue(indexes, (CFStringRef) kKnownStrings[n], (const void*) (n + 1));
+        }
+    });
+
+    return indexes;
+}
+
+// ==============================================
+// Writing
+// ==============================================
+
+#pragma mark -
+#pragma mark Writing
+
+typedef struct
+{
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+    CFMutableDictionaryRef strings; // string -> index plus one
+    NSUInteger stringCount;
+    BOOL failed;
+} Writer;
+
+static void reserve(Writer* writer, size_t extra)
+{
+    size_t needed = writer->length + extra;
+    if (needed > writer->capacity)
+    {
+        size_t capacity = MAX(writer->capacity * 2, needed);
+        writer->bytes = reallocf(writer->bytes, capacity);
+        writer->capacity = capacity;
+    }
+}
+
+static inline void writeByte(Writer* writer, uint8_t byte)
+{
+    reserve(writer, 1);
+    writer->bytes[writer->length++] = byte;
+}
+
+static inline void writeBytes(Writer* writer, const void* bytes, size_t length)
+{
+    reserve(writer, length);
+    memcpy(writer->bytes + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static inline void writeVarint(Writer* writer, uint64_t value)
+{
+    reserve(writer, 10);
+    while (value >= 0x80)
+    {
+        writer->bytes[writer->length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    writer->bytes[writer->length++] = (uint8_t) value;
+}
+
+static inline void writeDouble(Writer* writer, uint8_t tag, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = CFSwapInt64HostToLittle(bits);
+    writeByte(writer, tag);
+    writeBytes(writer, &bits, sizeof(bits));
+}
+
+static void writeString(Writer* writer, NSString* string)
+{
+    uintptr_t known = (uintptr_t) CFDictionaryGetValue(knownStringIndexes(), (CFStringRef) string);
+    if (known)
+    {
+        writeByte(writer, (uint8_t) (TagKnownString | (known - 1)));
+        return;
+    }
+
+    if (!writer->strings)
+    {
+        writer->strings = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+    }
+    uintptr_t previous = (uintptr_t) CFDictionaryGetValue(writer->strings, (CFStringRef) string);
+    if (previous)
+    {
+        writeByte(writer, TagStringReference);
+        writeVarint(writer, previous - 1);
+        return;
+    }
+
+    CFStringRef cf = (CFStringRef) string;
+    CFRange range = CFRangeMake(0, CFStringGetLength(cf));
+    CFIndex used = 0;
+    CFStringGetBytes(cf, range, kCFStringEncodingUTF8, 0, false, NULL, 0, &used);
+    writeByte(writer, TagString);
+    writeVarint(writer, (uint64_t) used);
+    reserve(writer, (size_t) used);
+    CFStringGetBytes(cf, range, kCFStringEncodingUTF8, 0, false, writer->bytes + writer->length, used, NULL);
+    writer->length += (size_t) used;
+
+    CFDictionarySetValue(writer->strings, cf, (const void*) ++writer->stringCount);
+}
+
+static void writeNumber(Writer* writer, NSNumber* number)
+{
+    CFNumberRef cf = (CFNumberRef) number;
+    if (CFGetTypeID(cf) == CFBooleanGetTypeID())
+    {
+        writeByte(writer, [number boolValue] ? TagTrue : TagFalse);
+    }
+    else if (CFNumberIsFloatType(cf))
+    {
+        writeDouble(writer, TagDouble, [number doubleValue]);
+    }
+    else if ((*[number objCType] == 'Q') && ([number unsignedLongLongValue] > INT64_MAX))
+    {
+        writeByte(writer, TagUnsigned);
+        writeVarint(writer, [number unsignedLongLongValue]);
+    }
+    else
+    {
+        int64_t value = [number longLongValue];
+        writeByte(writer, TagInteger);
+        writeVarint(writer, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+    }
+}
+
+static void writeValue(Writer* writer, id value)
+{
+    if ([value isKindOfClass:[NSString class]])
+    {
+        writeString(writer, value);
+    }
+    else if ([value isKindOfClass:[NSNumber class]])
+    {
+        writeNumber(writer, value);
+    }
+    else if ([value isKindOfClass:[NSDictionary class]])
+    {
+        writeByte(writer, TagDictionary);
+        writeVarint(writer, [value count]);
+        for (id key in value)
+        {
+            if (![key isKindOfClass:[NSString class]])
+            {
+                writer->failed = YES;
+                return;
+            }
+            writeString(writer, key);
+            writeValue(writer, [value objectForKey:key]);
+        }
+    }
+    else if ([value isKindOfClass:[NSArray class]])
+    {
+        writeByte(writer, TagArray);
+        writeVarint(writer, [value count]);
+        for (id item in value)
+        {
+            writeValue(writer, item);
+        }
+    }
+    else if (value == [NSNull null])
+    {
+        writeByte(writer, TagNull);
+    }
+    else if ([value isKindOfClass:[NSData class]])
+    {
+        writeByte(writer, TagData);
+        writeVarint(writer, [value length]);
+        writeBytes(writer, [value bytes], [value length]);
+    }
+    else if ([value isKindOfClass:[NSDate class]])
+    {
+        writeDouble(writer, TagDate, [value timeIntervalSince1970]);
+    }
+    else
+    {
+        ECDebug(TwitterRecordCoderChannel, @"can't encode %@", value);
+        writer->failed = YES;
+    }
+}
+
+// ==============================================
+// Reading
+// ==============================================
+
+#pragma mark -
+#pragma mark Reading
+
+typedef struct
+{
+    const uint8_t* bytes;
+    const uint8_t* end;
+    NSMutableArray* strings;
+    NSUInteger depth;
+} Reader;
+
+static inline BOOL readVarint(Reader* reader, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (NSUInteger shift = 0; shift < 64; shift += 7)
+    {
+        if (reader->bytes >= reader->end)
+        {
+            return NO;
+        }
+        uint8_t byte = *reader->bytes++;
+        result |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return YES;
+        }
+    }
+
+    return NO;
+}
+
+// --------------------------------------------------------------------------
+/// Read a count or length, checking that there are at least that
+/// many bytes left, since every item takes at least one.
+// --------------------------------------------------------------------------
+
+static inline BOOL readLength(Reader* reader, NSUInteger* length)
+{
+    uint64_t value;
+    BOOL ok = readVarint(reader, &value) && (value <= (uint64_t) (reader->end - reader->bytes));
+    if (ok)
+    {
+        *length = (NSUInteger) value;
+    }
+
+    return ok;
+}
+
+static inline BOOL readDouble(Reader* reader, double* value)
+{
+    uint64_t bits;
+    BOOL ok = (reader->end - reader->bytes) >= (ptrdiff_t) sizeof(bits);
+    if (ok)
+    {
+        memcpy(&bits, reader->bytes, sizeof(bits));
+        bits = CFSwapInt64LittleToHost(bits);
+        memcpy(value, &bits, sizeof(bits));
+        reader->bytes += sizeof(bits);
+    }
+
+    return ok;
+}
+
+static id readValue(Reader* reader)
+{
+    if ((reader->bytes >= reader->end) || (reader->depth >= kMaxDepth))
+    {
+        return nil;
+    }
+
+    id result = nil;
+    uint8_t tag = *reader->bytes++;
+    if (tag & TagKnownString)
+    {
+        NSUInteger index = tag & ~TagKnownString;
+        result = (index < kKnownStringCount) ? kKnownStrings[index] : nil;
+    }
+    else
+    {
+        uint64_t value;
+        NSUInteger length;
+        double time;
+        switch (tag)
+        {
+            case TagNull:
+                result = [NSNull null];
+                break;
+
+            case TagFalse:
+            case TagTrue:
+                result = [NSNumber numberWithBool:(tag == TagTrue)];
+                break;
+
+            case TagInteger:
+                if (readVarint(reader, &value))
+                {
+                    result = [NSNumber numberWithLongLong:(int64_t) (value >> 1) ^ -(int64_t) (value & 1)];
+                }
+                break;
+
+            case TagUnsigned:
+                if (readVarint(reader, &value))
+                {
+                    result = [NSNumber numberWithUnsignedLongLong:value];
+                }
+                break;
+
+            case TagDouble:
+                if (readDouble(reader, &time))
+                {
+                    result = [NSNumber numberWithDouble:time];
+                }
+                break;
+
+            case TagDate:
+                if (readDouble(reader, &time))
+                {
+                    result = [NSDate dateWithTimeIntervalSince1970:time];
+                }
+                break;
+
+            case TagString:
+                if (readLength(reader, &length))
+                {
+                    result = [[[NSString alloc] initWithBytes:reader->bytes length:length encoding:NSUTF8StringEncoding] autorelease];
+                    reader->bytes += length;
+                    if (result)
+                    {
+                        [reader->strings addObject:result];
+                    }
+                }
+                break;
+
+            case TagStringReference:
+                if (readVarint(reader, &value) && (value < [reader->strings count]))
+                {
+                    result = [reader->strings objectAtIndex:(NSUInteger) value];
+                }
+                break;
+
+            case TagData:
+                if (readLength(reader, &length))
+                {
+                    result = [NSData dataWithBytes:reader->bytes length:length];
+                    reader->bytes += length;
+                }
+                break;
+
+            case TagArray:
+                if (readLength(reader, &length))
+                {
+                    ++reader->depth;
+                    NSMutableArray* array = [NSMutableArray arrayWithCapacity:length];
+                    for (NSUInteger n = 0; (n < length) && array; ++n)
+                    {
+                        id item = readValue(reader);
+                        if (item)
+                        {
+                            [array addObject:item];
+                        }
+                        else
+                        {
+                            array = nil;
+                        }
+                    }
+                    --reader->depth;
+                    result = array;
+                }
+                break;
+
+            case TagDictionary:
+                if (readLength(reader, &length))
+                {
+                    ++reader->depth;
+                    NSMutableDictionary* dictionary = [NSMutableDictionary dictionaryWithCapacity:length];
+                    for (NSUInteger n = 0; (n < length) && dictionary; ++n)
+                    {
+                        id key = readValue(reader);
+                        id item = [key isKindOfClass:[NSString class]] ? readValue(reader) : nil;
+                        if (item)
+                        {
+                            [dictionary setObject:item forKey:key];
+                        }
+                        else
+                        {
+                            dictionary = nil;
+                        }
+                    }
+                    --reader->depth;
+                    result = dictionary;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return result;
+}
+
+// ==============================================
+// Methods
+// ==============================================
+
+#pragma mark -
+#pragma mark Methods
+
+// --------------------------------------------------------------------------
+/// Return the compact encoding of a payload, or nil if it contains
+/// something that we can't encode.
+// --------------------------------------------------------------------------
+
++ (NSData*)dataWithPayload:(id)payload
+{
+    NSData* result = nil;
+    if (payload)
+    {
+        Writer writer = { NULL, 0, 0, NULL, 0, NO };
+        reserve(&writer, 256);
+        writeByte(&writer, kCompactMagic);
+        writeByte(&writer, kVersion);
+        writeValue(&writer, payload);
+        if (writer.strings)
+        {
+            CFRelease(writer.strings);
+        }
+
+        if (writer.failed)
+        {
+            free(writer.bytes);
+        }
+        else
+        {
+            result = [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Decode compact data.
+// --------------------------------------------------------------------------
+
++ (id)payloadWithData:(NSData*)data
+{
+    id result = nil;
+    if ([self isCompactData:data])
+    {
+        const uint8_t* bytes = [data bytes];
+        Reader reader = { bytes + 2, bytes + [data length], [NSMutableArray array], 0 };
+        result = readValue(&reader);
+        if (reader.bytes != reader.end)
+        {
+            ECDebug(TwitterRecordCoderChannel, @"compact data was malformed");
+            result = nil;
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Is some data in our compact encoding?
+/// This is how a compact record is told apart from an older keyed archive.
+// --------------------------------------------------------------------------
+
++ (BOOL)isCompactData:(NSData*)data
+{
+    const uint8_t* bytes = [data bytes];
+
+    return ([data length] > 2) && (bytes[0] == kCompactMagic) && (bytes[1] == kVersion);
+}
+
+// --------------------------------------------------------------------------
+/// Return the compact encoding of a payload, compressed if that helps.
+// --------------------------------------------------------------------------
+
++ (NSData*)packedDataWithPayload:(id)payload
+{
+    NSData* result = nil;
+    NSData* compact = [self dataWithPayload:payload];
+    if (compact)
+    {
+        NSUInteger length = [compact length];
+        Writer writer = { NULL, 0, 0, NULL, 0, NO };
+        reserve(&writer, 3 + 10 + ECTwitterLZCompressBound(length));
+        writeByte(&writer, kPackedMagic);
+        writeByte(&writer, kVersion);
+        writeByte(&writer, PackedLZ);
+        writeVarint(&writer, length);
+
+        size_t compressed = 0;
+        if (length >= kMinPackedLength)
+        {
+            compressed = ECTwitterLZCompress([compact bytes], length, writer.bytes + writer.length, writer.capacity - writer.length);
+        }
+
+        if (compressed && (compressed < length))
+        {
+            writer.length += compressed;
+        }
+        else
+        {
+            writer.bytes[2] = PackedStored;
+            writeBytes(&writer, [compact bytes], length);
+        }
+
+        writer.bytes = reallocf(writer.bytes, writer.length);
+        result = [NSData dataWithBytesNoCopy:writer.bytes length:writer.length freeWhenDone:YES];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Decode packed data.
+// --------------------------------------------------------------------------
+
++ (id)payloadWithPackedData:(NSData*)data
+{
+    id result = nil;
+    const uint8_t* bytes = [data bytes];
+    NSUInteger length = [data length];
+    if ((length > 3) && (bytes[0] == kPackedMagic) && (bytes[1] == kVersion))
+    {
+        Reader reader = { bytes + 3, bytes + length, nil, 0 };
+        uint64_t compactLength;
+        if (readVarint(&reader, &compactLength))
+        {
+            NSUInteger bodyLength = (NSUInteger) (reader.end - reader.bytes);
+            if ((bytes[2] == PackedStored) && (compactLength == bodyLength))
+            {
+                NSData* compact = [[NSData alloc] initWithBytesNoCopy:(void*) reader.bytes length:bodyLength freeWhenDone:NO];
+                result = [self payloadWithData:compact];
+                [compact release];
+            }
+            else if ((bytes[2] == PackedLZ) && (compactLength <= bodyLength * 255))
+            {
+                NSMutableData* compact = [[NSMutableData alloc] initWithLength:(NSUInteger) compactLength];
+                if (ECTwitterLZDecompress(reader.bytes, bodyLength, [compact mutableBytes], (size_t) compactLength))
+                {
+                    result = [self payloadWithData:compact];
+                }
+                [compact release];
+            }
+        }
+
+        if (!result)
+        {
+            ECDebug(TwitterRecordCoderChannel, @"packed data was malformed");
+        }
+    }
+
+    return result;
+}
+
+@end
@@ -0,0 +1,40 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Builds, and optionally signs, requests to twitter.
+///
+/// The parameters are sorted once, and percent-encoded straight into a
+/// buffer that's reused from one request to the next. The same encoded
+/// pairs become the query string (or the body of a POST) and are then fed
+/// directly into the OAuth signature, without building the signature base
+/// string separately.
+///
+/// The HMAC state for each consumer/token pair is set up once and kept,
+/// so signing a request only has to hash its own data.
+///
+/// Not thread safe - each builder should only be used from one thread.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterRequestBuilder : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+// For checking signatures against known values; normally these are nil/0,
+// and a random nonce and the current time are used.
+@property (strong, nonatomic) NSString* fixedNonce;
+@property (assign, nonatomic) time_t fixedTimestamp;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters;
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters consumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret;
+
+@end
@@ -0,0 +1,589 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterRequestBuilder.h"
+
+#import <CommonCrypto/CommonHMAC.h>
+
+#include <time.h>
+
+// --------------------------------------------------------------------------
+// Types
+// --------------------------------------------------------------------------
+
+// A growable byte buffer.
+typedef struct
+{
+    uint8_t*    bytes;
+    NSUInteger  length;
+    NSUInteger  capacity;
+} ECTwitterRequestBuffer;
+
+// An encoded name=value pair, as offsets into the buffer.
+typedef struct
+{
+    NSUInteger  start;
+    NSUInteger  equals;
+    NSUInteger  end;
+} ECTwitterRequestPair;
+
+// --------------------------------------------------------------------------
+/// The signing state for one consumer/token pair.
+/// We keep an HMAC context that has already been given the key, and the
+/// encoded keys that go into each request.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterSigningKey : NSObject
+{
+@public
+    CCHmacContext mContext;
+}
+
+@property (strong, nonatomic) NSString* consumerKey;
+@property (strong, nonatomic) NSString* consumerSecret;
+@property (strong, nonatomic) NSString* tokenKey;
+@property (strong, nonatomic) NSString* tokenSecret;
+
+- (BOOL)matchesConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret;
+
+@end
+
+// --------------------------------------------------------------------------
+// Private Methods
+// --------------------------------------------------------------------------
+
+@interface ECTwitterRequestBuilder()
+{
+    ECTwitterRequestBuffer  mBuffer;
+    ECTwitterRequestPair*   mPairs;
+    NSUInteger              mPairCount;
+    NSUInteger              mPairCapacity;
+}
+
+@property (strong, nonatomic) NSMutableDictionary* keys;
+@property (strong, nonatomic) ECTwitterSigningKey* lastKey;
+
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters key:(ECTwitterSigningKey*)key;
+- (ECTwitterSigningKey*)keyForConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret;
+- (void)addPairWithName:(const char*)name length:(NSUInteger)nameLength value:(NSString*)value;
+- (NSString*)authorizationForMethod:(NSString*)method URL:(NSString*)url key:(ECTwitterSigningKey*)key;
+
+@end
+
+// --------------------------------------------------------------------------
+// Constants
+// --------------------------------------------------------------------------
+
+static NSString *const kPostMethod = @"POST";
+static NSString *const kGetMethod = @"GET";
+
+static const NSUInteger kInitialCapacity = 1024;
+static const NSUInteger kInitialPairCapacity = 16;
+
+// we don't expect more than a few accounts; if there are more than this
+// many keys, something is churning, and we start again
+static const NSUInteger kMaxSigningKeys = 16;
+
+static const char kHexDigits[] = "0123456789ABCDEF";
+static const char kBase64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// --------------------------------------------------------------------------
+// Helpers
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Is a character one that's left alone by percent-encoding?
+/// OAuth uses the RFC 3986 unreserved set, and so do we, so the query
+/// string and the signature always agree.
+// --------------------------------------------------------------------------
+
+static inline BOOL isUnreserved(uint8_t c)
+{
+    return ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '.') || (c == '_') || (c == '~');
+}
+
+static void reserve(ECTwitterRequestBuffer* buffer, NSUInteger extra)
+{
+    NSUInteger needed = buffer->length + extra;
+    if (needed > buffer->capacity)
+    {
+        NSUInteger capacity = MAX(buffer->capacity * 2, needed);
+        buffer->bytes = realloc(buffer->bytes, capacity);
+        buffer->capacity = capacity;
+    }
+}
+
+static void appendBytes(ECTwitterRequestBuffer* buffer, const void* bytes, NSUInteger length)
+{
+    reserve(buffer, length);
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+static void appendEncoded(ECTwitterRequestBuffer* buffer, const uint8_t* bytes, NSUInteger length)
+{
+    reserve(buffer, length * 3);
+    uint8_t* output = buffer->bytes + buffer->length;
+    for (NSUInteger n = 0; n < length; ++n)
+    {
+        uint8_t c = bytes[n];
+        if (isUnreserved(c))
+        {
+            *output++ = c;
+        }
+        else
+        {
+            *output++ = '%';
+            *output++ = kHexDigits[c >> 4];
+            *output++ = kHexDigits[c & 0x0F];
+        }
+    }
+    buffer->length = (NSUInteger) (output - buffer->bytes);
+}
+
+// --------------------------------------------------------------------------
+/// Return the UTF8 bytes of a string, without copying them if we can.
+// --------------------------------------------------------------------------
+
+static const uint8_t* utf8Bytes(NSString* string, NSUInteger* length)
+{
+    const char* bytes = CFStringGetCStringPtr((CFStringRef) string, kCFStringEncodingUTF8);
+    if (!bytes)
+    {
+        bytes = [string UTF8String];
+    }
+    *length = bytes ? strlen(bytes) : 0;
+
+    return (const uint8_t*) bytes;
+}
+
+static void appendEncodedString(ECTwitterRequestBuffer* buffer, NSString* string)
+{
+    NSUInteger length;
+    const uint8_t* bytes = utf8Bytes(string, &length);
+    appendEncoded(buffer, bytes, length);
+}
+
+// --------------------------------------------------------------------------
+/// Compare two pairs, by name and then by value, as OAuth wants them.
+// --------------------------------------------------------------------------
+
+static int comparePairs(const uint8_t* bytes, const ECTwitterRequestPair* pair1, const ECTwitterRequestPair* pair2)
+{
+    NSUInteger length1 = pair1->equals - pair1->start;
+    NSUInteger length2 = pair2->equals - pair2->start;
+    int result = memcmp(bytes + pair1->start, bytes + pair2->start, MIN(length1, length2));
+    if (result == 0)
+    {
+        result = (length1 > length2) - (length1 < length2);
+    }
+
+    if (result == 0)
+    {
+        length1 = pair1->end - pair1->equals;
+        length2 = pair2->end - pair2->equals;
+        result = memcmp(bytes + pair1->equals, bytes + pair2->equals, MIN(length1, length2));
+        if (result == 0)
+        {
+            result = (length1 > length2) - (length1 < length2);
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Hash some bytes, percent-encoding them as we go.
+/// For the pairs, which are already encoded, this is the second layer of
+/// encoding that the signature base string needs.
+// --------------------------------------------------------------------------
+
+static void updateEncoded(CCHmacContext* context, const uint8_t* bytes, NSUInteger length)
+{
+    uint8_t scratch[256];
+    NSUInteger used = 0;
+    for (NSUInteger n = 0; n < length; ++n)
+    {
+        if (used > sizeof(scratch) - 3)
+        {
+            CCHmacUpdate(context, scratch, used);
+            used = 0;
+        }
+
+        uint8_t c = bytes[n];
+        if (isUnreserved(c))
+        {
+            scratch[used++] = c;
+        }
+        else
+        {
+            scratch[used++] = '%';
+            scratch[used++] = (uint8_t) kHexDigits[c >> 4];
+            scratch[used++] = (uint8_t) kHexDigits[c & 0x0F];
+        }
+    }
+
+    CCHmacUpdate(context, scratch, used);
+}
+
+static BOOL stringsMatch(NSString* string1, NSString* string2)
+{
+    return (string1 == string2) || [string1 isEqualToString:string2];
+}
+
+@implementation ECTwitterSigningKey
+
+@synthesize consumerKey = _consumerKey;
+@synthesize consumerSecret = _consumerSecret;
+@synthesize tokenKey = _tokenKey;
+@synthesize tokenSecret = _tokenSecret;
+
+- (id)initWithConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret
+{
+    if ((self = [super init]) != nil)
+    {
+        self.consumerKey = consumerKey;
+        self.consumerSecret = consumerSecret;
+        self.tokenKey = tokenKey;
+        self.tokenSecret = tokenSecret;
+
+        ECTwitterRequestBuffer key = { NULL, 0, 0 };
+        appendEncodedString(&key, consumerSecret);
+        appendBytes(&key, "&", 1);
+        appendEncodedString(&key, tokenSecret);
+        CCHmacInit(&mContext, kCCHmacAlgSHA1, key.bytes, key.length);
+        free(key.bytes);
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_consumerKey release];
+    [_consumerSecret release];
+    [_tokenKey release];
+    [_tokenSecret release];
+
+    [super dealloc];
+}
+
+- (BOOL)matchesConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret
+{
+    return stringsMatch(self.consumerKey, consumerKey) && stringsMatch(self.tokenKey, tokenKey) && stringsMatch(self.consumerSecret, consumerSecret) && stringsMatch(self.tokenSecret, tokenSecret);
+}
+
+@end
+
+
+@implementation ECTwitterRequestBuilder
+
+// --------------------------------------------------------------------------
+// Properties
+// --------------------------------------------------------------------------
+
+@synthesize fixedNonce = _fixedNonce;
+@synthesize fixedTimestamp = _fixedTimestamp;
+@synthesize keys = _keys;
+@synthesize lastKey = _lastKey;
+
+// --------------------------------------------------------------------------
+// Lifecycle
+// --------------------------------------------------------------------------
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        mBuffer.bytes = malloc(kInitialCapacity);
+        mBuffer.capacity = kInitialCapacity;
+        mPairs = malloc(kInitialPairCapacity * sizeof(ECTwitterRequestPair));
+        mPairCapacity = kInitialPairCapacity;
+        self.keys = [NSMutableDictionary dictionary];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    free(mBuffer.bytes);
+    free(mPairs);
+    [_fixedNonce release];
+    [_keys release];
+    [_lastKey release];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+// Building
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Make an unsigned request.
+/// The parameters go in the query string, or the body for a POST. The URL
+/// shouldn't have a query string of its own.
+// --------------------------------------------------------------------------
+
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters
+{
+    return [self requestWithMethod:method URL:url parameters:parameters key:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Make a request, signed with OAuth.
+/// The token can be nil, for requests that are only signed by the consumer.
+// --------------------------------------------------------------------------
+
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters consumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret
+{
+    ECTwitterSigningKey* key = [self keyForConsumerKey:consumerKey consumerSecret:consumerSecret tokenKey:tokenKey tokenSecret:tokenSecret];
+
+    return [self requestWithMethod:method URL:url parameters:parameters key:key];
+}
+
+- (NSMutableURLRequest*)requestWithMethod:(NSString*)method URL:(NSString*)url parameters:(NSDictionary*)parameters key:(ECTwitterSigningKey*)key
+{
+    if (!method)
+    {
+        method = kGetMethod;
+    }
+
+    mBuffer.length = 0;
+    mPairCount = 0;
+
+    NSArray* names = [[parameters allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    for (NSString* name in names)
+    {
+        if (mPairCount)
+        {
+            appendBytes(&mBuffer, "&", 1);
+        }
+
+        id value = [parameters objectForKey:name];
+        NSUInteger nameLength;
+        const uint8_t* nameBytes = utf8Bytes(name, &nameLength);
+        [self addPairWithName:(const char*) nameBytes length:nameLength value:[value isKindOfClass:[NSString class]] ? value : [value description]];
+    }
+
+    NSUInteger queryLength = mBuffer.length;
+    NSData* body = nil;
+    NSString* urlString = url;
+    if (queryLength)
+    {
+        if ([method isEqualToString:kPostMethod])
+        {
+            body = [NSData dataWithBytes:mBuffer.bytes length:queryLength];
+        }
+        else
+        {
+            NSString* query = [[NSString alloc] initWithBytes:mBuffer.bytes length:queryLength encoding:NSASCIIStringEncoding];
+            urlString = [NSString stringWithFormat:@"%@?%@", url, query];
+            [query release];
+        }
+    }
+
+    NSURL* finalURL = [NSURL URLWithString:urlString];
+    if (!finalURL)
+    {
+        return nil;
+    }
+
+    NSMutableURLRequest* request = [NSMutableURLRequest requestWithURL:finalURL];
+    [request setHTTPMethod:method];
+    if (body)
+    {
+        [request setHTTPBody:body];
+    }
+
+    if (key)
+    {
+        [request setValue:[self authorizationForMethod:method URL:url key:key] forHTTPHeaderField:@"Authorization"];
+    }
+
+    return request;
+}
+
+// --------------------------------------------------------------------------
+/// Encode a name=value pair onto the end of the buffer, and remember
+/// where it is. The name must already be safe to use as it is.
+// --------------------------------------------------------------------------
+
+- (void)addPairWithName:(const char*)name length:(NSUInteger)nameLength value:(NSString*)value
+{
+    if (mPairCount == mPairCapacity)
+    {
+        mPairCapacity *= 2;
+        mPairs = realloc(mPairs, mPairCapacity * sizeof(ECTwitterRequestPair));
+    }
+
+    ECTwitterRequestPair* pair = &mPairs[mPairCount++];
+    pair->start = mBuffer.length;
+    appendEncoded(&mBuffer, (const uint8_t*) name, nameLength);
+    pair->equals = mBuffer.length;
+    appendBytes(&mBuffer, "=", 1);
+    appendEncodedString(&mBuffer, value);
+    pair->end = mBuffer.length;
+}
+
+// --------------------------------------------------------------------------
+// Signing
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Return the signing state for a consumer and token.
+/// Usually it's the same one as last time, so we check that first.
+// --------------------------------------------------------------------------
+
+- (ECTwitterSigningKey*)keyForConsumerKey:(NSString*)consumerKey consumerSecret:(NSString*)consumerSecret tokenKey:(NSString*)tokenKey tokenSecret:(NSString*)tokenSecret
+{
+    ECTwitterSigningKey* key = self.lastKey;
+    if (![key matchesConsumerKey:consumerKey consumerSecret:consumerSecret tokenKey:tokenKey tokenSecret:tokenSecret])
+    {
+        NSString* name = [NSString stringWithFormat:@"%@&%@", consumerKey, tokenKey ? tokenKey : @""];
+        key = [self.keys objectForKey:name];
+        if (![key matchesConsumerKey:consumerKey consumerSecret:consumerSecret tokenKey:tokenKey tokenSecret:tokenSecret])
+        {
+            if ([self.keys count] >= kMaxSigningKeys)
+            {
+                [self.keys removeAllObjects];
+            }
+
+            key = [[ECTwitterSigningKey alloc] initWithConsumerKey:consumerKey consumerSecret:consumerSecret tokenKey:tokenKey tokenSecret:tokenSecret];
+            [self.keys setObject:key forKey:name];
+            [key release];
+        }
+        self.lastKey = key;
+    }
+
+    return key;
+}
+
+// --------------------------------------------------------------------------
+/// Return the Authorization header for the request in the buffer.
+///
+/// We add the oauth pairs to the buffer, after the request's own. Both
+/// lots are already in order, so a merge gives us the order for the
+/// signature base string, which we hash as we go, rather than making it.
+// --------------------------------------------------------------------------
+
+- (NSString*)authorizationForMethod:(NSString*)method URL:(NSString*)url key:(ECTwitterSigningKey*)key
+{
+    NSUInteger requestPairs = mPairCount;
+
+    NSString* nonce = self.fixedNonce;
+    if (!nonce)
+    {
+        uint8_t random[16];
+        char hex[sizeof(random) * 2 + 1];
+        arc4random_buf(random, sizeof(random));
+        for (NSUInteger n = 0; n < sizeof(random); ++n)
+        {
+            hex[n * 2] = kHexDigits[random[n] >> 4];
+            hex[n * 2 + 1] = kHexDigits[random[n] & 0x0F];
+        }
+        hex[sizeof(hex) - 1] = 0;
+        nonce = [NSString stringWithUTF8String:hex];
+    }
+
+    time_t timestamp = self.fixedTimestamp ? self.fixedTimestamp : time(NULL);
+    NSString* timestampString = [NSString stringWithFormat:@"%ld", (long) timestamp];
+
+    [self addPairWithName:"oauth_consumer_key" length:18 value:key.consumerKey];
+    [self addPairWithName:"oauth_nonce" length:11 value:nonce];
+    [self addPairWithName:"oauth_signature_method" length:22 value:@"HMAC-SHA1"];
+    [self addPairWithName:"oauth_timestamp" length:15 value:timestampString];
+    if (key.tokenKey)
+    {
+        [self addPairWithName:"oauth_token" length:11 value:key.tokenKey];
+    }
+    [self addPairWithName:"oauth_version" length:13 value:@"1.0"];
+    NSUInteger totalPairs = mPairCount;
+
+    // the base string is METHOD&URL&PARAMETERS, each part encoded
+    CCHmacContext context = key->mContext;
+    NSUInteger length;
+    const uint8_t* bytes = utf8Bytes(method, &length);
+    CCHmacUpdate(&context, bytes, length);
+    CCHmacUpdate(&context, "&", 1);
+    bytes = utf8Bytes(url, &length);
+    updateEncoded(&context, bytes, length);
+    CCHmacUpdate(&context, "&", 1);
+
+    const uint8_t* buffer = mBuffer.bytes;
+    NSUInteger i = 0;
+    NSUInteger j = requestPairs;
+    BOOL first = YES;
+    while ((i < requestPairs) || (j < totalPairs))
+    {
+        ECTwitterRequestPair* pair;
+        if ((j == totalPairs) || ((i < requestPairs) && (comparePairs(buffer, &mPairs[i], &mPairs[j]) <= 0)))
+        {
+            pair = &mPairs[i++];
+        }
+        else
+        {
+            pair = &mPairs[j++];
+        }
+
+        if (!first)
+        {
+            CCHmacUpdate(&context, "%26", 3);
+        }
+        first = NO;
+
+        updateEncoded(&context, buffer + pair->start, pair->end - pair->start);
+    }
+
+    uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+    CCHmacFinal(&context, digest);
+
+    // base64 the signature; 20 bytes is six groups of three, plus two
+    char signature[29];
+    NSUInteger output = 0;
+    for (NSUInteger n = 0; n < sizeof(digest); n += 3)
+    {
+        uint32_t group = (uint32_t) digest[n] << 16;
+        group |= (n + 1 < sizeof(digest)) ? (uint32_t) digest[n + 1] << 8 : 0;
+        group |= (n + 2 < sizeof(digest)) ? (uint32_t) digest[n + 2] : 0;
+        signature[output++] = kBase64Digits[(group >> 18) & 0x3F];
+        signature[output++] = kBase64Digits[(group >> 12) & 0x3F];
+        signature[output++] = (n + 1 < sizeof(digest)) ? kBase64Digits[(group >> 6) & 0x3F] : '=';
+        signature[output++] = (n + 2 < sizeof(digest)) ? kBase64Digits[group & 0x3F] : '=';
+    }
+    signature[output] = 0;
+
+    // the header is the oauth pairs, with the values quoted, plus the
+    // signature; we copy the pairs from the buffer itself, so we make room
+    // first, to be sure it doesn't move whilst we're doing it
+    NSUInteger needed = 6 + 17 + (output * 3) + 1;
+    for (NSUInteger n = requestPairs; n < totalPairs; ++n)
+    {
+        needed += (mPairs[n].end - mPairs[n].start) + 5;
+    }
+    reserve(&mBuffer, needed);
+
+    NSUInteger headerStart = mBuffer.length;
+    appendBytes(&mBuffer, "OAuth ", 6);
+    for (NSUInteger n = requestPairs; n < totalPairs; ++n)
+    {
+        ECTwitterRequestPair* pair = &mPairs[n];
+        appendBytes(&mBuffer, mBuffer.bytes + pair->start, pair->equals - pair->start);
+        appendBytes(&mBuffer, "=\"", 2);
+        appendBytes(&mBuffer, mBuffer.bytes + pair->equals + 1, pair->end - pair->equals - 1);
+        appendBytes(&mBuffer, "\", ", 3);
+    }
+    appendBytes(&mBuffer, "oauth_signature=\"", 17);
+    appendEncoded(&mBuffer, (const uint8_t*) signature, output);
+    appendBytes(&mBuffer, "\"", 1);
+
+    NSString* header = [[NSString alloc] initWithBytes:mBuffer.bytes + headerStart length:mBuffer.length - headerStart encoding:NSASCIIStringEncoding];
+
+    return [header autorelease];
+}
+
+@end
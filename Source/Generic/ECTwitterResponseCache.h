@@ -0,0 +1,61 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// A response body we've been given before, along with the validators
+/// that let us ask the server whether it's changed.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCachedResponse : NSObject
+
+@property (strong, nonatomic) NSData* body;
+@property (strong, nonatomic) NSString* etag;
+@property (strong, nonatomic) NSString* lastModified;
+@property (strong, nonatomic) NSDate* validated;
+
+@end
+
+typedef void (^ECTwitterCachedResponseHandler)(ECTwitterCachedResponse* response);
+
+// --------------------------------------------------------------------------
+/// On-disk cache of raw response bodies, keyed by request.
+///
+/// Each response is stored in its own file, named after a hash of its key.
+/// Recently used responses are also kept in memory, up to a limit on how
+/// much memory their bodies take up. Reading and writing the files happens
+/// on a private serial queue, so the caller never waits for the disk.
+///
+/// Responses older than the maximum age are thrown away, as are the oldest
+/// ones once the disk budget is used up. We check at startup, and again
+/// each time a good fraction of the budget has been written.
+///
+/// Should only be called from the main thread; handlers are called on
+/// the main thread too.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterResponseCache : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (assign, nonatomic) NSUInteger maxMemoryBytes;
+@property (assign, nonatomic) NSUInteger maxDiskBytes;
+@property (assign, nonatomic) NSTimeInterval maxAge;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url;
+
+- (ECTwitterCachedResponse*)cachedResponseForKey:(NSString*)key;
+- (void)fetchResponseForKey:(NSString*)key handler:(ECTwitterCachedResponseHandler)handler;
+- (void)storeResponse:(ECTwitterCachedResponse*)response forKey:(NSString*)key;
+- (void)trimDiskCache;
+- (void)removeAllResponses;
+
+@end
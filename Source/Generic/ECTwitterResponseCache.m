@@ -0,0 +1,357 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterResponseCache.h"
+
+#pragma mark - Cached Response
+
+@implementation ECTwitterCachedResponse
+
+@synthesize body = _body;
+@synthesize etag = _etag;
+@synthesize lastModified = _lastModified;
+@synthesize validated = _validated;
+
+- (void)dealloc
+{
+    [_body release];
+    [_etag release];
+    [_lastModified release];
+    [_validated release];
+
+    [super dealloc];
+}
+
+@end
+
+#pragma mark - Private Interface
+
+@interface ECTwitterResponseCache()
+
+@property (strong, nonatomic) NSURL* url;
+@property (strong, nonatomic) NSCache* memory;
+@property (assign, nonatomic) dispatch_queue_t queue;
+@property (assign, nonatomic) NSUInteger bytesWritten;
+
+- (NSURL*)fileForKey:(NSString*)key;
+- (ECTwitterCachedResponse*)readResponseForKey:(NSString*)key;
+- (void)trimFilesToBytes:(NSUInteger)maxBytes age:(NSTimeInterval)maxAge;
+
+@end
+
+@implementation ECTwitterResponseCache
+
+#pragma mark - Debug Channels
+
+ECDefineDebugChannel(TwitterResponseCacheChannel);
+
+#pragma mark - Properties
+
+@synthesize bytesWritten = _bytesWritten;
+@synthesize maxAge = _maxAge;
+@synthesize maxDiskBytes = _maxDiskBytes;
+@synthesize memory = _memory;
+@synthesize queue = _queue;
+@synthesize url = _url;
+
+#pragma mark - Constants
+
+static NSString *const kKeyKey = @"key";
+static NSString *const kBodyKey = @"body";
+static NSString *const kETagKey = @"etag";
+static NSString *const kLastModifiedKey = @"modified";
+static NSString *const kValidatedKey = @"validated";
+
+static const NSUInteger kDefaultMaxMemoryBytes = 1024 * 1024;
+static const NSUInteger kDefaultMaxDiskBytes = 8 * 1024 * 1024;
+static const NSTimeInterval kDefaultMaxAge = 7.0 * 24.0 * 60.0 * 60.0;
+static const NSUInteger kTrimFraction = 8;
+
+#pragma mark - Lifecycle
+
+// --------------------------------------------------------------------------
+/// Set up a cache which stores its responses in the given folder.
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url
+{
+    if ((self = [super init]) != nil)
+    {
+        self.url = url;
+        self.queue = dispatch_queue_create("com.elegantchaos.ectwitter.responsecache", DISPATCH_QUEUE_SERIAL);
+
+        NSCache* memory = [[NSCache alloc] init];
+        self.memory = memory;
+        [memory release];
+
+        self.maxMemoryBytes = kDefaultMaxMemoryBytes;
+        self.maxDiskBytes = kDefaultMaxDiskBytes;
+        self.maxAge = kDefaultMaxAge;
+
+        NSError* error = nil;
+        if (![[NSFileManager defaultManager] createDirectoryAtURL:url withIntermediateDirectories:YES attributes:nil error:&error])
+        {
+            ECDebug(TwitterResponseCacheChannel, @"couldn't make response cache folder %@", error);
+        }
+
+        [self trimDiskCache];
+    }
+
+    return self;
+}
+
+// --------------------------------------------------------------------------
+/// Clean up.
+// --------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    dispatch_release(_queue);
+    [_memory release];
+    [_url release];
+
+    [super dealloc];
+}
+
+#pragma mark - Limits
+
+- (NSUInteger)maxMemoryBytes
+{
+    return self.memory.totalCostLimit;
+}
+
+- (void)setMaxMemoryBytes:(NSUInteger)maxMemoryBytes
+{
+    self.memory.totalCostLimit = maxMemoryBytes;
+}
+
+#pragma mark - Responses
+
+// --------------------------------------------------------------------------
+/// Return the file to use for a key.
+/// The name is a hash of the key; the key itself is stored in the file,
+/// so that we can spot the (unlikely) case of two keys colliding.
+// --------------------------------------------------------------------------
+
+- (NSURL*)fileForKey:(NSString*)key
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const char* bytes = [key UTF8String];
+    while (*bytes)
+    {
+        hash ^= (uint8_t) *bytes++;
+        hash *= 1099511628211ULL;
+    }
+
+    NSString* name = [NSString stringWithFormat:@"%016llx.response", (unsigned long long) hash];
+    return [self.url URLByAppendingPathComponent:name];
+}
+
+// --------------------------------------------------------------------------
+/// Return a response if it's already in memory, or nil if it isn't.
+/// Never blocks, and doesn't look on disk.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCachedResponse*)cachedResponseForKey:(NSString*)key
+{
+    return [self.memory objectForKey:key];
+}
+
+// --------------------------------------------------------------------------
+/// Fetch the stored response for a key, or nil if we don't have one.
+/// If it's in memory, the handler is called straight away. Otherwise we
+/// read it from disk in the background, and call the handler once we've
+/// got it.
+// --------------------------------------------------------------------------
+
+- (void)fetchResponseForKey:(NSString*)key handler:(ECTwitterCachedResponseHandler)handler
+{
+    ECTwitterCachedResponse* result = [self cachedResponseForKey:key];
+    if (result)
+    {
+        handler(result);
+    }
+    else
+    {
+        ECTwitterCachedResponseHandler copied = [handler copy];
+        dispatch_async(self.queue, ^{
+            ECTwitterCachedResponse* read = [self readResponseForKey:key];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (read && ![self.memory objectForKey:key])
+                {
+                    [self.memory setObject:read forKey:key cost:[read.body length]];
+                }
+                copied(read);
+                [copied release];
+            });
+        });
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Read the response for a key from disk.
+/// Must be called on our queue.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCachedResponse*)readResponseForKey:(NSString*)key
+{
+    ECTwitterCachedResponse* result = nil;
+    NSData* data = [[NSData alloc] initWithContentsOfURL:[self fileForKey:key]];
+    if (data)
+    {
+        NSDictionary* info = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:nil error:nil];
+        if ([info isKindOfClass:[NSDictionary class]] && [[info objectForKey:kKeyKey] isEqualToString:key])
+        {
+            result = [[[ECTwitterCachedResponse alloc] init] autorelease];
+            result.body = [info objectForKey:kBodyKey];
+            result.etag = [info objectForKey:kETagKey];
+            result.lastModified = [info objectForKey:kLastModifiedKey];
+            result.validated = [info objectForKey:kValidatedKey];
+        }
+        [data release];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Store a response for a key, replacing any previous one.
+// --------------------------------------------------------------------------
+
+- (void)storeResponse:(ECTwitterCachedResponse*)response forKey:(NSString*)key
+{
+    ECAssertNonNil(response.body);
+
+    [self.memory setObject:response forKey:key cost:[response.body length]];
+
+    NSMutableDictionary* info = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+                                 key, kKeyKey,
+                                 response.body, kBodyKey,
+                                 response.validated ? response.validated : [NSDate date], kValidatedKey,
+                                 nil];
+    if (response.etag)
+    {
+        [info setObject:response.etag forKey:kETagKey];
+    }
+    if (response.lastModified)
+    {
+        [info setObject:response.lastModified forKey:kLastModifiedKey];
+    }
+
+    NSData* data = [NSPropertyListSerialization dataWithPropertyList:info format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+    NSURL* file = [self fileForKey:key];
+    NSUInteger maxBytes = self.maxDiskBytes;
+    NSTimeInterval maxAge = self.maxAge;
+    dispatch_async(self.queue, ^{
+        if ([data writeToURL:file atomically:YES])
+        {
+            self.bytesWritten += [data length];
+            if (self.bytesWritten > maxBytes / kTrimFraction)
+            {
+                [self trimFilesToBytes:maxBytes age:maxAge];
+            }
+        }
+        else
+        {
+            ECDebug(TwitterResponseCacheChannel, @"failed to write response to %@", file);
+        }
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Throw away any responses on disk that are too old, then the oldest of
+/// the rest until we're within our budget.
+/// Happens in the background.
+// --------------------------------------------------------------------------
+
+- (void)trimDiskCache
+{
+    NSUInteger maxBytes = self.maxDiskBytes;
+    NSTimeInterval maxAge = self.maxAge;
+    dispatch_async(self.queue, ^{
+        [self trimFilesToBytes:maxBytes age:maxAge];
+    });
+}
+
+// --------------------------------------------------------------------------
+/// Do the work of trimming the disk cache.
+/// Must be called on our queue.
+// --------------------------------------------------------------------------
+
+- (void)trimFilesToBytes:(NSUInteger)maxBytes age:(NSTimeInterval)maxAge
+{
+    NSFileManager* fm = [NSFileManager defaultManager];
+    NSArray* keys = [NSArray arrayWithObjects:NSURLContentModificationDateKey, NSURLFileSizeKey, nil];
+    NSArray* files = [fm contentsOfDirectoryAtURL:self.url includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+    NSDate* cutoff = [NSDate dateWithTimeIntervalSinceNow:-maxAge];
+
+    NSUInteger total = 0;
+    NSUInteger removed = 0;
+    NSMutableArray* entries = [NSMutableArray arrayWithCapacity:[files count]];
+    for (NSURL* file in files)
+    {
+        NSDictionary* values = [file resourceValuesForKeys:keys error:nil];
+        NSDate* modified = [values objectForKey:NSURLContentModificationDateKey];
+        NSNumber* size = [values objectForKey:NSURLFileSizeKey];
+        if (modified && size)
+        {
+            if (([modified compare:cutoff] == NSOrderedAscending) && [fm removeItemAtURL:file error:nil])
+            {
+                ++removed;
+            }
+            else
+            {
+                total += [size unsignedIntegerValue];
+                [entries addObject:[NSArray arrayWithObjects:modified, size, file, nil]];
+            }
+        }
+    }
+
+    if (total > maxBytes)
+    {
+        [entries sortUsingComparator:^NSComparisonResult(NSArray* e1, NSArray* e2) {
+            return [[e1 objectAtIndex:0] compare:[e2 objectAtIndex:0]];
+        }];
+
+        for (NSArray* entry in entries)
+        {
+            if (total <= maxBytes)
+            {
+                break;
+            }
+
+            if ([fm removeItemAtURL:[entry objectAtIndex:2] error:nil])
+            {
+                total -= [[entry objectAtIndex:1] unsignedIntegerValue];
+                ++removed;
+            }
+        }
+    }
+
+    self.bytesWritten = 0;
+    ECDebug(TwitterResponseCacheChannel, @"trimmed %ld responses from disk cache", (long) removed);
+}
+
+// --------------------------------------------------------------------------
+/// Throw away everything.
+// --------------------------------------------------------------------------
+
+- (void)removeAllResponses
+{
+    [self.memory removeAllObjects];
+
+    NSURL* url = self.url;
+    dispatch_async(self.queue, ^{
+        NSFileManager* fm = [NSFileManager defaultManager];
+        NSArray* files = [fm contentsOfDirectoryAtURL:url includingPropertiesForKeys:nil options:0 error:nil];
+        for (NSURL* file in files)
+        {
+            [fm removeItemAtURL:file error:nil];
+        }
+    });
+}
+
+@end
@@ -29,6 +29,7 @@
 @property (strong, nonatomic) ECTwitterID* maxID;
 
 - (void)fetchTweetsMatchingSearch:(NSString*)search;
+- (void)addLocalTweetsMatchingSearch:(NSString*)search;
 
 @end
 
@@ -75,14 +76,46 @@ ECDefineDebugChannel(TwitterSearchTimelineChannel);
 
 // --------------------------------------------------------------------------
 /// Refresh this timeline.
+/// We fill in whatever matches from the local index straight away, then
+/// merge in the results from twitter when they arrive.
 // --------------------------------------------------------------------------
 
 - (void)refresh
 {
     ECAssertNonNil(self.text);
+    [self addLocalTweetsMatchingSearch:self.text];
     [self fetchTweetsMatchingSearch:self.text];
 }
 
+// --------------------------------------------------------------------------
+/// Add any cached tweets that match the search.
+/// Only the newest matches that we'd keep are read in, so that a search
+/// that matches a lot of old tweets still comes back straight away.
+// --------------------------------------------------------------------------
+
+- (void)addLocalTweetsMatchingSearch:(NSString*)search
+{
+    NSArray* tweetIDs = [mCache tweetIDsMatchingSearch:search];
+    NSUInteger limit = self.maxCount;
+    if ((limit > 0) && ([tweetIDs count] > limit))
+    {
+        tweetIDs = [tweetIDs subarrayWithRange:NSMakeRange(0, limit)];
+    }
+
+    NSArray* tweets = [mCache tweetsWithSortedIDs:tweetIDs];
+    ECDebug(TwitterSearchTimelineChannel, @"found %ld local tweets for search %@", (long) [tweets count], search);
+    if ([tweets count] > 0)
+    {
+        for (ECTwitterTweet* tweet in tweets)
+        {
+            [self addTweet:tweet];
+        }
+
+        NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+        [nc postNotificationName: ECTwitterTimelineUpdated object: self];
+    }
+}
+
 // --------------------------------------------------------------------------
 /// Request user timeline - everything they've received
 // --------------------------------------------------------------------------
@@ -120,9 +153,9 @@ ECDefineDebugChannel(TwitterSearchTimelineChannel);
         self.maxID = [ECTwitterID idFromKey:@"max_id_str" dictionary:result];
         
         NSArray* results = [handler.result objectForKey:@"results"];
-		for (NSDictionary* tweetData in results)
+		NSArray* tweets = [mCache addOrRefreshTweets: results];
+		for (ECTwitterTweet* tweet in tweets)
 		{
-			ECTwitterTweet* tweet = [mCache addOrRefreshTweetWithInfo: tweetData];
 			[self addTweet: tweet];
 			
 			ECDebug(TwitterSearchTimelineChannel, @"tweet info received: %@", tweet);
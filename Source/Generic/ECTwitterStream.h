@@ -0,0 +1,62 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterUser;
+
+// --------------------------------------------------------------------------
+/// A long-lived streaming connection for a user.
+///
+/// The stream sends a continuous series of JSON messages, each one either
+/// preceded by a line giving its length, or on a line of its own. We split
+/// them up and parse them in the background as the data arrives, then add
+/// any tweets to the cache and to the user's timelines on the main thread.
+///
+/// If the connection drops, fails, or goes quiet for too long, we
+/// reconnect, waiting exponentially longer each time it happens in a row.
+///
+/// The stream keeps itself alive whilst it's running - call stop before
+/// releasing it.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterStream : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (strong, nonatomic, readonly) ECTwitterUser* user;
+@property (strong, nonatomic) NSURL* url;
+@property (assign, nonatomic) NSTimeInterval stallTimeout;
+@property (assign, nonatomic) NSTimeInterval minimumReconnectDelay;
+@property (assign, nonatomic) NSTimeInterval maximumReconnectDelay;
+
+// Status.
+@property (assign, nonatomic, readonly, getter = isRunning) BOOL running;
+@property (assign, nonatomic, readonly, getter = isConnected) BOOL connected;
+@property (assign, nonatomic, readonly) NSTimeInterval reconnectDelay;
+
+// Statistics.
+@property (assign, nonatomic, readonly) NSUInteger messagesReceived;
+@property (assign, nonatomic, readonly) NSUInteger tweetsReceived;
+@property (assign, nonatomic, readonly) NSUInteger reconnects;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)initWithUser:(ECTwitterUser*)user;
+
+- (void)start;
+- (void)stop;
+
+@end
+
+// --------------------------------------------------------------------------
+// Notifications
+// --------------------------------------------------------------------------
+
+extern NSString *const ECTwitterStreamConnected;
+extern NSString *const ECTwitterStreamDisconnected;
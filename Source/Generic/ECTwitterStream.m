@@ -0,0 +1,695 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterStream.h"
+
+#import "ECTwitterAuthentication.h"
+#import "ECTwitterCache.h"
+#import "ECTwitterConnection.h"
+#import "ECTwitterID.h"
+#import "ECTwitterParser.h"
+#import "ECTwitterTweet.h"
+#import "ECTwitterUser.h"
+#import "ECTwitterUserMentionsTimeline.h"
+#import "ECTwitterUserTimeline.h"
+
+#import "MGTwitterEngineDelegate.h"
+
+// --------------------------------------------------------------------------
+/// Splits the stream into messages, and parses them.
+/// Each connection gets its own reader, which is only used on the
+/// connection's parse queue. One parser is reused for all of the messages,
+/// so the keys it interns are shared across the whole stream.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterStreamReader : NSObject<MGTwitterEngineDelegate>
+
+@property (strong, nonatomic) NSMutableData* buffer;
+@property (strong, nonatomic) NSMutableArray* messages;
+@property (strong, nonatomic) ECTwitterParser* parser;
+@property (assign, nonatomic) NSUInteger expectedLength;
+@property (assign, nonatomic) NSUInteger keepAlives;
+
+- (NSArray*)messagesFromData:(NSData*)data;
+
+@end
+
+// --------------------------------------------------------------------------
+// Private Methods
+// --------------------------------------------------------------------------
+
+typedef enum
+{
+    StreamFailureNetwork,
+    StreamFailureHTTP,
+    StreamFailureRateLimited,
+} StreamFailure;
+
+@interface ECTwitterStream()
+
+@property (strong, nonatomic, readwrite) ECTwitterUser* user;
+@property (strong, nonatomic) ECTwitterConnection* connection;
+@property (strong, nonatomic) ECTwitterStreamReader* reader;
+@property (strong, nonatomic) NSTimer* stallTimer;
+@property (assign, nonatomic) NSTimeInterval lastActivity;
+@property (assign, nonatomic, readwrite) BOOL running;
+@property (assign, nonatomic, readwrite) BOOL connected;
+@property (assign, nonatomic, readwrite) NSTimeInterval reconnectDelay;
+@property (assign, nonatomic, readwrite) NSUInteger messagesReceived;
+@property (assign, nonatomic, readwrite) NSUInteger tweetsReceived;
+@property (assign, nonatomic, readwrite) NSUInteger reconnects;
+
+- (void)connect;
+- (void)disconnect;
+- (void)disconnectAfterFailure:(StreamFailure)failure;
+- (void)reconnect;
+- (void)checkForStall;
+- (void)addTweets:(NSArray*)infos;
+- (void)handleMessages:(NSArray*)messages;
+
+@end
+
+
+@implementation ECTwitterStream
+
+// --------------------------------------------------------------------------
+// Debug Channels
+// --------------------------------------------------------------------------
+
+ECDefineDebugChannel(TwitterStreamChannel);
+
+// --------------------------------------------------------------------------
+// Properties
+// --------------------------------------------------------------------------
+
+@synthesize connected = _connected;
+@synthesize connection = _connection;
+@synthesize lastActivity = _lastActivity;
+@synthesize maximumReconnectDelay = _maximumReconnectDelay;
+@synthesize messagesReceived = _messagesReceived;
+@synthesize minimumReconnectDelay = _minimumReconnectDelay;
+@synthesize reader = _reader;
+@synthesize reconnectDelay = _reconnectDelay;
+@synthesize reconnects = _reconnects;
+@synthesize running = _running;
+@synthesize stallTimeout = _stallTimeout;
+@synthesize stallTimer = _stallTimer;
+@synthesize tweetsReceived = _tweetsReceived;
+@synthesize url = _url;
+@synthesize user = _user;
+
+// --------------------------------------------------------------------------
+// Constants
+// --------------------------------------------------------------------------
+
+NSString *const ECTwitterStreamConnected = @"StreamConnected";
+NSString *const ECTwitterStreamDisconnected = @"StreamDisconnected";
+
+static NSString *const kDefaultURL = @"https://userstream.twitter.com/2/user.json?delimited=length";
+
+// twitter sends a keep-alive every 30 seconds, so if we've heard nothing
+// for three times that, the connection has probably gone
+static const NSTimeInterval kDefaultStallTimeout = 90.0;
+
+// how long to wait before reconnecting the first time, for each kind of
+// failure; we double it each time the same thing happens in a row
+static const NSTimeInterval kNetworkFailureDelay = 0.25;
+static const NSTimeInterval kHTTPFailureDelay = 5.0;
+static const NSTimeInterval kRateLimitedDelay = 60.0;
+static const NSTimeInterval kDefaultMaximumReconnectDelay = 320.0;
+
+// --------------------------------------------------------------------------
+// Lifecycle
+// --------------------------------------------------------------------------
+
+- (id)initWithUser:(ECTwitterUser*)user
+{
+    if ((self = [super init]) != nil)
+    {
+        self.user = user;
+        self.url = [NSURL URLWithString:kDefaultURL];
+        self.stallTimeout = kDefaultStallTimeout;
+        self.minimumReconnectDelay = kNetworkFailureDelay;
+        self.maximumReconnectDelay = kDefaultMaximumReconnectDelay;
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    ECAssert(!_running);
+
+    [_connection release];
+    [_reader release];
+    [_stallTimer release];
+    [_url release];
+    [_user release];
+
+    [super dealloc];
+}
+
+- (NSString*)description
+{
+    return [NSString stringWithFormat:@"<ECTwitterStream: %@ %@ messages:%ld reconnects:%ld>", self.user.twitterName, self.connected ? @"connected" : @"disconnected", (long) self.messagesReceived, (long) self.reconnects];
+}
+
+// --------------------------------------------------------------------------
+// Control
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Start streaming.
+/// Should be called on the main thread.
+// --------------------------------------------------------------------------
+
+- (void)start
+{
+    if (!self.running)
+    {
+        self.running = YES;
+        self.reconnectDelay = 0;
+
+        NSTimeInterval interval = self.stallTimeout / 4.0;
+        self.stallTimer = [NSTimer scheduledTimerWithTimeInterval:interval target:self selector:@selector(checkForStall) userInfo:nil repeats:YES];
+
+        [self connect];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Stop streaming, and don't reconnect.
+// --------------------------------------------------------------------------
+
+- (void)stop
+{
+    if (self.running)
+    {
+        self.running = NO;
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(reconnect) object:nil];
+        [self.stallTimer invalidate];
+        self.stallTimer = nil;
+        [self disconnect];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Open a new connection.
+// --------------------------------------------------------------------------
+
+- (void)connect
+{
+    ECAssert(self.connection == nil);
+
+    NSMutableURLRequest* request;
+    ECTwitterAuthentication* authentication = self.user.authentication;
+    if (authentication)
+    {
+        request = [authentication requestForURL:self.url];
+    }
+    else
+    {
+        request = [NSMutableURLRequest requestWithURL:self.url];
+    }
+    [request setCachePolicy:NSURLRequestReloadIgnoringCacheData];
+    [request setTimeoutInterval:self.stallTimeout];
+    [request setHTTPShouldHandleCookies:NO];
+
+    ECDebug(TwitterStreamChannel, @"connecting to %@", self.url);
+
+    ECTwitterStreamReader* reader = [[ECTwitterStreamReader alloc] init];
+    self.reader = reader;
+    [reader release];
+
+    self.lastActivity = [NSDate timeIntervalSinceReferenceDate];
+    ECTwitterConnection* connection = [[ECTwitterConnection alloc] initWithRequest:request delegate:self];
+    self.connection = connection;
+    [connection release];
+}
+
+// --------------------------------------------------------------------------
+/// Drop the current connection.
+/// Anything still being parsed for it is thrown away.
+// --------------------------------------------------------------------------
+
+- (void)disconnect
+{
+    if (self.connection)
+    {
+        [self.connection cancel];
+        self.connection = nil;
+        self.reader = nil;
+
+        if (self.connected)
+        {
+            self.connected = NO;
+            [[NSNotificationCenter defaultCenter] postNotificationName:ECTwitterStreamDisconnected object:self];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Drop the current connection, and try again after a while.
+/// The wait starts off depending on what went wrong, and doubles each
+/// time we fail without receiving anything in between.
+// --------------------------------------------------------------------------
+
+- (void)disconnectAfterFailure:(StreamFailure)failure
+{
+    [self disconnect];
+
+    if (self.running)
+    {
+        NSTimeInterval initial;
+        switch (failure)
+        {
+            case StreamFailureHTTP:
+                initial = kHTTPFailureDelay;
+                break;
+
+            case StreamFailureRateLimited:
+                initial = kRateLimitedDelay;
+                break;
+
+            default:
+                initial = self.minimumReconnectDelay;
+                break;
+        }
+
+        NSTimeInterval delay = self.reconnectDelay * 2.0;
+        delay = MAX(delay, MAX(initial, self.minimumReconnectDelay));
+        delay = MIN(delay, self.maximumReconnectDelay);
+        self.reconnectDelay = delay;
+
+        ECDebug(TwitterStreamChannel, @"reconnecting in %lfs", delay);
+        [self performSelector:@selector(reconnect) withObject:nil afterDelay:delay];
+    }
+}
+
+- (void)reconnect
+{
+    if (self.running)
+    {
+        ++self.reconnects;
+        [self connect];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Called regularly whilst we're running.
+/// If we're connected but haven't heard anything for a while, we assume
+/// the connection has died without telling us.
+// --------------------------------------------------------------------------
+
+- (void)checkForStall
+{
+    if (self.connection && ([NSDate timeIntervalSinceReferenceDate] - self.lastActivity > self.stallTimeout))
+    {
+        ECDebug(TwitterStreamChannel, @"stream stalled");
+        [self disconnectAfterFailure:StreamFailureNetwork];
+    }
+}
+
+// --------------------------------------------------------------------------
+// Messages
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Does some tweet info mention a user?
+/// We go by the IDs in the entities, since names can change, and fall
+/// back on the names the tweet found in its text if there aren't any.
+// --------------------------------------------------------------------------
+
+static BOOL infoMentionsUser(NSDictionary* info, ECTwitterTweet* tweet, ECTwitterUser* user)
+{
+    NSArray* mentions = [[info objectForKey:@"entities"] objectForKey:@"user_mentions"];
+    if ([mentions isKindOfClass:[NSArray class]])
+    {
+        for (NSDictionary* mention in mentions)
+        {
+            if ([ECTwitterID idFromDictionary:mention] == user.twitterID)
+            {
+                return YES;
+            }
+        }
+
+        return NO;
+    }
+
+    return [tweet mentionsUser:user];
+}
+
+// --------------------------------------------------------------------------
+/// Add some tweets from the stream to the cache together, then to the
+/// user's timelines.
+// --------------------------------------------------------------------------
+
+- (void)addTweets:(NSArray*)infos
+{
+    if ([infos count])
+    {
+        ECTwitterUser* user = self.user;
+        ECTwitterID* userID = user.twitterID;
+        NSUInteger index = 0;
+        for (ECTwitterTweet* tweet in [user.cache addOrRefreshTweets:infos])
+        {
+            [user.timeline addTweet:tweet];
+            if (tweet.authorID == userID)
+            {
+                [user.posts addTweet:tweet];
+            }
+            if (infoMentionsUser([infos objectAtIndex:index++], tweet, user))
+            {
+                [user.mentions addTweet:tweet];
+            }
+        }
+
+        self.tweetsReceived += [infos count];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Deal with a batch of parsed messages.
+/// Runs of tweets are added in one go. Deletions are taken out of the
+/// timelines - after adding any tweets before them, since a tweet can be
+/// deleted in the same batch that it arrived in. Anything else is ignored.
+// --------------------------------------------------------------------------
+
+- (void)handleMessages:(NSArray*)messages
+{
+    ECTwitterUser* user = self.user;
+    NSArray* timelines = [NSArray arrayWithObjects:user.timeline, user.posts, user.mentions, nil];
+    NSMutableArray* counts = [NSMutableArray arrayWithCapacity:[timelines count]];
+    for (ECTwitterTimeline* timeline in timelines)
+    {
+        [counts addObject:[NSNumber numberWithUnsignedInteger:[timeline count]]];
+    }
+
+    NSMutableArray* infos = [NSMutableArray arrayWithCapacity:[messages count]];
+    for (NSDictionary* message in messages)
+    {
+        NSDictionary* deletion;
+        if ([message objectForKey:@"text"] && [message objectForKey:@"user"])
+        {
+            [infos addObject:message];
+        }
+        else if ((deletion = [[message objectForKey:@"delete"] objectForKey:@"status"]) != nil)
+        {
+            [self addTweets:infos];
+            [infos removeAllObjects];
+
+            ECTwitterTweet* tweet = [user.cache existingTweetWithID:[ECTwitterID idFromDictionary:deletion]];
+            if (tweet)
+            {
+                for (ECTwitterTimeline* timeline in timelines)
+                {
+                    [timeline removeTweet:tweet];
+                }
+            }
+        }
+        else
+        {
+            ECDebug(TwitterStreamChannel, @"ignored stream message with keys %@", [message allKeys]);
+        }
+    }
+
+    [self addTweets:infos];
+    self.messagesReceived += [messages count];
+
+    NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+    NSUInteger index = 0;
+    for (ECTwitterTimeline* timeline in timelines)
+    {
+        if ([timeline count] != [[counts objectAtIndex:index++] unsignedIntegerValue])
+        {
+            [nc postNotificationName:ECTwitterTimelineUpdated object:timeline];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+// NSURLConnection Delegate
+// --------------------------------------------------------------------------
+
+- (void)connection:(NSURLConnection*)connection didReceiveResponse:(NSURLResponse*)response
+{
+    NSInteger status = [response isKindOfClass:[NSHTTPURLResponse class]] ? [(NSHTTPURLResponse*) response statusCode] : 200;
+    if (status == 200)
+    {
+        ECDebug(TwitterStreamChannel, @"connected to %@", self.url);
+        self.connected = YES;
+        [[NSNotificationCenter defaultCenter] postNotificationName:ECTwitterStreamConnected object:self];
+    }
+    else
+    {
+        ECDebug(TwitterStreamChannel, @"stream refused with status %ld", (long) status);
+        BOOL limited = (status == 420) || (status == 429);
+        [self disconnectAfterFailure:limited ? StreamFailureRateLimited : StreamFailureHTTP];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Hand new data to the reader, in the background.
+/// Hearing anything at all - even a keep-alive - means that the connection
+/// is working, so we stop backing off.
+// --------------------------------------------------------------------------
+
+- (void)connection:(NSURLConnection*)connection didReceiveData:(NSData*)data
+{
+    self.lastActivity = [NSDate timeIntervalSinceReferenceDate];
+    self.reconnectDelay = 0;
+
+    ECTwitterConnection* streamConnection = self.connection;
+    ECTwitterStreamReader* reader = self.reader;
+    dispatch_async(streamConnection.parseQueue, ^{
+        NSArray* messages = [reader messagesFromData:data];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (streamConnection == self.connection)
+            {
+                if (!messages)
+                {
+                    ECDebug(TwitterStreamChannel, @"lost track of the message boundaries");
+                    [self disconnectAfterFailure:StreamFailureNetwork];
+                }
+                else if ([messages count])
+                {
+                    [self handleMessages:messages];
+                }
+            }
+        });
+    });
+}
+
+// --------------------------------------------------------------------------
+/// The server ended the stream.
+/// We wait for anything still being parsed to be dealt with first.
+// --------------------------------------------------------------------------
+
+- (void)connectionDidFinishLoading:(NSURLConnection*)connection
+{
+    ECDebug(TwitterStreamChannel, @"stream ended");
+    ECTwitterConnection* streamConnection = self.connection;
+    dispatch_async(streamConnection.parseQueue, ^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (streamConnection == self.connection)
+            {
+                [self disconnectAfterFailure:StreamFailureNetwork];
+            }
+        });
+    });
+}
+
+- (void)connection:(NSURLConnection*)connection didFailWithError:(NSError*)error
+{
+    ECDebug(TwitterStreamChannel, @"stream failed with error %@", error);
+    [self disconnectAfterFailure:StreamFailureNetwork];
+}
+
+@end
+
+
+@implementation ECTwitterStreamReader
+
+// --------------------------------------------------------------------------
+// Properties
+// --------------------------------------------------------------------------
+
+@synthesize buffer = _buffer;
+@synthesize expectedLength = _expectedLength;
+@synthesize keepAlives = _keepAlives;
+@synthesize messages = _messages;
+@synthesize parser = _parser;
+
+// --------------------------------------------------------------------------
+// Constants
+// --------------------------------------------------------------------------
+
+// anything claiming to be bigger than this means we've got out of step
+static const NSUInteger kMaximumMessageLength = 1024 * 1024;
+
+// --------------------------------------------------------------------------
+// Lifecycle
+// --------------------------------------------------------------------------
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:self options:MGTwitterEngineDeliveryIndividualResultsOption];
+        self.parser = parser;
+        [parser release];
+
+        self.buffer = [NSMutableData data];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_buffer release];
+    [_messages release];
+    [_parser release];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+// Framing
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Parse a single message.
+/// The bytes aren't copied, so they must stay put until we return.
+// --------------------------------------------------------------------------
+
+- (void)parseBytes:(const uint8_t*)bytes length:(NSUInteger)length
+{
+    NSData* message = [[NSData alloc] initWithBytesNoCopy:(void*) bytes length:length freeWhenDone:NO];
+    [self.parser parseData:message identifier:@"stream"];
+    [message release];
+}
+
+// --------------------------------------------------------------------------
+/// Add some data from the stream, and return any messages it completes.
+///
+/// A line with just a number on it gives the length of the message that
+/// follows (including its line ending). Any other line with something on
+/// it is a message in its own right. Empty lines are keep-alives.
+///
+/// Returns nil if the framing is broken, in which case the connection
+/// should be dropped.
+// --------------------------------------------------------------------------
+
+- (NSArray*)messagesFromData:(NSData*)data
+{
+    self.messages = [NSMutableArray array];
+
+    NSMutableData* buffer = self.buffer;
+    [buffer appendData:data];
+
+    const uint8_t* bytes = [buffer bytes];
+    NSUInteger length = [buffer length];
+    NSUInteger offset = 0;
+    BOOL broken = NO;
+    while (!broken && (offset < length))
+    {
+        NSUInteger expected = self.expectedLength;
+        if (expected)
+        {
+            if (length - offset < expected)
+            {
+                break;
+            }
+
+            [self parseBytes:bytes + offset length:expected];
+            offset += expected;
+            self.expectedLength = 0;
+        }
+        else
+        {
+            const uint8_t* newline = memchr(bytes + offset, '\n', length - offset);
+            if (!newline)
+            {
+                broken = (length - offset) > kMaximumMessageLength;
+                break;
+            }
+
+            NSUInteger lineStart = offset;
+            NSUInteger lineEnd = (NSUInteger) (newline - bytes);
+            offset = lineEnd + 1;
+            if ((lineEnd > lineStart) && (bytes[lineEnd - 1] == '\r'))
+            {
+                --lineEnd;
+            }
+
+            BOOL digits = (lineEnd > lineStart);
+            NSUInteger value = 0;
+            for (NSUInteger n = lineStart; digits && (n < lineEnd); ++n)
+            {
+                uint8_t c = bytes[n];
+                digits = (c >= '0') && (c <= '9');
+                if (value <= kMaximumMessageLength)
+                {
+                    value = (value * 10) + (c - '0');
+                }
+            }
+
+            if (lineEnd == lineStart)
+            {
+                ++self.keepAlives;
+            }
+            else if (digits)
+            {
+                broken = value > kMaximumMessageLength;
+                self.expectedLength = value;
+            }
+            else
+            {
+                [self parseBytes:bytes + lineStart length:lineEnd - lineStart];
+            }
+        }
+    }
+
+    [buffer replaceBytesInRange:NSMakeRange(0, offset) withBytes:NULL length:0];
+
+    NSArray* result = broken ? nil : [[self.messages retain] autorelease];
+    self.messages = nil;
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+// Parser Delegate
+// --------------------------------------------------------------------------
+
+- (void)receivedObject:(NSDictionary*)dictionary forRequest:(NSString*)connectionIdentifier
+{
+    if ([dictionary isKindOfClass:[NSDictionary class]])
+    {
+        [self.messages addObject:dictionary];
+    }
+}
+
+- (void)genericResultsReceived:(NSArray*)genericResults forRequest:(NSString*)connectionIdentifier
+{
+}
+
+- (void)requestSucceeded:(NSString*)connectionIdentifier
+{
+}
+
+// --------------------------------------------------------------------------
+/// A message didn't parse.
+/// We skip it - the framing tells us where the next one starts.
+// --------------------------------------------------------------------------
+
+- (void)requestFailed:(NSString*)connectionIdentifier withError:(NSError*)error
+{
+    ECDebug(TwitterStreamChannel, @"skipped a message that didn't parse: %@", error);
+}
+
+@end
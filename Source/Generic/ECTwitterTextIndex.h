@@ -0,0 +1,59 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+@class ECTwitterID;
+
+// --------------------------------------------------------------------------
+/// Full text index of the tweets in the cache.
+///
+/// Text is split into words, which are case and diacritic folded. For each
+/// word we keep a posting list of the tweets that contain it, in ID order,
+/// along with where in each tweet the word appears. The lists are stored
+/// delta encoded, as variable length integers, so a typical posting takes
+/// a few bytes.
+///
+/// Queries are made up of words and "quoted phrases", which must all match.
+/// Terms can be joined with OR, and a term starting with - excludes tweets
+/// that match it.
+///
+/// The index is written to its own file, and read back in one go when it's
+/// loaded. Most saves just append the changes since the last save to a log
+/// next to it, which is applied after the index is loaded; the whole index
+/// is only written again once the log has grown big enough.
+///
+/// Removed tweets are noted rather than taken out of the posting lists
+/// straight away, and skipped when searching. The lists are compacted when
+/// the whole index is written.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTextIndex : NSObject
+
+// --------------------------------------------------------------------------
+// Public Properties
+// --------------------------------------------------------------------------
+
+@property (strong, nonatomic, readonly) NSURL* url;
+@property (assign, nonatomic, readonly) NSUInteger documentCount;
+@property (assign, nonatomic, readonly) NSUInteger termCount;
+@property (assign, nonatomic, readonly) NSUInteger postingBytes;
+
+// --------------------------------------------------------------------------
+// Public Methods
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url;
+
+- (BOOL)containsDocumentWithID:(ECTwitterID*)documentID;
+- (void)addDocumentWithID:(ECTwitterID*)documentID text:(NSString*)text;
+- (void)removeDocumentWithID:(ECTwitterID*)documentID;
+- (NSArray*)documentIDsMatchingQuery:(NSString*)query;
+
+- (void)save;
+- (void)load;
+
++ (NSArray*)wordsInText:(NSString*)text;
+
+@end
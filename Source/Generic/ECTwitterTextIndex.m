@@ -0,0 +1,1379 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterTextIndex.h"
+#import "ECTwitterID.h"
+
+// ==============================================
+// Posting Lists
+// ==============================================
+
+// --------------------------------------------------------------------------
+/// The tweets that a word appears in.
+///
+/// Each posting is the difference between its tweet ID and the previous
+/// one, followed by the number of times the word appears, and the word
+/// positions, each relative to the one before. Everything is written as
+/// a variable length integer.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTextPostings : NSObject
+
+@property (strong, nonatomic) NSMutableData* data;
+@property (assign, nonatomic) uint64_t lastID;
+@property (assign, nonatomic) NSUInteger count;
+
+@end
+
+@implementation ECTwitterTextPostings
+
+@synthesize data = _data;
+@synthesize lastID = _lastID;
+@synthesize count = _count;
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        _data = [[NSMutableData alloc] init];
+    }
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [_data release];
+
+    [super dealloc];
+}
+
+@end
+
+// --------------------------------------------------------------------------
+/// A position in a posting list.
+// --------------------------------------------------------------------------
+
+typedef struct
+{
+    const uint8_t* next;
+    const uint8_t* end;
+    uint64_t identifier;
+    const uint8_t* tail;
+    const uint8_t* positions;
+    uint64_t positionCount;
+} ECTwitterTextCursor;
+
+// --------------------------------------------------------------------------
+/// The header for each set of changes appended to the log.
+// --------------------------------------------------------------------------
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t length;
+} ECTwitterTextLogHeader;
+
+typedef enum
+{
+    LogAdded = 1,
+    LogRemoved = 2
+} ECTwitterTextLogChange;
+
+// ==============================================
+// Private Methods
+// ==============================================
+
+#pragma mark -
+#pragma mark Private Methods
+
+@interface ECTwitterTextIndex()
+
+@property (strong, nonatomic, readwrite) NSURL* url;
+@property (strong, nonatomic) NSMutableDictionary* terms;
+@property (strong, nonatomic) NSMutableSet* documents;
+@property (strong, nonatomic) NSMutableSet* removed;
+@property (strong, nonatomic) NSMutableDictionary* readded;
+@property (strong, nonatomic) NSMutableData* log;
+@property (assign, nonatomic) BOOL changed;
+@property (assign, nonatomic) BOOL needsSnapshot;
+@property (assign, nonatomic) uint32_t generation;
+@property (assign, nonatomic) unsigned long long logBytes;
+@property (assign, nonatomic) NSUInteger snapshotBytes;
+@property (assign, nonatomic) dispatch_queue_t queue;
+
+- (void)indexDocumentWithID:(ECTwitterID*)documentID text:(NSString*)text;
+- (void)forgetDocumentWithID:(ECTwitterID*)documentID;
+- (void)compact;
+- (NSURL*)logURL;
+- (uint64_t)replayLog:(NSData*)data;
+- (NSData*)matchesForWords:(NSArray*)words;
+- (NSData*)archivedData;
+- (BOOL)readArchivedData:(NSData*)data;
+
+@end
+
+
+@implementation ECTwitterTextIndex
+
+// ==============================================
+// Debug Channels
+// ==============================================
+
+ECDefineDebugChannel(TwitterTextIndexChannel);
+
+// ==============================================
+// Properties
+// ==============================================
+
+#pragma mark -
+#pragma mark Properties
+
+@synthesize changed = _changed;
+@synthesize documents = _documents;
+@synthesize generation = _generation;
+@synthesize log = _log;
+@synthesize logBytes = _logBytes;
+@synthesize needsSnapshot = _needsSnapshot;
+@synthesize queue = _queue;
+@synthesize readded = _readded;
+@synthesize removed = _removed;
+@synthesize snapshotBytes = _snapshotBytes;
+@synthesize terms = _terms;
+@synthesize url = _url;
+
+// ==============================================
+// Constants
+// ==============================================
+
+#pragma mark -
+#pragma mark Constants
+
+static const uint32_t kFileMagic = 'ECTX';
+static const uint32_t kFileVersion = 2;
+static const uint32_t kLogMagic = 'ECTL';
+
+// the log of changes is left to grow to at least this size, or half the
+// size of the saved index, before the index is saved in full again
+static const unsigned long long kMinLogBytes = 256 * 1024;
+
+// the most removed tweets whose postings we'll leave in the lists
+static const NSUInteger kMaxTombstones = 1024;
+
+// ==============================================
+// Lifecycle
+// ==============================================
+
+#pragma mark -
+#pragma mark Methods
+
+// --------------------------------------------------------------------------
+/// Set up an empty index, which will be saved to the given location.
+// --------------------------------------------------------------------------
+
+- (id)initWithURL:(NSURL*)url
+{
+    if ((self = [super init]) != nil)
+    {
+        self.url = url;
+        self.terms = [NSMutableDictionary dictionary];
+        self.documents = [NSMutableSet set];
+        self.removed = [NSMutableSet set];
+        self.readded = [NSMutableDictionary dictionary];
+        self.log = [NSMutableData data];
+        self.needsSnapshot = YES;
+        self.queue = dispatch_queue_create("com.elegantchaos.ectwitter.textindex", DISPATCH_QUEUE_SERIAL);
+    }
+
+    return self;
+}
+
+// --------------------------------------------------------------------------
+/// Clean up, making sure any pending write has finished first.
+// --------------------------------------------------------------------------
+
+- (void)dealloc
+{
+    if (_queue)
+    {
+        dispatch_sync(_queue, ^{});
+        dispatch_release(_queue);
+    }
+
+    [_documents release];
+    [_log release];
+    [_readded release];
+    [_removed release];
+    [_terms release];
+    [_url release];
+
+    [super dealloc];
+}
+
+// --------------------------------------------------------------------------
+/// Statistics.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)documentCount
+{
+    return [self.documents count];
+}
+
+- (NSUInteger)termCount
+{
+    return [self.terms count];
+}
+
+- (NSUInteger)postingBytes
+{
+    NSUInteger result = 0;
+    for (ECTwitterTextPostings* postings in [self.terms objectEnumerator])
+    {
+        result += [postings.data length];
+    }
+
+    return result;
+}
+
+// ==============================================
+// Encoding
+// ==============================================
+
+#pragma mark -
+#pragma mark Encoding
+
+// --------------------------------------------------------------------------
+/// Append a variable length integer - seven bits per byte, low bits first.
+// --------------------------------------------------------------------------
+
+static void appendVarint(NSMutableData* data, uint64_t value)
+{
+    uint8_t buffer[10];
+    NSUInteger length = 0;
+    while (value >= 0x80)
+    {
+        buffer[length++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t) value;
+    [data appendBytes:buffer length:length];
+}
+
+// --------------------------------------------------------------------------
+/// Read a variable length integer.
+/// Returns NULL if we run off the end.
+// --------------------------------------------------------------------------
+
+static const uint8_t* readVarint(const uint8_t* next, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    NSUInteger shift = 0;
+    while (next && (next < end))
+    {
+        uint8_t byte = *next++;
+        result |= ((uint64_t) (byte & 0x7F)) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return next;
+        }
+
+        shift += 7;
+        if (shift > 63)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// --------------------------------------------------------------------------
+/// Start walking through a posting list.
+// --------------------------------------------------------------------------
+
+static void startCursor(ECTwitterTextCursor* cursor, NSData* data)
+{
+    cursor->next = [data bytes];
+    cursor->end = cursor->next + [data length];
+    cursor->identifier = 0;
+}
+
+// --------------------------------------------------------------------------
+/// Move on to the next posting.
+/// Returns NO at the end of the list.
+// --------------------------------------------------------------------------
+
+static BOOL nextPosting(ECTwitterTextCursor* cursor)
+{
+    uint64_t delta = 0;
+    const uint8_t* next = readVarint(cursor->next, cursor->end, &delta);
+    if (!next)
+    {
+        return NO;
+    }
+
+    cursor->identifier += delta;
+    cursor->tail = next;
+    next = readVarint(next, cursor->end, &cursor->positionCount);
+    cursor->positions = next;
+    for (uint64_t n = 0; next && (n < cursor->positionCount); ++n)
+    {
+        uint64_t ignored = 0;
+        next = readVarint(next, cursor->end, &ignored);
+    }
+    cursor->next = next;
+
+    return next != NULL;
+}
+
+// --------------------------------------------------------------------------
+/// Does the current posting have the word at a given position?
+// --------------------------------------------------------------------------
+
+static BOOL cursorHasPosition(const ECTwitterTextCursor* cursor, uint64_t position)
+{
+    const uint8_t* next = cursor->positions;
+    uint64_t current = 0;
+    for (uint64_t n = 0; next && (n < cursor->positionCount); ++n)
+    {
+        uint64_t delta = 0;
+        next = readVarint(next, cursor->end, &delta);
+        current += delta;
+        if (current >= position)
+        {
+            return current == position;
+        }
+    }
+
+    return NO;
+}
+
+// --------------------------------------------------------------------------
+/// Write a posting.
+/// The positions are given as a flat array of 32 bit integers, in order.
+// --------------------------------------------------------------------------
+
+static void appendPosting(NSMutableData* data, uint64_t previous, uint64_t identifier, NSData* positions)
+{
+    const uint32_t* position = [positions bytes];
+    NSUInteger count = [positions length] / sizeof(uint32_t);
+    appendVarint(data, identifier - previous);
+    appendVarint(data, count);
+    uint32_t last = 0;
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        appendVarint(data, position[n] - last);
+        last = position[n];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Copy the posting under a cursor, relative to a new previous ID.
+// --------------------------------------------------------------------------
+
+static void copyPosting(NSMutableData* data, uint64_t previous, const ECTwitterTextCursor* cursor)
+{
+    appendVarint(data, cursor->identifier - previous);
+    [data appendBytes:cursor->tail length:(NSUInteger) (cursor->next - cursor->tail)];
+}
+
+// --------------------------------------------------------------------------
+/// Is the posting under a cursor left over from before its tweet was
+/// removed and added again?
+/// For tweets that have been added again, we know which words they have
+/// now; the posting is current if it's for one of those words, and it's
+/// the last one for the tweet in the list (since a tweet's postings are
+/// added after any that are already there).
+// --------------------------------------------------------------------------
+
+static BOOL isSupersededPosting(const ECTwitterTextCursor* cursor, NSString* word, NSDictionary* readded)
+{
+    if ([readded count] == 0)
+    {
+        return NO;
+    }
+
+    NSSet* words = [readded objectForKey:[ECTwitterID idFromValue:cursor->identifier]];
+    if (!words)
+    {
+        return NO;
+    }
+
+    if (![words containsObject:word])
+    {
+        return YES;
+    }
+
+    ECTwitterTextCursor following = *cursor;
+
+    return nextPosting(&following) && (following.identifier == cursor->identifier);
+}
+
+// --------------------------------------------------------------------------
+/// Move on to the next posting that isn't superseded.
+/// Returns NO at the end of the list.
+// --------------------------------------------------------------------------
+
+static BOOL nextCurrentPosting(ECTwitterTextCursor* cursor, NSString* word, NSDictionary* readded)
+{
+    while (nextPosting(cursor))
+    {
+        if (!isSupersededPosting(cursor, word, readded))
+        {
+            return YES;
+        }
+    }
+
+    return NO;
+}
+
+// ==============================================
+// Words
+// ==============================================
+
+#pragma mark -
+#pragma mark Words
+
+// --------------------------------------------------------------------------
+/// Is a character part of a word?
+// --------------------------------------------------------------------------
+
+static inline BOOL isWordCharacter(unichar c)
+{
+    if (c < 0x80)
+    {
+        return ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '_') || ((c >= 'A') && (c <= 'Z'));
+    }
+
+    static CFCharacterSetRef alphanumerics = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        alphanumerics = CFCharacterSetGetPredefined(kCFCharacterSetAlphaNumeric);
+    });
+
+    return CFCharacterSetIsCharacterMember(alphanumerics, c);
+}
+
+// --------------------------------------------------------------------------
+/// Split some text into case and diacritic folded words, calling a block
+/// with each word and its position.
+/// Punctuation, including the @ and # of mentions and hashtags, is dropped.
+// --------------------------------------------------------------------------
+
+static void enumerateWords(NSString* text, void (^block)(NSString* word, uint32_t position))
+{
+    if (!text)
+    {
+        return;
+    }
+
+    NSMutableString* folded = [text mutableCopy];
+    CFStringFold((CFMutableStringRef) folded, kCFCompareCaseInsensitive | kCFCompareDiacriticInsensitive | kCFCompareWidthInsensitive, NULL);
+
+    NSUInteger length = [folded length];
+    unichar stackBuffer[512];
+    unichar* chars = (length <= 512) ? stackBuffer : malloc(length * sizeof(unichar));
+    [folded getCharacters:chars range:NSMakeRange(0, length)];
+
+    uint32_t position = 0;
+    NSUInteger n = 0;
+    while (n < length)
+    {
+        while ((n < length) && !isWordCharacter(chars[n]))
+        {
+            ++n;
+        }
+
+        NSUInteger start = n;
+        while ((n < length) && isWordCharacter(chars[n]))
+        {
+            ++n;
+        }
+
+        if (n > start)
+        {
+            NSString* word = [[NSString alloc] initWithCharacters:chars + start length:n - start];
+            block(word, position++);
+            [word release];
+        }
+    }
+
+    if (chars != stackBuffer)
+    {
+        free(chars);
+    }
+    [folded release];
+}
+
+// --------------------------------------------------------------------------
+/// Return the words in some text, in the form that they're indexed.
+// --------------------------------------------------------------------------
+
++ (NSArray*)wordsInText:(NSString*)text
+{
+    NSMutableArray* result = [NSMutableArray array];
+    enumerateWords(text, ^(NSString* word, uint32_t position) {
+        [result addObject:word];
+    });
+
+    return result;
+}
+
+// ==============================================
+// Updating
+// ==============================================
+
+#pragma mark -
+#pragma mark Updating
+
+// --------------------------------------------------------------------------
+/// Has a tweet been indexed?
+// --------------------------------------------------------------------------
+
+- (BOOL)containsDocumentWithID:(ECTwitterID*)documentID
+{
+    return [self.documents containsObject:documentID];
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet to the index.
+/// The change is noted in the log, to be saved with the next save.
+// --------------------------------------------------------------------------
+
+- (void)addDocumentWithID:(ECTwitterID*)documentID text:(NSString*)text
+{
+    if (documentID && text && ![self.documents containsObject:documentID])
+    {
+        [self indexDocumentWithID:documentID text:text];
+
+        NSData* utf8 = [text dataUsingEncoding:NSUTF8StringEncoding];
+        NSMutableData* log = self.log;
+        appendVarint(log, LogAdded);
+        appendVarint(log, documentID.value);
+        appendVarint(log, [utf8 length]);
+        [log appendData:utf8];
+        self.changed = YES;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet's postings to the lists for its words.
+///
+/// New tweets almost always have a higher ID than anything already in the
+/// index, so their postings can just be appended. Backfilled tweets
+/// have to be merged in to the right place, which means rewriting
+/// the posting lists for their words.
+///
+/// If the tweet was removed and is now being added again, its old
+/// postings are still in the lists. Rather than rewriting every list to
+/// get rid of them, we remember which words it has now, so that the old
+/// ones can be skipped, and leave them to be dropped when the lists are
+/// next compacted.
+// --------------------------------------------------------------------------
+
+- (void)indexDocumentWithID:(ECTwitterID*)documentID text:(NSString*)text
+{
+    if (![self.documents containsObject:documentID])
+    {
+        NSMutableDictionary* words = [NSMutableDictionary dictionary];
+        enumerateWords(text, ^(NSString* word, uint32_t position) {
+            NSMutableData* positions = [words objectForKey:word];
+            if (!positions)
+            {
+                positions = [NSMutableData dataWithCapacity:sizeof(uint32_t)];
+                [words setObject:positions forKey:word];
+            }
+            [positions appendBytes:&position length:sizeof(position)];
+        });
+
+        uint64_t identifier = documentID.value;
+        NSMutableDictionary* terms = self.terms;
+        for (NSString* word in words)
+        {
+            NSData* positions = [words objectForKey:word];
+            ECTwitterTextPostings* postings = [terms objectForKey:word];
+            if (!postings)
+            {
+                postings = [[ECTwitterTextPostings alloc] init];
+                [terms setObject:postings forKey:word];
+                [postings release];
+            }
+
+            if ((postings.count == 0) || (identifier > postings.lastID))
+            {
+                appendPosting(postings.data, postings.lastID, identifier, positions);
+                postings.lastID = identifier;
+            }
+            else
+            {
+                NSData* old = postings.data;
+                NSMutableData* merged = [[NSMutableData alloc] initWithCapacity:[old length] + 8];
+                ECTwitterTextCursor cursor;
+                startCursor(&cursor, old);
+                uint64_t previous = 0;
+                BOOL inserted = NO;
+                while (nextPosting(&cursor))
+                {
+                    if (!inserted && (cursor.identifier > identifier))
+                    {
+                        appendPosting(merged, previous, identifier, positions);
+                        previous = identifier;
+                        inserted = YES;
+                    }
+                    copyPosting(merged, previous, &cursor);
+                    previous = cursor.identifier;
+                }
+                if (!inserted)
+                {
+                    appendPosting(merged, previous, identifier, positions);
+                    postings.lastID = identifier;
+                }
+                postings.data = merged;
+                [merged release];
+            }
+            ++postings.count;
+        }
+
+        [self.documents addObject:documentID];
+        if ([self.removed containsObject:documentID])
+        {
+            [self.removed removeObject:documentID];
+            [self.readded setObject:[NSSet setWithArray:[words allKeys]] forKey:documentID];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Remove a tweet from the index.
+/// The change is noted in the log, to be saved with the next save.
+// --------------------------------------------------------------------------
+
+- (void)removeDocumentWithID:(ECTwitterID*)documentID
+{
+    if ([self.documents containsObject:documentID])
+    {
+        [self forgetDocumentWithID:documentID];
+
+        NSMutableData* log = self.log;
+        appendVarint(log, LogRemoved);
+        appendVarint(log, documentID.value);
+        self.changed = YES;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Note that a tweet has gone.
+/// We don't know which words it had, so rather than searching every
+/// posting list, we just note that it's gone. The lists are cleaned up
+/// the next time that they're compacted.
+// --------------------------------------------------------------------------
+
+- (void)forgetDocumentWithID:(ECTwitterID*)documentID
+{
+    if ([self.documents containsObject:documentID])
+    {
+        [self.documents removeObject:documentID];
+        [self.readded removeObjectForKey:documentID];
+        [self.removed addObject:documentID];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Rewrite the posting lists without any tweets that have been removed,
+/// or postings that have been superseded.
+// --------------------------------------------------------------------------
+
+- (void)compact
+{
+    NSSet* removed = self.removed;
+    NSDictionary* readded = self.readded;
+    if (([removed count] > 0) || ([readded count] > 0))
+    {
+        NSMutableArray* emptyTerms = [NSMutableArray array];
+        NSMutableDictionary* terms = self.terms;
+        for (NSString* word in terms)
+        {
+            ECTwitterTextPostings* postings = [terms objectForKey:word];
+            NSMutableData* compacted = [[NSMutableData alloc] initWithCapacity:[postings.data length]];
+            ECTwitterTextCursor cursor;
+            startCursor(&cursor, postings.data);
+            uint64_t previous = 0;
+            NSUInteger count = 0;
+            while (nextPosting(&cursor))
+            {
+                if (![removed containsObject:[ECTwitterID idFromValue:cursor.identifier]] && !isSupersededPosting(&cursor, word, readded))
+                {
+                    copyPosting(compacted, previous, &cursor);
+                    previous = cursor.identifier;
+                    ++count;
+                }
+            }
+
+            postings.data = compacted;
+            postings.count = count;
+            postings.lastID = previous;
+            [compacted release];
+            if (count == 0)
+            {
+                [emptyTerms addObject:word];
+            }
+        }
+
+        [terms removeObjectsForKeys:emptyTerms];
+        ECDebug(TwitterTextIndexChannel, @"compacted index, dropping %ld tweets, %ld older versions and %ld words", (long) [removed count], (long) [readded count], (long) [emptyTerms count]);
+        [self.removed removeAllObjects];
+        [self.readded removeAllObjects];
+    }
+}
+
+// ==============================================
+// Queries
+// ==============================================
+
+#pragma mark -
+#pragma mark Queries
+
+// --------------------------------------------------------------------------
+/// Sets of IDs are kept as sorted arrays of 64 bit integers.
+// --------------------------------------------------------------------------
+
+static NSData* intersectIDs(NSData* a, NSData* b)
+{
+    const uint64_t* ia = [a bytes];
+    const uint64_t* ib = [b bytes];
+    NSUInteger ca = [a length] / sizeof(uint64_t);
+    NSUInteger cb = [b length] / sizeof(uint64_t);
+    NSMutableData* result = [NSMutableData dataWithCapacity:MIN([a length], [b length])];
+    NSUInteger na = 0, nb = 0;
+    while ((na < ca) && (nb < cb))
+    {
+        if (ia[na] < ib[nb])
+        {
+            ++na;
+        }
+        else if (ia[na] > ib[nb])
+        {
+            ++nb;
+        }
+        else
+        {
+            [result appendBytes:&ia[na] length:sizeof(uint64_t)];
+            ++na;
+            ++nb;
+        }
+    }
+
+    return result;
+}
+
+static NSData* unionIDs(NSData* a, NSData* b)
+{
+    const uint64_t* ia = [a bytes];
+    const uint64_t* ib = [b bytes];
+    NSUInteger ca = [a length] / sizeof(uint64_t);
+    NSUInteger cb = [b length] / sizeof(uint64_t);
+    NSMutableData* result = [NSMutableData dataWithCapacity:[a length] + [b length]];
+    NSUInteger na = 0, nb = 0;
+    while ((na < ca) || (nb < cb))
+    {
+        uint64_t value;
+        if ((nb == cb) || ((na < ca) && (ia[na] < ib[nb])))
+        {
+            value = ia[na++];
+        }
+        else if ((na == ca) || (ib[nb] < ia[na]))
+        {
+            value = ib[nb++];
+        }
+        else
+        {
+            value = ia[na++];
+            ++nb;
+        }
+        [result appendBytes:&value length:sizeof(uint64_t)];
+    }
+
+    return result;
+}
+
+static NSData* subtractIDs(NSData* a, NSData* b)
+{
+    const uint64_t* ia = [a bytes];
+    const uint64_t* ib = [b bytes];
+    NSUInteger ca = [a length] / sizeof(uint64_t);
+    NSUInteger cb = [b length] / sizeof(uint64_t);
+    NSMutableData* result = [NSMutableData dataWithCapacity:[a length]];
+    NSUInteger nb = 0;
+    for (NSUInteger na = 0; na < ca; ++na)
+    {
+        while ((nb < cb) && (ib[nb] < ia[na]))
+        {
+            ++nb;
+        }
+        if ((nb == cb) || (ib[nb] != ia[na]))
+        {
+            [result appendBytes:&ia[na] length:sizeof(uint64_t)];
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of the tweets that contain a word, or a sequence of
+/// words, one after the other.
+// --------------------------------------------------------------------------
+
+- (NSData*)matchesForWords:(NSArray*)words
+{
+    NSUInteger count = [words count];
+    NSMutableData* result = [NSMutableData data];
+    ECTwitterTextCursor* cursors = calloc(count, sizeof(ECTwitterTextCursor));
+    NSDictionary* readded = self.readded;
+    BOOL ok = count > 0;
+    for (NSUInteger n = 0; ok && (n < count); ++n)
+    {
+        ECTwitterTextPostings* postings = [self.terms objectForKey:[words objectAtIndex:n]];
+        if (postings)
+        {
+            startCursor(&cursors[n], postings.data);
+            ok = nextCurrentPosting(&cursors[n], [words objectAtIndex:n], readded);
+        }
+        else
+        {
+            ok = NO;
+        }
+    }
+
+    while (ok)
+    {
+        // find the highest current ID, and bring all the lists up to it
+        uint64_t target = 0;
+        for (NSUInteger n = 0; n < count; ++n)
+        {
+            target = MAX(target, cursors[n].identifier);
+        }
+
+        BOOL aligned = YES;
+        for (NSUInteger n = 0; ok && (n < count); ++n)
+        {
+            while (ok && (cursors[n].identifier < target))
+            {
+                ok = nextCurrentPosting(&cursors[n], [words objectAtIndex:n], readded);
+            }
+            aligned = aligned && (cursors[n].identifier == target);
+        }
+
+        if (ok && aligned)
+        {
+            BOOL matched = (count == 1);
+            if (!matched)
+            {
+                // check that the words appear in order somewhere
+                const uint8_t* next = cursors[0].positions;
+                uint64_t position = 0;
+                for (uint64_t p = 0; !matched && next && (p < cursors[0].positionCount); ++p)
+                {
+                    uint64_t delta = 0;
+                    next = readVarint(next, cursors[0].end, &delta);
+                    position += delta;
+                    matched = YES;
+                    for (NSUInteger n = 1; matched && (n < count); ++n)
+                    {
+                        matched = cursorHasPosition(&cursors[n], position + n);
+                    }
+                }
+            }
+
+            if (matched)
+            {
+                [result appendBytes:&target length:sizeof(uint64_t)];
+            }
+
+            ok = nextCurrentPosting(&cursors[0], [words objectAtIndex:0], readded);
+        }
+    }
+
+    free(cursors);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of the tweets that match a query, newest first.
+// --------------------------------------------------------------------------
+
+- (NSArray*)documentIDsMatchingQuery:(NSString*)query
+{
+    // split the query into terms - a clause for each group of terms joined by OR
+    NSMutableArray* clauses = [NSMutableArray array];
+    NSMutableArray* exclusions = [NSMutableArray array];
+    NSScanner* scanner = [NSScanner scannerWithString:query ? query : @""];
+    scanner.charactersToBeSkipped = [NSCharacterSet whitespaceAndNewlineCharacterSet];
+    BOOL joinWithPrevious = NO;
+    while (![scanner isAtEnd])
+    {
+        BOOL exclude = [scanner scanString:@"-" intoString:nil];
+        NSString* term = nil;
+        if ([scanner scanString:@"\"" intoString:nil])
+        {
+            [scanner scanUpToString:@"\"" intoString:&term];
+            [scanner scanString:@"\"" intoString:nil];
+        }
+        else
+        {
+            [scanner scanUpToCharactersFromSet:scanner.charactersToBeSkipped intoString:&term];
+        }
+
+        if (!exclude && [term isEqualToString:@"OR"])
+        {
+            joinWithPrevious = [clauses count] > 0;
+        }
+        else
+        {
+            NSArray* words = [ECTwitterTextIndex wordsInText:term];
+            if ([words count] > 0)
+            {
+                if (exclude)
+                {
+                    [exclusions addObject:words];
+                }
+                else if (joinWithPrevious)
+                {
+                    [[clauses lastObject] addObject:words];
+                }
+                else
+                {
+                    [clauses addObject:[NSMutableArray arrayWithObject:words]];
+                }
+            }
+            joinWithPrevious = NO;
+        }
+    }
+
+    // every clause has to match
+    NSData* matches = nil;
+    for (NSArray* clause in clauses)
+    {
+        NSData* clauseMatches = nil;
+        for (NSArray* words in clause)
+        {
+            NSData* wordMatches = [self matchesForWords:words];
+            clauseMatches = clauseMatches ? unionIDs(clauseMatches, wordMatches) : wordMatches;
+        }
+        matches = matches ? intersectIDs(matches, clauseMatches) : clauseMatches;
+    }
+
+    for (NSArray* words in exclusions)
+    {
+        matches = subtractIDs(matches, [self matchesForWords:words]);
+    }
+
+    const uint64_t* identifiers = [matches bytes];
+    NSUInteger count = [matches length] / sizeof(uint64_t);
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:count];
+    NSSet* removed = self.removed;
+    while (count--)
+    {
+        ECTwitterID* documentID = [ECTwitterID idFromValue:identifiers[count]];
+        if (![removed containsObject:documentID])
+        {
+            [result addObject:documentID];
+        }
+    }
+
+    ECDebug(TwitterTextIndexChannel, @"query %@ matched %ld tweets", query, (long) [result count]);
+
+    return result;
+}
+
+// ==============================================
+// Saving
+// ==============================================
+
+#pragma mark -
+#pragma mark Saving
+
+static int compareIdentifiers(const void* i1, const void* i2)
+{
+    uint64_t v1 = *(const uint64_t*) i1;
+    uint64_t v2 = *(const uint64_t*) i2;
+
+    return (v1 < v2) ? -1 : ((v1 > v2) ? 1 : 0);
+}
+
+// --------------------------------------------------------------------------
+/// Return the index in the form that it's saved.
+/// This is a header (which includes the generation, so that we know which
+/// changes in the log come after it), the IDs of the indexed tweets, in
+/// order and delta encoded, and then each word with its posting list.
+// --------------------------------------------------------------------------
+
+- (NSData*)archivedData
+{
+    NSMutableData* data = [NSMutableData dataWithCapacity:[self postingBytes] + [self.terms count] * 16];
+    uint32_t header[3] = { kFileMagic, kFileVersion, self.generation };
+    [data appendBytes:header length:sizeof(header)];
+
+    NSUInteger count = [self.documents count];
+    uint64_t* identifiers = malloc(MAX(count, 1) * sizeof(uint64_t));
+    NSUInteger n = 0;
+    for (ECTwitterID* documentID in self.documents)
+    {
+        identifiers[n++] = documentID.value;
+    }
+    qsort(identifiers, count, sizeof(uint64_t), compareIdentifiers);
+
+    appendVarint(data, count);
+    uint64_t previous = 0;
+    for (n = 0; n < count; ++n)
+    {
+        appendVarint(data, identifiers[n] - previous);
+        previous = identifiers[n];
+    }
+    free(identifiers);
+
+    NSDictionary* terms = self.terms;
+    appendVarint(data, [terms count]);
+    for (NSString* word in terms)
+    {
+        ECTwitterTextPostings* postings = [terms objectForKey:word];
+        const char* utf8 = [word UTF8String];
+        NSUInteger length = strlen(utf8);
+        appendVarint(data, length);
+        [data appendBytes:utf8 length:length];
+        appendVarint(data, postings.count);
+        appendVarint(data, postings.lastID);
+        appendVarint(data, [postings.data length]);
+        [data appendData:postings.data];
+    }
+
+    return data;
+}
+
+// --------------------------------------------------------------------------
+/// Rebuild the index from saved data.
+/// Indexes saved before there was a log don't have a generation, and are
+/// read as generation zero.
+/// Returns NO if the data isn't valid.
+// --------------------------------------------------------------------------
+
+- (BOOL)readArchivedData:(NSData*)data
+{
+    const uint8_t* next = [data bytes];
+    const uint8_t* end = next + [data length];
+    const uint32_t* header = (const uint32_t*) next;
+    if (([data length] < 2 * sizeof(uint32_t)) || (header[0] != kFileMagic) || (header[1] < 1) || (header[1] > kFileVersion))
+    {
+        return NO;
+    }
+
+    NSUInteger headerLength = (header[1] == 1) ? 2 * sizeof(uint32_t) : 3 * sizeof(uint32_t);
+    if ([data length] < headerLength)
+    {
+        return NO;
+    }
+    uint32_t generation = (header[1] == 1) ? 0 : header[2];
+    next += headerLength;
+
+    uint64_t count = 0;
+    next = readVarint(next, end, &count);
+    NSMutableSet* documents = [NSMutableSet setWithCapacity:(NSUInteger) MIN(count, 1 << 20)];
+    uint64_t identifier = 0;
+    for (uint64_t n = 0; next && (n < count); ++n)
+    {
+        uint64_t delta = 0;
+        next = readVarint(next, end, &delta);
+        identifier += delta;
+        [documents addObject:[ECTwitterID idFromValue:identifier]];
+    }
+
+    next = readVarint(next, end, &count);
+    NSMutableDictionary* terms = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger) MIN(count, 1 << 20)];
+    for (uint64_t n = 0; next && (n < count); ++n)
+    {
+        uint64_t length = 0, postingCount = 0, lastID = 0, postingLength = 0;
+        next = readVarint(next, end, &length);
+        NSString* word = nil;
+        if (next && (length <= (uint64_t) (end - next)))
+        {
+            word = [[[NSString alloc] initWithBytes:next length:(NSUInteger) length encoding:NSUTF8StringEncoding] autorelease];
+            next += length;
+        }
+        else
+        {
+            next = NULL;
+        }
+
+        next = readVarint(next, end, &postingCount);
+        next = readVarint(next, end, &lastID);
+        next = readVarint(next, end, &postingLength);
+        if (word && next && (postingLength <= (uint64_t) (end - next)))
+        {
+            ECTwitterTextPostings* postings = [[ECTwitterTextPostings alloc] init];
+            [postings.data appendBytes:next length:(NSUInteger) postingLength];
+            postings.count = (NSUInteger) postingCount;
+            postings.lastID = lastID;
+            [terms setObject:postings forKey:word];
+            [postings release];
+            next += postingLength;
+        }
+        else
+        {
+            next = NULL;
+        }
+    }
+
+    BOOL ok = (next == end);
+    if (ok)
+    {
+        self.documents = documents;
+        self.terms = terms;
+        self.generation = generation;
+        [self.removed removeAllObjects];
+        [self.readded removeAllObjects];
+    }
+
+    return ok;
+}
+
+// --------------------------------------------------------------------------
+/// Return the location of the log of changes made since the index was
+/// last saved in full.
+// --------------------------------------------------------------------------
+
+- (NSURL*)logURL
+{
+    return [self.url URLByAppendingPathExtension:@"log"];
+}
+
+// --------------------------------------------------------------------------
+/// Apply one set of changes from the log.
+/// Returns NO if the changes aren't valid.
+// --------------------------------------------------------------------------
+
+- (BOOL)replayChanges:(const uint8_t*)next end:(const uint8_t*)end
+{
+    while (next && (next < end))
+    {
+        uint64_t change = 0, identifier = 0;
+        next = readVarint(next, end, &change);
+        next = readVarint(next, end, &identifier);
+        if (next && (change == LogAdded))
+        {
+            uint64_t length = 0;
+            next = readVarint(next, end, &length);
+            if (next && (length <= (uint64_t) (end - next)))
+            {
+                NSString* text = [[NSString alloc] initWithBytes:next length:(NSUInteger) length encoding:NSUTF8StringEncoding];
+                if (text)
+                {
+                    [self indexDocumentWithID:[ECTwitterID idFromValue:identifier] text:text];
+                    [text release];
+                }
+                next += length;
+            }
+            else
+            {
+                next = NULL;
+            }
+        }
+        else if (next && (change == LogRemoved))
+        {
+            [self forgetDocumentWithID:[ECTwitterID idFromValue:identifier]];
+        }
+        else
+        {
+            next = NULL;
+        }
+    }
+
+    return next == end;
+}
+
+// --------------------------------------------------------------------------
+/// Apply the changes in the log that were made since the index was last
+/// saved in full. Any from earlier generations (left behind if we stopped
+/// before the log could be removed) are skipped.
+/// We stop at the first set of changes that's incomplete or damaged, and
+/// return its offset.
+// --------------------------------------------------------------------------
+
+- (uint64_t)replayLog:(NSData*)data
+{
+    const uint8_t* bytes = [data bytes];
+    uint64_t length = [data length];
+    uint64_t offset = 0;
+    NSUInteger replayed = 0;
+    while (offset + sizeof(ECTwitterTextLogHeader) <= length)
+    {
+        const ECTwitterTextLogHeader* header = (const ECTwitterTextLogHeader*) (bytes + offset);
+        uint64_t start = offset + sizeof(ECTwitterTextLogHeader);
+        uint64_t end = start + header->length;
+        if ((header->magic != kLogMagic) || (end > length))
+        {
+            break;
+        }
+
+        if (header->generation == self.generation)
+        {
+            if (![self replayChanges:bytes + start end:bytes + end])
+            {
+                break;
+            }
+            ++replayed;
+        }
+
+        offset = end;
+    }
+
+    ECDebug(TwitterTextIndexChannel, @"replayed %ld sets of changes", (long) replayed);
+
+    return offset;
+}
+
+// --------------------------------------------------------------------------
+/// Save the index, if it has changed.
+///
+/// Usually we just append the changes since the last save to the log.
+/// Once the log has grown big enough, or enough removed tweets have been
+/// left in the posting lists, we compact the lists and save the whole
+/// index, with a new generation, and then remove the log.
+///
+/// The data is built up here, and written out in the background.
+// --------------------------------------------------------------------------
+
+- (void)save
+{
+    if (self.changed)
+    {
+        NSURL* url = self.url;
+        NSURL* logURL = [self logURL];
+        unsigned long long logBytes = self.logBytes + [self.log length];
+        if (self.needsSnapshot || (logBytes > MAX(kMinLogBytes, self.snapshotBytes / 2)) || ([self.removed count] + [self.readded count] > kMaxTombstones))
+        {
+            [self compact];
+            self.generation = self.generation + 1;
+            NSData* data = [self archivedData];
+            dispatch_async(self.queue, ^{
+                NSError* error = nil;
+                [[NSFileManager defaultManager] createDirectoryAtURL:[url URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:&error];
+                if ([data writeToURL:url options:NSDataWritingAtomic error:&error])
+                {
+                    [[NSFileManager defaultManager] removeItemAtURL:logURL error:nil];
+                }
+                else
+                {
+                    ECDebug(TwitterTextIndexChannel, @"failed to save index: %@", error);
+                }
+            });
+            ECDebug(TwitterTextIndexChannel, @"saving index of %ld tweets, %ld words, %ld bytes", (long) [self.documents count], (long) [self.terms count], (long) [data length]);
+
+            self.snapshotBytes = [data length];
+            self.logBytes = 0;
+            self.needsSnapshot = NO;
+        }
+        else
+        {
+            ECTwitterTextLogHeader header = { kLogMagic, self.generation, (uint32_t) [self.log length] };
+            NSMutableData* changes = [NSMutableData dataWithCapacity:sizeof(header) + [self.log length]];
+            [changes appendBytes:&header length:sizeof(header)];
+            [changes appendData:self.log];
+            dispatch_async(self.queue, ^{
+                NSError* error = nil;
+                NSFileManager* fm = [NSFileManager defaultManager];
+                if (![fm fileExistsAtPath:[logURL path]])
+                {
+                    [fm createDirectoryAtURL:[logURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:&error];
+                    [[NSData data] writeToURL:logURL options:0 error:&error];
+                }
+
+                NSFileHandle* file = [NSFileHandle fileHandleForWritingToURL:logURL error:&error];
+                if (file)
+                {
+                    [file seekToEndOfFile];
+                    [file writeData:changes];
+                    [file closeFile];
+                }
+                else
+                {
+                    ECDebug(TwitterTextIndexChannel, @"failed to save index changes: %@", error);
+                }
+            });
+            ECDebug(TwitterTextIndexChannel, @"saving %ld bytes of index changes", (long) [changes length]);
+
+            self.logBytes = self.logBytes + [changes length];
+        }
+
+        [self.log setLength:0];
+        self.changed = NO;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Load the index, and apply any changes that were saved since.
+/// Anything already in it is replaced. If the saved index is missing we
+/// start with an empty one; if it's damaged, the changes since can't be
+/// used either, so we throw them away too.
+// --------------------------------------------------------------------------
+
+- (void)load
+{
+    __block NSData* data = nil;
+    __block NSData* logData = nil;
+    NSURL* url = self.url;
+    NSURL* logURL = [self logURL];
+    dispatch_sync(self.queue, ^{
+        data = [[NSData alloc] initWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil];
+        logData = [[NSData alloc] initWithContentsOfURL:logURL options:NSDataReadingMappedIfSafe error:nil];
+    });
+
+    [self.terms removeAllObjects];
+    [self.documents removeAllObjects];
+    [self.removed removeAllObjects];
+    [self.readded removeAllObjects];
+    [self.log setLength:0];
+    self.generation = 0;
+    self.logBytes = 0;
+    self.snapshotBytes = 0;
+
+    BOOL ok = !data || [self readArchivedData:data];
+    if (ok)
+    {
+        uint64_t length = [logData length];
+        uint64_t offset = [self replayLog:logData];
+        if (offset != length)
+        {
+            ECDebug(TwitterTextIndexChannel, @"discarding %lld bytes of damaged index changes", (long long) (length - offset));
+            dispatch_sync(self.queue, ^{
+                truncate([[logURL path] fileSystemRepresentation], (off_t) offset);
+            });
+        }
+
+        self.logBytes = offset;
+        self.snapshotBytes = [data length];
+        self.needsSnapshot = (data == nil);
+        self.changed = self.needsSnapshot;
+        ECDebug(TwitterTextIndexChannel, @"loaded index of %ld tweets, %ld words", (long) [self.documents count], (long) [self.terms count]);
+    }
+    else
+    {
+        ECDebug(TwitterTextIndexChannel, @"no valid index at %@", url);
+        [self.terms removeAllObjects];
+        [self.documents removeAllObjects];
+        dispatch_sync(self.queue, ^{
+            [[NSFileManager defaultManager] removeItemAtURL:logURL error:nil];
+        });
+        self.needsSnapshot = YES;
+        self.changed = YES;
+    }
+    [data release];
+    [logData release];
+}
+
+@end
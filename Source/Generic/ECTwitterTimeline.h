@@ -11,6 +11,7 @@
 
 @class ECTwitterTweet;
 @class ECTwitterHandler;
+@class ECTwitterID;
 @class ECTwitterUser;
 
 typedef enum
@@ -32,9 +33,18 @@ typedef enum
 // Public Properties
 // --------------------------------------------------------------------------
 
+// Tweets are kept in order (newest first, unless this is a sorted view),
+// and without duplicates - use addTweet/removeTweet to change them.
 @property (strong, nonatomic) NSMutableArray* tweets;
-@property (strong, nonatomic) ECTwitterTweet* oldestTweet;
-@property (strong, nonatomic) ECTwitterTweet* newestTweet;
+@property (strong, nonatomic, readonly) ECTwitterTweet* oldestTweet;
+@property (strong, nonatomic, readonly) ECTwitterTweet* newestTweet;
+@property (assign, nonatomic, readonly) SEL sortSelector;
+@property (assign, nonatomic) NSUInteger maxConcurrentBackfills;
+
+// The most tweets to keep hold of (zero means no limit). The oldest are
+// dropped as newer ones arrive. Fetching older tweets reads them back in
+// from the cache, and raises the limit to make room for them.
+@property (assign, nonatomic) NSUInteger maxCount;
 
 // --------------------------------------------------------------------------
 // Public Methods
@@ -45,6 +55,11 @@ typedef enum
 - (void)encodeWithCoder:(NSCoder*)coder;
 - (void)refresh;
 - (void)addTweet:(ECTwitterTweet*)tweet;
+- (void)removeTweet:(ECTwitterTweet*)tweet;
+- (BOOL)containsTweet:(ECTwitterTweet*)tweet;
+- (void)resort;
+- (NSUInteger)gapCount;
+- (NSArray*)tweetsSinceID:(ECTwitterID*)sinceID maxID:(ECTwitterID*)maxID;
 - (ECTwitterTimeline*)sortedWithSelector:(SEL) selector;
 - (void)timelineHandler:(ECTwitterHandler*)handler;
 - (void)fetchTweetsForUser:(ECTwitterUser*)user method:(FetchMethod)method type:(FetchType)type;
@@ -15,6 +15,51 @@
 #import "ECTwitterID.h"
 #import "ECTwitterEngine.h"
 
+// ==============================================
+// Timeline Requests
+// ==============================================
+
+#pragma mark -
+#pragma mark Timeline Requests
+
+// --------------------------------------------------------------------------
+/// Details of a timeline request, passed along as the handler's extra
+/// so that we can tell how a page of results relates to what we've got.
+/// Also used to record gaps: a gap covers IDs above sinceID, up to and
+/// including maxID.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTimelineRequest : NSObject
+
+@property (strong, nonatomic) ECTwitterUser* user;
+@property (assign, nonatomic) FetchMethod method;
+@property (strong, nonatomic) ECTwitterID* sinceID;
+@property (strong, nonatomic) ECTwitterID* maxID;
+@property (assign, nonatomic) NSUInteger count;
+@property (assign, nonatomic) BOOL backfill;
+
+@end
+
+@implementation ECTwitterTimelineRequest
+
+@synthesize backfill = _backfill;
+@synthesize count = _count;
+@synthesize maxID = _maxID;
+@synthesize method = _method;
+@synthesize sinceID = _sinceID;
+@synthesize user = _user;
+
+- (void)dealloc
+{
+    [_maxID release];
+    [_sinceID release];
+    [_user release];
+
+    [super dealloc];
+}
+
+@end
+
 // ==============================================
 // Private Methods
 // ==============================================
@@ -24,6 +69,23 @@
 
 @interface ECTwitterTimeline()
 
+@property (assign, nonatomic) BOOL needsMaterializing;
+@property (strong, nonatomic) NSMutableSet* members;
+@property (strong, nonatomic) NSMutableDictionary* views;
+@property (strong, nonatomic, readwrite) ECTwitterTweet* oldestTweet;
+@property (strong, nonatomic, readwrite) ECTwitterTweet* newestTweet;
+@property (assign, nonatomic, readwrite) SEL sortSelector;
+
+@property (strong, nonatomic) NSMutableArray* gaps;
+@property (assign, nonatomic) NSUInteger backfillsInFlight;
+@property (strong, nonatomic) NSMutableArray* olderIDs;
+
+- (void)updateNewestAndOldest;
+- (void)trimToMaxCount;
+- (BOOL)restoreOlderTweets;
+- (void)requestTweets:(ECTwitterTimelineRequest*)request;
+- (void)startBackfillsForUser:(ECTwitterUser*)user method:(FetchMethod)method;
+
 @end
 
 
@@ -43,6 +105,15 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 @synthesize tweets;
 @synthesize newestTweet;
 @synthesize oldestTweet;
+@synthesize backfillsInFlight = _backfillsInFlight;
+@synthesize gaps = _gaps;
+@synthesize maxConcurrentBackfills = _maxConcurrentBackfills;
+@synthesize maxCount = _maxCount;
+@synthesize members = _members;
+@synthesize needsMaterializing = _needsMaterializing;
+@synthesize olderIDs = _olderIDs;
+@synthesize sortSelector = _sortSelector;
+@synthesize views = _views;
 
 // ==============================================
 // Constants
@@ -51,6 +122,26 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 #pragma mark -
 #pragma mark Constants
 
+// the most tweets the API will give us in one page
+static const NSUInteger kPageSize = 200;
+static const NSUInteger kMentionsPageSize = 10;
+
+// how many backfill requests we allow at once, by default
+static const NSUInteger kDefaultMaxConcurrentBackfills = 2;
+
+// the API won't go back further than this for a timeline, so by default
+// there's no point holding on to more
+static const NSUInteger kDefaultMaxCount = 800;
+
+// how many IDs of dropped tweets we remember (we let it grow to twice
+// this before cutting it back, so that we don't sort it every time)
+static const NSUInteger kMaxOlderIDs = 4 * kDefaultMaxCount;
+
+// gaps spanning fewer IDs than this aren't worth splitting into
+// separate requests (status IDs carry a millisecond timestamp in
+// their upper bits, so this is about a minute of tweets)
+static const uint64_t kMinSplitSpan = 60000ULL << 22;
+
 // ==============================================
 // Lifecycle
 // ==============================================
@@ -66,7 +157,9 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 {
 	if ((self = [super initWithCache:cache]) != nil)
 	{
-		
+		self.gaps = [NSMutableArray array];
+		self.maxConcurrentBackfills = kDefaultMaxConcurrentBackfills;
+		self.maxCount = kDefaultMaxCount;
 	}
 	
 	return self;
@@ -78,28 +171,44 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 
 - (id)initWithCoder:(NSCoder*)coder
 {
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
 	if ((self = [super initWithCache:cache]) != nil)
     {
+        // The tweets were saved in order, without duplicates, so we set them
+        // up directly rather than with setTweets:, which would sort them
+        // again, and mark us as changed when we've only just been loaded.
+        // Anything past our limit isn't read in at all.
+        self.maxCount = kDefaultMaxCount;
         NSArray* tweetIds = [coder decodeObjectForKey:@"tweets"];
-        NSMutableArray* cachedTweets = [NSMutableArray arrayWithCapacity:[tweetIds count]];
-        for (ECTwitterID* tweetId in tweetIds)
+        self.olderIDs = [NSMutableArray arrayWithArray:[coder decodeObjectForKey:@"older"]];
+        if ([tweetIds count] > self.maxCount)
         {
-            [cachedTweets addObject:[cache tweetWithID:tweetId]];
+            NSRange range = NSMakeRange(self.maxCount, [tweetIds count] - self.maxCount);
+            [self.olderIDs addObjectsFromArray:[tweetIds subarrayWithRange:range]];
+            tweetIds = [tweetIds subarrayWithRange:NSMakeRange(0, self.maxCount)];
         }
-
-        ECTwitterID* oldestId = [coder decodeObjectForKey:@"oldest"];
-        if (oldestId)
+        tweets = [[NSMutableArray alloc] initWithCapacity:[tweetIds count]];
+        for (ECTwitterID* tweetId in tweetIds)
         {
-            self.oldestTweet = [cache tweetWithID:oldestId];
+            [tweets addObject:[cache tweetWithID:tweetId]];
         }
-        
-        ECTwitterID* newestId = [coder decodeObjectForKey:@"newest"];
-        if (newestId)
+        [tweets makeObjectsPerformSelector:@selector(pin)];
+        self.members = [NSMutableSet setWithArray:tweets];
+        [self updateNewestAndOldest];
+        self.needsMaterializing = YES;
+
+        // gaps are stored as a flat list of (sinceID, maxID) pairs
+        NSArray* gapIds = [coder decodeObjectForKey:@"gaps"];
+        self.gaps = [NSMutableArray arrayWithCapacity:[gapIds count] / 2];
+        for (NSUInteger n = 0; n + 1 < [gapIds count]; n += 2)
         {
-            self.newestTweet = [cache tweetWithID:newestId];
+            ECTwitterTimelineRequest* gap = [[ECTwitterTimelineRequest alloc] init];
+            gap.sinceID = [gapIds objectAtIndex:n];
+            gap.maxID = [gapIds objectAtIndex:n + 1];
+            [self.gaps addObject:gap];
+            [gap release];
         }
-        self.tweets = cachedTweets;
+        self.maxConcurrentBackfills = kDefaultMaxConcurrentBackfills;
     }
     
     return self;
@@ -111,27 +220,217 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 
 - (void) dealloc
 {
+	[tweets makeObjectsPerformSelector:@selector(unpin)];
 	[tweets release];
 	[newestTweet release];
 	[oldestTweet release];
+	[_gaps release];
+	[_members release];
+	[_olderIDs release];
+	[_views release];
 	
 	[super dealloc];
 }
 
+// --------------------------------------------------------------------------
+/// Return our tweets.
+/// If we were read from disk, our tweets may just be placeholders, so we
+/// get the cache to fill them in the first time we're asked for them.
+// --------------------------------------------------------------------------
+
+- (NSMutableArray*)tweets
+{
+	if (self.needsMaterializing && [mCache materializeObjects:tweets])
+	{
+		self.needsMaterializing = NO;
+		[self removeMissingTweets];
+	}
+
+	return tweets;
+}
+
+// --------------------------------------------------------------------------
+/// Compare two tweets by ID, newest first.
+// --------------------------------------------------------------------------
+
+static inline NSComparisonResult compareIDsDescending(ECTwitterTweet* t1, ECTwitterTweet* t2)
+{
+	uint64_t v1 = t1.twitterID.value;
+	uint64_t v2 = t2.twitterID.value;
+
+	return (v1 > v2) ? NSOrderedAscending : ((v1 < v2) ? NSOrderedDescending : NSOrderedSame);
+}
+
+// --------------------------------------------------------------------------
+/// Compare two tweets using a selector, or by ID if there isn't one.
+// --------------------------------------------------------------------------
+
+static NSInteger compareTweets(id t1, id t2, void* context)
+{
+	SEL selector = (SEL) context;
+	NSComparisonResult result;
+	if (selector)
+	{
+		NSComparisonResult (*compare)(id, SEL, id) = (NSComparisonResult (*)(id, SEL, id)) [t1 methodForSelector:selector];
+		result = compare(t1, selector, t2);
+	}
+	else
+	{
+		result = compareIDsDescending(t1, t2);
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Binary search for the place to insert a tweet.
+// --------------------------------------------------------------------------
+
+static NSUInteger insertionIndex(NSArray* array, ECTwitterTweet* tweet, SEL selector)
+{
+	NSUInteger low = 0;
+	NSUInteger high = [array count];
+	while (low < high)
+	{
+		NSUInteger mid = low + ((high - low) / 2);
+		if (compareTweets([array objectAtIndex:mid], tweet, (void*) selector) == NSOrderedDescending)
+		{
+			high = mid;
+		}
+		else
+		{
+			low = mid + 1;
+		}
+	}
+
+	return low;
+}
+
+// --------------------------------------------------------------------------
+/// Binary search for the first tweet with an ID at or below a given value.
+/// Only valid for timelines in ID order.
+// --------------------------------------------------------------------------
+
+static NSUInteger indexAtOrBelowValue(NSArray* array, uint64_t value)
+{
+	NSUInteger low = 0;
+	NSUInteger high = [array count];
+	while (low < high)
+	{
+		NSUInteger mid = low + ((high - low) / 2);
+		if (((ECTwitterTweet*) [array objectAtIndex:mid]).twitterID.value <= value)
+		{
+			high = mid;
+		}
+		else
+		{
+			low = mid + 1;
+		}
+	}
+
+	return low;
+}
+
+// --------------------------------------------------------------------------
+/// Replace our tweets.
+/// The new tweets are sorted and any duplicates are dropped.
+/// Tweets stay pinned in the cache for as long as they're in a timeline,
+/// so anything past our limit is dropped straight away.
+/// Any sorted views are refilled from the new tweets, rather than thrown
+/// away, since whoever asked for them may still be holding on to them.
+// --------------------------------------------------------------------------
+
+- (void)setTweets:(NSMutableArray*)newTweets
+{
+	if (newTweets != tweets)
+	{
+		NSMutableSet* newMembers = [[NSMutableSet alloc] initWithCapacity:[newTweets count]];
+		NSMutableArray* sorted = [[NSMutableArray alloc] initWithCapacity:[newTweets count]];
+		for (ECTwitterTweet* tweet in newTweets)
+		{
+			if (![newMembers containsObject:tweet])
+			{
+				[newMembers addObject:tweet];
+				[sorted addObject:tweet];
+			}
+		}
+		[sorted sortUsingFunction:compareTweets context:(void*) self.sortSelector];
+
+		[sorted makeObjectsPerformSelector:@selector(pin)];
+		[tweets makeObjectsPerformSelector:@selector(unpin)];
+		[tweets release];
+		tweets = sorted;
+		self.members = newMembers;
+		[newMembers release];
+
+		[self updateNewestAndOldest];
+		for (ECTwitterTimeline* view in [self.views allValues])
+		{
+			view.tweets = sorted;
+		}
+		[self markDirty];
+		[self trimToMaxCount];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Work out the newest and oldest tweets from scratch.
+// --------------------------------------------------------------------------
+
+- (void)updateNewestAndOldest
+{
+	ECTwitterTweet* newest = nil;
+	ECTwitterTweet* oldest = nil;
+	if (self.sortSelector)
+	{
+		for (ECTwitterTweet* tweet in tweets)
+		{
+			if (!newest || (compareIDsDescending(tweet, newest) == NSOrderedAscending))
+			{
+				newest = tweet;
+			}
+			if (!oldest || (compareIDsDescending(tweet, oldest) == NSOrderedDescending))
+			{
+				oldest = tweet;
+			}
+		}
+	}
+	else if ([tweets count] > 0)
+	{
+		newest = [tweets objectAtIndex:0];
+		oldest = [tweets lastObject];
+	}
+
+	self.newestTweet = newest;
+	self.oldestTweet = oldest;
+}
+
 // --------------------------------------------------------------------------
 /// Save the timeline to a file.
 // --------------------------------------------------------------------------
 
 - (void)encodeWithCoder:(NSCoder*)coder
 {
-    NSMutableArray* tweetIds = [NSMutableArray arrayWithCapacity:[self.tweets count]];
-    for (ECTwitterTweet* tweet in self.tweets)
+    // we use the ivar directly so that saving doesn't read in any placeholder tweets
+    NSMutableArray* tweetIds = [NSMutableArray arrayWithCapacity:[tweets count]];
+    for (ECTwitterTweet* tweet in tweets)
     {
         [tweetIds addObject:tweet.twitterID];
     }
     [coder encodeObject:tweetIds forKey:@"tweets"];
-    [coder encodeObject:self.oldestTweet.twitterID forKey:@"oldest"];
-    [coder encodeObject:self.newestTweet.twitterID forKey:@"newest"];
+
+    NSMutableArray* gapIds = [NSMutableArray arrayWithCapacity:[self.gaps count] * 2];
+    for (ECTwitterTimelineRequest* gap in self.gaps)
+    {
+        [gapIds addObject:gap.sinceID];
+        [gapIds addObject:gap.maxID];
+    }
+    [coder encodeObject:gapIds forKey:@"gaps"];
+
+    if ([self.olderIDs count] > 0)
+    {
+        [coder encodeObject:self.olderIDs forKey:@"older"];
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -144,7 +443,9 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 }
 
 // --------------------------------------------------------------------------
-/// Add a tweet to our timeline.
+/// Add a tweet to our timeline, keeping it in order.
+/// Membership is checked with a hash, and the insertion point found with
+/// a binary search. Any sorted views of the timeline are updated too.
 // --------------------------------------------------------------------------
 
 - (void) addTweet:(ECTwitterTweet*)tweet
@@ -157,70 +458,336 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 		[array release];
 	}
 	
-	NSDate* tweetDate = [tweet created];
-	if (!self.newestTweet || ([tweetDate compare: self.newestTweet.created] == NSOrderedDescending))
+	if (![self.members containsObject:tweet])
+	{
+		[array insertObject:tweet atIndex:insertionIndex(array, tweet, self.sortSelector)];
+		[self.members addObject:tweet];
+		[tweet pin];
+
+		if (!self.newestTweet || (compareIDsDescending(tweet, self.newestTweet) == NSOrderedAscending))
+		{
+			self.newestTweet = tweet;
+		}
+		
+		if (!self.oldestTweet || (compareIDsDescending(tweet, self.oldestTweet) == NSOrderedDescending))
+		{
+			self.oldestTweet = tweet;
+		}
+
+		for (ECTwitterTimeline* view in [self.views allValues])
+		{
+			[view addTweet:tweet];
+		}
+
+		[self markDirty];
+		[self trimToMaxCount];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Remove a tweet from our timeline, and any sorted views of it.
+// --------------------------------------------------------------------------
+
+- (void)removeTweet:(ECTwitterTweet*)tweet
+{
+	if ([self.members containsObject:tweet])
 	{
-		self.newestTweet = tweet;
+		NSUInteger index;
+		if (self.sortSelector)
+		{
+			index = [tweets indexOfObjectIdenticalTo:tweet];
+		}
+		else
+		{
+			index = indexAtOrBelowValue(tweets, tweet.twitterID.value);
+		}
+		ECAssert([tweets objectAtIndex:index] == tweet);
+
+		[[tweet retain] autorelease];
+		[tweets removeObjectAtIndex:index];
+		[self.members removeObject:tweet];
+		[tweet unpin];
+
+		if ((tweet == self.newestTweet) || (tweet == self.oldestTweet))
+		{
+			[self updateNewestAndOldest];
+		}
+
+		for (ECTwitterTimeline* view in [self.views allValues])
+		{
+			[view removeTweet:tweet];
+		}
+
+		[self markDirty];
 	}
-	
-	if (!self.oldestTweet || ([tweetDate compare: self.oldestTweet.created] == NSOrderedDescending))
+}
+
+// --------------------------------------------------------------------------
+/// Drop our oldest tweets until we're within our limit.
+/// They're no longer pinned, so the cache can evict them, but we keep
+/// their IDs so that they can be read back in if they're asked for again.
+/// Sorted views don't have a limit of their own; they follow us.
+// --------------------------------------------------------------------------
+
+- (void)trimToMaxCount
+{
+	NSUInteger maxCount = self.maxCount;
+	if (!self.sortSelector && (maxCount > 0) && ([tweets count] > maxCount))
 	{
-		self.oldestTweet = tweet;
+		if (!self.olderIDs)
+		{
+			self.olderIDs = [NSMutableArray array];
+		}
+
+		ECDebug(TwitterTimelineChannel, @"dropping %ld old tweets", (long) ([tweets count] - maxCount));
+		NSMutableArray* older = self.olderIDs;
+		while ([tweets count] > maxCount)
+		{
+			ECTwitterTweet* oldest = [tweets lastObject];
+			[older addObject:oldest.twitterID];
+			[self removeTweet:oldest];
+		}
+
+		if ([older count] > kMaxOlderIDs * 2)
+		{
+			[older sortUsingComparator:^NSComparisonResult(ECTwitterID* id1, ECTwitterID* id2) {
+				return [id2 compare:id1];
+			}];
+			[older removeObjectsInRange:NSMakeRange(kMaxOlderIDs, [older count] - kMaxOlderIDs)];
+		}
 	}
-	
-	if ([array indexOfObject:tweet] == NSNotFound)
+}
+
+// --------------------------------------------------------------------------
+/// Read back in a page of the tweets we dropped to stay within our limit,
+/// newest first.
+/// Older tweets have been asked for, so our limit grows to make room for
+/// them. Any that the cache no longer has are skipped.
+/// Returns NO if there weren't any to read back.
+// --------------------------------------------------------------------------
+
+- (BOOL)restoreOlderTweets
+{
+	NSMutableArray* older = self.olderIDs;
+	NSUInteger count = MIN([older count], kPageSize);
+	NSArray* restored = nil;
+	if (count > 0)
 	{
-		[array addObject:tweet];
+		[older sortUsingComparator:^NSComparisonResult(ECTwitterID* id1, ECTwitterID* id2) {
+			return [id2 compare:id1];
+		}];
+		NSRange range = NSMakeRange(0, count);
+		NSArray* ids = [older subarrayWithRange:range];
+		[older removeObjectsInRange:range];
+		[self markDirty];
+
+		restored = [mCache tweetsWithSortedIDs:ids];
+		if (self.maxCount > 0)
+		{
+			self.maxCount += [restored count];
+		}
+		ECDebug(TwitterTimelineChannel, @"restored %ld of %ld old tweets", (long) [restored count], (long) count);
+		for (ECTwitterTweet* tweet in restored)
+		{
+			[self addTweet:tweet];
+		}
 	}
+
+	return [restored count] > 0;
+}
+
+// --------------------------------------------------------------------------
+/// Sort the tweets again.
+/// Only needed for sorted views whose ordering can change.
+// --------------------------------------------------------------------------
+
+- (void)resort
+{
+	[tweets sortUsingFunction:compareTweets context:(void*) self.sortSelector];
+}
+
+// --------------------------------------------------------------------------
+/// Is a tweet in this timeline?
+// --------------------------------------------------------------------------
+
+- (BOOL)containsTweet:(ECTwitterTweet*)tweet
+{
+	return [self.members containsObject:tweet];
 }
 
 // --------------------------------------------------------------------------
-/// Return a new, sorted version of this timeline.
+/// Return the tweets with IDs above sinceID and at or below maxID, newest first.
+/// Either ID can be nil, to leave that end of the range open.
+/// This uses the same conventions as the since_id and max_id API parameters.
+// --------------------------------------------------------------------------
+
+- (NSArray*)tweetsSinceID:(ECTwitterID*)sinceID maxID:(ECTwitterID*)maxID
+{
+	ECAssert(self.sortSelector == nil);
+
+	NSArray* array = self.tweets;
+	NSUInteger start = maxID ? indexAtOrBelowValue(array, maxID.value) : 0;
+	NSUInteger end = sinceID ? indexAtOrBelowValue(array, sinceID.value) : [array count];
+	NSArray* result = (end > start) ? [array subarrayWithRange:NSMakeRange(start, end - start)] : [NSArray array];
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return a sorted view of this timeline.
+/// The view is sorted once when it's first asked for, and is then kept
+/// in order as tweets are added to or removed from this timeline.
+/// If the ordering depends on something that can change (such as the
+/// number of times a tweet has been viewed), call resort on the view
+/// to bring it up to date.
 // --------------------------------------------------------------------------
 
 - (ECTwitterTimeline*)	sortedWithSelector:(SEL) selector
 {
-	ECTwitterTimeline* timeline = [[ECTwitterTimeline alloc] init];
-	timeline.newestTweet = self.newestTweet;
-	timeline.oldestTweet = self.oldestTweet;
-    NSMutableArray* tweetsCopy = [self.tweets mutableCopy];
-	timeline.tweets = tweetsCopy;
-	[timeline.tweets sortUsingSelector: selector];
-	[tweetsCopy release];
+	NSString* key = NSStringFromSelector(selector);
+	ECTwitterTimeline* timeline = [self.views objectForKey:key];
+	if (!timeline)
+	{
+		timeline = [[ECTwitterTimeline alloc] initWithCache:mCache];
+		timeline.sortSelector = selector;
+		timeline.tweets = self.tweets;
+
+		if (!self.views)
+		{
+			self.views = [NSMutableDictionary dictionary];
+		}
+		[self.views setObject:timeline forKey:key];
+		[timeline release];
+	}
     
-	return [timeline autorelease];
+	return timeline;
 }
 
 // --------------------------------------------------------------------------
-/// Handle confirmation that we've authenticated ok as a given user.
-/// We fire off a request for the list of friends for the user.
+/// Handle a page of timeline results.
+///
+/// If the page was asking for everything since a given tweet, and it came
+/// back full, there are probably more tweets between that tweet and the
+/// oldest one we got. We record that as a gap, and start backfilling it.
 // --------------------------------------------------------------------------
 
 - (void) timelineHandler:(ECTwitterHandler*)handler
 {
+	ECTwitterTimelineRequest* request = [handler.extra isKindOfClass:[ECTwitterTimelineRequest class]] ? handler.extra : nil;
+	if (request.backfill)
+	{
+		--self.backfillsInFlight;
+	}
+
 	if (handler.status == StatusResults)
 	{
 		ECDebug(TwitterTimelineChannel, @"received timeline for: %@", self);
         ECAssertIsKindOfClass(handler.result, NSArray);
         
         NSArray* results = handler.result;
-		for (NSDictionary* tweetData in results)
+		ECTwitterTweet* oldestReceived = nil;
+		NSArray* tweets = [mCache addOrRefreshTweets: results];
+
+		// older tweets were asked for, so we make room for them
+		if (request.maxID && !request.backfill && (self.maxCount > 0))
+		{
+			self.maxCount += [tweets count];
+		}
+
+		for (ECTwitterTweet* tweet in tweets)
 		{
-			ECTwitterTweet* tweet = [mCache addOrRefreshTweetWithInfo: tweetData];
 			[self addTweet: tweet];
+			if (!oldestReceived || (compareIDsDescending(tweet, oldestReceived) == NSOrderedDescending))
+			{
+				oldestReceived = tweet;
+			}
 			
 			ECDebug(TwitterTimelineChannel, @"tweet info received: %@", tweet);
 		}
+
+		// backfills carry on until they get an empty page; normal requests
+		// allow some slack, since the API can return short pages
+		NSUInteger received = [results count];
+		BOOL full = request.backfill ? (received > 0) : (received >= (request.count * 3) / 4);
+		uint64_t oldestValue = oldestReceived.twitterID.value;
+		if (request.sinceID && full && (oldestValue > request.sinceID.value + 1))
+		{
+			ECTwitterTimelineRequest* gap = [[ECTwitterTimelineRequest alloc] init];
+			gap.sinceID = request.sinceID;
+			gap.maxID = [ECTwitterID idFromValue:oldestValue - 1];
+			[self.gaps addObject:gap];
+			[gap release];
+			ECDebug(TwitterTimelineChannel, @"found gap from %@ to %@", gap.sinceID, gap.maxID);
+		}
 	}
 	else
 	{
 		ECDebug(TwitterTimelineChannel, @"error receiving timeline for: %@", self);
+
+		// put the gap back so that we try again next time
+		if (request.backfill)
+		{
+			[self.gaps addObject:request];
+		}
+	}
+
+	if (request && (handler.status == StatusResults))
+	{
+		[self startBackfillsForUser:request.user method:request.method];
 	}
     
 	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
 	[nc postNotificationName: ECTwitterTimelineUpdated object: self];
 }
 
+// --------------------------------------------------------------------------
+/// Return the number of gaps that we know about but haven't filled yet.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)gapCount
+{
+	return [self.gaps count] + self.backfillsInFlight;
+}
+
+// --------------------------------------------------------------------------
+/// Issue backfill requests for any gaps we know about, up to our limit.
+/// If there's spare capacity, big gaps are split in two by ID, so that
+/// the halves can be fetched at the same time. The results are merged
+/// into the timeline in ID order whatever order they arrive in.
+// --------------------------------------------------------------------------
+
+- (void)startBackfillsForUser:(ECTwitterUser*)user method:(FetchMethod)method
+{
+	NSMutableArray* gaps = self.gaps;
+	while ((self.backfillsInFlight < self.maxConcurrentBackfills) && ([gaps count] > 0))
+	{
+		ECTwitterTimelineRequest* gap = [[gaps objectAtIndex:0] retain];
+		[gaps removeObjectAtIndex:0];
+
+		uint64_t since = gap.sinceID.value;
+		uint64_t max = gap.maxID.value;
+		NSUInteger spare = self.maxConcurrentBackfills - self.backfillsInFlight;
+		if ((spare > 1) && ([gaps count] == 0) && (max - since > kMinSplitSpan))
+		{
+			uint64_t mid = since + ((max - since) / 2);
+			ECTwitterTimelineRequest* upper = [[ECTwitterTimelineRequest alloc] init];
+			upper.sinceID = [ECTwitterID idFromValue:mid];
+			upper.maxID = gap.maxID;
+			[gaps addObject:upper];
+			[upper release];
+			gap.maxID = [ECTwitterID idFromValue:mid];
+		}
+
+		gap.user = user;
+		gap.method = method;
+		gap.count = kPageSize;
+		gap.backfill = YES;
+		++self.backfillsInFlight;
+		ECDebug(TwitterTimelineChannel, @"backfilling from %@ to %@", gap.sinceID, gap.maxID);
+		[self requestTweets:gap];
+		[gap release];
+	}
+}
 
 // --------------------------------------------------------------------------
 /// Request user timeline - everything they've received
@@ -228,15 +795,45 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 
 - (void)fetchTweetsForUser:(ECTwitterUser*)user method:(FetchMethod)method type:(FetchType)type
 {
+    // tweets we dropped to stay within our limit come back from the cache,
+    // before we go back to the server for anything older
+    if ((type == FetchOlder) && [self restoreOlderTweets])
+    {
+        [[NSNotificationCenter defaultCenter] postNotificationName:ECTwitterTimelineUpdated object:self];
+        return;
+    }
+
     ECDebug(TwitterTimelineChannel, @"requesting timeline for %@", user);
+
+    ECTwitterTimelineRequest* request = [[ECTwitterTimelineRequest alloc] init];
+    request.user = user;
+    request.method = method;
+    request.count = (method == MethodMentions) ? kMentionsPageSize : kPageSize;
     
-    NSString* methodName;
-    NSUInteger count = 200;
-    switch (method)
+    if ((type == FetchLatest) && ([self.tweets count] > 0))
+    {
+        request.sinceID = self.newestTweet.twitterID;
+    }
+    else if (type == FetchOlder)
+    {
+        request.maxID = self.oldestTweet.twitterID;
+    }
+
+    [self requestTweets:request];
+    [request release];
+}
+
+// --------------------------------------------------------------------------
+/// Issue a request for a page of tweets.
+// --------------------------------------------------------------------------
+
+- (void)requestTweets:(ECTwitterTimelineRequest*)request
+{
+    NSString* methodName = nil;
+    switch (request.method)
     {
         case MethodMentions:
             methodName = @"statuses/mentions";
-            count = 10;
             break;
             
         case MethodHome:
@@ -247,30 +844,31 @@ ECDefineDebugChannel(TwitterTimelineChannel);
             methodName = @"statuses/user_timeline";
             break;
     }
-
     
     NSMutableDictionary* parameters = [NSMutableDictionary dictionaryWithObjectsAndKeys:
                                 @"1", @"trim_user",
                                 @"1", @"include_rts",
-                                [NSString stringWithFormat:@"%ld", (long) count], @"count",
+                                [NSString stringWithFormat:@"%ld", (long) request.count], @"count",
                                 nil];
     
-    if (method != MethodMentions)
+    ECTwitterUser* user = request.user;
+    if (request.method != MethodMentions)
     {
         ECAssertNonNil(user.twitterID.string);
         [parameters setObject:user.twitterID.string forKey:@"user_id"];
     }
-    
-    if ((type == FetchLatest) && ([self.tweets count] > 0))
+
+    if (request.sinceID)
     {
-        [parameters setObject:self.newestTweet.twitterID.string forKey:@"since_id"];
+        [parameters setObject:request.sinceID.string forKey:@"since_id"];
     }
-    else if (type == FetchOlder)
+
+    if (request.maxID)
     {
-        [parameters setObject:self.oldestTweet.twitterID.string forKey:@"max_id"];
+        [parameters setObject:request.maxID.string forKey:@"max_id"];
     }
          
-    [user.engine callGetMethod:methodName parameters: parameters target: self selector: @selector(timelineHandler:)];
+    [user.engine callGetMethod:methodName parameters:parameters target:self selector:@selector(timelineHandler:) extra:request];
 }
 
 // --------------------------------------------------------------------------
@@ -297,13 +895,12 @@ ECDefineDebugChannel(TwitterTimelineChannel);
 
 - (void)removeMissingTweets
 {
-    NSUInteger n = [self.tweets count];
-    while(n--)
+    NSArray* current = [[self.tweets copy] autorelease];
+    for (ECTwitterTweet* tweet in current)
     {
-        ECTwitterTweet* tweet = [self.tweets objectAtIndex:n];
         if (![tweet gotData])
         {
-            [self.tweets removeObjectAtIndex:n];
+            [self removeTweet:tweet];
         }
     }
 }
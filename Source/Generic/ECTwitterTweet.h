@@ -19,13 +19,22 @@
 // Public Properties
 // --------------------------------------------------------------------------
 
-@property (nonatomic, readonly) NSString* text;
-@property (strong, nonatomic) NSDictionary* data;
+// The data, and everything pulled out of it, is atomic, so it can be
+// read on one thread whilst the tweet is refreshed on another. Reading
+// the data as a whole always gives either the old or the new version.
+@property (strong, readonly) NSString* text;
+@property (strong) NSDictionary* data;
 @property (strong, nonatomic) ECTwitterID* twitterID;
-@property (strong, nonatomic) ECTwitterID* authorID;
+@property (strong) ECTwitterID* authorID;
 @property (strong, nonatomic) ECTwitterUser* cachedAuthor;
 @property (nonatomic, assign) NSUInteger viewed;
 
+// Entities, pulled out of the tweet once when its data is set.
+// Screen names and hashtags are lower case, without the @ or #.
+@property (strong, readonly) NSArray* mentionedNames;
+@property (strong, readonly) NSArray* hashtags;
+@property (strong, readonly) NSArray* urls;
+
 // --------------------------------------------------------------------------
 // Public Methods
 // --------------------------------------------------------------------------
@@ -37,6 +46,11 @@
 - (BOOL)			gotData;
 
 - (void)			refreshWithInfo:(NSDictionary*)info;
+- (void)			refreshWithTweet:(ECTwitterTweet*)other;
+
+// A compact binary form of the tweet, which is what the cache saves.
++ (ECTwitterTweet*)	tweetWithCompactRecord:(NSData*)record;
+- (NSData*)			compactRecord;
 
 - (NSString*)		description;
 - (BOOL)			gotLocation;
@@ -47,6 +61,8 @@
 - (ECTwitterID*)	authorID;
 - (BOOL)			isFavourited;
 - (BOOL)			mentionsUser:(ECTwitterUser*)user;
+- (BOOL)			mentionsName:(NSString*)name;
+- (BOOL)			hasHashtag:(NSString*)hashtag;
 
 - (NSString*)		inReplyToTwitterName;
 - (ECTwitterID*)	inReplyToMessageID;
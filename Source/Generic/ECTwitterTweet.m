@@ -10,12 +10,48 @@
 #import "ECTwitterTweet.h"
 #import "ECTwitterID.h"
 #import "ECTwitterCache.h"
+#import "ECTwitterParsing.h"
 #import "ECTwitterUser.h"
 #import "ECTwitterTimeline.h"
+#import "ECTwitterRecordCoder.h"
 
 #import <CoreLocation/CoreLocation.h>
 #import <ECRegExKitLite/ECRegExKitLite.h>
 
+// --------------------------------------------------------------------------
+// Private Methods
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTweet()
+
+@property (strong) NSString* text;
+@property (strong) NSString* source;
+@property (strong) NSString* inReplyToTwitterName;
+@property (strong) NSString* inReplyToMessageIDString;
+@property (strong) NSString* inReplyToAuthorIDString;
+@property (strong) NSDictionary* unpackedExtras;
+@property (strong) NSData* packedExtras;
+@property (strong) NSDictionary* builtData;
+@property (strong) NSDictionary* builtAuthorData;
+@property (assign) NSTimeInterval createdTime;
+@property (assign) BOOL favourited;
+@property (assign) BOOL hasData;
+@property (strong, readwrite) NSArray* mentionedNames;
+@property (strong, readwrite) NSArray* hashtags;
+@property (strong, readwrite) NSArray* urls;
+@property (strong) NSString* sourceName;
+@property (strong) NSURL* sourceURL;
+
++ (NSArray*)decodedKeys;
++ (NSTimeInterval)timeFromValue:(id)value;
+- (NSDictionary*)extras;
+- (NSData*)packExtras;
+- (void)readCompactRecord:(NSDictionary*)record;
+- (void)extractEntitiesFromInfo:(NSDictionary*)info;
+- (void)setMentionedNames:(NSArray*)names hashtags:(NSArray*)tags;
+
+@end
+
 @implementation ECTwitterTweet
 
 ECDefineDebugChannel(TweetChannel);
@@ -24,11 +60,27 @@ ECDefineDebugChannel(TweetChannel);
 // Properties
 // --------------------------------------------------------------------------
 
-@synthesize data;
+@synthesize text;
+@synthesize source;
+@synthesize inReplyToTwitterName;
+@synthesize inReplyToMessageIDString;
+@synthesize inReplyToAuthorIDString;
+@synthesize unpackedExtras;
+@synthesize packedExtras;
+@synthesize builtData;
+@synthesize builtAuthorData;
+@synthesize createdTime;
+@synthesize favourited;
+@synthesize hasData;
 @synthesize cachedAuthor;
 @synthesize twitterID;
 @synthesize authorID;
 @synthesize viewed;
+@synthesize mentionedNames;
+@synthesize hashtags;
+@synthesize urls;
+@synthesize sourceName;
+@synthesize sourceURL;
 
 // --------------------------------------------------------------------------
 /// Set up with data properties.
@@ -38,8 +90,8 @@ ECDefineDebugChannel(TweetChannel);
 {
 	if ((self = [super initWithCache: cache]) != nil)
 	{
-        [self refreshWithInfo:info];
 		self.twitterID = [ECTwitterID idFromDictionary: info];
+        [self refreshWithInfo:info];
 	}
 	
 	return self;
@@ -69,7 +121,7 @@ ECDefineDebugChannel(TweetChannel);
     ECTwitterID* tweetID = [coder decodeObjectForKey:@"id"];
     
     // is there already an instance with this id in the cache?
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
     ECTwitterTweet* existing = [cache existingTweetWithID:tweetID];
     if (existing)
     {
@@ -96,6 +148,414 @@ ECDefineDebugChannel(TweetChannel);
     return self;
 }
 
+// --------------------------------------------------------------------------
+/// Keys that we store in their own properties, rather than in the extras dictionary.
+/// (we also skip the numeric ids, since we only ever use the string versions, and
+/// the author info, which is already in the user cache)
+// --------------------------------------------------------------------------
+
+static NSString *const kIDKey = @"id_str";
+static NSString *const kTextKey = @"text";
+static NSString *const kCreatedKey = @"created_at";
+static NSString *const kFavouritedKey = @"favorited";
+static NSString *const kSourceKey = @"source";
+static NSString *const kReplyNameKey = @"in_reply_to_screen_name";
+static NSString *const kReplyMessageKey = @"in_reply_to_status_id_str";
+static NSString *const kReplyAuthorKey = @"in_reply_to_user_id_str";
+static NSString *const kUserKey = @"user";
+static NSString *const kSearchAuthorKey = @"from_user_id_str";
+
++ (NSArray*)decodedKeys
+{
+    static NSArray* keys = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        keys = [[NSArray alloc] initWithObjects:kIDKey, kTextKey, kCreatedKey, kFavouritedKey, kSourceKey, kReplyNameKey, kReplyMessageKey, kReplyAuthorKey, kUserKey, kSearchAuthorKey,
+                @"id", @"in_reply_to_status_id", @"in_reply_to_user_id", @"from_user_id", nil];
+    });
+    
+    return keys;
+}
+
+// --------------------------------------------------------------------------
+/// Return a value from the info, treating null as missing.
+// --------------------------------------------------------------------------
+
+static inline id valueForKey(NSDictionary* info, NSString* key)
+{
+    id value = [info objectForKey:key];
+    return (value == [NSNull null]) ? nil : value;
+}
+
+// --------------------------------------------------------------------------
+/// Set the tweet data.
+/// The fields that we use are pulled out into properties, and anything
+/// we don't know about is kept in an extras dictionary. That's only
+/// packed when the tweet is saved (see -packExtras), so a fresh tweet
+/// doesn't pay for packing it.
+///
+/// The fields are all set together under our lock, so that -data never
+/// sees half of an update. The entities are done afterwards, since
+/// indexing them takes the cache's lock, which mustn't be taken whilst
+/// holding ours.
+// --------------------------------------------------------------------------
+
+- (void)setData:(NSDictionary*)info
+{
+    NSTimeInterval time = [ECTwitterTweet timeFromValue:valueForKey(info, kCreatedKey)];
+    NSMutableDictionary* remaining = [info mutableCopy];
+    [remaining removeObjectsForKeys:[ECTwitterTweet decodedKeys]];
+    NSDictionary* extras = ([remaining count] > 0) ? [NSDictionary dictionaryWithDictionary:remaining] : nil;
+    uint64_t hash = [ECTwitterCachedObject hashForInfo:info];
+
+    @synchronized(self)
+    {
+        self.hasData = (info != nil);
+        self.text = valueForKey(info, kTextKey);
+        self.source = valueForKey(info, kSourceKey);
+        self.inReplyToTwitterName = valueForKey(info, kReplyNameKey);
+        self.inReplyToMessageIDString = valueForKey(info, kReplyMessageKey);
+        self.inReplyToAuthorIDString = valueForKey(info, kReplyAuthorKey);
+        self.favourited = [valueForKey(info, kFavouritedKey) boolValue];
+        self.createdTime = time;
+        self.unpackedExtras = extras;
+        self.packedExtras = nil;
+        self.builtData = nil;
+        self.infoHash = hash;
+    }
+    [remaining release];
+
+    [self extractEntitiesFromInfo:info];
+}
+
+// --------------------------------------------------------------------------
+/// Return the tweet data as a dictionary.
+/// It isn't stored, so it's rebuilt from our properties the first time it's
+/// asked for after a change, and kept until the next one (or until we're
+/// saved). The user is the full data of the author, if we've got it, and
+/// the dictionary is rebuilt when that changes too.
+/// We find the author before taking our lock, since looking it up takes
+/// the cache's lock, and that has to be taken first.
+// --------------------------------------------------------------------------
+
+- (NSDictionary*)data
+{
+    ECTwitterID* author = self.authorID;
+    ECTwitterUser* user = self.cachedAuthor;
+    if (!user && author)
+    {
+        user = [mCache existingUserWithID:author];
+    }
+    NSDictionary* authorData = user.data;
+
+    @synchronized(self)
+    {
+        NSDictionary* result = self.builtData;
+        if (self.hasData && (!result || (self.builtAuthorData != authorData)))
+        {
+            NSMutableDictionary* built = [NSMutableDictionary dictionaryWithDictionary:self.extras];
+            [built setValue:self.twitterID.string forKey:kIDKey];
+            [built setValue:self.text forKey:kTextKey];
+            [built setValue:self.source forKey:kSourceKey];
+            [built setValue:self.inReplyToTwitterName forKey:kReplyNameKey];
+            [built setValue:self.inReplyToMessageIDString forKey:kReplyMessageKey];
+            [built setValue:self.inReplyToAuthorIDString forKey:kReplyAuthorKey];
+            [built setObject:[NSNumber numberWithBool:self.favourited] forKey:kFavouritedKey];
+            if (self.createdTime)
+            {
+                [built setObject:[NSNumber numberWithDouble:self.createdTime] forKey:kCreatedKey];
+            }
+            if (authorData)
+            {
+                [built setObject:authorData forKey:kUserKey];
+            }
+            else if (author)
+            {
+                [built setObject:[NSDictionary dictionaryWithObject:author.string forKey:kIDKey] forKey:kUserKey];
+            }
+
+            result = [NSDictionary dictionaryWithDictionary:built];
+            self.builtData = result;
+            self.builtAuthorData = authorData;
+        }
+        else if (!self.hasData)
+        {
+            result = nil;
+        }
+
+        return [[result retain] autorelease];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the fields that we don't pull out into properties.
+/// If they've been packed, we unpack them the first time they're asked
+/// for, and hang on to the result.
+// --------------------------------------------------------------------------
+
+- (NSDictionary*)extras
+{
+    @synchronized(self)
+    {
+        NSDictionary* result = self.unpackedExtras;
+        NSData* packed = self.packedExtras;
+        if (!result && packed)
+        {
+            result = [ECTwitterRecordCoder payloadWithPackedData:packed];
+            self.unpackedExtras = result;
+        }
+
+        return [[result retain] autorelease];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the extras packed, for saving.
+/// Once a tweet has been saved it's less likely to be looked at again,
+/// so we keep just the packed version, and let the dictionaries go. 
+/// Must be called with our lock held.
+// --------------------------------------------------------------------------
+
+- (NSData*)packExtras
+{
+    NSData* result = self.packedExtras;
+    NSDictionary* extras = self.unpackedExtras;
+    if (!result && extras)
+    {
+        result = [ECTwitterRecordCoder packedDataWithPayload:extras];
+        self.packedExtras = result;
+    }
+    self.unpackedExtras = nil;
+    self.builtData = nil;
+    self.builtAuthorData = nil;
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Convert a created_at value into a time.
+/// Normally the parser will have turned it into a number already.
+// --------------------------------------------------------------------------
+
++ (NSTimeInterval)timeFromValue:(id)value
+{
+	NSTimeInterval result = 0;
+	if ([value isKindOfClass: [NSNumber class]])
+	{
+		result = [value doubleValue];
+	}
+	else if ([value isKindOfClass: [NSString class]])
+	{
+		result = ECTwitterTimeFromString(value);
+		ECDebug(TweetChannel, @"converted time %lf from string %@", result, value);
+	}
+	else if ([value isKindOfClass: [NSDate class]])
+	{
+		result = [value timeIntervalSince1970];
+	}
+	
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Is a character part of a screen name or hashtag?
+// --------------------------------------------------------------------------
+
+static inline BOOL isEntityCharacter(unichar c)
+{
+    if (c < 0x80)
+    {
+        return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) || (c == '_');
+    }
+    
+    static CFCharacterSetRef alphanumerics = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        alphanumerics = CFCharacterSetGetPredefined(kCFCharacterSetAlphaNumeric);
+    });
+    
+    return CFCharacterSetIsCharacterMember(alphanumerics, c);
+}
+
+// --------------------------------------------------------------------------
+/// Add a lower case name to a list of entities, if it's not already there.
+// --------------------------------------------------------------------------
+
+static void addEntity(NSMutableArray** list, NSString* name)
+{
+    if ([name length] > 0)
+    {
+        name = [name lowercaseString];
+        if (!*list)
+        {
+            *list = [NSMutableArray arrayWithCapacity:2];
+        }
+        if (![*list containsObject:name])
+        {
+            [*list addObject:name];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Scan the text of a tweet for @names, #tags and links.
+/// This is only used for tweets that didn't come with an entities dictionary.
+// --------------------------------------------------------------------------
+
+static void scanEntities(NSString* text, NSMutableArray** names, NSMutableArray** tags, NSMutableArray** links)
+{
+    NSUInteger length = [text length];
+    unichar stackBuffer[512];
+    unichar* chars = (length <= 512) ? stackBuffer : malloc(length * sizeof(unichar));
+    [text getCharacters:chars range:NSMakeRange(0, length)];
+
+    NSUInteger n = 0;
+    while (n < length)
+    {
+        unichar c = chars[n];
+        BOOL atBoundary = (n == 0) || !isEntityCharacter(chars[n - 1]);
+        if (atBoundary && ((c == '@') || (c == '#')))
+        {
+            NSUInteger start = ++n;
+            BOOL allDigits = YES;
+            while ((n < length) && isEntityCharacter(chars[n]))
+            {
+                allDigits = allDigits && (chars[n] >= '0') && (chars[n] <= '9');
+                ++n;
+            }
+            
+            if (n > start)
+            {
+                NSString* name = [[NSString alloc] initWithCharacters:chars + start length:n - start];
+                if (c == '@')
+                {
+                    addEntity(names, name);
+                }
+                else if (!allDigits)
+                {
+                    addEntity(tags, name);
+                }
+                [name release];
+            }
+        }
+        else if (atBoundary && (c == 'h') && (length - n > 7) && ((chars[n + 4] == ':') || (chars[n + 5] == ':')))
+        {
+            NSUInteger start = n;
+            while ((n < length) && (chars[n] > ' '))
+            {
+                ++n;
+            }
+            
+            NSString* link = [[NSString alloc] initWithCharacters:chars + start length:n - start];
+            if ([link hasPrefix:@"http://"] || [link hasPrefix:@"https://"])
+            {
+                if (!*links)
+                {
+                    *links = [NSMutableArray arrayWithCapacity:1];
+                }
+                [*links addObject:link];
+            }
+            [link release];
+        }
+        else
+        {
+            ++n;
+        }
+    }
+
+    if (chars != stackBuffer)
+    {
+        free(chars);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Pull the mentions, hashtags, links and source application out of the
+/// tweet data, so that we don't have to search the text every time we're
+/// asked about them.
+/// We use the entities that twitter gives us, if there are any, and scan
+/// the text ourselves otherwise.
+// --------------------------------------------------------------------------
+
+static NSString *const kSourceExpression = @"<a.+href=\"(.*)\".*>(.*)</a>";
+
+- (void)extractEntitiesFromInfo:(NSDictionary*)info
+{
+    NSMutableArray* names = nil;
+    NSMutableArray* tags = nil;
+    NSMutableArray* links = nil;
+
+    NSDictionary* entities = valueForKey(info, @"entities");
+    if ([entities isKindOfClass:[NSDictionary class]])
+    {
+        for (NSDictionary* mention in valueForKey(entities, @"user_mentions"))
+        {
+            addEntity(&names, valueForKey(mention, @"screen_name"));
+        }
+        for (NSDictionary* tag in valueForKey(entities, @"hashtags"))
+        {
+            addEntity(&tags, valueForKey(tag, @"text"));
+        }
+        for (NSDictionary* url in valueForKey(entities, @"urls"))
+        {
+            NSString* link = valueForKey(url, @"expanded_url");
+            if (!link)
+            {
+                link = valueForKey(url, @"url");
+            }
+            if (link)
+            {
+                if (!links)
+                {
+                    links = [NSMutableArray arrayWithCapacity:1];
+                }
+                [links addObject:link];
+            }
+        }
+    }
+    else if (self.text)
+    {
+        scanEntities(self.text, &names, &tags, &links);
+    }
+
+    self.urls = links;
+    [self setMentionedNames:names hashtags:tags];
+    
+    NSString* name = nil;
+    NSURL* url = nil;
+    NSString* sourceText = self.source;
+    if (sourceText && ([sourceText rangeOfString:@"</a>"].location != NSNotFound))
+    {
+        NSArray* captures = [sourceText captureComponentsMatchedByRegex: kSourceExpression];
+        if ([captures count] == 3)
+        {
+            url = [NSURL URLWithString: [captures objectAtIndex: 1]];
+            name = [captures objectAtIndex: 2];
+        }
+    }
+    self.sourceName = name;
+    self.sourceURL = url;
+}
+
+// --------------------------------------------------------------------------
+/// Update our mentions and hashtags, and (re)index us in the cache.
+// --------------------------------------------------------------------------
+
+- (void)setMentionedNames:(NSArray*)names hashtags:(NSArray*)tags
+{
+    NSArray* oldNames = self.mentionedNames;
+    NSArray* oldTags = self.hashtags;
+    BOOL sameNames = (names == oldNames) || [names isEqualToArray:oldNames];
+    BOOL sameTags = (tags == oldTags) || [tags isEqualToArray:oldTags];
+    if (!sameNames || !sameTags)
+    {
+        [mCache unindexTweet:self];
+        self.mentionedNames = names;
+        self.hashtags = tags;
+    }
+    [mCache indexTweet:self];
+}
+
 // --------------------------------------------------------------------------
 /// Update the tweet data.
 // --------------------------------------------------------------------------
@@ -118,6 +578,62 @@ ECDefineDebugChannel(TweetChannel);
             self.authorID = [ECTwitterID idFromString:searchAuthor];
         }
     }
+
+    @synchronized(self)
+    {
+        // the data we built may have the old author in it
+        self.builtData = nil;
+    }
+
+    [self markDirty];
+}
+
+// --------------------------------------------------------------------------
+/// Update from another instance of the same tweet.
+/// Used to fill in a placeholder from a tweet that was decoded standalone,
+/// without having to pull the data apart again.
+// --------------------------------------------------------------------------
+
+- (void)refreshWithTweet:(ECTwitterTweet*)other
+{
+    ECAssert([self.twitterID isEqual:other.twitterID]);
+
+    @synchronized(self)
+    {
+        self.hasData = other.hasData;
+        self.text = other.text;
+        self.source = other.source;
+        self.inReplyToTwitterName = other.inReplyToTwitterName;
+        self.inReplyToMessageIDString = other.inReplyToMessageIDString;
+        self.inReplyToAuthorIDString = other.inReplyToAuthorIDString;
+        self.favourited = other.favourited;
+        self.createdTime = other.createdTime;
+        self.unpackedExtras = other.unpackedExtras;
+        self.packedExtras = other.packedExtras;
+        self.builtData = nil;
+        self.infoHash = other.infoHash;
+        self.urls = other.urls;
+        self.sourceName = other.sourceName;
+        self.sourceURL = other.sourceURL;
+        self.authorID = other.authorID;
+    }
+    [self setMentionedNames:other.mentionedNames hashtags:other.hashtags];
+    self.viewed = other.viewed;
+
+    [self markDirty];
+}
+
+// --------------------------------------------------------------------------
+/// Update the view count.
+// --------------------------------------------------------------------------
+
+- (void)setViewed:(NSUInteger)newViewed
+{
+    if (newViewed != viewed)
+    {
+        viewed = newViewed;
+        [self markDirty];
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -126,7 +642,7 @@ ECDefineDebugChannel(TweetChannel);
 
 - (BOOL) gotData
 {
-	return (self.data != nil);
+	return self.hasData;
 }
 
 // --------------------------------------------------------------------------
@@ -135,9 +651,23 @@ ECDefineDebugChannel(TweetChannel);
 
 - (void) dealloc
 {
-	[data release];
+	[text release];
+	[source release];
+	[inReplyToTwitterName release];
+	[inReplyToMessageIDString release];
+	[inReplyToAuthorIDString release];
+	[unpackedExtras release];
+	[packedExtras release];
+	[builtData release];
+	[builtAuthorData release];
+	[mentionedNames release];
+	[hashtags release];
+	[urls release];
+	[sourceName release];
+	[sourceURL release];
 	[authorID release];
 	[twitterID release];
+	[cachedAuthor unpin];
 	[cachedAuthor release];
 	
 	[super dealloc];
@@ -150,11 +680,6 @@ ECDefineDebugChannel(TweetChannel);
 	return [NSString stringWithFormat: @"%@: '%@' %@ views:%ld #%@", self.author.twitterName, truncated, date, (long) self.viewed, self.twitterID];
 }
 
-- (NSString*)text
-{
-	return [self.data objectForKey: @"text"];
-}
-
 //- (NSString*)source
 //{
 //	return [self.user objectForKey: @"source"];
@@ -162,13 +687,13 @@ ECDefineDebugChannel(TweetChannel);
 
 - (BOOL) gotLocation
 {
-	return [self.data objectForKey: @"geo"] || [self.data objectForKey: @"coordinate"];
+	NSDictionary* extras = self.extras;
+	return [extras objectForKey: @"geo"] || [extras objectForKey: @"coordinate"];
 }
 
 - (BOOL) isFavourited
 {
-	NSNumber* value = [self.data objectForKey: @"favorited"];
-	return [value boolValue];
+	return self.favourited;
 }
 
 //- (NSString*)locationText
@@ -182,14 +707,15 @@ ECDefineDebugChannel(TweetChannel);
 {
 	CLLocation* result = nil;
 	
-	id value = [self.data objectForKey: @"geo"];
+	NSDictionary* extras = self.extras;
+	id value = [extras objectForKey: @"geo"];
 	if (value && (value != [NSNull null]))
 	{
 		value = [(NSDictionary*)value objectForKey: @"coordinates"];
 	}
 	else
 	{
-		value = [self.data objectForKey: @"coordinate"];
+		value = [extras objectForKey: @"coordinate"];
 	}
 	
 	if (value && (value != [NSNull null]))
@@ -215,25 +741,11 @@ ECDefineDebugChannel(TweetChannel);
 
 - (NSDate*)created
 {
-	NSDate* date;
-	id value = [self.data objectForKey: @"created_at"];
-	if ([value isKindOfClass: [NSString class]])
-	{
-		NSDateFormatter* formatter = [[NSDateFormatter alloc] init];
-		[formatter setDateFormat: @"EEE MM dd HH:mm:ss ZZZ yyyy"];
-		date = [formatter dateFromString: value];
-		[formatter release];
-		ECDebug(TweetChannel, @"converted date %@ from string %@", date, value);
-	}
-	else if ([value isKindOfClass: [NSNumber class]])
-	{
-		date = [NSDate dateWithTimeIntervalSince1970: [value unsignedIntegerValue]];
-	}
-	else
+	NSDate* date = nil;
+	if (self.createdTime)
 	{
-		date = value;
+		date = [NSDate dateWithTimeIntervalSince1970: self.createdTime];
 	}
-
 	
 	return date;
 }
@@ -251,14 +763,61 @@ ECDefineDebugChannel(TweetChannel);
 	return author;
 }
 
+// --------------------------------------------------------------------------
+/// Keep a note of the author.
+/// We pin it in the cache, so that all our tweets share the same instance.
+// --------------------------------------------------------------------------
+
+- (void)setCachedAuthor:(ECTwitterUser*)author
+{
+	if (author != cachedAuthor)
+	{
+		[author pin];
+		[cachedAuthor unpin];
+		[cachedAuthor release];
+		cachedAuthor = [author retain];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Return a rough idea of how much memory we're using.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)estimatedSize
+{
+	static const NSUInteger kExtraSize = 64;
+
+	NSUInteger size = [super estimatedSize];
+	size += ([self.text length] + [self.source length] + [self.inReplyToTwitterName length]) * sizeof(unichar);
+	size += [self.packedExtras length];
+	size += [self.unpackedExtras count] * kExtraSize;
+	size += ([self.mentionedNames count] + [self.hashtags count] + [self.urls count] + (self.sourceName ? 1 : 0)) * kExtraSize;
+
+	return size;
+}
+
+// --------------------------------------------------------------------------
+/// Tweets that have been looked at more often are more worth keeping.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)evictionWeight
+{
+	return self.viewed;
+}
+
+static inline NSComparisonResult compareTimes(NSTimeInterval t1, NSTimeInterval t2)
+{
+	return (t1 < t2) ? NSOrderedAscending : ((t1 > t2) ? NSOrderedDescending : NSOrderedSame);
+}
+
 - (NSComparisonResult) compareByDateAscending:(ECTwitterTweet*)other
 {
-	return [self.created compare: other.created];
+	return compareTimes(self.createdTime, other.createdTime);
 }
 
 - (NSComparisonResult) compareByDateDescending:(ECTwitterTweet*)other
 {
-	return [other.created compare: self.created];
+	return compareTimes(other.createdTime, self.createdTime);
 }
 
 - (NSComparisonResult) compareByViewsDateDescending:(ECTwitterTweet*)other
@@ -274,20 +833,15 @@ ECDefineDebugChannel(TweetChannel);
 	else
 	{
 		// compare by date
-		return [other.created compare: self.created];
+		return compareTimes(other.createdTime, self.createdTime);
 	}
 
 }
 
-- (NSString*)inReplyToTwitterName
-{
-	return [self.data objectForKey: @"in_reply_to_screen_name"];
-}
-
 - (ECTwitterID*)inReplyToMessageID
 {
 	ECTwitterID* result = nil;
-	NSString* string = [self.data objectForKey: @"in_reply_to_status_id_str"];
+	NSString* string = self.inReplyToMessageIDString;
 	if (string)
 	{
 		result = [ECTwitterID idFromString:string];
@@ -299,7 +853,7 @@ ECDefineDebugChannel(TweetChannel);
 - (ECTwitterID*)inReplyToAuthorID
 {
 	ECTwitterID* result = nil;
-	NSString* string = [self.data objectForKey: @"in_reply_to_user_id_str"];
+	NSString* string = self.inReplyToAuthorIDString;
 	if (string)
 	{
 		result = [ECTwitterID idFromString:string];
@@ -308,43 +862,128 @@ ECDefineDebugChannel(TweetChannel);
 	return result;
 }
 
-static NSString *const kSourceExpression = @"<a.+href=\"(.*)\".*>(.*)</a>";
+- (BOOL) mentionsUser:(ECTwitterUser *)user
+{
+	return [self mentionsName:user.twitterName];
+}
+
+// --------------------------------------------------------------------------
 
-- (NSString*)sourceName
+- (BOOL) mentionsName:(NSString*)name
 {
-	NSString* source = [self.data objectForKey: @"source"];
-	NSArray* captures = [source captureComponentsMatchedByRegex: kSourceExpression];
-	NSString* result = nil;
-	if ([captures count] == 3)
-	{
-		result = [captures objectAtIndex: 2];
-	}
+	return name && [self.mentionedNames containsObject:[name lowercaseString]];
+}
 
-	return result;
+// --------------------------------------------------------------------------
+
+- (BOOL) hasHashtag:(NSString*)hashtag
+{
+	return hashtag && [self.hashtags containsObject:[hashtag lowercaseString]];
 }
 
+// --------------------------------------------------------------------------
+/// Keys for the things in a compact record that aren't in the tweet data.
+/// They're all known strings, so each costs a byte.
+// --------------------------------------------------------------------------
+
+static NSString *const kViewedRecordKey = @"viewed";
+static NSString *const kHasDataRecordKey = @"has_data";
+static NSString *const kExtrasRecordKey = @"extras";
+static NSString *const kAuthorRecordKey = @"author_id_str";
+static NSString *const kMentionsRecordKey = @"user_mentions";
+static NSString *const kHashtagsRecordKey = @"hashtags";
+static NSString *const kURLsRecordKey = @"urls";
+static NSString *const kSourceNameRecordKey = @"source_name";
+static NSString *const kSourceURLRecordKey = @"source_url";
+
+// --------------------------------------------------------------------------
+/// Return the tweet as a compact record, for the cache to save.
+///
+/// This is much smaller than a keyed archive of the data. The extras
+/// go in packed, and the entities and source that we pulled out of the
+/// data go in as they are, so that reading the record back doesn't have
+/// to unpack or search anything.
 // --------------------------------------------------------------------------
 
-- (NSURL*)sourceURL
+- (NSData*)compactRecord
 {
-	NSString* source = [self.data objectForKey: @"source"];
-	NSArray* captures = [source captureComponentsMatchedByRegex: kSourceExpression];
-	NSURL* result = nil;
-	if ([captures count] == 3)
-	{
-		result = [NSURL URLWithString: [captures objectAtIndex: 1]];
-	}
-	
-	return result;
+    NSMutableDictionary* record = [NSMutableDictionary dictionaryWithCapacity:16];
+    [record setObject:self.twitterID.string forKey:kIDKey];
+    [record setObject:[NSNumber numberWithUnsignedInteger:self.viewed] forKey:kViewedRecordKey];
+    @synchronized(self)
+    {
+        if (self.hasData)
+        {
+            [record setObject:[NSNumber numberWithBool:YES] forKey:kHasDataRecordKey];
+            [record setValue:self.text forKey:kTextKey];
+            [record setValue:self.source forKey:kSourceKey];
+            [record setValue:self.inReplyToTwitterName forKey:kReplyNameKey];
+            [record setValue:self.inReplyToMessageIDString forKey:kReplyMessageKey];
+            [record setValue:self.inReplyToAuthorIDString forKey:kReplyAuthorKey];
+            [record setObject:[NSNumber numberWithBool:self.favourited] forKey:kFavouritedKey];
+            [record setObject:[NSNumber numberWithDouble:self.createdTime] forKey:kCreatedKey];
+            [record setValue:[self packExtras] forKey:kExtrasRecordKey];
+        }
+        [record setValue:self.authorID.string forKey:kAuthorRecordKey];
+        [record setValue:self.mentionedNames forKey:kMentionsRecordKey];
+        [record setValue:self.hashtags forKey:kHashtagsRecordKey];
+        [record setValue:self.urls forKey:kURLsRecordKey];
+        [record setValue:self.sourceName forKey:kSourceNameRecordKey];
+        [record setValue:[self.sourceURL absoluteString] forKey:kSourceURLRecordKey];
+    }
+
+    return [ECTwitterRecordCoder dataWithPayload:record];
 }
 
+// --------------------------------------------------------------------------
+/// Return a tweet read back from a compact record.
+/// Like a tweet decoded with a nil cache, it's standalone; it's up to
+/// the caller to put it into a cache.
 // --------------------------------------------------------------------------
 
-- (BOOL) mentionsUser:(ECTwitterUser *)user
++ (ECTwitterTweet*)tweetWithCompactRecord:(NSData*)data
+{
+    ECTwitterTweet* result = nil;
+    NSDictionary* record = [ECTwitterRecordCoder payloadWithData:data];
+    ECTwitterID* tweetID = [record isKindOfClass:[NSDictionary class]] ? [ECTwitterID idFromKey:kIDKey dictionary:record] : nil;
+    if (tweetID)
+    {
+        result = [[[ECTwitterTweet alloc] initWithID:tweetID inCache:nil] autorelease];
+        [result readCompactRecord:record];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Fill in our properties from a compact record.
+// --------------------------------------------------------------------------
+
+- (void)readCompactRecord:(NSDictionary*)record
 {
-	NSString* text = [self text];
-	NSString* name = [NSString stringWithFormat:@"@%@", user.twitterName];
-	return [text rangeOfString: name].length > 0;
+    NSString* author = valueForKey(record, kAuthorRecordKey);
+    NSString* sourceURL = valueForKey(record, kSourceURLRecordKey);
+
+    @synchronized(self)
+    {
+        self.hasData = [valueForKey(record, kHasDataRecordKey) boolValue];
+        self.text = valueForKey(record, kTextKey);
+        self.source = valueForKey(record, kSourceKey);
+        self.inReplyToTwitterName = valueForKey(record, kReplyNameKey);
+        self.inReplyToMessageIDString = valueForKey(record, kReplyMessageKey);
+        self.inReplyToAuthorIDString = valueForKey(record, kReplyAuthorKey);
+        self.favourited = [valueForKey(record, kFavouritedKey) boolValue];
+        self.createdTime = [valueForKey(record, kCreatedKey) doubleValue];
+        self.unpackedExtras = nil;
+        self.packedExtras = valueForKey(record, kExtrasRecordKey);
+        self.builtData = nil;
+        self.authorID = author ? [ECTwitterID idFromString:author] : nil;
+        self.urls = valueForKey(record, kURLsRecordKey);
+        self.sourceName = valueForKey(record, kSourceNameRecordKey);
+        self.sourceURL = sourceURL ? [NSURL URLWithString:sourceURL] : nil;
+    }
+    [self setMentionedNames:valueForKey(record, kMentionsRecordKey) hashtags:valueForKey(record, kHashtagsRecordKey)];
+    self.viewed = [valueForKey(record, kViewedRecordKey) unsignedIntegerValue];
 }
 
 // --------------------------------------------------------------------------
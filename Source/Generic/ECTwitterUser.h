@@ -11,6 +11,7 @@
 
 @class ECTwitterAuthentication;
 @class ECTwitterID;
+@class ECTwitterIDSet;
 @class ECTwitterImage;
 @class ECTwitterUserTimeline;
 @class ECTwitterUserMentionsTimeline;
@@ -24,9 +25,15 @@
 // --------------------------------------------------------------------------
 
 @property (strong, nonatomic) ECTwitterImage* cachedImage;
-@property (strong, nonatomic) NSDictionary* data;
+
+// Atomic, like the fields pulled out of it, so that it can be read on one
+// thread whilst the user is refreshed on another.
+@property (strong) NSDictionary* data;
+
 @property (strong, nonatomic) ECTwitterUserList* followers;
 @property (strong, nonatomic) ECTwitterUserList* friends;
+@property (strong, nonatomic, readonly) ECTwitterIDSet* followerIDs;
+@property (strong, nonatomic, readonly) ECTwitterIDSet* friendIDs;
 @property (strong, nonatomic) ECTwitterUserMentionsTimeline* mentions;
 @property (strong, nonatomic) ECTwitterUserTimeline* posts;
 @property (strong, nonatomic) ECTwitterUserTimeline* timeline;
@@ -59,5 +66,14 @@
 
 - (void)            requestFollowers;
 - (void)            requestFriends;
+- (void)            requestFollowerIDs;
+- (void)            requestFriendIDs;
+
+- (ECTwitterIDSet*) mutualIDs;
+- (ECTwitterIDSet*) followerIDsNotFollowedBack;
+- (ECTwitterIDSet*) addedFollowerIDs;
+- (ECTwitterIDSet*) removedFollowerIDs;
+
+- (NSDictionary*)   socialGraph;
 
 @end
@@ -11,19 +11,42 @@
 
 #import "ECTwitterAuthentication.h"
 #import "ECTwitterID.h"
+#import "ECTwitterIDSet.h"
 #import "ECTwitterTweet.h"
 #import "ECTwitterCache.h"
 #import "ECTwitterHandler.h"
 #import "ECTwitterEngine.h"
 #import "ECTwitterUserMentionsTimeline.h"
 #import "ECTwitterUserTimeline.h"
+#import "ECTwitterRecordCoder.h"
 #import "ECTwitterUserList.h"
 
 @interface ECTwitterUser()
+
+@property (strong) NSString* name;
+@property (strong) NSString* twitterName;
+@property (strong) NSString* bio; // the "description" field, renamed to avoid a clash with -description
+@property (strong) NSString* imageURL;
+@property (strong) NSDictionary* extras;
+@property (strong) NSDictionary* builtData;
+@property (assign) BOOL hasData;
+@property (assign, nonatomic) BOOL waitingForImage;
+@property (strong, nonatomic, readwrite) ECTwitterIDSet* followerIDs;
+@property (strong, nonatomic, readwrite) ECTwitterIDSet* friendIDs;
+@property (strong, nonatomic) ECTwitterIDSet* previousFollowerIDs;
+@property (strong, nonatomic) NSMutableData* pendingFollowerIDs;
+@property (strong, nonatomic) NSMutableData* pendingFriendIDs;
+@property (assign, nonatomic) BOOL socialGraphLoaded;
+
++ (NSArray*)decodedKeys;
 - (void)makeTimelines;
 - (void)friendsHandler:(ECTwitterHandler*)handler;
 - (void)followersHandler:(ECTwitterHandler*)handler;
 - (void)followerIDsHandler:(ECTwitterHandler*)handler;
+- (void)friendIDsHandler:(ECTwitterHandler*)handler;
+- (void)requestIDsWithMethod:(NSString*)method cursor:(NSString*)cursor selector:(SEL)selector;
+- (BOOL)receiveIDsFromHandler:(ECTwitterHandler*)handler into:(NSMutableData*)pending method:(NSString*)method selector:(SEL)selector;
+- (void)loadSocialGraphIfNeeded;
 @end
 
 
@@ -36,14 +59,27 @@ ECDefineDebugChannel(TwitterUserChannel);
 // --------------------------------------------------------------------------
 
 @synthesize authentication = _authentication;
+@synthesize bio = _bio;
+@synthesize builtData = _builtData;
 @synthesize cachedImage = _cachedImage;
-@synthesize data = _data;
+@synthesize extras = _extras;
+@synthesize hasData = _hasData;
+@synthesize imageURL = _imageURL;
+@synthesize name = _name;
+@synthesize pendingFollowerIDs = _pendingFollowerIDs;
+@synthesize pendingFriendIDs = _pendingFriendIDs;
+@synthesize previousFollowerIDs = _previousFollowerIDs;
+@synthesize followerIDs = _followerIDs;
 @synthesize followers = _followers;
+@synthesize friendIDs = _friendIDs;
 @synthesize friends = _friends;
 @synthesize mentions = _mentions;
 @synthesize posts = _posts;
+@synthesize socialGraphLoaded = _socialGraphLoaded;
 @synthesize timeline = _timeline;
 @synthesize twitterID = _twitterID;
+@synthesize twitterName = _twitterName;
+@synthesize waitingForImage = _waitingForImage;
 
 // --------------------------------------------------------------------------
 /// Set up with data properties.
@@ -72,7 +108,7 @@ ECDefineDebugChannel(TwitterUserChannel);
     ECTwitterID* userID = [coder decodeObjectForKey:@"id"];
     
     // is there already an instance with this id in the cache?
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
     ECTwitterUser* existing = [cache existingUserWithID:userID];
     if (existing)
     {
@@ -90,7 +126,9 @@ ECDefineDebugChannel(TwitterUserChannel);
     if (self)
     {
         self.twitterID = userID;
-        self.data = [coder decodeObjectForKey:@"info"];
+        // older caches have the info as a plain dictionary
+        NSData* packed = [coder decodeObjectForKey:@"packedInfo"];
+        self.data = packed ? [ECTwitterRecordCoder payloadWithPackedData:packed] : [coder decodeObjectForKey:@"info"];
         self.mentions = [coder decodeObjectForKey:@"mentions"];
         self.posts = [coder decodeObjectForKey:@"posts"];
         self.timeline = [coder decodeObjectForKey:@"timeline"];
@@ -127,14 +165,24 @@ ECDefineDebugChannel(TwitterUserChannel);
 - (void) dealloc
 {
     [_authentication release];
+	[_bio release];
+	[_builtData release];
 	[_cachedImage release];
-	[_data release];
+	[_extras release];
+	[_imageURL release];
+	[_name release];
+	[_pendingFollowerIDs release];
+	[_pendingFriendIDs release];
+	[_previousFollowerIDs release];
+	[_followerIDs release];
 	[_followers release];
+	[_friendIDs release];
 	[_friends release];
 	[_mentions release];
 	[_posts release];
 	[_timeline release];
 	[_twitterID release];
+	[_twitterName release];
 	
 	[super dealloc];
 }
@@ -164,48 +212,122 @@ ECDefineDebugChannel(TwitterUserChannel);
 }
 
 // --------------------------------------------------------------------------
-/// Update with new info
+/// Keys that we store in their own properties, rather than in the extras dictionary.
+/// (we also skip the numeric id, since we only ever use the string version, and
+/// the user's latest status, which we never use)
 // --------------------------------------------------------------------------
 
-- (void) refreshWithInfo:(NSDictionary*)info
+static NSString *const kIDKey = @"id_str";
+static NSString *const kNameKey = @"name";
+static NSString *const kTwitterNameKey = @"screen_name";
+static NSString *const kBioKey = @"description";
+static NSString *const kImageKey = @"profile_image_url";
+
++ (NSArray*)decodedKeys
 {
-	self.data = info;
+    static NSArray* keys = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        keys = [[NSArray alloc] initWithObjects:kIDKey, kNameKey, kTwitterNameKey, kBioKey, kImageKey, @"id", @"status", nil];
+    });
+    
+    return keys;
 }
 
 // --------------------------------------------------------------------------
-/// Have we had our data filled in?
+/// Return a value from the info, treating null as missing.
 // --------------------------------------------------------------------------
 
-- (BOOL) gotData
+static inline id valueForKey(NSDictionary* info, NSString* key)
 {
-	return (self.data != nil) && ([self.data objectForKey:@"name"] != nil);
+    id value = [info objectForKey:key];
+    return (value == [NSNull null]) ? nil : value;
 }
 
 // --------------------------------------------------------------------------
-/// Return debug description of the item.
+/// Set the user data.
+/// The fields that we use are pulled out into properties, and anything
+/// we don't know about is kept in an extras dictionary.
+/// They're all set together under our lock, so that -data never sees
+/// half of an update.
 // --------------------------------------------------------------------------
 
-- (NSString*)description
+- (void)setData:(NSDictionary*)info
 {
-	return [NSString stringWithFormat: @"<TwitterUser: %@ %@ posts:%ld timeline:%ld mentions:%ld>", self.twitterName, self.twitterID, (long) [self.posts count], (long) [self.timeline count], (long) [self.mentions count]];
+    NSMutableDictionary* remaining = [info mutableCopy];
+    [remaining removeObjectsForKeys:[ECTwitterUser decodedKeys]];
+    uint64_t hash = [ECTwitterCachedObject hashForInfo:info];
+
+    @synchronized(self)
+    {
+        self.hasData = (info != nil);
+        self.name = valueForKey(info, kNameKey);
+        self.twitterName = valueForKey(info, kTwitterNameKey);
+        self.bio = valueForKey(info, kBioKey);
+        self.imageURL = valueForKey(info, kImageKey);
+        self.extras = ([remaining count] > 0) ? remaining : nil;
+        self.builtData = nil;
+        self.infoHash = hash;
+    }
+    [remaining release];
 }
 
 // --------------------------------------------------------------------------
-/// Return the proper name of the user.
+/// Return the user data as a dictionary.
+/// It isn't stored, so it's rebuilt from our properties the first time
+/// it's asked for after a change, and kept until the next one. Tweets
+/// include it as their user, and can tell it's changed when they get a
+/// different dictionary back.
 // --------------------------------------------------------------------------
 
-- (NSString*)name
+- (NSDictionary*)data
 {
-	return [self.data objectForKey: @"name"];
+    @synchronized(self)
+    {
+        NSDictionary* result = self.builtData;
+        if (!result && self.hasData)
+        {
+            NSMutableDictionary* built = [NSMutableDictionary dictionaryWithDictionary:self.extras];
+            [built setValue:self.twitterID.string forKey:kIDKey];
+            [built setValue:self.name forKey:kNameKey];
+            [built setValue:self.twitterName forKey:kTwitterNameKey];
+            [built setValue:self.bio forKey:kBioKey];
+            [built setValue:self.imageURL forKey:kImageKey];
+
+            result = [NSDictionary dictionaryWithDictionary:built];
+            self.builtData = result;
+        }
+
+        return [[result retain] autorelease];
+    }
 }
 
 // --------------------------------------------------------------------------
-/// Return the twitter name of the user.
+/// Update with new info
 // --------------------------------------------------------------------------
 
-- (NSString*)twitterName
+- (void) refreshWithInfo:(NSDictionary*)info
 {
-	return [self.data objectForKey: @"screen_name"];
+	self.data = info;
+	[self markDirty];
+}
+
+// --------------------------------------------------------------------------
+/// Have we had our data filled in?
+// --------------------------------------------------------------------------
+
+- (BOOL) gotData
+{
+	return self.hasData && (self.name != nil);
+}
+
+// --------------------------------------------------------------------------
+/// Return debug description of the item.
+// --------------------------------------------------------------------------
+
+- (NSString*)description
+{
+	return [NSString stringWithFormat: @"<TwitterUser: %@ %@ posts:%ld timeline:%ld mentions:%ld>", self.twitterName, self.twitterID, (long) [self.posts count], (long) [self.timeline count], (long) [self.mentions count]];
 }
 
 // --------------------------------------------------------------------------
@@ -223,6 +345,7 @@ ECDefineDebugChannel(TwitterUserChannel);
 	}
 	
 	[list addUser:user];
+	[self markDirty];
 }
 
 // --------------------------------------------------------------------------
@@ -240,23 +363,52 @@ ECDefineDebugChannel(TwitterUserChannel);
 	}
 	
 	[list addUser:user];
+	[self markDirty];
 }
 
 // --------------------------------------------------------------------------
-/// Request user posts - everything they've posted
+/// Request the IDs of everyone following the user.
+/// The IDs come a page at a time; we keep asking until we've got them all.
 // --------------------------------------------------------------------------
 
 - (void) requestFollowerIDs
 {
-	ECDebug(TwitterUserChannel, @"requesting followers for %@", self);
+	if (!self.pendingFollowerIDs)
+	{
+		ECDebug(TwitterUserChannel, @"requesting follower ids for %@", self);
+		self.pendingFollowerIDs = [NSMutableData data];
+		[self requestIDsWithMethod:@"followers/ids" cursor:@"-1" selector:@selector(followerIDsHandler:)];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Request the IDs of everyone the user follows.
+// --------------------------------------------------------------------------
+
+- (void) requestFriendIDs
+{
+	if (!self.pendingFriendIDs)
+	{
+		ECDebug(TwitterUserChannel, @"requesting friend ids for %@", self);
+		self.pendingFriendIDs = [NSMutableData data];
+		[self requestIDsWithMethod:@"friends/ids" cursor:@"-1" selector:@selector(friendIDsHandler:)];
+	}
+}
+
+// --------------------------------------------------------------------------
+/// Request one page of IDs.
+// --------------------------------------------------------------------------
+
+- (void) requestIDsWithMethod:(NSString*)method cursor:(NSString*)cursor selector:(SEL)selector
+{
     ECAssertNonNil(self.twitterID.string);
 
 	NSDictionary* parameters = [NSDictionary dictionaryWithObjectsAndKeys:
 								self.twitterID.string, @"user_id",
-								@"-1", @"cursor",
+								cursor, @"cursor",
 								nil];
 	
-	[mCache.engine callGetMethod: @"friends/ids" parameters: parameters target: self selector: @selector(followerIDsHandler:)];
+	[mCache.engine callGetMethod: method parameters: parameters target: self selector: selector];
 }
 
 // --------------------------------------------------------------------------
@@ -307,10 +459,9 @@ ECDefineDebugChannel(TwitterUserChannel);
         ECAssertIsKindOfClass(handler.result, NSDictionary);
         
         NSDictionary* info = handler.result;
-        NSArray* users = [info objectForKey:@"users"];
-		for (NSDictionary* userData in users)
+        NSArray* users = [mCache addOrRefreshUsers:[info objectForKey:@"users"]];
+		for (ECTwitterUser* user in users)
 		{
-			ECTwitterUser* user = [mCache addOrRefreshUserWithInfo: userData];
 			[self addFriend: user];
 			
 			ECDebug(TwitterUserChannel, @"friend info received: %@", user);
@@ -335,22 +486,21 @@ ECDefineDebugChannel(TwitterUserChannel);
 {
 	if (handler.status == StatusResults)
 	{
-		ECDebug(TwitterUserChannel, @"received friends for: %@", self);
+		ECDebug(TwitterUserChannel, @"received followers for: %@", self);
         ECAssertIsKindOfClass(handler.result, NSDictionary);
 
         NSDictionary* result = handler.result;
-        NSArray* users = [result objectForKey:@"users"];
-		for (NSDictionary* userData in users)
+        NSArray* users = [mCache addOrRefreshUsers:[result objectForKey:@"users"]];
+		for (ECTwitterUser* user in users)
 		{
-			ECTwitterUser* user = [mCache addOrRefreshUserWithInfo: userData];
-			[self addFriend: user];
+			[self addFollower: user];
 			
-			ECDebug(TwitterUserChannel, @"friend info received: %@", user);
+			ECDebug(TwitterUserChannel, @"follower info received: %@", user);
 		}
 	}
 	else
 	{
-		ECDebug(TwitterUserChannel, @"error receiving friends for: %@", self);
+		ECDebug(TwitterUserChannel, @"error receiving followers for: %@", self);
 	}
     
 	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
@@ -358,73 +508,260 @@ ECDefineDebugChannel(TwitterUserChannel);
 }
 
 // --------------------------------------------------------------------------
-/// Handle confirmation that we've authenticated ok as a given user.
-/// We fire off a request for the list of friends for the user.
+/// Add a page of IDs to the ones we've collected so far.
+/// If there are more pages to come, we ask for the next one and return NO.
+// --------------------------------------------------------------------------
+
+- (BOOL) receiveIDsFromHandler:(ECTwitterHandler*)handler into:(NSMutableData*)pending method:(NSString*)method selector:(SEL)selector
+{
+	ECAssertIsKindOfClass(handler.result, NSDictionary);
+
+	NSDictionary* result = handler.result;
+	NSArray* ids = [result objectForKey:@"ids"];
+	NSUInteger count = [ids count];
+	NSUInteger offset = [pending length];
+	[pending increaseLengthBy:count * sizeof(uint64_t)];
+	uint64_t* values = (uint64_t*) ((uint8_t*) [pending mutableBytes] + offset);
+	for (id value in ids)
+	{
+		*values++ = [value isKindOfClass:[NSNumber class]] ? [value unsignedLongLongValue] : strtoull([[value description] UTF8String], NULL, 10);
+	}
+
+	NSString* cursor = [result objectForKey:@"next_cursor_str"];
+	if (!cursor)
+	{
+		cursor = [[result objectForKey:@"next_cursor"] description];
+	}
+
+	BOOL done = !cursor || [cursor isEqualToString:@"0"];
+	if (!done)
+	{
+		ECDebug(TwitterUserChannel, @"received %ld ids for %@, requesting more", (long) count, self);
+		[self requestIDsWithMethod:method cursor:cursor selector:selector];
+	}
+
+	return done;
+}
+
+// --------------------------------------------------------------------------
+/// Handle a page of follower IDs.
+/// Once we've got them all, they replace the previous set; we hang on to
+/// the old one so that we can tell who has come and gone since.
 // --------------------------------------------------------------------------
 
 - (void) followerIDsHandler:(ECTwitterHandler*)handler
 {
+	NSMutableData* pending = self.pendingFollowerIDs;
 	if (handler.status == StatusResults)
 	{
-		ECDebug(TwitterUserChannel, @"received followers for: %@", self);
-        ECAssertIsKindOfClass(handler.result, NSDictionary);
+		if (![self receiveIDsFromHandler:handler into:pending method:@"followers/ids" selector:@selector(followerIDsHandler:)])
+		{
+			return;
+		}
 
-        NSDictionary* result = handler.result;
-        NSArray* userIDs = [result objectForKey:@"ids"];
-		for (NSNumber* value in userIDs)
+		[self loadSocialGraphIfNeeded];
+		ECTwitterIDSet* ids = [ECTwitterIDSet setWithValues:[pending bytes] count:[pending length] / sizeof(uint64_t)];
+		ECDebug(TwitterUserChannel, @"received %ld follower ids for: %@", (long) ids.count, self);
+		self.previousFollowerIDs = self.followerIDs;
+		self.followerIDs = ids;
+		[mCache socialGraphDidChange:self];
+	}
+	else
+	{
+		ECDebug(TwitterUserChannel, @"error receiving follower ids for: %@", self);
+	}
+
+	self.pendingFollowerIDs = nil;
+	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+	[nc postNotificationName: ECTwitterUserUpdated object: self];
+}
+
+// --------------------------------------------------------------------------
+/// Handle a page of friend IDs.
+// --------------------------------------------------------------------------
+
+- (void) friendIDsHandler:(ECTwitterHandler*)handler
+{
+	NSMutableData* pending = self.pendingFriendIDs;
+	if (handler.status == StatusResults)
+	{
+		if (![self receiveIDsFromHandler:handler into:pending method:@"friends/ids" selector:@selector(friendIDsHandler:)])
 		{
-#if 0
-            NSString* userIDString = [value stringValue];
-            ECTwitterID* userID = [[ECTwitterID alloc] initWithString:userIDString];
-            
-            ECTwitterUser* user = [mCache userWithID:userID];
-			[self addFollower: user];
-            [userID release];
-			
-			ECDebug(TwitterUserChannel, @"follower info received: %@", user);
-#endif
+			return;
 		}
+
+		[self loadSocialGraphIfNeeded];
+		ECTwitterIDSet* ids = [ECTwitterIDSet setWithValues:[pending bytes] count:[pending length] / sizeof(uint64_t)];
+		ECDebug(TwitterUserChannel, @"received %ld friend ids for: %@", (long) ids.count, self);
+		self.friendIDs = ids;
+		[mCache socialGraphDidChange:self];
 	}
 	else
 	{
-		ECDebug(TwitterUserChannel, @"error receiving followers for: %@", self);
+		ECDebug(TwitterUserChannel, @"error receiving friend ids for: %@", self);
 	}
-    
+
+	self.pendingFriendIDs = nil;
 	NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
 	[nc postNotificationName: ECTwitterUserUpdated object: self];
 }
 
 // --------------------------------------------------------------------------
-/// Return the user name in the form "Full Name (@twitterName)"
+/// Read in our saved friends and followers, the first time they're needed.
 // --------------------------------------------------------------------------
 
-- (NSString*)longDisplayName
+- (void) loadSocialGraphIfNeeded
 {
-	return [NSString stringWithFormat: @"%@ (@%@)", [self name], [self twitterName]];
+	if (!self.socialGraphLoaded)
+	{
+		self.socialGraphLoaded = YES;
+		NSDictionary* saved = [mCache savedSocialGraphForUserID:self.twitterID];
+		if (saved)
+		{
+			self.friendIDs = [saved objectForKey:@"friends"];
+			self.followerIDs = [saved objectForKey:@"followers"];
+			self.previousFollowerIDs = [saved objectForKey:@"previousFollowers"];
+		}
+	}
+}
+
+- (ECTwitterIDSet*) followerIDs
+{
+	[self loadSocialGraphIfNeeded];
+	return _followerIDs;
+}
+
+- (ECTwitterIDSet*) friendIDs
+{
+	[self loadSocialGraphIfNeeded];
+	return _friendIDs;
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of people who we follow, and who follow us.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*) mutualIDs
+{
+	ECTwitterIDSet* followers = self.followerIDs;
+	ECTwitterIDSet* friends = self.friendIDs;
+	return (followers && friends) ? [followers setByIntersectingSet:friends] : [ECTwitterIDSet set];
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of people who follow us, but who we don't follow.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*) followerIDsNotFollowedBack
+{
+	ECTwitterIDSet* followers = self.followerIDs;
+	ECTwitterIDSet* friends = self.friendIDs;
+	if (followers && friends)
+	{
+		followers = [followers setBySubtractingSet:friends];
+	}
+
+	return followers ? followers : [ECTwitterIDSet set];
 }
 
 // --------------------------------------------------------------------------
-/// Return the user's "description" field
-/// (called "bio" to avoid clash with the standard NSObject description method).
+/// Return the IDs of followers who weren't there at the previous sync.
+/// Until we've synced twice, there's nothing to compare with, and this is empty.
 // --------------------------------------------------------------------------
 
-- (NSString*)bio
+- (ECTwitterIDSet*) addedFollowerIDs
 {
-	return [self.data objectForKey: @"description"];
+	ECTwitterIDSet* followers = self.followerIDs;
+	ECTwitterIDSet* previous = self.previousFollowerIDs;
+	return (followers && previous) ? [followers setBySubtractingSet:previous] : [ECTwitterIDSet set];
+}
+
+// --------------------------------------------------------------------------
+/// Return the IDs of followers who've gone since the previous sync.
+// --------------------------------------------------------------------------
+
+- (ECTwitterIDSet*) removedFollowerIDs
+{
+	ECTwitterIDSet* followers = self.followerIDs;
+	ECTwitterIDSet* previous = self.previousFollowerIDs;
+	return (followers && previous) ? [previous setBySubtractingSet:followers] : [ECTwitterIDSet set];
+}
+
+// --------------------------------------------------------------------------
+/// Return our friends and followers, in a form that the cache can save.
+// --------------------------------------------------------------------------
+
+- (NSDictionary*) socialGraph
+{
+	[self loadSocialGraphIfNeeded];
+
+	NSMutableDictionary* result = [NSMutableDictionary dictionary];
+	if (_friendIDs)
+	{
+		[result setObject:_friendIDs forKey:@"friends"];
+	}
+	if (_followerIDs)
+	{
+		[result setObject:_followerIDs forKey:@"followers"];
+	}
+	if (_previousFollowerIDs)
+	{
+		[result setObject:_previousFollowerIDs forKey:@"previousFollowers"];
+	}
+
+	return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return a rough idea of how much memory we're using.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)estimatedSize
+{
+	static const NSUInteger kExtraSize = 64;
+
+	NSUInteger size = [super estimatedSize];
+	size += ([self.name length] + [self.twitterName length] + [self.bio length]) * sizeof(unichar);
+	size += [self.extras count] * kExtraSize;
+	size += (_friendIDs.count + _followerIDs.count + _previousFollowerIDs.count) * sizeof(uint64_t);
+
+	return size;
+}
+
+// --------------------------------------------------------------------------
+/// Return the user name in the form "Full Name (@twitterName)"
+// --------------------------------------------------------------------------
+
+- (NSString*)longDisplayName
+{
+	return [NSString stringWithFormat: @"%@ (@%@)", [self name], [self twitterName]];
 }
 
 // --------------------------------------------------------------------------
 /// Return an image for the user.
+/// The image is shared with the cache, rather than being held on to by
+/// us. If it isn't loaded yet we return nil, and post an update for the
+/// user once it arrives.
 // --------------------------------------------------------------------------
 
 - (ECTwitterImage*)image
 {
 	ECTwitterImage* image = self.cachedImage;
-	if (!image)
+	if (!image && self.imageURL && !self.waitingForImage)
 	{
-		NSURL* url = [NSURL URLWithString:[self.data objectForKey: @"profile_image_url"]];
-		image = [mCache imageWithID: self.twitterID URL: url];
-		self.cachedImage = image;
+		NSURL* url = [NSURL URLWithString:self.imageURL];
+		image = [mCache imageWithURL:url handler:^(ECTwitterImage* loaded, NSError* error) {
+			if (self.waitingForImage)
+			{
+				self.waitingForImage = NO;
+				if (loaded)
+				{
+					NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+					[nc postNotificationName:ECTwitterUserUpdated object:self];
+				}
+			}
+		}];
+		self.waitingForImage = (image == nil);
 	}
 	
 	return image;
@@ -441,8 +778,17 @@ ECDefineDebugChannel(TwitterUserChannel);
 	{
 		info = [NSDictionary dictionaryWithObject: self.twitterID.string forKey: @"id_str"];
 	}
-	
-    [coder encodeObject:info forKey:@"info"];
+
+    // the info is packed if possible, since it's most of the size of a user
+    NSData* packed = [ECTwitterRecordCoder packedDataWithPayload:info];
+    if (packed)
+    {
+        [coder encodeObject:packed forKey:@"packedInfo"];
+    }
+    else
+    {
+        [coder encodeObject:info forKey:@"info"];
+    }
     [coder encodeObject:self.twitterID forKey:@"id"];
     [coder encodeObject:self.posts forKey:@"posts"];
     [coder encodeObject:self.timeline forKey:@"timeline"];
@@ -10,6 +10,7 @@
 #import "ECTwitterUserList.h"
 
 #import "ECTwitterCache.h"
+#import "ECTwitterID.h"
 #import "ECTwitterUser.h"
 
 // ==============================================
@@ -21,6 +22,9 @@
 
 @interface ECTwitterUserList()
 
+@property (assign, nonatomic) ECTwitterCache* cache;
+@property (strong, nonatomic) NSMutableSet* userIDs;
+
 @end
 
 
@@ -33,6 +37,8 @@
 #pragma mark -
 #pragma mark Properties
 
+@synthesize cache = _cache;
+@synthesize userIDs = _userIDs;
 @synthesize users;
 
 // ==============================================
@@ -70,7 +76,7 @@
 
 - (id)initWithCoder:(NSCoder*)coder
 {
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
 	if ((self = [super init]) != nil)
     {
         NSArray* userIds = [coder decodeObjectForKey:@"users"];
@@ -80,6 +86,7 @@
             [cachedUsers addObject:[cache userWithID:userId requestIfMissing:NO]];
         }
         self.users = cachedUsers;
+        self.cache = cache;
     }
     
     return self;
@@ -92,20 +99,56 @@
 
 - (void) dealloc
 {
+	[users makeObjectsPerformSelector:@selector(unpin)];
 	[users release];
+	[_userIDs release];
 	
 	[super dealloc];
 }
 
 
+// --------------------------------------------------------------------------
+/// Return our users.
+/// If we were read from disk, our users may just be placeholders, so we
+/// get the cache to fill them in the first time we're asked for them.
+// --------------------------------------------------------------------------
+
+- (NSMutableArray*)users
+{
+	if (self.cache && [self.cache materializeObjects:users])
+	{
+		self.cache = nil;
+	}
+
+	return users;
+}
+
+// --------------------------------------------------------------------------
+/// Replace our users.
+/// Users stay pinned in the cache for as long as they're in a list.
+// --------------------------------------------------------------------------
+
+- (void)setUsers:(NSMutableArray*)newUsers
+{
+	if (newUsers != users)
+	{
+		[newUsers makeObjectsPerformSelector:@selector(pin)];
+		[users makeObjectsPerformSelector:@selector(unpin)];
+		[users release];
+		users = [newUsers retain];
+		self.userIDs = nil;
+	}
+}
+
 // --------------------------------------------------------------------------
 /// Save the timeline to a file.
 // --------------------------------------------------------------------------
 
 - (void)encodeWithCoder:(NSCoder*)coder
 {
-    NSMutableArray* userIds = [NSMutableArray arrayWithCapacity:[self.users count]];
-    for (ECTwitterUser* user in self.users)
+    // we use the ivar directly so that saving doesn't read in any placeholder users
+    NSMutableArray* userIds = [NSMutableArray arrayWithCapacity:[users count]];
+    for (ECTwitterUser* user in users)
     {
         [userIds addObject:user.twitterID];
     }
@@ -113,7 +156,9 @@
 }
 
 // --------------------------------------------------------------------------
-/// Add a tweet to our timeline.
+/// Add a user to the list, if they're not already in it.
+/// We keep a set of the IDs in the list, so that checking doesn't mean
+/// searching the whole array.
 // --------------------------------------------------------------------------
 
 - (void) addUser:(ECTwitterUser*)user
@@ -126,9 +171,19 @@
 		[array release];
 	}
 	
-	if ([array indexOfObject: user] == NSNotFound)
+	NSMutableSet* ids = self.userIDs;
+	if (!ids)
+	{
+		ids = [[NSMutableSet alloc] initWithArray:[array valueForKey:@"twitterID"]];
+		self.userIDs = ids;
+		[ids release];
+	}
+	
+	if (![ids containsObject: user.twitterID])
 	{
+		[ids addObject: user.twitterID];
 		[array addObject: user];
+		[user pin];
 	}
 }
 
@@ -60,7 +60,7 @@ ECDefineDebugChannel(TwitterUserMentionsTimelineChannel);
 
 - (id)initWithCoder:(NSCoder*)coder
 {
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
 	if ((self = [super initWithCoder:coder]) != nil)
     {
         ECTwitterID* userID = [coder decodeObjectForKey:@"user"];
@@ -91,6 +91,15 @@ ECDefineDebugChannel(TwitterUserMentionsTimelineChannel);
     [super encodeWithCoder:coder];
 }
 
+// --------------------------------------------------------------------------
+/// We're saved as part of our user, so changes to us are changes to them.
+// --------------------------------------------------------------------------
+
+- (void)markDirty
+{
+    [self.user markDirty];
+}
+
 // --------------------------------------------------------------------------
 /// Refresh this timeline, by refreshing the associated user's main timeline.
 // --------------------------------------------------------------------------
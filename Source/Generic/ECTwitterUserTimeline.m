@@ -75,7 +75,7 @@ ECDefineDebugChannel(TwitterUserTimelineChannel);
 
 - (id)initWithCoder:(NSCoder*)coder
 {
-    ECTwitterCache* cache = [ECTwitterCache decodingCache];
+    ECTwitterCache* cache = [ECTwitterCache cacheForCoder:coder];
 	if ((self = [super initWithCoder:coder]) != nil)
     {
         self.method = (FetchMethod) [coder decodeIntForKey:@"method"];
@@ -108,6 +108,15 @@ ECDefineDebugChannel(TwitterUserTimelineChannel);
     [super encodeWithCoder:coder];
 }
 
+// --------------------------------------------------------------------------
+/// We're saved as part of our user, so changes to us are changes to them.
+// --------------------------------------------------------------------------
+
+- (void)markDirty
+{
+    [self.user markDirty];
+}
+
 - (void)trackHome
 {
     self.method = MethodHome;
@@ -11,22 +11,41 @@
 #import <ECOAuthConsumer/ECOAuthConsumer.h>
 
 @class ECTwitterAuthentication;
+@class ECTwitterResponseCache;
 
 @interface MGTwitterEngine : NSObject
 {
     __weak NSObject <MGTwitterEngineDelegate>*  mDelegate;
     NSMutableDictionary*                        mConnections;   // MGTwitterHTTPURLConnection objects
+    NSMutableArray*                             mQueues[MGTwitterRequestPriorityCount]; // requests waiting for a connection
+    NSCountedSet*                               mHostConnections; // active connections per host
+    NSUInteger                                  mStarted[MGTwitterRequestPriorityCount];
+    NSTimeInterval                              mTotalWait[MGTwitterRequestPriorityCount];
+    NSTimeInterval                              mMaxWait[MGTwitterRequestPriorityCount];
+    NSMutableDictionary*                        mRateLimits;    // MGTwitterRateLimit objects, by account and endpoint family
+    NSUInteger                                  mShed;
+    NSMutableDictionary*                        mStaleAges;     // how old a cached response can be and still be served, by path
+    NSMutableDictionary*                        mFailures;      // errors for requests that failed before they were sent, waiting to be reported
+    NSMutableDictionary*                        mReplays;       // cached responses waiting to be served, by request identifier
+    NSMutableDictionary*                        mLookups;       // requests waiting for the response cache to look on disk, by identifier
+    NSMutableDictionary*                        mPendingStores; // responses to cache once they've parsed, by request identifier
+    NSMutableSet*                               mParsing;       // requests whose responses are still being parsed
 }
 
 @property (assign, nonatomic) BOOL secure;
 @property (strong, nonatomic) NSString* apiDomain;
 @property (strong, nonatomic) NSString* searchDomain;
+@property (assign, nonatomic) MGTwitterEngineDeliveryOptions deliveryOptions;
+@property (assign, nonatomic) NSUInteger maxConnectionsPerHost;
+@property (assign, nonatomic) NSTimeInterval maxRateLimitWait;
+@property (strong, nonatomic) ECTwitterResponseCache* responseCache;
 
 #pragma mark Class management
 
 - (MGTwitterEngine *)initWithDelegate:(NSObject*)delegate;
 - (void)setClientName:(NSString*)name version:(NSString*)version URL:(NSString*)url;
 - (NSString*)request:(NSString*)path parameters:(NSDictionary*)params method:(NSString*)method authentication:(ECTwitterAuthentication*)authentication;
+- (NSString*)request:(NSString*)path parameters:(NSDictionary*)params method:(NSString*)method authentication:(ECTwitterAuthentication*)authentication priority:(MGTwitterRequestPriority)priority;
 
 // Connection methods
 - (NSUInteger)numberOfConnections;
@@ -34,4 +53,18 @@
 - (void)closeConnection:(NSString*)identifier;
 - (void)closeAllConnections;
 
+// Queue statistics
+- (NSUInteger)numberOfQueuedRequests;
+- (NSUInteger)numberOfQueuedRequestsWithPriority:(MGTwitterRequestPriority)priority;
+- (NSTimeInterval)averageWaitForPriority:(MGTwitterRequestPriority)priority;
+- (NSTimeInterval)maximumWaitForPriority:(MGTwitterRequestPriority)priority;
+- (NSUInteger)numberOfShedRequests;
+
+// Rate limits
+- (NSUInteger)remainingRequestsForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication;
+- (NSDate*)rateLimitResetForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication;
+
+// Response caching
+- (void)setMaxStaleAge:(NSTimeInterval)age forPath:(NSString*)path;
+
 @end
@@ -11,21 +11,122 @@
 #import "ECTwitterConnection.h"
 #import "ECTwitterParser.h"
 #import "ECTwitterAuthentication.h"
+#import "ECTwitterRequestBuilder.h"
+#import "ECTwitterResponseCache.h"
 
 
+#pragma mark - Queued Requests
+
+// --------------------------------------------------------------------------
+/// A request that's waiting for a free connection.
+// --------------------------------------------------------------------------
+
+@interface MGTwitterQueuedRequest : NSObject
+
+@property (strong, nonatomic) NSURLRequest* request;
+@property (strong, nonatomic) NSString* identifier;
+@property (strong, nonatomic) NSString* host;
+@property (strong, nonatomic) NSString* rateLimitKey;
+@property (strong, nonatomic) NSString* cacheKey;
+@property (strong, nonatomic) ECTwitterCachedResponse* cachedResponse;
+@property (assign, nonatomic) BOOL silent;
+@property (assign, nonatomic) MGTwitterRequestPriority priority;
+@property (assign, nonatomic) NSTimeInterval queued;
+
+@end
+
+@implementation MGTwitterQueuedRequest
+
+@synthesize cacheKey = _cacheKey;
+@synthesize cachedResponse = _cachedResponse;
+@synthesize host = _host;
+@synthesize identifier = _identifier;
+@synthesize priority = _priority;
+@synthesize queued = _queued;
+@synthesize rateLimitKey = _rateLimitKey;
+@synthesize request = _request;
+@synthesize silent = _silent;
+
+- (void)dealloc
+{
+    [_cacheKey release];
+    [_cachedResponse release];
+    [_host release];
+    [_identifier release];
+    [_rateLimitKey release];
+    [_request release];
+
+    [super dealloc];
+}
+
+@end
+
+#pragma mark - Rate Limits
+
+// --------------------------------------------------------------------------
+/// The rate limit budget for one account, for one family of endpoints.
+/// We take a token each time we send a request, and the server tells us
+/// the real figures in the headers of each response.
+// --------------------------------------------------------------------------
+
+@interface MGTwitterRateLimit : NSObject
+
+@property (assign, nonatomic) NSUInteger limit;
+@property (assign, nonatomic) NSUInteger remaining;
+@property (assign, nonatomic) NSTimeInterval reset;
+
+- (void)refillIfResetAt:(NSTimeInterval)now;
+
+@end
+
+@implementation MGTwitterRateLimit
+
+@synthesize limit = _limit;
+@synthesize remaining = _remaining;
+@synthesize reset = _reset;
+
+- (void)refillIfResetAt:(NSTimeInterval)now
+{
+    if (now >= self.reset)
+    {
+        self.remaining = self.limit;
+    }
+}
+
+@end
+
 #pragma mark - Private Interface
 
-@interface MGTwitterEngine()
+@interface MGTwitterEngine() <MGTwitterEngineDelegate>
 
 @property (strong, nonatomic) NSString* clientName;
 @property (strong, nonatomic) NSString* clientVersion;
 @property (strong, nonatomic) NSString* clientURL;
-
-- (NSString*)queryStringWithBase:(NSString*)base parameters:(NSDictionary *)params prefixed:(BOOL)prefixed;
-- (NSString*)encodeString:(NSString*)string;
-- (NSString*)sendRequest:(NSURLRequest *)theRequest;
+@property (strong, nonatomic) ECTwitterRequestBuilder* requestBuilder;
+
+- (NSString*)sendRequest:(MGTwitterQueuedRequest*)queued;
+- (NSString*)sendCacheableRequest:(MGTwitterQueuedRequest*)queued path:(NSString*)twitterPath;
+- (NSString*)sendRequest:(MGTwitterQueuedRequest*)queued cachedResponse:(ECTwitterCachedResponse*)cached path:(NSString*)twitterPath;
+- (BOOL)isCacheableRequestWithParameters:(NSDictionary*)params;
+- (NSString*)responseCacheKeyForPath:(NSString*)path parameters:(NSDictionary*)params authentication:(ECTwitterAuthentication*)authentication;
+- (void)replayResponse:(ECTwitterCachedResponse*)response identifier:(NSString*)identifier;
+- (void)deliverReplay:(NSString*)identifier;
+- (void)storeResponseForConnection:(ECTwitterConnection*)connection;
+- (void)storePendingResponseForRequest:(NSString*)identifier;
+- (BOOL)getValidatorsFromResponse:(NSHTTPURLResponse*)response etag:(NSString**)etag lastModified:(NSString**)lastModified;
+- (BOOL)shouldNotifyDelegate:(SEL)selector forConnection:(ECTwitterConnection*)connection;
+- (NSString*)rateLimitKeyForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication;
+- (void)updateRateLimit:(NSString*)key fromResponse:(NSHTTPURLResponse*)response;
+- (void)startQueuedRequests;
+- (void)startRequest:(MGTwitterQueuedRequest*)queued;
+- (void)reportFailure:(NSError*)error forIdentifier:(NSString*)identifier;
+- (void)deliverFailures;
+- (void)finishConnection:(ECTwitterConnection*)connection;
 - (NSMutableURLRequest *)requestWithMethod:(NSString*)method path:(NSString*)path parameters:(NSDictionary *)params authentication:(ECTwitterAuthentication*)authentication;
-- (void)parseDataFromConnection:(ECTwitterConnection*)connection;
+- (void)startParsingForConnection:(ECTwitterConnection*)connection;
+- (void)finishParsingForConnection:(ECTwitterConnection*)connection;
+- (void)parseOnQueue:(dispatch_queue_t)queue block:(dispatch_block_t)block;
+- (void)parsingFailedForRequest:(NSString*)identifier withError:(NSError*)error;
 - (BOOL) isValidDelegateForSelector:(SEL)selector;
 
 @end
@@ -42,6 +143,11 @@
 @synthesize secure = _secure;
 @synthesize apiDomain = _apiDomain;
 @synthesize searchDomain = _searchDomain;
+@synthesize deliveryOptions = _deliveryOptions;
+@synthesize maxConnectionsPerHost = _maxConnectionsPerHost;
+@synthesize maxRateLimitWait = _maxRateLimitWait;
+@synthesize requestBuilder = _requestBuilder;
+@synthesize responseCache = _responseCache;
 
 #pragma mark - Debug Channels
 
@@ -55,6 +161,21 @@ static NSString *const kSearchDomain           = @"search.twitter.com";
 static NSString *const kPostMethod             = @"POST";
 
 static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails quickly if it's going to fail at all.
+static const NSUInteger kDefaultMaxConnectionsPerHost = 4;
+
+// background requests can't use the last tenth of a rate limit budget
+static const NSUInteger kBackgroundReserveDivisor = 10;
+
+// background requests that would have to wait longer than this for the
+// budget to be reset are dropped instead
+static const NSTimeInterval kDefaultMaxRateLimitWait = 60.0;
+
+typedef enum
+{
+    RateLimitSend,
+    RateLimitHold,
+    RateLimitShed
+} RateLimitDecision;
 
 
 #pragma mark - Lifecycle
@@ -68,11 +189,37 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
     if ((self = [super init])) {
         mDelegate = (NSObject <MGTwitterEngineDelegate>*)newDelegate; // deliberately weak reference
         mConnections = [[NSMutableDictionary alloc] initWithCapacity:0];
+        mHostConnections = [[NSCountedSet alloc] init];
+        mRateLimits = [[NSMutableDictionary alloc] init];
+        mStaleAges = [[NSMutableDictionary alloc] init];
+        mFailures = [[NSMutableDictionary alloc] init];
+        mReplays = [[NSMutableDictionary alloc] init];
+        mLookups = [[NSMutableDictionary alloc] init];
+        mPendingStores = [[NSMutableDictionary alloc] init];
+        mParsing = [[NSMutableSet alloc] init];
+        for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+        {
+            mQueues[n] = [[NSMutableArray alloc] init];
+        }
         self.clientName = @"ECTwitter";
         self.clientVersion = @"1.0";
         self.clientURL = @"http://www.elegantchaos.com/libraries/ectwitter";
         self.apiDomain = kTwitterDomain;
         self.searchDomain = kSearchDomain;
+        self.deliveryOptions = MGTwitterEngineDeliveryAllResultsOption;
+        self.maxConnectionsPerHost = kDefaultMaxConnectionsPerHost;
+        self.maxRateLimitWait = kDefaultMaxRateLimitWait;
+
+        NSString* bundle = [[NSBundle mainBundle] bundleIdentifier];
+        NSURL* caches = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] objectAtIndex:0];
+        NSURL* responses = [[caches URLByAppendingPathComponent:bundle ? bundle : @"com.elegantchaos.ectwitter"] URLByAppendingPathComponent:@"ECTwitterEngine Responses"];
+        ECTwitterResponseCache* responseCache = [[ECTwitterResponseCache alloc] initWithURL:responses];
+        self.responseCache = responseCache;
+        [responseCache release];
+
+        ECTwitterRequestBuilder* requestBuilder = [[ECTwitterRequestBuilder alloc] init];
+        self.requestBuilder = requestBuilder;
+        [requestBuilder release];
         
         self.secure = YES;
 
@@ -97,6 +244,22 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
     
     [[mConnections allValues] makeObjectsPerformSelector:@selector(cancel)];
     [mConnections release];
+    [mHostConnections release];
+    [mRateLimits release];
+    [mStaleAges release];
+    [mFailures release];
+    [mReplays release];
+    [mLookups release];
+    [mPendingStores release];
+    [mParsing release];
+    [_requestBuilder release];
+    [_responseCache release];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(startQueuedRequests) object:nil];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(deliverFailures) object:nil];
+    for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+    {
+        [mQueues[n] release];
+    }
 	
     [super dealloc];
 }
@@ -137,101 +300,638 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 
 // --------------------------------------------------------------------------
 /// Close connection with a given identifier.
+/// If the request hasn't been sent yet, we just take it out of the queue.
+/// If it failed before it could be sent, the failure is never reported.
+/// If it's being served from the response cache, it's only cancelled if 
+/// the cached response hasn't been delivered yet; after that, there's
+/// nothing left to stop.
+/// If we're still looking for a cached response for it, it's never sent.
 // --------------------------------------------------------------------------
 
 - (void)closeConnection:(NSString*)connectionIdentifier
 {
+    [mParsing removeObject:connectionIdentifier];
+    [mPendingStores removeObjectForKey:connectionIdentifier];
     ECTwitterConnection* connection = [mConnections objectForKey:connectionIdentifier];
     if (connection) {
         [connection cancel];
-        [mConnections removeObjectForKey:connectionIdentifier];
-		if ([self isValidDelegateForSelector:@selector(connectionFinished:)])
-			[mDelegate connectionFinished:connectionIdentifier];
+        [self finishConnection:connection];
+    }
+    else if ([mFailures objectForKey:connectionIdentifier])
+    {
+        ECDebug(MGTwitterEngineChannel, @"cancelled failed request %@", connectionIdentifier);
+        [mFailures removeObjectForKey:connectionIdentifier];
+    }
+    else if ([mReplays objectForKey:connectionIdentifier])
+    {
+        ECDebug(MGTwitterEngineChannel, @"cancelled cached request %@", connectionIdentifier);
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(deliverReplay:) object:connectionIdentifier];
+        [mReplays removeObjectForKey:connectionIdentifier];
+    }
+    else if ([mLookups objectForKey:connectionIdentifier])
+    {
+        ECDebug(MGTwitterEngineChannel, @"cancelled request %@ before it was sent", connectionIdentifier);
+        [mLookups removeObjectForKey:connectionIdentifier];
+    }
+    else
+    {
+        for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+        {
+            NSMutableArray* queue = mQueues[n];
+            NSUInteger count = [queue count];
+            for (NSUInteger index = 0; index < count; ++index)
+            {
+                MGTwitterQueuedRequest* queued = [queue objectAtIndex:index];
+                if ([queued.identifier isEqualToString:connectionIdentifier])
+                {
+                    ECDebug(MGTwitterEngineChannel, @"cancelled queued request %@", connectionIdentifier);
+                    [queue removeObjectAtIndex:index];
+                    return;
+                }
+            }
+        }
     }
 }
 
 // --------------------------------------------------------------------------
-/// Close all connections.
+/// Close all connections, and throw away any queued requests.
 // --------------------------------------------------------------------------
 
 - (void)closeAllConnections
 {
+    for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+    {
+        [mQueues[n] removeAllObjects];
+    }
+    [mFailures removeAllObjects];
+    [mReplays removeAllObjects];
+    [mLookups removeAllObjects];
+    [mPendingStores removeAllObjects];
+    [mParsing removeAllObjects];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(deliverReplay:) object:nil];
+
     [[mConnections allValues] makeObjectsPerformSelector:@selector(cancel)];
     [mConnections removeAllObjects];
+    [mHostConnections removeAllObjects];
 }
 
+// --------------------------------------------------------------------------
+/// Clean up after a connection that's done, and start
+/// the next request that was waiting for it.
+// --------------------------------------------------------------------------
 
-#pragma mark Utility methods
+- (void)finishConnection:(ECTwitterConnection*)connection
+{
+    NSString* connectionIdentifier = [[connection identifier] retain];
+    if ([mConnections objectForKey:connectionIdentifier])
+    {
+        if (connection.host)
+        {
+            [mHostConnections removeObject:connection.host];
+        }
+        [mConnections removeObjectForKey:connectionIdentifier];
+        if ([self shouldNotifyDelegate:@selector(connectionFinished:) forConnection:connection])
+            [mDelegate connectionFinished:connectionIdentifier];
+    }
+    [connectionIdentifier release];
+
+    [self startQueuedRequests];
+}
+
+#pragma mark Queue statistics
 
 // --------------------------------------------------------------------------
-/// Build query string.
+/// Return the number of requests waiting for a connection.
 // --------------------------------------------------------------------------
 
-- (NSString*)queryStringWithBase:(NSString*)base parameters:(NSDictionary *)params prefixed:(BOOL)prefixed
+- (NSUInteger)numberOfQueuedRequests
 {
-    // Append base if specified.
-    NSMutableString *str = [NSMutableString stringWithCapacity:0];
-    if (base) {
-        [str appendString:base];
+    NSUInteger result = 0;
+    for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+    {
+        result += [mQueues[n] count];
     }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the number of requests of a given priority waiting for a connection.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)numberOfQueuedRequestsWithPriority:(MGTwitterRequestPriority)priority
+{
+    ECAssert(priority < MGTwitterRequestPriorityCount);
+    return [mQueues[priority] count];
+}
+
+// --------------------------------------------------------------------------
+/// Return how long requests of a given priority have waited
+/// for a connection, on average.
+// --------------------------------------------------------------------------
+
+- (NSTimeInterval)averageWaitForPriority:(MGTwitterRequestPriority)priority
+{
+    ECAssert(priority < MGTwitterRequestPriorityCount);
+    NSUInteger started = mStarted[priority];
+    return started ? mTotalWait[priority] / started : 0.0;
+}
+
+// --------------------------------------------------------------------------
+/// Return the longest time that a request of a given priority has
+/// waited for a connection.
+// --------------------------------------------------------------------------
+
+- (NSTimeInterval)maximumWaitForPriority:(MGTwitterRequestPriority)priority
+{
+    ECAssert(priority < MGTwitterRequestPriorityCount);
+    return mMaxWait[priority];
+}
+
+// --------------------------------------------------------------------------
+/// Return the number of requests we've dropped rather than spend
+/// rate limit budget on them.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)numberOfShedRequests
+{
+    return mShed;
+}
+
+#pragma mark Rate limits
+
+// --------------------------------------------------------------------------
+/// Return the key we file the rate limit for a request under.
+/// Twitter keeps a separate budget for each authenticated user, and
+/// for each family of endpoints (statuses/..., users/..., etc).
+// --------------------------------------------------------------------------
+
+- (NSString*)rateLimitKeyForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication
+{
+    NSString* account = authentication.user ? authentication.user : @"";
+    NSRange slash = [path rangeOfString:@"/"];
+    NSString* family = (slash.location == NSNotFound) ? path : [path substringToIndex:slash.location];
+
+    return [NSString stringWithFormat:@"%@ %@", account, family];
+}
+
+// --------------------------------------------------------------------------
+/// Return how many more requests we think we can make for a given
+/// path, or NSNotFound if we haven't heard from the server yet.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)remainingRequestsForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication
+{
+    MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:[self rateLimitKeyForPath:path authentication:authentication]];
+    [rateLimit refillIfResetAt:[NSDate timeIntervalSinceReferenceDate]];
+
+    return rateLimit ? rateLimit.remaining : NSNotFound;
+}
+
+// --------------------------------------------------------------------------
+/// Return when the rate limit budget for a given path is next reset,
+/// or nil if we don't know.
+// --------------------------------------------------------------------------
+
+- (NSDate*)rateLimitResetForPath:(NSString*)path authentication:(ECTwitterAuthentication*)authentication
+{
+    MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:[self rateLimitKeyForPath:path authentication:authentication]];
     
-    // Append each name-value pair.
-    if (params) {
-        NSUInteger i;
-        NSArray *names = [params allKeys];
-        for (i = 0; i < [names count]; i++) {
-            if (i == 0 && prefixed) {
-                [str appendString:@"?"];
-            } else if (i > 0) {
-                [str appendString:@"&"];
+    return rateLimit ? [NSDate dateWithTimeIntervalSinceReferenceDate:rateLimit.reset] : nil;
+}
+
+// --------------------------------------------------------------------------
+/// Pick up the rate limit figures from the headers of a response.
+/// (Different versions of the API spell the headers differently).
+// --------------------------------------------------------------------------
+
+- (void)updateRateLimit:(NSString*)key fromResponse:(NSHTTPURLResponse*)response
+{
+    NSString* limit = nil;
+    NSString* remaining = nil;
+    NSString* reset = nil;
+    NSDictionary* headers = [response allHeaderFields];
+    for (NSString* header in headers)
+    {
+        NSString* name = [[header lowercaseString] stringByReplacingOccurrencesOfString:@"ratelimit" withString:@"rate-limit"];
+        if ([name isEqualToString:@"x-rate-limit-limit"])
+            limit = [headers objectForKey:header];
+        else if ([name isEqualToString:@"x-rate-limit-remaining"])
+            remaining = [headers objectForKey:header];
+        else if ([name isEqualToString:@"x-rate-limit-reset"])
+            reset = [headers objectForKey:header];
+    }
+
+    if (key && limit && remaining && reset)
+    {
+        MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:key];
+        if (!rateLimit)
+        {
+            rateLimit = [[MGTwitterRateLimit alloc] init];
+            [mRateLimits setObject:rateLimit forKey:key];
+            [rateLimit release];
+        }
+        
+        rateLimit.limit = (NSUInteger) MAX([limit integerValue], 0);
+        rateLimit.remaining = (NSUInteger) MAX([remaining integerValue], 0);
+        rateLimit.reset = [[NSDate dateWithTimeIntervalSince1970:[reset doubleValue]] timeIntervalSinceReferenceDate];
+        ECDebug(MGTwitterEngineChannel, @"rate limit for %@: %@ of %@", key, remaining, limit);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Decide whether we can spend some rate limit budget on a request.
+/// Background requests aren't allowed to eat into a reserve kept for more
+/// important things; if they'd have to wait too long for the budget
+/// to be reset, we drop them. Everything else just waits.
+// --------------------------------------------------------------------------
+
+- (RateLimitDecision)rateLimitDecisionForRequest:(MGTwitterQueuedRequest*)queued now:(NSTimeInterval)now
+{
+    RateLimitDecision result = RateLimitSend;
+    MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:queued.rateLimitKey];
+    if (rateLimit)
+    {
+        [rateLimit refillIfResetAt:now];
+        BOOL background = queued.priority == MGTwitterRequestPriorityBackground;
+        NSUInteger reserve = background ? rateLimit.limit / kBackgroundReserveDivisor : 0;
+        if (rateLimit.remaining <= reserve)
+        {
+            BOOL tooLong = (rateLimit.reset - now) > self.maxRateLimitWait;
+            result = (background && tooLong) ? RateLimitShed : RateLimitHold;
+        }
+    }
+
+    return result;
+}
+
+#pragma mark Response caching
+
+// --------------------------------------------------------------------------
+/// Allow a cached response for a path to be served without waiting for
+/// the server, if it was last validated no more than a given time ago.
+/// The response is then revalidated in the background, so that the next 
+/// request gets the fresh version.
+/// A negative age turns this off again.
+// --------------------------------------------------------------------------
+
+- (void)setMaxStaleAge:(NSTimeInterval)age forPath:(NSString*)path
+{
+    if (age < 0.0)
+    {
+        [mStaleAges removeObjectForKey:path];
+    }
+    else
+    {
+        [mStaleAges setObject:[NSNumber numberWithDouble:age] forKey:path];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Is the response to a request worth caching?
+/// Requests that page through results - with since_id, max_id, a cursor
+/// or a page number - are rarely made again exactly, so caching them would
+/// just fill the cache with responses that we'll never use.
+// --------------------------------------------------------------------------
+
+- (BOOL)isCacheableRequestWithParameters:(NSDictionary*)params
+{
+    static NSString *const kPagingParameters[] = { @"since_id", @"max_id", @"cursor", @"page" };
+
+    for (NSUInteger n = 0; n < sizeof(kPagingParameters) / sizeof(kPagingParameters[0]); ++n)
+    {
+        if ([params objectForKey:kPagingParameters[n]])
+        {
+            return NO;
+        }
+    }
+
+    return YES;
+}
+
+// --------------------------------------------------------------------------
+/// Return the key we cache the response to a request under.
+/// The parameters are sorted, so that the same request always gives
+/// the same key. The authenticated user is part of it too, since 
+/// most responses depend on who's asking.
+// --------------------------------------------------------------------------
+
+- (NSString*)responseCacheKeyForPath:(NSString*)path parameters:(NSDictionary*)params authentication:(ECTwitterAuthentication*)authentication
+{
+    NSMutableString* key = [NSMutableString stringWithFormat:@"%@ GET %@", authentication.user ? authentication.user : @"", path];
+    NSArray* names = [[params allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    NSString* separator = @"?";
+    for (NSString* name in names)
+    {
+        [key appendFormat:@"%@%@=%@", separator, name, [params objectForKey:name]];
+        separator = @"&";
+    }
+
+    return key;
+}
+
+// --------------------------------------------------------------------------
+/// Deliver a cached response body to the delegate, as if it had just
+/// arrived from the server.
+/// As with a real response, the parser tells us whether it succeeded
+/// once it's done.
+// --------------------------------------------------------------------------
+
+- (void)replayResponse:(ECTwitterCachedResponse*)response identifier:(NSString*)identifier
+{
+    ECDebug(MGTwitterEngineChannel, @"replaying cached response for %@", identifier);
+
+    ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:self options:self.deliveryOptions];
+    [mParsing addObject:identifier];
+    [self parseOnQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0) block:^{
+        [parser beginParsingWithIdentifier:identifier];
+        if ([parser parseChunk:response.body])
+        {
+            [parser finishParsing];
+        }
+    }];
+    [parser release];
+}
+
+// --------------------------------------------------------------------------
+/// Serve a cached response that we promised to a request, unless the
+/// request has been cancelled since.
+// --------------------------------------------------------------------------
+
+- (void)deliverReplay:(NSString*)identifier
+{
+    ECTwitterCachedResponse* response = [[mReplays objectForKey:identifier] retain];
+    if (response)
+    {
+        [mReplays removeObjectForKey:identifier];
+        [self replayResponse:response identifier:identifier];
+        [response release];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Get ready to store the body of a successful response, if it came with
+/// validators that we can use to check it next time.
+/// A body is only worth keeping if it parses, and we don't know that yet,
+/// so it's held until the parser tells us that it succeeded.
+/// Nobody else parses the response to a silent request, so we parse
+/// those ourselves, just to check them.
+// --------------------------------------------------------------------------
+
+- (void)storeResponseForConnection:(ECTwitterConnection*)connection
+{
+    NSString* cacheKey = connection.cacheKey;
+    if (cacheKey && ([connection.data length] > 0))
+    {
+        NSString* etag = nil;
+        NSString* lastModified = nil;
+        if ([self getValidatorsFromResponse:connection.response etag:&etag lastModified:&lastModified])
+        {
+            ECTwitterCachedResponse* response = [[ECTwitterCachedResponse alloc] init];
+            response.body = [NSData dataWithData:connection.data];
+            response.etag = etag;
+            response.lastModified = lastModified;
+            response.validated = [NSDate date];
+            NSString* identifier = [connection identifier];
+            [mPendingStores setObject:[NSDictionary dictionaryWithObject:response forKey:cacheKey] forKey:identifier];
+
+            if (connection.silent)
+            {
+                ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:self options:self.deliveryOptions];
+                [self parseOnQueue:dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0) block:^{
+                    [parser beginParsingWithIdentifier:identifier];
+                    if ([parser parseChunk:response.body])
+                    {
+                        [parser finishParsing];
+                    }
+                }];
+                [parser release];
             }
-            NSString *name = [names objectAtIndex:i];
-            [str appendString:[NSString stringWithFormat:@"%@=%@", 
-             name, [self encodeString:[params objectForKey:name]]]];
+            [response release];
         }
     }
-    
-    return str;
 }
 
 // --------------------------------------------------------------------------
-/// Encode string.
+/// A response has parsed, so if we were waiting to cache it, we can.
+// --------------------------------------------------------------------------
+
+- (void)storePendingResponseForRequest:(NSString*)identifier
+{
+    NSDictionary* pending = [mPendingStores objectForKey:identifier];
+    for (NSString* cacheKey in pending)
+    {
+        [self.responseCache storeResponse:[pending objectForKey:cacheKey] forKey:cacheKey];
+    }
+    [mPendingStores removeObjectForKey:identifier];
+}
+
+// --------------------------------------------------------------------------
+/// Find the headers in a response that we can use to revalidate it later.
+/// Returns NO if there aren't any.
 // --------------------------------------------------------------------------
 
-- (NSString*)encodeString:(NSString*)string
+- (BOOL)getValidatorsFromResponse:(NSHTTPURLResponse*)response etag:(NSString**)etag lastModified:(NSString**)lastModified
 {
-    NSString *result = (NSString*)CFURLCreateStringByAddingPercentEscapes(NULL, 
-                                                                 (CFStringRef)string, 
-                                                                 NULL, 
-                                                                 (CFStringRef)@";/?:@&=$+{}<>,",
-                                                                 kCFStringEncodingUTF8);
-    return [result autorelease];
+    NSDictionary* headers = [response allHeaderFields];
+    for (NSString* header in headers)
+    {
+        if ([header caseInsensitiveCompare:@"ETag"] == NSOrderedSame)
+            *etag = [headers objectForKey:header];
+        else if ([header caseInsensitiveCompare:@"Last-Modified"] == NSOrderedSame)
+            *lastModified = [headers objectForKey:header];
+    }
+
+    return (*etag != nil) || (*lastModified != nil);
 }
 
+#pragma mark Utility methods
+
 #pragma mark Request sending methods
 
 // --------------------------------------------------------------------------
 /// Send request.
+/// The request goes into the queue for its priority, and is sent
+/// as soon as there's a free connection to its host.
+/// We return the identifier that the connection will use (which is
+/// made now, unless the request already has one).
 // --------------------------------------------------------------------------
 
--(NSString*)sendRequest:(NSURLRequest *)theRequest
+-(NSString*)sendRequest:(MGTwitterQueuedRequest*)queued
 {
+    if (!queued.request) {
+        return nil;
+    }
+
+    MGTwitterRequestPriority priority = queued.priority;
+    ECAssert(priority < MGTwitterRequestPriorityCount);
+    if (!queued.identifier)
+    {
+        queued.identifier = [NSString stringWithNewUUID];
+    }
+    queued.host = [[queued.request URL] host];
+    queued.queued = [NSDate timeIntervalSinceReferenceDate];
+    [mQueues[priority] addObject:queued];
+
+    NSString* identifier = queued.identifier;
+    [self startQueuedRequests];
+    
+    return identifier;
+}
+
+// --------------------------------------------------------------------------
+/// Start as many queued requests as we can, highest priority first.
+/// Background requests are never allowed to take the last free 
+/// connection to a host, so that there's always one left for
+/// something more urgent.
+/// Requests whose rate limit budget has run out are held back (letting
+/// requests for other endpoints go ahead of them), and we try again when 
+/// the budget is next reset.
+// --------------------------------------------------------------------------
+
+- (void)startQueuedRequests
+{
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSTimeInterval retry = 0.0;
+    NSMutableArray* shed = nil;
+    NSUInteger maxPerHost = MAX(self.maxConnectionsPerHost, 1);
+    for (NSUInteger n = 0; n < MGTwitterRequestPriorityCount; ++n)
+    {
+        NSUInteger limit = ((n == MGTwitterRequestPriorityBackground) && (maxPerHost > 1)) ? maxPerHost - 1 : maxPerHost;
+        NSMutableArray* queue = mQueues[n];
+        NSUInteger index = 0;
+        while (index < [queue count])
+        {
+            MGTwitterQueuedRequest* queued = [queue objectAtIndex:index];
+            RateLimitDecision decision = [self rateLimitDecisionForRequest:queued now:now];
+            if (decision == RateLimitShed)
+            {
+                if (!shed)
+                {
+                    shed = [NSMutableArray array];
+                }
+                [shed addObject:queued];
+                [queue removeObjectAtIndex:index];
+            }
+            else if (decision == RateLimitHold)
+            {
+                MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:queued.rateLimitKey];
+                retry = (retry == 0.0) ? rateLimit.reset : MIN(retry, rateLimit.reset);
+                ++index;
+            }
+            else if ([mHostConnections countForObject:queued.host] < limit)
+            {
+                [queued retain];
+                [queue removeObjectAtIndex:index];
+                [self startRequest:queued];
+                [queued release];
+            }
+            else
+            {
+                ++index;
+            }
+        }
+    }
+
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(startQueuedRequests) object:nil];
+    if (retry > 0.0)
+    {
+        ECDebug(MGTwitterEngineChannel, @"holding requests for %.0fs until rate limit reset", retry - now);
+        [self performSelector:@selector(startQueuedRequests) withObject:nil afterDelay:MAX(retry - now, 1.0)];
+    }
+
+    for (MGTwitterQueuedRequest* queued in shed)
+    {
+        ECDebug(MGTwitterEngineChannel, @"shedding request %@ - rate limit exhausted", queued.identifier);
+        ++mShed;
+
+        // a silent request was only going to refresh the cache, so
+        // there's nobody waiting to hear that it didn't happen
+        if (!queued.silent)
+        {
+            NSDictionary* info = [NSDictionary dictionaryWithObject:@"rate limit exhausted" forKey:NSLocalizedDescriptionKey];
+            NSError* error = [NSError errorWithDomain:@"MGTwitterEngine" code:429 userInfo:info];
+            [self reportFailure:error forIdentifier:queued.identifier];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Report that a request failed before we could send it.
+/// This can happen while the request is still being made - before the
+/// caller has even been given its identifier - so we never tell the
+/// delegate straight away. Instead the failure is reported on the next
+/// turn of the run loop, unless the request is cancelled first.
+// --------------------------------------------------------------------------
+
+- (void)reportFailure:(NSError*)error forIdentifier:(NSString*)identifier
+{
+    [mFailures setObject:error forKey:identifier];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(deliverFailures) object:nil];
+    [self performSelector:@selector(deliverFailures) withObject:nil afterDelay:0.0];
+}
+
+// --------------------------------------------------------------------------
+/// Tell the delegate about any requests that failed before they were sent.
+// --------------------------------------------------------------------------
+
+- (void)deliverFailures
+{
+    NSDictionary* failures = [mFailures copy];
+    [mFailures removeAllObjects];
+
+    // the delegate may well respond by making more requests, so we work from a copy
+    for (NSString* identifier in failures)
+    {
+		if ([self isValidDelegateForSelector:@selector(requestFailed:withError:)])
+			[mDelegate requestFailed:identifier withError:[failures objectForKey:identifier]];
+    }
+    [failures release];
+}
+
+// --------------------------------------------------------------------------
+/// Start a connection for a queued request.
+// --------------------------------------------------------------------------
+
+- (void)startRequest:(MGTwitterQueuedRequest*)queued
+{
+    MGTwitterRequestPriority priority = queued.priority;
+    NSTimeInterval wait = [NSDate timeIntervalSinceReferenceDate] - queued.queued;
+    ++mStarted[priority];
+    mTotalWait[priority] += wait;
+    mMaxWait[priority] = MAX(mMaxWait[priority], wait);
     
     // Create a connection using this request, with the default timeout and caching policy, 
     // and appropriate Twitter request and response types for parsing and error reporting.
-    ECTwitterConnection* connection = [[ECTwitterConnection alloc] initWithRequest:theRequest delegate:self ];
+    ECTwitterConnection* connection = [[ECTwitterConnection alloc] initWithRequest:queued.request delegate:self ];
     
     if (!connection) {
-        return nil;
-    } else {
-        [mConnections setObject:connection forKey:[connection identifier]];
-        [connection release];
+        if (!queued.silent)
+        {
+            NSError* error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCannotConnectToHost userInfo:nil];
+            [self reportFailure:error forIdentifier:queued.identifier];
+        }
+        return;
     }
+
+    ECDebug(MGTwitterEngineChannel, @"starting request %@ after %.3fs", queued.identifier, wait);
+    connection.identifier = queued.identifier;
+    connection.host = queued.host;
+    connection.rateLimitKey = queued.rateLimitKey;
+    connection.cacheKey = queued.cacheKey;
+    connection.cachedResponse = queued.cachedResponse;
+    connection.silent = queued.silent;
+    MGTwitterRateLimit* rateLimit = [mRateLimits objectForKey:queued.rateLimitKey];
+    if (rateLimit.remaining > 0)
+    {
+        rateLimit.remaining--;
+    }
+    [mConnections setObject:connection forKey:[connection identifier]];
+    [mHostConnections addObject:queued.host];
+    [connection release];
 	
-	if ([self isValidDelegateForSelector:@selector(connectionStarted:)])
+	if ([self shouldNotifyDelegate:@selector(connectionStarted:) forConnection:connection])
 		[mDelegate connectionStarted:[connection identifier]];
-    
-    return [connection identifier];
 }
 
 
@@ -242,24 +942,119 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 // --------------------------------------------------------------------------
 
 - (NSString*)request:(NSString*)twitterPath parameters:(NSDictionary *)params method:(NSString*)method authentication:(ECTwitterAuthentication*)authentication
+{
+    return [self request:twitterPath parameters:params method:method authentication:authentication priority:MGTwitterRequestPriorityRefresh];
+}
+
+// --------------------------------------------------------------------------
+/// Make a request with a given priority.
+// --------------------------------------------------------------------------
+
+- (NSString*)request:(NSString*)twitterPath parameters:(NSDictionary *)params method:(NSString*)method authentication:(ECTwitterAuthentication*)authentication priority:(MGTwitterRequestPriority)priority
 {
 	NSString* path = [NSString stringWithFormat:@"%@.%@", twitterPath, kAPIFormat];
     NSMutableURLRequest* request = [self requestWithMethod:method path:path parameters:params authentication:authentication];
-    
-    // Set the request body if this is a POST request.
     BOOL isPOST = (method && [method isEqualToString:kPostMethod]);
-    if (isPOST) 
+	
+	MGTwitterQueuedRequest* queued = [[[MGTwitterQueuedRequest alloc] init] autorelease];
+	queued.request = request;
+	queued.priority = priority;
+	queued.rateLimitKey = [self rateLimitKeyForPath:twitterPath authentication:authentication];
+
+	// If this is a GET that we might have had a response to before,
+	// the response cache gets a look at it.
+	if (!isPOST && self.responseCache && request && [self isCacheableRequestWithParameters:params])
+	{
+		queued.cacheKey = [self responseCacheKeyForPath:twitterPath parameters:params authentication:authentication];
+		return [self sendCacheableRequest:queued path:twitterPath];
+	}
+
+	return [self sendRequest:queued];
+}
+
+// --------------------------------------------------------------------------
+/// Send a request that might have a response in the response cache.
+/// If the response is in memory, we can carry on straight away. If not,
+/// we look on disk in the background, and carry on once we know - in the
+/// meantime, the caller already has the identifier, and can use it to
+/// cancel the request.
+// --------------------------------------------------------------------------
+
+- (NSString*)sendCacheableRequest:(MGTwitterQueuedRequest*)queued path:(NSString*)twitterPath
+{
+    ECTwitterResponseCache* responseCache = self.responseCache;
+    ECTwitterCachedResponse* cached = [responseCache cachedResponseForKey:queued.cacheKey];
+    if (cached)
     {
-        // Set request body, if specified (hopefully so), with 'source' parameter if appropriate.
-		NSString* body = [self queryStringWithBase:nil parameters:params prefixed:NO];
-        [request setHTTPBody:[body dataUsingEncoding:NSUTF8StringEncoding]];
+        return [self sendRequest:queued cachedResponse:cached path:twitterPath];
     }
-	
-	return [self sendRequest:request];
+
+    NSString* identifier = [NSString stringWithNewUUID];
+    queued.identifier = identifier;
+    [mLookups setObject:queued forKey:identifier];
+    [responseCache fetchResponseForKey:queued.cacheKey handler:^(ECTwitterCachedResponse* response) {
+        MGTwitterQueuedRequest* waiting = [[mLookups objectForKey:identifier] retain];
+        if (waiting)
+        {
+            [mLookups removeObjectForKey:identifier];
+            [self sendRequest:waiting cachedResponse:response path:twitterPath];
+            [waiting release];
+        }
+    }];
+
+    return identifier;
+}
+
+// --------------------------------------------------------------------------
+/// Send a request, given the response we've got cached for it (if any).
+/// If we've had a response before, we ask the server to just tell us if
+/// it's unchanged.
+/// If the caller is happy with a slightly stale answer, we give them the
+/// one we've got, and revalidate it quietly in the background.
+// --------------------------------------------------------------------------
+
+- (NSString*)sendRequest:(MGTwitterQueuedRequest*)queued cachedResponse:(ECTwitterCachedResponse*)cached path:(NSString*)twitterPath
+{
+    if (cached)
+    {
+        NSMutableURLRequest* request = [[queued.request mutableCopy] autorelease];
+        if (cached.etag)
+        {
+            [request setValue:cached.etag forHTTPHeaderField:@"If-None-Match"];
+        }
+        if (cached.lastModified)
+        {
+            [request setValue:cached.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+        }
+        queued.request = request;
+        queued.cachedResponse = cached;
+    }
+
+    NSNumber* maxAge = [mStaleAges objectForKey:twitterPath];
+    if (cached && maxAge && (-[cached.validated timeIntervalSinceNow] <= [maxAge doubleValue]))
+    {
+        // The response is served on the next turn of the run loop, so that
+        // the caller has the identifier first, and can still cancel it.
+        NSString* identifier = queued.identifier ? [[queued.identifier retain] autorelease] : [NSString stringWithNewUUID];
+        ECDebug(MGTwitterEngineChannel, @"serving stale response for %@", twitterPath);
+        [mReplays setObject:cached forKey:identifier];
+        [self performSelector:@selector(deliverReplay:) withObject:identifier afterDelay:0.0];
+
+        queued.identifier = nil;
+        queued.silent = YES;
+        queued.priority = MGTwitterRequestPriorityBackground;
+        [self sendRequest:queued];
+
+        return identifier;
+    }
+
+    return [self sendRequest:queued];
 }
 
 // --------------------------------------------------------------------------
 /// Make a request.
+/// The builder encodes the parameters - into the query string, or the body
+/// for a POST - and signs the request if we've got authentication.
 // --------------------------------------------------------------------------
 
 - (NSMutableURLRequest *)requestWithMethod:(NSString*)method path:(NSString*)path parameters:(NSDictionary *)params authentication:(ECTwitterAuthentication*)authentication
@@ -275,42 +1070,30 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 	}
 	
     // Construct appropriate URL string.
-    NSString *fullPath = [path stringByAddingPercentEscapesUsingEncoding:NSNonLossyASCIIStringEncoding];
-    if (params && ![method isEqualToString:kPostMethod]) {
-        fullPath = [self queryStringWithBase:fullPath parameters:params prefixed:YES];
-    }
-    
 	BOOL isSearch = [method isEqualToString:@"search"];
 	NSString* domain = isSearch ? self.searchDomain : self.apiDomain;
 	NSString* connectionType = (self.secure && !isSearch) ? @"https" : @"http";
-		
-    NSString *urlString = [NSString stringWithFormat:@"%@://%@/%@", 
-                           connectionType,
-                           domain, fullPath];
-    
-    NSURL *finalURL = [NSURL URLWithString:urlString];
-    if (!finalURL) {
-        return nil;
-    }
+    NSString* fullPath = [path stringByAddingPercentEscapesUsingEncoding:NSNonLossyASCIIStringEncoding];
+    NSString *urlString = [NSString stringWithFormat:@"%@://%@/%@", connectionType, domain, fullPath];
     
-	ECDebug(MGTwitterEngineChannel, @"MGTwitterEngine: finalURL = %@", finalURL);
-
     // Construct an NSMutableURLRequest for the URL and set appropriate request method.
 	NSMutableURLRequest *theRequest = nil;
     if(authentication)
     {
-        theRequest = [authentication requestForURL:finalURL];
-		[theRequest setCachePolicy:NSURLRequestReloadIgnoringCacheData ];
-		[theRequest setTimeoutInterval:kRequestTimeout];
+        theRequest = [authentication requestWithBuilder:self.requestBuilder method:method URL:urlString parameters:params];
 	}
     else
     {
-		theRequest = [NSMutableURLRequest requestWithURL:finalURL cachePolicy:NSURLRequestReloadIgnoringCacheData timeoutInterval:kRequestTimeout];
+        theRequest = [self.requestBuilder requestWithMethod:method URL:urlString parameters:params];
 	}
-    if (method) {
-        [theRequest setHTTPMethod:method];
+    if (!theRequest) {
+        return nil;
     }
     
+	ECDebug(MGTwitterEngineChannel, @"MGTwitterEngine: finalURL = %@", [theRequest URL]);
+
+    [theRequest setCachePolicy:NSURLRequestReloadIgnoringCacheData];
+    [theRequest setTimeoutInterval:kRequestTimeout];
     [theRequest setHTTPShouldHandleCookies:NO];
     
     // Set headers for client information, for tracking purposes at Twitter.
@@ -326,22 +1109,140 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 #pragma mark Parsing methods
 
 // --------------------------------------------------------------------------
-/// Parse received data.
+/// Set up a parser for a connection.
+/// The response body is fed to the parser as it arrives, so we never need to 
+/// hold the whole thing in memory, and results can be delivered before the 
+/// last of the data has turned up.
+/// We're the parser's delegate; it calls us back on the connection's parse
+/// queue, and we pass everything on to our own delegate on the main thread.
 // --------------------------------------------------------------------------
 
-- (void)parseDataFromConnection:(ECTwitterConnection*)connection
+- (void)startParsingForConnection:(ECTwitterConnection*)connection
 {
-    NSData* data = [[connection data] copy];
-    NSString* identifier = [[connection identifier] copy];
+    ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:self options:self.deliveryOptions];
+    [parser beginParsingWithIdentifier:[connection identifier]];
+    [mParsing addObject:[connection identifier]];
+    connection.parser = parser;
+    [parser release];
+}
 
-	ECDebug(MGTwitterEngineChannel, @"MGTwitterEngine: jsonData = %@", [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease]);
+// --------------------------------------------------------------------------
+/// Parse any remaining data, and report the results.
+/// This happens on the connection's parse queue, after any chunks that
+/// are still waiting to be parsed. It's only then that we know whether
+/// the request succeeded.
+// --------------------------------------------------------------------------
 
-    ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:mDelegate options:MGTwitterEngineDeliveryAllResultsOption];
-    [parser parseData:data identifier:identifier];
-    [parser release];
+- (void)finishParsingForConnection:(ECTwitterConnection*)connection
+{
+    ECTwitterParser* parser = connection.parser;
+    if (parser)
+    {
+        [self parseOnQueue:connection.parseQueue block:^{
+            [parser finishParsing];
+        }];
+        connection.parser = nil;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Do some parsing on a queue.
+/// The parser calls us back, so we make sure that we're still around when
+/// it does - and that, if we're the last thing holding on to the engine, 
+/// it goes away on the main thread.
+// --------------------------------------------------------------------------
 
-    [data release];
-    [identifier release];
+- (void)parseOnQueue:(dispatch_queue_t)queue block:(dispatch_block_t)block
+{
+    [self retain];
+    dispatch_async(queue, ^{
+        block();
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self release];
+        });
+    });
+}
+
+// --------------------------------------------------------------------------
+/// A parser has given up on a response.
+/// If the connection is still going we destroy it, so that nothing else
+/// is reported for it; then we pass the error on.
+// --------------------------------------------------------------------------
+
+- (void)parsingFailedForRequest:(NSString*)identifier withError:(NSError*)error
+{
+    [mParsing removeObject:identifier];
+    ECTwitterConnection* connection = [mConnections objectForKey:identifier];
+    if (connection)
+    {
+        [connection cancel];
+        connection.parser = nil;
+        [self finishConnection:connection];
+    }
+
+    if ([self isValidDelegateForSelector:@selector(requestFailed:withError:)])
+        [mDelegate requestFailed:identifier withError:error];
+}
+
+#pragma mark Parser delegate methods
+
+// --------------------------------------------------------------------------
+/// These are called by our parsers, on their queues.
+/// All of our own state, and our delegate, belong to the main thread, so
+/// we just pass them on to there. Each parser reports from a serial queue,
+/// so its results arrive in the order it sent them.
+/// Anything for a request that's been cancelled in the meantime is dropped.
+// --------------------------------------------------------------------------
+
+- (void)requestSucceeded:(NSString*)identifier
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self storePendingResponseForRequest:identifier];
+        if ([mParsing containsObject:identifier] && [self isValidDelegateForSelector:@selector(requestSucceeded:)])
+            [mDelegate requestSucceeded:identifier];
+    });
+}
+
+- (void)requestFailed:(NSString*)identifier withError:(NSError*)error
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [mPendingStores removeObjectForKey:identifier];
+        if ([mParsing containsObject:identifier])
+            [self parsingFailedForRequest:identifier withError:error];
+    });
+}
+
+- (void)receivedObjects:(NSArray*)dictionaries forRequest:(NSString*)identifier
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if ([mParsing containsObject:identifier])
+        {
+            if ([self isValidDelegateForSelector:@selector(receivedObjects:forRequest:)])
+            {
+                [mDelegate receivedObjects:dictionaries forRequest:identifier];
+            }
+            else if ([self isValidDelegateForSelector:@selector(receivedObject:forRequest:)])
+            {
+                for (NSDictionary* dictionary in dictionaries)
+                {
+                    [mDelegate receivedObject:dictionary forRequest:identifier];
+                }
+            }
+        }
+    });
+}
+
+- (void)genericResultsReceived:(NSArray*)results forRequest:(NSString*)identifier
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if ([mParsing containsObject:identifier])
+        {
+            // this is the last we'll hear from the parser
+            [mParsing removeObject:identifier];
+            if ([self isValidDelegateForSelector:@selector(genericResultsReceived:forRequest:)])
+                [mDelegate genericResultsReceived:results forRequest:identifier];
+        }
+    });
 }
 
 #pragma mark Delegate methods
@@ -355,6 +1256,17 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 	return ((mDelegate != nil) && [mDelegate respondsToSelector:selector]);
 }
 
+// --------------------------------------------------------------------------
+/// Should the delegate hear about something that happened to a connection?
+/// Silent connections are ones we made for our own purposes (revalidating
+/// the response cache), so the delegate doesn't know about them.
+// --------------------------------------------------------------------------
+
+- (BOOL)shouldNotifyDelegate:(SEL)selector forConnection:(ECTwitterConnection*)connection
+{
+    return !connection.silent && [self isValidDelegateForSelector:selector];
+}
+
 
 #pragma mark NSURLConnection delegate methods
 
@@ -376,27 +1288,73 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
     // This method is called when the server has determined that it has enough information to create the NSURLResponse.
     // it can be called multiple times, for example in the case of a redirect, so each time we reset the data.
     [connection resetDataLength];
+    connection.parser = nil;
     
     // Get response code.
     NSHTTPURLResponse *resp = (NSHTTPURLResponse *)response;
     [connection setResponse:resp];
     NSInteger statusCode = [resp statusCode];
+    [self updateRateLimit:connection.rateLimitKey fromResponse:resp];
     
     if (statusCode == 304)
     {
-        // Not modified, or generic success.
-		if ([self isValidDelegateForSelector:@selector(requestSucceeded:)])
-			[mDelegate requestSucceeded:[connection identifier]];
-        if (statusCode == 304) 
+        // Not modified, so the response we validated against is still good;
+        // we mark it as freshly validated, and deliver it again.
+        ECTwitterCachedResponse* cached = connection.cachedResponse;
+        if (cached)
         {
+            cached.validated = [NSDate date];
+            [self.responseCache storeResponse:cached forKey:connection.cacheKey];
+        }
+        
+        if (connection.silent)
+        {
+            ECDebug(MGTwitterEngineChannel, @"cached response for %@ still valid", connection.cacheKey);
+        }
+        else if (cached)
+        {
+            [self replayResponse:cached identifier:[connection identifier]];
+        }
+		else if ([self isValidDelegateForSelector:@selector(requestSucceeded:)])
+        {
+			[mDelegate requestSucceeded:[connection identifier]];
         }
         
         // Destroy the connection.
         [connection cancel];
-		NSString *connectionIdentifier = [connection identifier];
-		[mConnections removeObjectForKey:connectionIdentifier];
-		if ([self isValidDelegateForSelector:@selector(connectionFinished:)])
-			[mDelegate connectionFinished:connectionIdentifier];
+        [self finishConnection:connection];
+    }
+    else
+    {
+        // whatever we had cached is out of date now
+        connection.cachedResponse = nil;
+
+        if (connection.cacheKey && (statusCode < 400))
+        {
+            // we only keep a copy of the body if we'll be able to revalidate it
+            NSString* etag = nil;
+            NSString* lastModified = nil;
+            if (![self getValidatorsFromResponse:resp etag:&etag lastModified:&lastModified])
+            {
+                connection.cacheKey = nil;
+            }
+        }
+
+        if ((statusCode < 400) && connection.silent && !connection.cacheKey)
+        {
+            // a silent request is only made to refresh the cache, so if 
+            // the response can't be cached there's no point reading it
+            ECDebug(MGTwitterEngineChannel, @"response for silent request %@ can't be cached", [connection identifier]);
+            [connection cancel];
+            [self finishConnection:connection];
+        }
+        else if ((statusCode < 400) && !connection.silent)
+        {
+            // the body is a real response, so parse it as it arrives
+            // (error bodies are still buffered, so that we can report them,
+            // as are the bodies of silent requests, which we just cache)
+            [self startParsingForConnection:connection];
+        }
     }
     
         ECDebug(MGTwitterEngineChannel, @"MGTwitterEngine:(%ld) [%@]:\r%@", 
@@ -411,8 +1369,29 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 
 - (void)connection:(ECTwitterConnection*)connection didReceiveData:(NSData *)data
 {
-    // Append the new data to the receivedData.
-    [connection appendData:data];
+    ECTwitterParser* parser = connection.parser;
+    if (parser)
+    {
+        // Hand the new data to the parser, in the background.
+        // If it fails, it'll tell us.
+        NSData* chunk = [data copy];
+        [self parseOnQueue:connection.parseQueue block:^{
+            [parser parseChunk:chunk];
+        }];
+        [chunk release];
+
+        if (connection.cacheKey)
+        {
+            // Keep the raw body too, so that we can cache it - the
+            // key is only left set if the response had validators.
+            [connection appendData:data];
+        }
+    }
+    else
+    {
+        // Append the new data to the receivedData.
+        [connection appendData:data];
+    }
 }
 
 // --------------------------------------------------------------------------
@@ -423,16 +1402,18 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
 {
 	NSString *connectionIdentifier = [connection identifier];
 	
+    // Anything the parser still has to say about it is too late.
+    [mParsing removeObject:connectionIdentifier];
+    connection.parser = nil;
+
     // Inform delegate.
-	if ([self isValidDelegateForSelector:@selector(requestFailed:withError:)]){
+	if ([self shouldNotifyDelegate:@selector(requestFailed:withError:) forConnection:connection]){
 		[mDelegate requestFailed:connectionIdentifier
 					   withError:error];
 	}
     
     // Release the connection.
-    [mConnections removeObjectForKey:connectionIdentifier];
-	if ([self isValidDelegateForSelector:@selector(connectionFinished:)])
-		[mDelegate connectionFinished:connectionIdentifier];
+    [self finishConnection:connection];
 }
 
 // --------------------------------------------------------------------------
@@ -454,47 +1435,34 @@ static const NSTimeInterval kRequestTimeout = 25.0; // Twitter usually fails qui
                                   body, @"body",
                                   nil];
         NSError *error = [NSError errorWithDomain:@"HTTP" code:statusCode userInfo:userInfo];
-		if ([self isValidDelegateForSelector:@selector(requestFailed:withError:)])
+		if ([self shouldNotifyDelegate:@selector(requestFailed:withError:) forConnection:connection])
 			[mDelegate requestFailed:[connection identifier] withError:error];
 
         // Destroy the connection.
         [connection cancel];
-		NSString *connectionIdentifier = [connection identifier];
-		[mConnections removeObjectForKey:connectionIdentifier];
-		if ([self isValidDelegateForSelector:@selector(connectionFinished:)])
-			[mDelegate connectionFinished:connectionIdentifier];
+        [self finishConnection:connection];
         return;
     }
 
 	NSString *connID = nil;
 	connID = [connection identifier];
 	
-    // Inform delegate.
-	if ([self isValidDelegateForSelector:@selector(requestSucceeded:)])
+    // Remember the body, if we can revalidate it next time.
+    [self storeResponseForConnection:connection];
+
+    if (connection.parser)
+    {
+        // Parse whatever is left of the data from the connection;
+        // the parser tells us whether it worked, and we pass that on.
+        [self finishParsingForConnection:connection];
+    }
+	else if ([self shouldNotifyDelegate:@selector(requestSucceeded:) forConnection:connection])
+    {
 		[mDelegate requestSucceeded:connID];
-    
-    NSData *receivedData = [connection data];
-    if (receivedData) {
-		// Dump data as string for debugging.
-		ECDebug(MGTwitterEngineChannel, @"MGTwitterEngine: Succeeded! Received %lu bytes of data:\r\r%@", (unsigned long)[receivedData length], [NSString stringWithUTF8String:[receivedData bytes]]);
-#if DEBUG        
-        if (NO) {
-            // Dump XML to file for debugging.
-            NSString *dataString = [NSString stringWithUTF8String:[receivedData bytes]];
-            static NSUInteger index = 0;
-            [dataString writeToFile:[[NSString stringWithFormat:@"~/Desktop/Twitter Messages/message %ld.%@", (long) index++, kAPIFormat] stringByExpandingTildeInPath]
-                         atomically:NO encoding:NSUTF8StringEncoding error:NULL];
-        }
-#endif
-        
-        // Parse data from the connection (either XML or JSON.)
-        [self parseDataFromConnection:connection];
     }
     
     // Release the connection.
-    [mConnections removeObjectForKey:connID];
-	if ([self isValidDelegateForSelector:@selector(connectionFinished:)])
-		[mDelegate connectionFinished:connID];
+    [self finishConnection:connection];
 }
 
 
@@ -18,6 +18,19 @@ typedef enum _MGTwitterEngineDeliveryOptions {
 	// these options can be combined with the | operator
 } MGTwitterEngineDeliveryOptions;
 
+typedef enum _MGTwitterRequestPriority {
+	// something the user is waiting for, such as posting a tweet
+	MGTwitterRequestPriorityInteractive,
+
+	// refreshing something the user can see, such as a timeline
+	MGTwitterRequestPriorityRefresh,
+
+	// filling in details that nobody is waiting for yet
+	MGTwitterRequestPriorityBackground,
+
+	MGTwitterRequestPriorityCount
+} MGTwitterRequestPriority;
+
 
 
 @protocol MGTwitterEngineDelegate
@@ -32,6 +45,10 @@ typedef enum _MGTwitterEngineDeliveryOptions {
 // the deliveryOption is configured for MGTwitterEngineDeliveryIndividualResults.
 - (void)receivedObject:(NSDictionary *)dictionary forRequest:(NSString *)connectionIdentifier;
 
+// If the delegate implements this, individual results are delivered in batches - all the
+// results that were parsed from each chunk of data, in one go - instead of one at a time.
+- (void)receivedObjects:(NSArray *)dictionaries forRequest:(NSString *)connectionIdentifier;
+
 
 // These delegate methods are called after all results are parsed from the connection. If 
 // the deliveryOption is configured for MGTwitterEngineDeliveryAllResults (the default), a
@@ -0,0 +1,699 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/ECTwitterParser.h>
+#import <ECTwitter/ECTwitterRequestBuilder.h>
+#import <ECOAuthConsumer/ECOAuthConsumer.h>
+
+#import "ECTwitterFixtures.h"
+
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+#include <time.h>
+
+// --------------------------------------------------------------------------
+/// Parser delegate which just hangs on to whatever it's given.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterBenchmarkCollector : NSObject<MGTwitterEngineDelegate>
+
+@property (strong, nonatomic) NSArray* results;
+@property (strong, nonatomic) NSError* error;
+
+@end
+
+@implementation ECTwitterBenchmarkCollector
+
+@synthesize error = _error;
+@synthesize results = _results;
+
+- (void)dealloc
+{
+    [_error release];
+    [_results release];
+
+    [super dealloc];
+}
+
+- (void)requestSucceeded:(NSString*)connectionIdentifier
+{
+}
+
+- (void)requestFailed:(NSString*)connectionIdentifier withError:(NSError*)error
+{
+    self.error = error;
+}
+
+- (void)genericResultsReceived:(NSArray*)genericResults forRequest:(NSString*)connectionIdentifier
+{
+    self.results = genericResults;
+}
+
+@end
+
+// --------------------------------------------------------------------------
+/// Benchmarks for the main paths that tweets take - parsing, going into
+/// the cache, being saved and loaded, and being added to timelines - at
+/// a few different corpus sizes.
+///
+/// Nothing here touches the network; responses come from the recorded
+/// fixtures, via ECTwitterFixtureProtocol when we go through the engine.
+///
+/// Each run logs its wall clock time, throughput, how many more blocks
+/// (and bytes) were live at the end than at the start, and the peak
+/// resident size of the process so far.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterBenchmarks : ECTestCase
+
+@end
+
+@implementation ECTwitterBenchmarks
+
+static const NSUInteger kCorpusSizes[] = { 200, 1000, 5000 };
+static const NSUInteger kCorpusSizeCount = sizeof(kCorpusSizes) / sizeof(kCorpusSizes[0]);
+static const NSUInteger kDecodeIterations = 100000;
+
+typedef struct
+{
+    NSTimeInterval time;
+    size_t blocks;
+    size_t bytes;
+} ECTwitterBenchmarkSample;
+
+// --------------------------------------------------------------------------
+/// Take a note of the time and the allocations that are live right now.
+// --------------------------------------------------------------------------
+
+static ECTwitterBenchmarkSample takeSample(void)
+{
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+
+    ECTwitterBenchmarkSample result;
+    result.time = [NSDate timeIntervalSinceReferenceDate];
+    result.blocks = stats.blocks_in_use;
+    result.bytes = stats.size_in_use;
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the most memory that the process has had resident, in MB.
+// --------------------------------------------------------------------------
+
+static double peakResidentMB(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // ru_maxrss is in bytes on the Mac and iOS
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+}
+
+// --------------------------------------------------------------------------
+/// The way the parser used to decode strings, for comparison.
+// --------------------------------------------------------------------------
+
+static NSString* oldDecode(const unsigned char* bytes, NSUInteger length)
+{
+    NSMutableString *value = [[[NSMutableString alloc] initWithBytes:bytes length:length encoding:NSUTF8StringEncoding] autorelease];
+    [value replaceOccurrencesOfString:@"&gt;" withString:@">" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
+    [value replaceOccurrencesOfString:@"&lt;" withString:@"<" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
+    [value replaceOccurrencesOfString:@"&amp;" withString:@"&" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
+    [value replaceOccurrencesOfString:@"&quot;" withString:@"\"" options:NSCaseInsensitiveSearch range:NSMakeRange(0, [value length])];
+
+    return value;
+}
+
+// --------------------------------------------------------------------------
+/// The way the parser used to read dates, for comparison.
+// --------------------------------------------------------------------------
+
+static NSTimeInterval oldTime(NSString* value)
+{
+    struct tm theTime;
+    memset(&theTime, 0, sizeof(theTime));
+    if ([value hasSuffix:@"+0000"])
+    {
+        strptime([value UTF8String], "%a, %d %b %Y %H:%M:%S +0000", &theTime);
+    }
+    else
+    {
+        strptime([value UTF8String], "%a %b %d %H:%M:%S +0000 %Y", &theTime);
+    }
+
+    return timegm(&theTime);
+}
+
+// --------------------------------------------------------------------------
+/// Log the results of a run.
+/// If bytes is non-zero, we report the data rate as well.
+// --------------------------------------------------------------------------
+
+- (void)report:(NSString*)name count:(NSUInteger)count bytes:(NSUInteger)bytes since:(ECTwitterBenchmarkSample)start
+{
+    ECTwitterBenchmarkSample end = takeSample();
+    NSTimeInterval elapsed = MAX(end.time - start.time, 1e-6);
+    long blocks = (long) end.blocks - (long) start.blocks;
+    double liveMB = ((double) end.bytes - (double) start.bytes) / (1024.0 * 1024.0);
+
+    NSString* rate = bytes ? [NSString stringWithFormat:@", %.1fMB/s", (bytes / (1024.0 * 1024.0)) / elapsed] : @"";
+    NSLog(@"benchmark %@ x%ld: %.3fs, %.0f/s%@, %+ld blocks %+.2fMB live, peak rss %.1fMB", name, (long) count, elapsed, count / elapsed, rate, blocks, liveMB, peakResidentMB());
+}
+
+// --------------------------------------------------------------------------
+/// Return a folder to save a cache into.
+// --------------------------------------------------------------------------
+
+- (NSURL*)folderNamed:(NSString*)name
+{
+    return [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+}
+
+// --------------------------------------------------------------------------
+/// Return an empty folder to save a cache into.
+// --------------------------------------------------------------------------
+
+- (NSURL*)emptyFolderNamed:(NSString*)name
+{
+    NSURL* url = [self folderNamed:name];
+    NSFileManager* fm = [NSFileManager defaultManager];
+    [fm removeItemAtURL:url error:nil];
+    [fm createDirectoryAtURL:url withIntermediateDirectories:YES attributes:nil error:nil];
+
+    return url;
+}
+
+// --------------------------------------------------------------------------
+/// Return a cache which isn't connected to twitter, and never evicts.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCache*)offlineCacheInFolder:(NSURL*)folder
+{
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+    cache.cacheFolder = folder;
+    cache.maxTweets = 0;
+    cache.maxTweetBytes = 0;
+    cache.maxUsers = 0;
+
+    return [cache autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Parse some data in one go, returning the results.
+// --------------------------------------------------------------------------
+
+- (NSArray*)parseData:(NSData*)data
+{
+    ECTwitterBenchmarkCollector* collector = [[ECTwitterBenchmarkCollector alloc] init];
+    ECTwitterParser* parser = [[ECTwitterParser alloc] initWithDelegate:collector options:MGTwitterEngineDeliveryAllResultsOption];
+    [parser parseData:data identifier:@"benchmark"];
+    NSArray* results = [[collector.results retain] autorelease];
+    [parser release];
+    [collector release];
+
+    return results;
+}
+
+// --------------------------------------------------------------------------
+/// Call a method through the engine, with the fixture protocol standing
+/// in for twitter, and return how many results came back.
+// --------------------------------------------------------------------------
+
+- (NSUInteger)replayMethod:(NSString*)method data:(NSData*)data expecting:(NSUInteger)expected
+{
+    [ECTwitterFixtureProtocol setResponse:data forMethod:method];
+
+    NSURL* url = [NSURL URLWithString:@"http://elegantchaos.github.com/ECTwitter/Documentation"];
+    ECTwitterEngine* engine = [[ECTwitterEngine alloc] initWithConsumerKey:@"fixture-key" consumerSecret:@"fixture-secret" clientName:@"ECTwitter Benchmarks" version:@"1.0" url:url];
+
+    __block NSUInteger received = 0;
+    [engine callGetMethod:method parameters:nil handler:^(ECTwitterHandler* handler) {
+        if (handler.status == StatusResults)
+        {
+            if (++received == expected)
+            {
+                [self timeToExitRunLoop];
+            }
+        }
+        else
+        {
+            NSLog(@"replay of %@ failed: %@", method, [handler errorString]);
+            [self timeToExitRunLoop];
+        }
+    }];
+
+    [self runUntilTimeToExit];
+    [engine release];
+
+    return received;
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// Check that the recorded fixtures themselves come through the parser.
+// --------------------------------------------------------------------------
+
+- (void)testRecordedFixtures
+{
+    NSArray* tweets = [self parseData:[ECTwitterFixtures dataForFixture:@"timeline"]];
+    ECTestAssertIntegerIsEqual([tweets count], 3);
+    ECTestAssertStringIsEqual([[tweets objectAtIndex:0] objectForKey:@"id_str"], @"240859602684612608");
+    ECTestAssertStringIsEqual([[[tweets objectAtIndex:2] objectForKey:@"user"] objectForKey:@"screen_name"], @"TwitterEng");
+
+    NSArray* users = [self parseData:[ECTwitterFixtures dataForFixture:@"users"]];
+    ECTestAssertIntegerIsEqual([users count], 3);
+    ECTestAssertStringIsEqual([[users objectAtIndex:0] objectForKey:@"screen_name"], @"samdeane");
+
+    NSArray* search = [self parseData:[ECTwitterFixtures dataForFixture:@"search"]];
+    ECTestAssertNotEmpty(search);
+}
+
+// --------------------------------------------------------------------------
+/// Parse timelines of increasing size.
+// --------------------------------------------------------------------------
+
+- (void)testParser
+{
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            NSData* data = [ECTwitterFixtures dataForObject:[ECTwitterFixtures tweetsWithCount:size]];
+
+            ECTwitterBenchmarkSample start = takeSample();
+            NSArray* results = [self parseData:data];
+            [self report:@"parse timeline" count:size bytes:[data length] since:start];
+            ECTestAssertIntegerIsEqual([results count], size);
+
+            data = [ECTwitterFixtures dataForObject:[ECTwitterFixtures usersWithCount:size]];
+            start = takeSample();
+            results = [self parseData:data];
+            [self report:@"parse users" count:size bytes:[data length] since:start];
+            ECTestAssertIntegerIsEqual([results count], size);
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Time the old and new ways of decoding strings and dates.
+/// The new ones should be comfortably faster.
+// --------------------------------------------------------------------------
+
+- (void)testDecoding
+{
+    NSArray* strings = [NSArray arrayWithObjects:
+                        @"Just setting up my twttr",
+                        @"RT @someone: check this out http://t.co/abcdefg #things",
+                        @"a &gt; b &amp;&amp; c &lt; d - &quot;quoted&quot;",
+                        @"<a href=\"http://twitter.com/#!/download/iphone\" rel=\"nofollow\">Twitter for iPhone</a>",
+                        nil];
+    NSString* date = @"Thu Jan 15 02:04:38 +0000 2009";
+    const char* dateBytes = [date UTF8String];
+    NSUInteger dateLength = strlen(dateBytes);
+    NSUInteger stringCount = kDecodeIterations * [strings count];
+
+    ECTestAssertTrue(ECTwitterTimeFromBytes(dateBytes, dateLength) == oldTime(date));
+
+    ECTwitterBenchmarkSample start = takeSample();
+    for (NSUInteger n = 0; n < kDecodeIterations; ++n)
+    {
+        @autoreleasepool
+        {
+            for (NSString* string in strings)
+            {
+                const char* bytes = [string UTF8String];
+                oldDecode((const unsigned char*) bytes, strlen(bytes));
+            }
+        }
+    }
+    NSTimeInterval oldStringTime = takeSample().time - start.time;
+    [self report:@"decode strings (old)" count:stringCount bytes:0 since:start];
+
+    start = takeSample();
+    for (NSUInteger n = 0; n < kDecodeIterations; ++n)
+    {
+        @autoreleasepool
+        {
+            for (NSString* string in strings)
+            {
+                const char* bytes = [string UTF8String];
+                ECTwitterStringWithEntitiesDecoded((const unsigned char*) bytes, strlen(bytes));
+            }
+        }
+    }
+    NSTimeInterval newStringTime = takeSample().time - start.time;
+    [self report:@"decode strings" count:stringCount bytes:0 since:start];
+
+    start = takeSample();
+    for (NSUInteger n = 0; n < kDecodeIterations; ++n)
+    {
+        @autoreleasepool
+        {
+            NSString* value = [[NSString alloc] initWithBytes:dateBytes length:dateLength encoding:NSUTF8StringEncoding];
+            oldTime(value);
+            [value release];
+        }
+    }
+    NSTimeInterval oldDateTime = takeSample().time - start.time;
+    [self report:@"decode dates (old)" count:kDecodeIterations bytes:0 since:start];
+
+    start = takeSample();
+    for (NSUInteger n = 0; n < kDecodeIterations; ++n)
+    {
+        ECTwitterTimeFromBytes(dateBytes, dateLength);
+    }
+    NSTimeInterval newDateTime = takeSample().time - start.time;
+    [self report:@"decode dates" count:kDecodeIterations bytes:0 since:start];
+
+    ECTestAssertTrue(newStringTime < oldStringTime);
+    ECTestAssertTrue(newDateTime < oldDateTime);
+}
+
+// --------------------------------------------------------------------------
+/// Add tweets and users to an empty cache, then refresh them all.
+// --------------------------------------------------------------------------
+
+- (void)testCacheIngest
+{
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            NSArray* infos = [ECTwitterFixtures tweetsWithCount:size];
+            ECTwitterCache* cache = [self offlineCacheInFolder:[self emptyFolderNamed:@"ECTwitterBenchmarks Ingest"]];
+
+            ECTwitterBenchmarkSample start = takeSample();
+            [cache addOrRefreshTweets:infos];
+            [self report:@"cache add tweets" count:size bytes:0 since:start];
+            ECTestAssertIntegerIsEqual(cache.tweetCount, size);
+
+            start = takeSample();
+            [cache addOrRefreshTweets:infos];
+            [self report:@"cache refresh tweets" count:size bytes:0 since:start];
+            ECTestAssertIntegerIsEqual(cache.tweetCount, size);
+
+            NSArray* users = [ECTwitterFixtures usersWithCount:size];
+            start = takeSample();
+            [cache addOrRefreshUsers:users];
+            [self report:@"cache add users" count:size bytes:0 since:start];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Save a full cache, then load it back, both eagerly and lazily.
+// --------------------------------------------------------------------------
+
+- (void)testCacheSaveAndLoad
+{
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            NSURL* folder = [self emptyFolderNamed:@"ECTwitterBenchmarks Save"];
+            NSArray* infos = [ECTwitterFixtures tweetsWithCount:size];
+
+            ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+            cache.cacheFolder = folder;
+            [cache addOrRefreshTweets:infos];
+
+            ECTwitterBenchmarkSample start = takeSample();
+            [cache save];
+            [self report:@"cache save" count:size bytes:0 since:start];
+
+            // releasing the cache waits for the background writes to finish
+            start = takeSample();
+            [cache release];
+            [self report:@"cache save flush" count:size bytes:0 since:start];
+
+            cache = [self offlineCacheInFolder:folder];
+            cache.loadsLazily = NO;
+            start = takeSample();
+            [cache load];
+            [self report:@"cache load" count:size bytes:0 since:start];
+            ECTestAssertIntegerIsEqual(cache.tweetCount, size);
+
+            cache = [self offlineCacheInFolder:folder];
+            start = takeSample();
+            [cache load];
+            [self report:@"cache lazy load" count:size bytes:0 since:start];
+            ECTestAssertNotNil([cache tweetWithID:[ECTwitterID idFromString:[[infos lastObject] objectForKey:@"id_str"]]]);
+        }
+    }
+
+    [[NSFileManager defaultManager] removeItemAtURL:[self folderNamed:@"ECTwitterBenchmarks Save"] error:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Report how many bytes each tweet takes: as the keyed archive that the
+/// cache used to save, as the compact record it saves now, in the cache
+/// folder once it's been saved, and live in memory once it's been ingested.
+// --------------------------------------------------------------------------
+
+- (void)testRecordSize
+{
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            NSURL* folder = [self emptyFolderNamed:@"ECTwitterBenchmarks Records"];
+            NSArray* infos = [ECTwitterFixtures tweetsWithCount:size];
+
+            ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+            cache.cacheFolder = folder;
+            ECTwitterBenchmarkSample start = takeSample();
+            NSArray* tweets = [cache addOrRefreshTweets:infos];
+            double live = (double) takeSample().bytes - (double) start.bytes;
+
+            NSUInteger archived = 0;
+            NSUInteger compact = 0;
+            for (ECTwitterTweet* tweet in tweets)
+            {
+                @autoreleasepool
+                {
+                    archived += [[NSKeyedArchiver archivedDataWithRootObject:tweet] length];
+                    compact += [[tweet compactRecord] length];
+                }
+            }
+
+            // releasing the cache waits for the background writes to finish
+            [cache save];
+            [cache release];
+
+            unsigned long long saved = 0;
+            NSFileManager* fm = [NSFileManager defaultManager];
+            for (NSURL* file in [fm contentsOfDirectoryAtURL:folder includingPropertiesForKeys:nil options:0 error:nil])
+            {
+                saved += [[fm attributesOfItemAtPath:[file path] error:nil] fileSize];
+            }
+
+            NSLog(@"benchmark tweet bytes x%ld: %.0f archived, %.0f compact (%.0f%% smaller), %.0f in cache folder, %.0f live in memory", (long) size, (double) archived / size, (double) compact / size, 100.0 * (1.0 - (double) compact / archived), (double) saved / size, live / size);
+            ECTestAssertTrue(compact < archived);
+        }
+    }
+
+    [[NSFileManager defaultManager] removeItemAtURL:[self folderNamed:@"ECTwitterBenchmarks Records"] error:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Look up tweets and users that are in memory from more and more threads
+/// at once, up to one per core.
+/// The total number of lookups stays the same, so if lookups scale, the
+/// rate should go up with the number of threads.
+// --------------------------------------------------------------------------
+
+- (void)testConcurrentLookups
+{
+    static const NSUInteger kCorpusSize = 5000;
+    static const NSUInteger kLookupCount = 1000000;
+
+    ECTwitterCache* cache = [self offlineCacheInFolder:[self emptyFolderNamed:@"ECTwitterBenchmarks Lookups"]];
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:kCorpusSize];
+    [cache addOrRefreshTweets:infos];
+
+    NSUInteger count = [infos count];
+    ECTwitterID** tweetIDs = calloc(count, sizeof(ECTwitterID*));
+    ECTwitterID** authorIDs = calloc(count, sizeof(ECTwitterID*));
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        NSDictionary* info = [infos objectAtIndex:n];
+        tweetIDs[n] = [[ECTwitterID idFromDictionary:info] retain];
+        authorIDs[n] = [[ECTwitterID idFromDictionary:[info objectForKey:@"user"]] retain];
+    }
+
+    NSUInteger cores = MAX([[NSProcessInfo processInfo] activeProcessorCount], 1);
+    for (NSUInteger threads = 1; threads <= cores; threads *= 2)
+    {
+        NSUInteger perThread = kLookupCount / threads;
+        ECTwitterBenchmarkSample start = takeSample();
+        dispatch_apply(threads, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            NSUInteger index = thread * (count / threads);
+            for (NSUInteger n = 0; n < perThread; n += 3)
+            {
+                @autoreleasepool
+                {
+                    index = (index + 1) % count;
+                    [cache existingTweetWithID:tweetIDs[index]];
+                    [cache tweetWithID:tweetIDs[index]];
+                    [cache userWithID:authorIDs[index] requestIfMissing:NO];
+                }
+            }
+        });
+        [self report:[NSString stringWithFormat:@"cache lookups, %ld threads", (long) threads] count:perThread * threads bytes:0 since:start];
+        ECTestAssertIntegerIsEqual(cache.tweetCount, count);
+    }
+
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        [tweetIDs[n] release];
+        [authorIDs[n] release];
+    }
+    free(tweetIDs);
+    free(authorIDs);
+
+    [[NSFileManager defaultManager] removeItemAtURL:[self folderNamed:@"ECTwitterBenchmarks Lookups"] error:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Add tweets to a timeline one at a time - first in the order they arrive
+/// from twitter, then shuffled.
+// --------------------------------------------------------------------------
+
+- (void)testTimelineAddTweet
+{
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            ECTwitterCache* cache = [self offlineCacheInFolder:[self emptyFolderNamed:@"ECTwitterBenchmarks Timeline"]];
+            NSArray* tweets = [cache addOrRefreshTweets:[ECTwitterFixtures tweetsWithCount:size]];
+
+            ECTwitterTimeline* timeline = [[ECTwitterTimeline alloc] initWithCache:cache];
+            ECTwitterBenchmarkSample start = takeSample();
+            for (ECTwitterTweet* tweet in tweets)
+            {
+                [timeline addTweet:tweet];
+            }
+            [self report:@"timeline add in order" count:size bytes:0 since:start];
+            ECTestAssertIntegerIsEqual([timeline count], size);
+            [timeline release];
+
+            NSMutableArray* shuffled = [NSMutableArray arrayWithArray:tweets];
+            srandom((unsigned) size);
+            for (NSUInteger i = [shuffled count]; i > 1; --i)
+            {
+                [shuffled exchangeObjectAtIndex:i - 1 withObjectAtIndex:(NSUInteger) random() % i];
+            }
+
+            timeline = [[ECTwitterTimeline alloc] initWithCache:cache];
+            start = takeSample();
+            for (ECTwitterTweet* tweet in shuffled)
+            {
+                [timeline addTweet:tweet];
+            }
+            [self report:@"timeline add shuffled" count:size bytes:0 since:start];
+            ECTestAssertIntegerIsEqual([timeline count], size);
+            [timeline release];
+        }
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Fetch timelines and user lists through the engine, end to end,
+/// with the fixture protocol standing in for twitter.
+// --------------------------------------------------------------------------
+
+- (void)testReplayThroughEngine
+{
+    [ECTwitterFixtureProtocol install];
+
+    for (NSUInteger n = 0; n < kCorpusSizeCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSUInteger size = kCorpusSizes[n];
+            NSData* data = [ECTwitterFixtures dataForObject:[ECTwitterFixtures tweetsWithCount:size]];
+            ECTwitterBenchmarkSample start = takeSample();
+            NSUInteger received = [self replayMethod:@"statuses/home_timeline" data:data expecting:size];
+            [self report:@"replay home timeline" count:size bytes:[data length] since:start];
+            ECTestAssertIntegerIsEqual(received, size);
+
+            data = [ECTwitterFixtures dataForObject:[ECTwitterFixtures usersWithCount:size]];
+            start = takeSample();
+            received = [self replayMethod:@"users/lookup" data:data expecting:size];
+            [self report:@"replay user lookup" count:size bytes:[data length] since:start];
+            ECTestAssertIntegerIsEqual(received, size);
+        }
+    }
+
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], kCorpusSizeCount * 2);
+    [ECTwitterFixtureProtocol uninstall];
+}
+
+// --------------------------------------------------------------------------
+/// Build signed requests for users/show and a timeline, the way a big
+/// fan-out does - first with the request builder, then signing each one
+/// from scratch with OAMutableURLRequest, for comparison.
+// --------------------------------------------------------------------------
+
+- (void)testRequestConstruction
+{
+    static const NSUInteger kRequestCount = 10000;
+
+    NSString* consumerKey = @"fixture-key";
+    NSString* consumerSecret = @"fixture-secret";
+    OAToken* token = [[OAToken alloc] initWithKey:@"370773112-fixture-token" secret:@"fixture-token-secret"];
+    NSDictionary* timelineParameters = [NSDictionary dictionaryWithObjectsAndKeys:@"200", @"count", @"240859602684612608", @"since_id", @"true", @"include_entities", nil];
+
+    ECTwitterRequestBuilder* builder = [[ECTwitterRequestBuilder alloc] init];
+    ECTwitterBenchmarkSample start = takeSample();
+    for (NSUInteger n = 0; n < kRequestCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSDictionary* parameters = [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"%ld", (long) (100000 + n)] forKey:@"user_id"];
+            NSURLRequest* request = [builder requestWithMethod:@"GET" URL:@"https://api.twitter.com/1/users/show.json" parameters:parameters consumerKey:consumerKey consumerSecret:consumerSecret tokenKey:token.key tokenSecret:token.secret];
+            ECTestAssertNotNil([request valueForHTTPHeaderField:@"Authorization"]);
+            [builder requestWithMethod:@"GET" URL:@"https://api.twitter.com/1/statuses/home_timeline.json" parameters:timelineParameters consumerKey:consumerKey consumerSecret:consumerSecret tokenKey:token.key tokenSecret:token.secret];
+        }
+    }
+    [self report:@"request builder" count:kRequestCount * 2 bytes:0 since:start];
+    [builder release];
+
+    OAConsumer* consumer = [[OAConsumer alloc] initWithKey:consumerKey secret:consumerSecret];
+    start = takeSample();
+    for (NSUInteger n = 0; n < kRequestCount; ++n)
+    {
+        @autoreleasepool
+        {
+            NSURL* url = [NSURL URLWithString:[NSString stringWithFormat:@"https://api.twitter.com/1/users/show.json?user_id=%ld", (long) (100000 + n)]];
+            OAMutableURLRequest* request = [[OAMutableURLRequest alloc] initWithURL:url consumer:consumer token:token realm:nil signatureProvider:nil];
+            [request prepare];
+            [request release];
+
+            url = [NSURL URLWithString:@"https://api.twitter.com/1/statuses/home_timeline.json?count=200&include_entities=true&since_id=240859602684612608"];
+            request = [[OAMutableURLRequest alloc] initWithURL:url consumer:consumer token:token realm:nil signatureProvider:nil];
+            [request prepare];
+            [request release];
+        }
+    }
+    [self report:@"request OAMutableURLRequest" count:kRequestCount * 2 bytes:0 since:start];
+
+    [consumer release];
+    [token release];
+}
+
+@end
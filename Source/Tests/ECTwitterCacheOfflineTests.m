@@ -0,0 +1,325 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+#import "ECTwitterFixtures.h"
+
+// --------------------------------------------------------------------------
+/// Cache tests that run against the recorded fixtures, without needing
+/// a twitter account or the network.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCacheOfflineTests : ECTestCase
+
+@property (strong, nonatomic) ECTwitterCache* cache;
+@property (strong, nonatomic) NSURL* folder;
+@property (strong, nonatomic) NSDictionary* lastUpdate;
+@property (assign, nonatomic) NSUInteger updateCount;
+
+@end
+
+
+@implementation ECTwitterCacheOfflineTests
+
+@synthesize cache = _cache;
+@synthesize folder = _folder;
+@synthesize lastUpdate = _lastUpdate;
+@synthesize updateCount = _updateCount;
+
+- (void)setUp
+{
+    // each test gets a folder of its own, so nothing is picked up from the real cache, or an earlier test
+    NSString* name = [NSString stringWithFormat:@"ECTwitterCacheOfflineTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.folder withIntermediateDirectories:YES attributes:nil error:nil];
+
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+    cache.cacheFolder = self.folder;
+    self.cache = cache;
+    [cache release];
+
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(cacheUpdated:) name:ECTwitterCacheUpdated object:cache];
+}
+
+- (void)tearDown
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    self.cache = nil;
+    self.lastUpdate = nil;
+
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+}
+
+// --------------------------------------------------------------------------
+/// Remember the last update.
+/// The cache can post updates from any thread, so we lock around this.
+// --------------------------------------------------------------------------
+
+- (void)cacheUpdated:(NSNotification*)notification
+{
+    @synchronized(self)
+    {
+        self.lastUpdate = [notification userInfo];
+        ++self.updateCount;
+    }
+}
+
+- (void)testIngestUnchanged
+{
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:20];
+    [self.cache addOrRefreshTweets:infos];
+    ECTestAssertIntegerIsEqual(self.updateCount, 1);
+    ECTestAssertIntegerIsEqual([[self.lastUpdate objectForKey:ECTwitterCacheUpdatedTweetsKey] count], 20);
+
+    // the same info again changes nothing
+    [self.cache addOrRefreshTweets:infos];
+    ECTestAssertIntegerIsEqual(self.updateCount, 1);
+
+    // but different info does
+    NSMutableDictionary* changed = [[infos objectAtIndex:3] mutableCopy];
+    [changed setObject:@"something else entirely" forKey:@"text"];
+    [self.cache addOrRefreshTweets:[NSArray arrayWithObject:changed]];
+    ECTestAssertIntegerIsEqual(self.updateCount, 2);
+    ECTestAssertIntegerIsEqual([[self.lastUpdate objectForKey:ECTwitterCacheUpdatedTweetsKey] count], 1);
+    ECTestAssertIntegerIsEqual([[self.lastUpdate objectForKey:ECTwitterCacheUpdatedUsersKey] count], 0);
+    [changed release];
+}
+
+// --------------------------------------------------------------------------
+/// A tweet's data is only rebuilt when the tweet or its author changes,
+/// and has the author's full data as its user.
+// --------------------------------------------------------------------------
+
+- (void)testTweetData
+{
+    NSDictionary* info = [[ECTwitterFixtures tweetsWithCount:1] objectAtIndex:0];
+    ECTwitterTweet* tweet = [[self.cache addOrRefreshTweets:[NSArray arrayWithObject:info]] objectAtIndex:0];
+
+    NSDictionary* data = tweet.data;
+    ECTestAssertTrue(tweet.data == data);
+    ECTestAssertStringIsEqual([data objectForKey:@"text"], [info objectForKey:@"text"]);
+    ECTestAssertStringIsEqual([[data objectForKey:@"user"] objectForKey:@"screen_name"], [[info objectForKey:@"user"] objectForKey:@"screen_name"]);
+
+    NSMutableDictionary* author = [[info objectForKey:@"user"] mutableCopy];
+    [author setObject:@"renamed" forKey:@"screen_name"];
+    [self.cache addOrRefreshUserWithInfo:author];
+    [author release];
+    ECTestAssertStringIsEqual([[tweet.data objectForKey:@"user"] objectForKey:@"screen_name"], @"renamed");
+
+    data = tweet.data;
+    NSMutableDictionary* changed = [info mutableCopy];
+    [changed setObject:@"something else entirely" forKey:@"text"];
+    [self.cache addOrRefreshTweets:[NSArray arrayWithObject:changed]];
+    [changed release];
+    ECTestAssertFalse(tweet.data == data);
+    ECTestAssertStringIsEqual([tweet.data objectForKey:@"text"], @"something else entirely");
+}
+
+// --------------------------------------------------------------------------
+/// Search the local text index.
+/// The fixture tweets are given known text; their ids go down as they go
+/// along the list, so results (which are newest first) come out in list order.
+// --------------------------------------------------------------------------
+
+- (void)testLocalSearch
+{
+    NSArray* texts = [NSArray arrayWithObjects:@"Morning tea, no coffee today", @"@someone the morning train is late", @"Café au lait in the morning #coffee", nil];
+    NSArray* fixtures = [ECTwitterFixtures tweetsWithCount:[texts count]];
+    NSMutableArray* infos = [NSMutableArray arrayWithCapacity:[texts count]];
+    [fixtures enumerateObjectsUsingBlock:^(id fixture, NSUInteger index, BOOL *stop) {
+        NSMutableDictionary* info = [fixture mutableCopy];
+        [info setObject:[texts objectAtIndex:index] forKey:@"text"];
+        [infos addObject:info];
+        [info release];
+    }];
+    [self.cache addOrRefreshTweets:infos];
+
+    NSString* tea = [[infos objectAtIndex:0] objectForKey:@"id_str"];
+    NSString* train = [[infos objectAtIndex:1] objectForKey:@"id_str"];
+    NSString* cafe = [[infos objectAtIndex:2] objectForKey:@"id_str"];
+    NSString* (^search)(NSString*) = ^(NSString* query) {
+        return [[[self.cache tweetIDsMatchingSearch:query] valueForKey:@"string"] componentsJoinedByString:@","];
+    };
+    NSString* (^ids)(NSArray*) = ^(NSArray* list) {
+        return [list componentsJoinedByString:@","];
+    };
+
+    ECTestAssertStringIsEqual(search(@"MORNING"), ids([NSArray arrayWithObjects:tea, train, cafe, nil]));
+    ECTestAssertStringIsEqual(search(@"cafe"), cafe);
+    ECTestAssertStringIsEqual(search(@"morning coffee"), ids([NSArray arrayWithObjects:tea, cafe, nil]));
+    ECTestAssertStringIsEqual(search(@"\"morning tea\""), tea);
+    ECTestAssertStringIsEqual(search(@"\"tea morning\""), @"");
+    ECTestAssertStringIsEqual(search(@"tea OR train"), ids([NSArray arrayWithObjects:tea, train, nil]));
+    ECTestAssertStringIsEqual(search(@"morning -coffee"), train);
+    ECTestAssertStringIsEqual(search(@"#coffee"), ids([NSArray arrayWithObjects:tea, cafe, nil]));
+}
+
+// --------------------------------------------------------------------------
+/// The hashtag index is saved a change at a time, and now and then all in
+/// one go; either way, a new cache reading the same folder finds the same
+/// tweets for each tag, including ones that have moved between tags.
+// --------------------------------------------------------------------------
+
+- (void)testEntityIndexSaved
+{
+    static const NSUInteger kSaves = 100;
+
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:kSaves];
+    @autoreleasepool
+    {
+        for (NSUInteger n = 0; n < kSaves; ++n)
+        {
+            NSMutableDictionary* info = [infos objectAtIndex:n];
+            NSArray* tags = [NSArray arrayWithObjects:[NSDictionary dictionaryWithObject:@"common" forKey:@"text"], [NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"tag%ld", (long) n] forKey:@"text"], nil];
+            [info setObject:[NSDictionary dictionaryWithObject:tags forKey:@"hashtags"] forKey:@"entities"];
+            [self.cache addOrRefreshTweets:[NSArray arrayWithObject:info]];
+            [self.cache save];
+        }
+
+        NSMutableDictionary* moved = [[[infos objectAtIndex:0] mutableCopy] autorelease];
+        NSArray* tags = [NSArray arrayWithObject:[NSDictionary dictionaryWithObject:@"other" forKey:@"text"]];
+        [moved setObject:[NSDictionary dictionaryWithObject:tags forKey:@"hashtags"] forKey:@"entities"];
+        [self.cache addOrRefreshTweets:[NSArray arrayWithObject:moved]];
+        [self.cache save];
+
+        [[NSNotificationCenter defaultCenter] removeObserver:self];
+        self.cache = nil;
+    }
+
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+    cache.cacheFolder = self.folder;
+    [cache load];
+
+    ECTwitterID* movedID = [ECTwitterID idFromDictionary:[infos objectAtIndex:0]];
+    ECTestAssertIntegerIsEqual([[cache tweetIDsWithHashtag:@"common"] count], kSaves - 1);
+    ECTestAssertFalse([[cache tweetIDsWithHashtag:@"common"] containsObject:movedID]);
+    ECTestAssertIntegerIsEqual([[cache tweetIDsWithHashtag:@"tag0"] count], 0);
+    ECTestAssertTrue([[cache tweetIDsWithHashtag:@"other"] containsObject:movedID]);
+    ECTestAssertIntegerIsEqual([[cache tweetIDsWithHashtag:[NSString stringWithFormat:@"tag%ld", (long) (kSaves - 1)]] count], 1);
+
+    [cache release];
+}
+
+// --------------------------------------------------------------------------
+/// Hammer the cache from lots of threads at once.
+/// Half the threads keep refreshing a set of tweets and their authors, whilst
+/// the other half look up the same ids and read their data back. Every thread
+/// has to end up with the same instance for each id, and every read has to see
+/// a whole version of the data, rather than a mixture of two.
+// --------------------------------------------------------------------------
+
+- (void)testConcurrentAccess
+{
+    static const NSUInteger kTweetCount = 500;
+    static const NSUInteger kUserCount = 50;
+    static const NSUInteger kThreadCount = 8;
+    static const NSUInteger kPasses = 10;
+
+    ECTwitterCache* cache = self.cache;
+    cache.maxTweets = 0;
+    cache.maxTweetBytes = 0;
+    cache.maxUsers = 0;
+
+    NSMutableArray* tweetIDs = [NSMutableArray arrayWithCapacity:kTweetCount];
+    for (NSUInteger n = 0; n < kTweetCount; ++n)
+    {
+        [tweetIDs addObject:[ECTwitterID idFromString:[NSString stringWithFormat:@"%ld", (long) (50000 + n)]]];
+    }
+    NSMutableArray* userIDs = [NSMutableArray arrayWithCapacity:kUserCount];
+    for (NSUInteger n = 0; n < kUserCount; ++n)
+    {
+        [userIDs addObject:[ECTwitterID idFromString:[NSString stringWithFormat:@"%ld", (long) (900 + n)]]];
+    }
+
+    // what each thread saw for each id on its last pass
+    id* seenTweets = calloc(kThreadCount * kTweetCount, sizeof(id));
+    id* seenUsers = calloc(kThreadCount * kTweetCount, sizeof(id));
+    NSUInteger* torn = calloc(kThreadCount, sizeof(NSUInteger));
+
+    dispatch_apply(kThreadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+        for (NSUInteger pass = 0; pass < kPasses; ++pass)
+        {
+            @autoreleasepool
+            {
+                for (NSUInteger n = 0; n < kTweetCount; ++n)
+                {
+                    // each thread goes round the ids from a different starting point
+                    NSUInteger index = (n + thread * (kTweetCount / kThreadCount)) % kTweetCount;
+                    NSUInteger slot = (thread * kTweetCount) + index;
+                    ECTwitterID* tweetID = [tweetIDs objectAtIndex:index];
+                    ECTwitterID* userID = [userIDs objectAtIndex:index % kUserCount];
+                    NSString* screenName = [NSString stringWithFormat:@"user%@", userID.string];
+                    if ((thread & 1) == 0)
+                    {
+                        NSDictionary* author = [NSDictionary dictionaryWithObjectsAndKeys:userID.string, @"id_str", screenName, @"screen_name", @"Test User", @"name", nil];
+                        NSString* text = [NSString stringWithFormat:@"tweet %@ from thread %ld pass %ld", tweetID.string, (long) thread, (long) pass];
+                        NSDictionary* info = [NSDictionary dictionaryWithObjectsAndKeys:tweetID.string, @"id_str", text, @"text", author, @"user", nil];
+                        seenTweets[slot] = [cache addOrRefreshTweetWithInfo:info];
+                        seenUsers[slot] = [cache existingUserWithID:userID];
+                    }
+                    else
+                    {
+                        ECTwitterTweet* tweet = (pass & 1) ? [cache existingTweetWithID:tweetID] : nil;
+                        if (!tweet)
+                        {
+                            tweet = [cache tweetWithID:tweetID];
+                        }
+                        ECTwitterUser* user = [cache userWithID:userID requestIfMissing:NO];
+                        seenTweets[slot] = tweet;
+                        seenUsers[slot] = user;
+
+                        NSDictionary* tweetData = tweet.data;
+                        if (tweetData && !([[tweetData objectForKey:@"id_str"] isEqualToString:tweetID.string] && [[tweetData objectForKey:@"text"] hasPrefix:[NSString stringWithFormat:@"tweet %@ ", tweetID.string]]))
+                        {
+                            ++torn[thread];
+                        }
+
+                        NSDictionary* userData = user.data;
+                        if (userData && [userData objectForKey:@"name"] && ![[userData objectForKey:@"screen_name"] isEqualToString:screenName])
+                        {
+                            ++torn[thread];
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    NSUInteger duplicates = 0;
+    NSUInteger tornReads = 0;
+    for (NSUInteger thread = 0; thread < kThreadCount; ++thread)
+    {
+        tornReads += torn[thread];
+        for (NSUInteger index = 0; index < kTweetCount; ++index)
+        {
+            ECTwitterID* tweetID = [tweetIDs objectAtIndex:index];
+            ECTwitterID* userID = [userIDs objectAtIndex:index % kUserCount];
+            NSUInteger slot = (thread * kTweetCount) + index;
+            if ((seenTweets[slot] != [cache existingTweetWithID:tweetID]) || (seenUsers[slot] != [cache existingUserWithID:userID]))
+            {
+                ++duplicates;
+            }
+        }
+    }
+
+    ECTestAssertIntegerIsEqual(duplicates, 0);
+    ECTestAssertIntegerIsEqual(tornReads, 0);
+    ECTestAssertIntegerIsEqual(cache.tweetCount, kTweetCount);
+    ECTestAssertIntegerIsEqual(cache.userCount, kUserCount);
+    for (ECTwitterID* tweetID in tweetIDs)
+    {
+        ECTestAssertTrue([[cache existingTweetWithID:tweetID] gotData]);
+    }
+
+    free(seenTweets);
+    free(seenUsers);
+    free(torn);
+}
+
+@end
@@ -0,0 +1,228 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/ECTwitterCacheStore.h>
+
+// --------------------------------------------------------------------------
+/// Tests for the journal that the cache saves tweets and users in.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterCacheStoreTests : ECTestCase
+
+@property (strong, nonatomic) NSURL* folder;
+@property (strong, nonatomic) NSURL* url;
+
+@end
+
+
+@implementation ECTwitterCacheStoreTests
+
+@synthesize folder = _folder;
+@synthesize url = _url;
+
+static const NSUInteger kRecordCount = 300;
+
+- (void)setUp
+{
+    NSString* name = [NSString stringWithFormat:@"ECTwitterCacheStoreTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    self.url = [self.folder URLByAppendingPathComponent:@"journal"];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+    self.url = nil;
+}
+
+#pragma mark - Helpers
+
+// --------------------------------------------------------------------------
+/// Return the ID we use for a record.
+// --------------------------------------------------------------------------
+
+static ECTwitterID* idOf(NSUInteger n)
+{
+    return [ECTwitterID idFromValue:n + 1];
+}
+
+// --------------------------------------------------------------------------
+/// Return the data we write for a version of a record.
+// --------------------------------------------------------------------------
+
+static NSData* dataOf(NSUInteger n, NSUInteger version)
+{
+    return [[NSString stringWithFormat:@"record %ld version %ld", (long) n, (long) version] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+// --------------------------------------------------------------------------
+/// Open the journal.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCacheStore*)open
+{
+    return [[[ECTwitterCacheStore alloc] initWithURL:self.url] autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Write some versions of each record, then close the journal.
+// --------------------------------------------------------------------------
+
+- (void)writeVersions:(NSUInteger)versions
+{
+    @autoreleasepool
+    {
+        ECTwitterCacheStore* store = [self open];
+        for (NSUInteger version = 0; version < versions; ++version)
+        {
+            for (NSUInteger n = 0; n < kRecordCount; ++n)
+            {
+                [store appendRecordOfKind:RecordTweet recordID:idOf(n) data:dataOf(n, version)];
+            }
+        }
+        [store synchronize];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the size of the journal file.
+// --------------------------------------------------------------------------
+
+- (unsigned long long)fileSize
+{
+    return [[[NSFileManager defaultManager] attributesOfItemAtPath:[self.url path] error:nil] fileSize];
+}
+
+// --------------------------------------------------------------------------
+/// Change a byte of the journal file.
+// --------------------------------------------------------------------------
+
+- (void)damageByteAtOffset:(unsigned long long)offset
+{
+    NSFileHandle* file = [NSFileHandle fileHandleForUpdatingURL:self.url error:nil];
+    [file seekToFileOffset:offset];
+    uint8_t byte = ~*(const uint8_t*) [[file readDataOfLength:1] bytes];
+    [file seekToFileOffset:offset];
+    [file writeData:[NSData dataWithBytes:&byte length:1]];
+    [file closeFile];
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// Records written to the journal are there when it's opened again, with
+/// the latest version of each, and without the ones that were removed.
+// --------------------------------------------------------------------------
+
+- (void)testAppend
+{
+    [self writeVersions:2];
+    @autoreleasepool
+    {
+        ECTwitterCacheStore* store = [self open];
+        [store removeRecordOfKind:RecordTweet recordID:idOf(0)];
+        [store appendRecordOfKind:RecordUser recordID:idOf(0) data:dataOf(0, 0)];
+    }
+
+    ECTwitterCacheStore* store = [self open];
+    ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount);
+    ECTestAssertFalse([store containsRecordOfKind:RecordTweet recordID:idOf(0)]);
+    ECTestAssertTrue([[store dataForRecordOfKind:RecordUser recordID:idOf(0)] isEqualToData:dataOf(0, 0)]);
+    for (NSUInteger n = 1; n < kRecordCount; ++n)
+    {
+        ECTestAssertTrue([[store dataForRecordOfKind:RecordTweet recordID:idOf(n)] isEqualToData:dataOf(n, 1)]);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// A record that was only partly written when we stopped is thrown away
+/// when the journal is opened again, and what's written after it is fine.
+// --------------------------------------------------------------------------
+
+- (void)testTornTail
+{
+    [self writeVersions:1];
+    truncate([[self.url path] fileSystemRepresentation], (off_t) ([self fileSize] - 4));
+
+    @autoreleasepool
+    {
+        ECTwitterCacheStore* store = [self open];
+        ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount - 1);
+        ECTestAssertNil([store dataForRecordOfKind:RecordTweet recordID:idOf(kRecordCount - 1)]);
+        [store appendRecordOfKind:RecordTweet recordID:idOf(kRecordCount - 1) data:dataOf(kRecordCount - 1, 1)];
+    }
+
+    ECTwitterCacheStore* store = [self open];
+    ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount);
+    ECTestAssertTrue([[store dataForRecordOfKind:RecordTweet recordID:idOf(kRecordCount - 2)] isEqualToData:dataOf(kRecordCount - 2, 0)]);
+    ECTestAssertTrue([[store dataForRecordOfKind:RecordTweet recordID:idOf(kRecordCount - 1)] isEqualToData:dataOf(kRecordCount - 1, 1)]);
+}
+
+// --------------------------------------------------------------------------
+/// Compacting the journal throws away superseded records, and keeps the
+/// latest version of everything else.
+// --------------------------------------------------------------------------
+
+- (void)testCompaction
+{
+    [self writeVersions:3];
+    unsigned long long size = [self fileSize];
+
+    @autoreleasepool
+    {
+        ECTwitterCacheStore* store = [self open];
+        ECTestAssertIntegerIsEqual(store.staleRecords, kRecordCount * 2);
+        [store compactIfNeeded];
+        [store synchronize];
+        ECTestAssertIntegerIsEqual(store.staleRecords, 0);
+    }
+    ECTestAssertTrue([self fileSize] < size * 2 / 3);
+
+    ECTwitterCacheStore* store = [self open];
+    ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount);
+    ECTestAssertIntegerIsEqual(store.staleRecords, 0);
+    for (NSUInteger n = 0; n < kRecordCount; ++n)
+    {
+        ECTestAssertTrue([[store dataForRecordOfKind:RecordTweet recordID:idOf(n)] isEqualToData:dataOf(n, 2)]);
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Once the index has been saved, opening the journal doesn't read through
+/// the records it covers. A damaged record is only noticed when it's read,
+/// and doesn't take the rest of the journal with it.
+// --------------------------------------------------------------------------
+
+- (void)testSavedIndex
+{
+    [self writeVersions:1];
+    @autoreleasepool
+    {
+        // enough has been written since the last save to save the index again
+        ECTwitterCacheStore* store = [self open];
+        [store compactIfNeeded];
+        [store appendRecordOfKind:RecordUser recordID:idOf(0) data:dataOf(0, 0)];
+    }
+
+    // the first record's payload starts after the file header (16 bytes)
+    // and its own header (24 bytes)
+    [self damageByteAtOffset:40];
+
+    ECTwitterCacheStore* store = [self open];
+    ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount + 1);
+    ECTestAssertNil([store dataForRecordOfKind:RecordTweet recordID:idOf(0)]);
+    ECTestAssertIntegerIsEqual(store.liveRecords, kRecordCount);
+    ECTestAssertTrue([[store dataForRecordOfKind:RecordUser recordID:idOf(0)] isEqualToData:dataOf(0, 0)]);
+    for (NSUInteger n = 1; n < kRecordCount; ++n)
+    {
+        ECTestAssertTrue([[store dataForRecordOfKind:RecordTweet recordID:idOf(n)] isEqualToData:dataOf(n, 0)]);
+    }
+}
+
+@end
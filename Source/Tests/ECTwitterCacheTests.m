@@ -215,5 +215,4 @@
     [[NSNotificationCenter defaultCenter] removeObserver:self];
 }
 
-
-@end
\ No newline at end of file
+@end
@@ -0,0 +1,56 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+// --------------------------------------------------------------------------
+/// Recorded twitter responses, for tests that shouldn't touch the network.
+///
+/// The fixtures in the test bundle are real (if small) responses. Bigger
+/// corpora are made by cloning them, giving each copy its own ID, date,
+/// author and a bit of varied text.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterFixtures : NSObject
+
++ (NSData*)dataForFixture:(NSString*)name;
++ (id)objectForFixture:(NSString*)name;
+
++ (NSArray*)tweetsWithCount:(NSUInteger)count;
++ (NSArray*)usersWithCount:(NSUInteger)count;
++ (NSDictionary*)searchResultsWithCount:(NSUInteger)count;
+
++ (NSData*)dataForObject:(id)object;
+
+@end
+
+// --------------------------------------------------------------------------
+/// Stands in for the twitter servers.
+///
+/// Once installed, any request to the twitter API is answered with the
+/// response registered for its method (eg "statuses/home_timeline"), or
+/// a 404 if there isn't one. Instead of a fixed response, a method can
+/// have a block which makes one from the request's parameters. The response is handed over in chunks, so
+/// that the streaming parser sees it the way it would off the network.
+///
+/// A method can also be set up as a stream, in which case its messages
+/// are sent length-delimited, at the given rate, after which the stream
+/// ends - as if the server had dropped the connection.
+// --------------------------------------------------------------------------
+
+typedef NSData* (^ECTwitterFixtureResponder)(NSDictionary* parameters);
+
+@interface ECTwitterFixtureProtocol : NSURLProtocol
+
++ (void)install;
++ (void)uninstall;
+
++ (void)setResponse:(NSData*)data forMethod:(NSString*)method;
++ (void)setHeaders:(NSDictionary*)headers forMethod:(NSString*)method;
++ (void)setResponder:(ECTwitterFixtureResponder)responder forMethod:(NSString*)method;
++ (void)setStreamMessages:(NSArray*)messages rate:(double)messagesPerSecond forMethod:(NSString*)method;
++ (void)removeAllResponses;
++ (NSUInteger)requestCount;
+
+@end
@@ -0,0 +1,538 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import "ECTwitterFixtures.h"
+
+#include <time.h>
+
+@implementation ECTwitterFixtures
+
+// the newest generated tweet matches the newest recorded one; the rest go back from there
+static const unsigned long long kBaseTweetID = 240859602684612608ULL;
+static const unsigned long long kBaseUserID = 100000ULL;
+static const time_t kBaseTime = 1346260378;
+
+static const NSUInteger kTweetsPerUser = 8;
+
+static NSString* const kWords[] =
+{
+    @"morning", @"coffee", @"release", @"build", @"tests", @"weekend", @"train", @"bug",
+    @"conference", @"lunch", @"deploy", @"rain", @"music", @"review", @"edinburgh", @"café",
+};
+
+static const NSUInteger kWordCount = sizeof(kWords) / sizeof(kWords[0]);
+
+// --------------------------------------------------------------------------
+/// Format a time the way twitter does.
+// --------------------------------------------------------------------------
+
+static NSString* dateString(time_t time, const char* format)
+{
+    struct tm parts;
+    gmtime_r(&time, &parts);
+
+    char buffer[64];
+    strftime(buffer, sizeof(buffer), format, &parts);
+
+    return [NSString stringWithUTF8String:buffer];
+}
+
+// --------------------------------------------------------------------------
+/// Return the raw data for a recorded response.
+// --------------------------------------------------------------------------
+
++ (NSData*)dataForFixture:(NSString*)name
+{
+    NSURL* url = [[NSBundle bundleForClass:self] URLForResource:name withExtension:@"json"];
+    NSData* data = [NSData dataWithContentsOfURL:url];
+    NSAssert(data != nil, @"missing fixture %@", name);
+
+    return data;
+}
+
+// --------------------------------------------------------------------------
+/// Return a recorded response, decoded into mutable arrays and dictionaries.
+// --------------------------------------------------------------------------
+
++ (id)objectForFixture:(NSString*)name
+{
+    NSError* error = nil;
+    id result = [NSJSONSerialization JSONObjectWithData:[self dataForFixture:name] options:NSJSONReadingMutableContainers error:&error];
+    NSAssert(result != nil, @"couldn't decode fixture %@: %@", name, error);
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return some text for generated item n, so that the corpus has a spread
+/// of vocabulary rather than the same few sentences over and over.
+// --------------------------------------------------------------------------
+
++ (NSString*)textForItem:(NSUInteger)n base:(NSString*)base
+{
+    NSString* word1 = kWords[(n * 7) % kWordCount];
+    NSString* word2 = kWords[(n * 13 + 3) % kWordCount];
+
+    return [NSString stringWithFormat:@"%@ %@ %@ %ld", base, word1, word2, (long) n];
+}
+
+// --------------------------------------------------------------------------
+/// Return a user for generated item n, based on one of the recorded users.
+// --------------------------------------------------------------------------
+
++ (NSMutableDictionary*)userForItem:(NSUInteger)n template:(NSDictionary*)template
+{
+    NSMutableDictionary* user = [[template mutableCopy] autorelease];
+    unsigned long long userID = kBaseUserID + n;
+    [user setObject:[NSNumber numberWithUnsignedLongLong:userID] forKey:@"id"];
+    [user setObject:[NSString stringWithFormat:@"%llu", userID] forKey:@"id_str"];
+    [user setObject:[NSString stringWithFormat:@"fixture%ld", (long) n] forKey:@"screen_name"];
+    [user setObject:[NSString stringWithFormat:@"Fixture User %ld", (long) n] forKey:@"name"];
+    [user removeObjectForKey:@"status"];
+
+    return user;
+}
+
+// --------------------------------------------------------------------------
+/// Return a timeline of the given number of tweets, newest first.
+/// There's a new author for every few tweets.
+// --------------------------------------------------------------------------
+
++ (NSArray*)tweetsWithCount:(NSUInteger)count
+{
+    NSArray* templates = [self objectForFixture:@"timeline"];
+    NSUInteger templateCount = [templates count];
+    NSUInteger userCount = MAX(count / kTweetsPerUser, (NSUInteger) 1);
+
+    NSMutableArray* users = [NSMutableArray arrayWithCapacity:userCount];
+    for (NSUInteger n = 0; n < userCount; ++n)
+    {
+        NSDictionary* template = [[templates objectAtIndex:n % templateCount] objectForKey:@"user"];
+        [users addObject:[self userForItem:n template:template]];
+    }
+
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        NSDictionary* template = [templates objectAtIndex:n % templateCount];
+        NSMutableDictionary* tweet = [template mutableCopy];
+        unsigned long long tweetID = kBaseTweetID - (n * 4096);
+        [tweet setObject:[NSNumber numberWithUnsignedLongLong:tweetID] forKey:@"id"];
+        [tweet setObject:[NSString stringWithFormat:@"%llu", tweetID] forKey:@"id_str"];
+        [tweet setObject:dateString(kBaseTime - (time_t) (n * 60), "%a %b %d %H:%M:%S +0000 %Y") forKey:@"created_at"];
+        [tweet setObject:[self textForItem:n base:[template objectForKey:@"text"]] forKey:@"text"];
+        [tweet setObject:[users objectAtIndex:n % userCount] forKey:@"user"];
+        [result addObject:tweet];
+        [tweet release];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return a list of the given number of users.
+// --------------------------------------------------------------------------
+
++ (NSArray*)usersWithCount:(NSUInteger)count
+{
+    NSArray* templates = [self objectForFixture:@"users"];
+    NSUInteger templateCount = [templates count];
+
+    NSMutableArray* result = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        [result addObject:[self userForItem:n template:[templates objectAtIndex:n % templateCount]]];
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return a page of search results with the given number of tweets in it.
+// --------------------------------------------------------------------------
+
++ (NSDictionary*)searchResultsWithCount:(NSUInteger)count
+{
+    NSMutableDictionary* search = [self objectForFixture:@"search"];
+    NSArray* templates = [search objectForKey:@"results"];
+    NSUInteger templateCount = [templates count];
+
+    NSMutableArray* results = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        NSDictionary* template = [templates objectAtIndex:n % templateCount];
+        NSMutableDictionary* tweet = [template mutableCopy];
+        unsigned long long tweetID = kBaseTweetID - (n * 4096);
+        unsigned long long userID = kBaseUserID + (n / kTweetsPerUser);
+        [tweet setObject:[NSNumber numberWithUnsignedLongLong:tweetID] forKey:@"id"];
+        [tweet setObject:[NSString stringWithFormat:@"%llu", tweetID] forKey:@"id_str"];
+        [tweet setObject:[NSString stringWithFormat:@"%llu", userID] forKey:@"from_user_id_str"];
+        [tweet setObject:[NSString stringWithFormat:@"fixture%llu", userID - kBaseUserID] forKey:@"from_user"];
+        [tweet setObject:dateString(kBaseTime - (time_t) (n * 60), "%a, %d %b %Y %H:%M:%S +0000") forKey:@"created_at"];
+        [tweet setObject:[self textForItem:n base:[template objectForKey:@"text"]] forKey:@"text"];
+        [results addObject:tweet];
+        [tweet release];
+    }
+
+    [search setObject:results forKey:@"results"];
+    if (count > 0)
+    {
+        [search setObject:[[results objectAtIndex:0] objectForKey:@"id_str"] forKey:@"max_id_str"];
+    }
+
+    return search;
+}
+
+// --------------------------------------------------------------------------
+/// Encode generated fixtures, ready to be served or parsed.
+// --------------------------------------------------------------------------
+
++ (NSData*)dataForObject:(id)object
+{
+    NSError* error = nil;
+    NSData* result = [NSJSONSerialization dataWithJSONObject:object options:0 error:&error];
+    NSAssert(result != nil, @"couldn't encode fixture: %@", error);
+
+    return result;
+}
+
+@end
+
+@interface ECTwitterFixtureProtocol()
+
+@property (strong, nonatomic) NSArray* frames;
+@property (strong, nonatomic) NSTimer* timer;
+@property (assign, nonatomic) NSTimeInterval started;
+@property (assign, nonatomic) double rate;
+@property (assign, nonatomic) NSUInteger sent;
+
+- (void)startStream:(NSDictionary*)stream;
+- (void)sendFrames;
+
+@end
+
+@implementation ECTwitterFixtureProtocol
+
+@synthesize frames = _frames;
+@synthesize rate = _rate;
+@synthesize sent = _sent;
+@synthesize started = _started;
+@synthesize timer = _timer;
+
+static NSMutableDictionary* gResponses = nil;
+static NSMutableDictionary* gStreams = nil;
+static NSMutableDictionary* gHeaders = nil;
+static NSMutableDictionary* gResponders = nil;
+static NSUInteger gRequestCount = 0;
+
+static const NSUInteger kChunkSize = 16384;
+static const NSTimeInterval kStreamTick = 0.01;
+
+static NSString *const kFramesKey = @"frames";
+static NSString *const kRateKey = @"rate";
+
+// --------------------------------------------------------------------------
+/// Start answering requests to twitter.
+// --------------------------------------------------------------------------
+
++ (void)install
+{
+    @synchronized(self)
+    {
+        if (!gResponses)
+        {
+            gResponses = [[NSMutableDictionary alloc] init];
+            gStreams = [[NSMutableDictionary alloc] init];
+            gHeaders = [[NSMutableDictionary alloc] init];
+            gResponders = [[NSMutableDictionary alloc] init];
+        }
+        gRequestCount = 0;
+    }
+
+    [NSURLProtocol registerClass:self];
+}
+
+// --------------------------------------------------------------------------
+/// Stop answering requests, and forget all the responses.
+// --------------------------------------------------------------------------
+
++ (void)uninstall
+{
+    [NSURLProtocol unregisterClass:self];
+    [self removeAllResponses];
+}
+
++ (void)setResponse:(NSData*)data forMethod:(NSString*)method
+{
+    @synchronized(self)
+    {
+        [gResponses setObject:data forKey:method];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Send some extra headers with the response to a method
+/// (eg rate limits, or validators).
+// --------------------------------------------------------------------------
+
++ (void)setHeaders:(NSDictionary*)headers forMethod:(NSString*)method
+{
+    @synchronized(self)
+    {
+        [gHeaders setObject:headers forKey:method];
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Answer a method with whatever a block makes from the parameters
+/// of each request, so that paging can be faked.
+/// The block is called on the loading thread.
+// --------------------------------------------------------------------------
+
++ (void)setResponder:(ECTwitterFixtureResponder)responder forMethod:(NSString*)method
+{
+    ECTwitterFixtureResponder copied = [responder copy];
+    @synchronized(self)
+    {
+        [gResponders setObject:copied forKey:method];
+    }
+    [copied release];
+}
+
+// --------------------------------------------------------------------------
+/// Serve a method as a stream of messages.
+/// Each message is encoded up front, with the length line twitter puts in
+/// front of it when asked for delimited=length.
+// --------------------------------------------------------------------------
+
++ (void)setStreamMessages:(NSArray*)messages rate:(double)messagesPerSecond forMethod:(NSString*)method
+{
+    NSMutableArray* frames = [NSMutableArray arrayWithCapacity:[messages count]];
+    for (id message in messages)
+    {
+        NSData* json = [ECTwitterFixtures dataForObject:message];
+        NSMutableData* frame = [NSMutableData dataWithCapacity:[json length] + 16];
+        [frame appendData:[[NSString stringWithFormat:@"%ld\r\n", (long) [json length] + 2] dataUsingEncoding:NSUTF8StringEncoding]];
+        [frame appendData:json];
+        [frame appendBytes:"\r\n" length:2];
+        [frames addObject:frame];
+    }
+
+    NSDictionary* stream = [NSDictionary dictionaryWithObjectsAndKeys:frames, kFramesKey, [NSNumber numberWithDouble:messagesPerSecond], kRateKey, nil];
+    @synchronized(self)
+    {
+        [gStreams setObject:stream forKey:method];
+    }
+}
+
++ (void)removeAllResponses
+{
+    @synchronized(self)
+    {
+        [gResponses removeAllObjects];
+        [gStreams removeAllObjects];
+        [gHeaders removeAllObjects];
+        [gResponders removeAllObjects];
+    }
+}
+
++ (NSUInteger)requestCount
+{
+    @synchronized(self)
+    {
+        return gRequestCount;
+    }
+}
+
+// --------------------------------------------------------------------------
+/// Return the parameters in the query string of a URL.
+// --------------------------------------------------------------------------
+
++ (NSDictionary*)parametersForURL:(NSURL*)url
+{
+    NSMutableDictionary* result = [NSMutableDictionary dictionary];
+    for (NSString* pair in [[url query] componentsSeparatedByString:@"&"])
+    {
+        NSRange equals = [pair rangeOfString:@"="];
+        if (equals.location != NSNotFound)
+        {
+            NSString* key = [[pair substringToIndex:equals.location] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+            NSString* value = [[pair substringFromIndex:equals.location + 1] stringByReplacingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+            [result setObject:value forKey:key];
+        }
+    }
+
+    return result;
+}
+
+// --------------------------------------------------------------------------
+/// Return the twitter method that a URL is calling.
+/// eg https://api.twitter.com/1/statuses/home_timeline.json is "statuses/home_timeline",
+/// and https://userstream.twitter.com/2/user.json is "user".
+// --------------------------------------------------------------------------
+
++ (NSString*)methodForURL:(NSURL*)url
+{
+    NSString* path = [[url path] stringByDeletingPathExtension];
+    if ([path hasPrefix:@"/"])
+    {
+        path = [path substringFromIndex:1];
+    }
+
+    // skip the API version, if there is one
+    NSRange slash = [path rangeOfString:@"/"];
+    if ((slash.location != NSNotFound) && ([[path substringToIndex:slash.location] rangeOfCharacterFromSet:[[NSCharacterSet decimalDigitCharacterSet] invertedSet]].location == NSNotFound))
+    {
+        path = [path substringFromIndex:slash.location + 1];
+    }
+
+    return path;
+}
+
+#pragma mark - NSURLProtocol
+
+// --------------------------------------------------------------------------
+/// We take every request to twitter, whether or not we've got a response
+/// for it - nothing should get through to the real servers.
+// --------------------------------------------------------------------------
+
++ (BOOL)canInitWithRequest:(NSURLRequest*)request
+{
+    return [[[request URL] host] hasSuffix:@"twitter.com"];
+}
+
++ (NSURLRequest*)canonicalRequestForRequest:(NSURLRequest*)request
+{
+    return request;
+}
+
+- (void)dealloc
+{
+    [_frames release];
+    [_timer release];
+
+    [super dealloc];
+}
+
+- (void)startLoading
+{
+    NSURL* url = [[self request] URL];
+    NSString* method = [ECTwitterFixtureProtocol methodForURL:url];
+
+    NSData* data;
+    NSDictionary* stream;
+    NSDictionary* extra;
+    ECTwitterFixtureResponder responder;
+    @synchronized([ECTwitterFixtureProtocol class])
+    {
+        responder = [[gResponders objectForKey:method] retain];
+        data = [[gResponses objectForKey:method] retain];
+        stream = [[gStreams objectForKey:method] retain];
+        extra = [[gHeaders objectForKey:method] retain];
+        ++gRequestCount;
+    }
+
+    if (stream)
+    {
+        [self startStream:stream];
+        [stream release];
+        [responder release];
+        return;
+    }
+
+    if (responder)
+    {
+        [data release];
+        data = [responder([ECTwitterFixtureProtocol parametersForURL:url]) retain];
+        [responder release];
+    }
+
+    NSInteger status = data ? 200 : 404;
+    NSMutableDictionary* headers = [NSMutableDictionary dictionaryWithObjectsAndKeys:@"application/json; charset=utf-8", @"Content-Type", [NSString stringWithFormat:@"%ld", (long) [data length]], @"Content-Length", nil];
+    if (extra)
+    {
+        [headers addEntriesFromDictionary:extra];
+        [extra release];
+    }
+    NSHTTPURLResponse* response = [[NSHTTPURLResponse alloc] initWithURL:url statusCode:status HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    id<NSURLProtocolClient> client = [self client];
+    [client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [response release];
+
+    NSUInteger length = [data length];
+    for (NSUInteger offset = 0; offset < length; offset += kChunkSize)
+    {
+        NSData* chunk = [data subdataWithRange:NSMakeRange(offset, MIN(kChunkSize, length - offset))];
+        [client URLProtocol:self didLoadData:chunk];
+    }
+    [client URLProtocolDidFinishLoading:self];
+
+    [data release];
+}
+
+- (void)stopLoading
+{
+    [self.timer invalidate];
+    self.timer = nil;
+}
+
+#pragma mark - Streaming
+
+// --------------------------------------------------------------------------
+/// Start sending a stream.
+/// We send a keep-alive straight away, like twitter does, then the
+/// messages are sent from a timer on the loading thread.
+// --------------------------------------------------------------------------
+
+- (void)startStream:(NSDictionary*)stream
+{
+    self.frames = [stream objectForKey:kFramesKey];
+    self.rate = [[stream objectForKey:kRateKey] doubleValue];
+    self.started = [NSDate timeIntervalSinceReferenceDate];
+
+    NSDictionary* headers = [NSDictionary dictionaryWithObject:@"application/json; charset=utf-8" forKey:@"Content-Type"];
+    NSHTTPURLResponse* response = [[NSHTTPURLResponse alloc] initWithURL:[[self request] URL] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:headers];
+    id<NSURLProtocolClient> client = [self client];
+    [client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [response release];
+    [client URLProtocol:self didLoadData:[NSData dataWithBytes:"\r\n" length:2]];
+
+    self.timer = [NSTimer scheduledTimerWithTimeInterval:kStreamTick target:self selector:@selector(sendFrames) userInfo:nil repeats:YES];
+}
+
+// --------------------------------------------------------------------------
+/// Send every message that's due by now, in a single chunk.
+/// Working from the elapsed time rather than the number of ticks keeps the
+/// rate right even when it's faster than the timer.
+// --------------------------------------------------------------------------
+
+- (void)sendFrames
+{
+    NSUInteger count = [self.frames count];
+    NSTimeInterval elapsed = [NSDate timeIntervalSinceReferenceDate] - self.started;
+    NSUInteger due = (self.rate > 0.0) ? MIN((NSUInteger) (elapsed * self.rate), count) : count;
+
+    id<NSURLProtocolClient> client = [self client];
+    if (due > self.sent)
+    {
+        NSMutableData* chunk = [NSMutableData data];
+        for (NSUInteger n = self.sent; n < due; ++n)
+        {
+            [chunk appendData:[self.frames objectAtIndex:n]];
+        }
+        self.sent = due;
+        [client URLProtocol:self didLoadData:chunk];
+    }
+
+    if (self.sent == count)
+    {
+        [self.timer invalidate];
+        self.timer = nil;
+        [client URLProtocolDidFinishLoading:self];
+    }
+}
+
+@end
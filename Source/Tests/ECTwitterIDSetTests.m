@@ -0,0 +1,80 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+@interface ECTwitterIDSetTests : ECTestCase
+
+@end
+
+
+@implementation ECTwitterIDSetTests
+
+- (NSString*)stringForSet:(ECTwitterIDSet*)set
+{
+    return [[[set idsInRange:NSMakeRange(0, set.count)] valueForKey:@"string"] componentsJoinedByString:@","];
+}
+
+- (ECTwitterIDSet*)setWithString:(NSString*)string
+{
+    return [ECTwitterIDSet setWithIDs:[string length] ? [string componentsSeparatedByString:@","] : [NSArray array]];
+}
+
+- (void)testCreation
+{
+    uint64_t values[] = { 30, 10, 20, 10, 18446744073709551615ULL };
+    ECTwitterIDSet* set = [ECTwitterIDSet setWithValues:values count:5];
+    ECTestAssertIntegerIsEqual(set.count, 4);
+    ECTestAssertStringIsEqual([self stringForSet:set], @"10,20,30,18446744073709551615");
+
+    NSArray* mixed = [NSArray arrayWithObjects:[ECTwitterID idFromString:@"5"], [NSNumber numberWithInt:3], @"4", nil];
+    ECTestAssertStringIsEqual([self stringForSet:[ECTwitterIDSet setWithIDs:mixed]], @"3,4,5");
+
+    ECTestAssertTrue([set containsValue:20]);
+    ECTestAssertFalse([set containsValue:21]);
+    ECTestAssertTrue([set containsID:[ECTwitterID idFromString:@"30"]]);
+    ECTestAssertIntegerIsEqual([ECTwitterIDSet set].count, 0);
+}
+
+- (void)testOperations
+{
+    ECTwitterIDSet* friends = [self setWithString:@"1,2,3,5,8,13"];
+    ECTwitterIDSet* followers = [self setWithString:@"2,3,4,5,6,7,8"];
+
+    ECTestAssertStringIsEqual([self stringForSet:[followers setByIntersectingSet:friends]], @"2,3,5,8");
+    ECTestAssertStringIsEqual([self stringForSet:[followers setBySubtractingSet:friends]], @"4,6,7");
+    ECTestAssertStringIsEqual([self stringForSet:[friends setBySubtractingSet:followers]], @"1,13");
+    ECTestAssertStringIsEqual([self stringForSet:[friends setByUnioningSet:followers]], @"1,2,3,4,5,6,7,8,13");
+    ECTestAssertStringIsEqual([self stringForSet:[friends setByIntersectingSet:[ECTwitterIDSet set]]], @"");
+    ECTestAssertStringIsEqual([self stringForSet:[friends setByUnioningSet:[ECTwitterIDSet set]]], @"1,2,3,5,8,13");
+}
+
+- (void)testSkewedIntersection
+{
+    NSUInteger count = 100000;
+    uint64_t* values = malloc(count * sizeof(uint64_t));
+    for (NSUInteger n = 0; n < count; ++n)
+    {
+        values[n] = n * 3;
+    }
+    ECTwitterIDSet* big = [ECTwitterIDSet setWithValues:values count:count];
+    free(values);
+
+    ECTwitterIDSet* small = [self setWithString:@"0,1,2,3,299997,299998,300000"];
+    ECTestAssertStringIsEqual([self stringForSet:[small setByIntersectingSet:big]], @"0,3,299997");
+    ECTestAssertStringIsEqual([self stringForSet:[big setByIntersectingSet:small]], @"0,3,299997");
+}
+
+- (void)testArchiving
+{
+    ECTwitterIDSet* set = [self setWithString:@"7,11,13"];
+    NSData* data = [NSKeyedArchiver archivedDataWithRootObject:set];
+    ECTwitterIDSet* decoded = [NSKeyedUnarchiver unarchiveObjectWithData:data];
+    ECTestAssertTrue([decoded isEqualToSet:set]);
+}
+
+@end
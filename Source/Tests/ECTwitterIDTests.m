@@ -0,0 +1,84 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+@interface ECTwitterIDTests : ECTestCase
+
+@end
+
+
+@implementation ECTwitterIDTests
+
+- (void)testStrings
+{
+    ECTestAssertIntegerIsEqual([ECTwitterID idFromString:@"0"].value, 0);
+    ECTestAssertIntegerIsEqual([ECTwitterID idFromString:@"1234567890"].value, 1234567890);
+    ECTestAssertTrue([ECTwitterID idFromString:@"18446744073709551615"].value == UINT64_MAX);
+    ECTestAssertStringIsEqual([ECTwitterID idFromString:@"00042"].string, @"42");
+
+    ECTestAssertNil([ECTwitterID idFromString:@""]);
+    ECTestAssertNil([ECTwitterID idFromString:@"18446744073709551616"]);
+    ECTestAssertNil([ECTwitterID idFromString:@"99999999999999999999"]);
+    ECTestAssertNil([ECTwitterID idFromString:@"123456789012345678901"]);
+    ECTestAssertNil([ECTwitterID idFromString:@"12a4"]);
+    ECTestAssertNil([ECTwitterID idFromString:@"-1"]);
+
+    NSDictionary* info = [NSDictionary dictionaryWithObject:@"not an id" forKey:@"id_str"];
+    ECTestAssertNil([ECTwitterID idFromDictionary:info]);
+}
+
+- (void)testInterning
+{
+    ECTwitterID* id1 = [ECTwitterID idFromString:@"61523"];
+    ECTwitterID* id2 = [ECTwitterID idFromValue:61523];
+    ECTestAssertTrue(id1 == id2);
+    ECTwitterID* copied = [id1 copy];
+    ECTestAssertTrue(copied == id1);
+    [copied release];
+
+    NSData* data = [NSKeyedArchiver archivedDataWithRootObject:id1];
+    ECTestAssertTrue([NSKeyedUnarchiver unarchiveObjectWithData:data] == id1);
+}
+
+// --------------------------------------------------------------------------
+/// IDs nobody holds are let go when purged; ones still in use are kept,
+/// and stay the only instance for their value.
+// --------------------------------------------------------------------------
+
+- (void)testPurging
+{
+    static const uint64_t kBase = 0xEC00000000000000ULL;
+    static const NSUInteger kCount = 10000;
+
+    ECTwitterID* kept = [[ECTwitterID idFromValue:kBase] retain];
+    @autoreleasepool
+    {
+        // the pool holds on to these, so the table can't let them go yet
+        for (NSUInteger n = 1; n < kCount; ++n)
+        {
+            [ECTwitterID idFromValue:kBase + n];
+        }
+    }
+
+    ECTestAssertTrue([ECTwitterID purgeUnusedIDs] >= kCount - 1);
+    ECTestAssertTrue([ECTwitterID idFromValue:kBase] == kept);
+    ECTestAssertIntegerIsEqual([ECTwitterID idFromValue:kBase + 1].value, kBase + 1);
+    [kept release];
+}
+
+- (void)testCompare
+{
+    ECTwitterID* small = [ECTwitterID idFromValue:10];
+    ECTwitterID* big = [ECTwitterID idFromValue:20];
+    ECTestAssertIntegerIsEqual([small compare:big], NSOrderedAscending);
+    ECTestAssertIntegerIsEqual([big compare:small], NSOrderedDescending);
+    ECTestAssertIntegerIsEqual([small compare:small], NSOrderedSame);
+    ECTestAssertIntegerIsEqual([small compare:nil], NSOrderedDescending);
+}
+
+@end
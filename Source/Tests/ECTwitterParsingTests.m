@@ -0,0 +1,45 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's 
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+@interface ECTwitterParsingTests : ECTestCase
+
+@end
+
+
+@implementation ECTwitterParsingTests
+
+- (NSString*)decode:(NSString*)string
+{
+    const char* bytes = [string UTF8String];
+    return ECTwitterStringWithEntitiesDecoded((const unsigned char*) bytes, strlen(bytes));
+}
+
+- (void)testEntityDecoding
+{
+    ECTestAssertStringIsEqual([self decode:@"plain text"], @"plain text");
+    ECTestAssertStringIsEqual([self decode:@"a &gt; b &lt; c"], @"a > b < c");
+    ECTestAssertStringIsEqual([self decode:@"fish &AMP; chips"], @"fish & chips");
+    ECTestAssertStringIsEqual([self decode:@"&quot;quoted&quot;"], @"\"quoted\"");
+    ECTestAssertStringIsEqual([self decode:@"AT&T & co &amp"], @"AT&T & co &amp");
+    ECTestAssertStringIsEqual([self decode:@"café &amp; crème"], @"café & crème");
+    ECTestAssertStringIsEqual([self decode:@""], @"");
+}
+
+- (void)testDates
+{
+    NSString* rest = @"Thu Jan 15 02:04:38 +0000 2009";
+    NSString* search = @"Fri, 06 Feb 2009 07:28:06 +0000";
+
+    ECTestAssertTrue(ECTwitterTimeFromString(rest) == 1231985078.0);
+    ECTestAssertTrue(ECTwitterTimeFromString(search) == 1233905286.0);
+    ECTestAssertTrue(ECTwitterTimeFromString(@"Mon Feb 29 23:59:59 +0100 2016") == 1456786799.0);
+    ECTestAssertTrue(ECTwitterTimeFromString(@"not a date") == 0.0);
+}
+
+@end
@@ -0,0 +1,181 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/MGTwitterEngine.h>
+#import <ECTwitter/ECTwitterResponseCache.h>
+
+#import "ECTwitterFixtures.h"
+
+// --------------------------------------------------------------------------
+/// Tests for the way the engine spends its rate limit budget.
+///
+/// The fixture protocol answers for twitter, and tells the engine that
+/// the budget is used up. The engine is driven directly, with the test
+/// as its delegate, so that we can see exactly what it reports.
+/// There's no response cache unless a test sets one up, so requests are
+/// queued as soon as they're made.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterRateLimitTests : ECTestCase<MGTwitterEngineDelegate>
+
+@property (strong, nonatomic) MGTwitterEngine* engine;
+@property (strong, nonatomic) NSMutableArray* succeeded;
+@property (strong, nonatomic) NSMutableDictionary* failed;
+
+@end
+
+
+@implementation ECTwitterRateLimitTests
+
+@synthesize engine = _engine;
+@synthesize failed = _failed;
+@synthesize succeeded = _succeeded;
+
+static NSString *const kMethod = @"statuses/home_timeline";
+static const NSTimeInterval kTimeout = 10.0;
+
+- (void)setUp
+{
+    [ECTwitterFixtureProtocol install];
+    [ECTwitterFixtureProtocol setResponse:[ECTwitterFixtures dataForFixture:@"timeline"] forMethod:kMethod];
+
+    self.succeeded = [NSMutableArray array];
+    self.failed = [NSMutableDictionary dictionary];
+
+    MGTwitterEngine* engine = [[MGTwitterEngine alloc] initWithDelegate:self];
+    engine.maxRateLimitWait = 1.0;
+    engine.responseCache = nil;
+    self.engine = engine;
+    [engine release];
+}
+
+- (void)tearDown
+{
+    [self.engine closeAllConnections];
+    self.engine = nil;
+    self.succeeded = nil;
+    self.failed = nil;
+
+    [ECTwitterFixtureProtocol uninstall];
+}
+
+#pragma mark - Delegate
+
+- (void)requestSucceeded:(NSString*)connectionIdentifier
+{
+    [self.succeeded addObject:connectionIdentifier];
+}
+
+- (void)requestFailed:(NSString*)connectionIdentifier withError:(NSError*)error
+{
+    [self.failed setObject:error forKey:connectionIdentifier];
+}
+
+#pragma mark - Helpers
+
+// --------------------------------------------------------------------------
+/// Answer every request with a spent budget, which is next reset after
+/// a given delay, plus any other headers we're given.
+// --------------------------------------------------------------------------
+
+- (void)setBudgetResetAfter:(NSTimeInterval)delay headers:(NSDictionary*)headers
+{
+    NSString* reset = [NSString stringWithFormat:@"%.0f", ceil([[NSDate date] timeIntervalSince1970] + delay)];
+    NSMutableDictionary* all = [NSMutableDictionary dictionaryWithObjectsAndKeys:@"100", @"X-Rate-Limit-Limit", @"0", @"X-Rate-Limit-Remaining", reset, @"X-Rate-Limit-Reset", nil];
+    [all addEntriesFromDictionary:headers];
+    [ECTwitterFixtureProtocol setHeaders:all forMethod:kMethod];
+}
+
+// --------------------------------------------------------------------------
+/// Run the run loop until a condition is met, or we give up waiting.
+// --------------------------------------------------------------------------
+
+- (BOOL)runUntil:(BOOL (^)(void))condition timeout:(NSTimeInterval)timeout
+{
+    NSDate* limit = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    while (!condition() && ([limit timeIntervalSinceNow] > 0.0))
+    {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+
+    return condition();
+}
+
+// --------------------------------------------------------------------------
+/// Make one request, so that the engine hears about the budget.
+// --------------------------------------------------------------------------
+
+- (void)spendBudget
+{
+    NSString* identifier = [self.engine request:kMethod parameters:nil method:nil authentication:nil];
+    ECTestAssertTrue([self runUntil:^{ return [self.succeeded containsObject:identifier]; } timeout:kTimeout]);
+    ECTestAssertIntegerIsEqual([self.engine remainingRequestsForPath:kMethod authentication:nil], 0);
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// With the budget spent, a background request that would have to wait
+/// too long is dropped, and its caller told. Anything more important
+/// waits for the reset, then goes.
+// --------------------------------------------------------------------------
+
+- (void)testHoldAndShed
+{
+    [self setBudgetResetAfter:3.0 headers:nil];
+    [self spendBudget];
+
+    NSString* shed = [self.engine request:kMethod parameters:nil method:nil authentication:nil priority:MGTwitterRequestPriorityBackground];
+    NSString* held = [self.engine request:kMethod parameters:nil method:nil authentication:nil priority:MGTwitterRequestPriorityRefresh];
+    ECTestAssertIntegerIsEqual([self.engine numberOfShedRequests], 1);
+    ECTestAssertIntegerIsEqual([self.engine numberOfQueuedRequestsWithPriority:MGTwitterRequestPriorityRefresh], 1);
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], 1);
+
+    ECTestAssertTrue([self runUntil:^{ return (BOOL) ([self.failed objectForKey:shed] != nil); } timeout:kTimeout]);
+    ECTestAssertIntegerIsEqual([[self.failed objectForKey:shed] code], 429);
+    ECTestAssertNil([self.failed objectForKey:held]);
+    ECTestAssertFalse([self.succeeded containsObject:held]);
+
+    ECTestAssertTrue([self runUntil:^{ return [self.succeeded containsObject:held]; } timeout:kTimeout]);
+    ECTestAssertIntegerIsEqual([self.engine numberOfQueuedRequests], 0);
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], 2);
+    ECTestAssertIntegerIsEqual([self.failed count], 1);
+}
+
+// --------------------------------------------------------------------------
+/// When a stale response is served, the quiet refresh that goes with it
+/// can be shed too - but the caller already has its answer, so it
+/// mustn't be told that the request failed.
+// --------------------------------------------------------------------------
+
+- (void)testSilentShed
+{
+    NSURL* folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:@"ECTwitterRateLimitTests"];
+    [[NSFileManager defaultManager] removeItemAtURL:folder error:nil];
+    ECTwitterResponseCache* responseCache = [[ECTwitterResponseCache alloc] initWithURL:folder];
+    self.engine.responseCache = responseCache;
+    [responseCache release];
+    [self.engine setMaxStaleAge:60.0 forPath:kMethod];
+
+    [self setBudgetResetAfter:3600.0 headers:[NSDictionary dictionaryWithObject:@"\"fixture\"" forKey:@"ETag"]];
+    [self spendBudget];
+
+    NSString* stale = [self.engine request:kMethod parameters:nil method:nil authentication:nil priority:MGTwitterRequestPriorityRefresh];
+    ECTestAssertTrue([self runUntil:^{ return [self.succeeded containsObject:stale]; } timeout:kTimeout]);
+    ECTestAssertIntegerIsEqual([self.engine numberOfShedRequests], 1);
+
+    // give a failure time to turn up, if it was going to
+    [self runUntil:^{ return (BOOL) ([self.failed count] > 0); } timeout:0.5];
+    ECTestAssertIntegerIsEqual([self.failed count], 0);
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], 1);
+
+    self.engine.responseCache = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:folder error:nil];
+}
+
+@end
@@ -0,0 +1,150 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/ECTwitterRecordCoder.h>
+
+#import "ECTwitterFixtures.h"
+
+@interface ECTwitterRecordCoderTests : ECTestCase
+
+@end
+
+
+@implementation ECTwitterRecordCoderTests
+
+- (NSDictionary*)examplePayload
+{
+    NSArray* indices = [NSArray arrayWithObjects:[NSNumber numberWithInt:0], [NSNumber numberWithInt:12], nil];
+    NSDictionary* mention = [NSDictionary dictionaryWithObjectsAndKeys:@"elegantchaos", @"screen_name", indices, @"indices", @"an unknown value", @"an_unknown_key", nil];
+    NSDictionary* entities = [NSDictionary dictionaryWithObjectsAndKeys:[NSArray arrayWithObjects:mention, mention, nil], @"user_mentions", [NSArray array], @"hashtags", nil];
+
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            @"247483648123456789", @"id_str",
+            [NSNumber numberWithUnsignedLongLong:247483648123456789ULL], @"id",
+            [NSNumber numberWithUnsignedLongLong:18446744073709551615ULL], @"huge",
+            [NSNumber numberWithLongLong:-42], @"negative",
+            [NSNumber numberWithDouble:1318622958.25], @"created_at",
+            [NSNumber numberWithBool:YES], @"favorited",
+            [NSNumber numberWithBool:NO], @"retweeted",
+            [NSNull null], @"geo",
+            @"héllo wörld ☃ - @elegantchaos", @"text",
+            @"", @"empty",
+            [NSData dataWithBytes:"\0\1\2\3" length:4], @"bytes",
+            [NSDate dateWithTimeIntervalSince1970:1000000000], @"date",
+            entities, @"entities",
+            nil];
+}
+
+- (void)testRoundTrip
+{
+    NSDictionary* payload = [self examplePayload];
+    NSData* data = [ECTwitterRecordCoder dataWithPayload:payload];
+    ECTestAssertTrue([ECTwitterRecordCoder isCompactData:data]);
+    ECTestAssertTrue([[ECTwitterRecordCoder payloadWithData:data] isEqual:payload]);
+
+    NSData* packed = [ECTwitterRecordCoder packedDataWithPayload:payload];
+    ECTestAssertFalse([ECTwitterRecordCoder isCompactData:packed]);
+    ECTestAssertTrue([[ECTwitterRecordCoder payloadWithPackedData:packed] isEqual:payload]);
+
+    // bools have to stay bools
+    NSDictionary* decoded = [ECTwitterRecordCoder payloadWithData:data];
+    ECTestAssertTrue(CFGetTypeID((CFTypeRef) [decoded objectForKey:@"favorited"]) == CFBooleanGetTypeID());
+
+    // anything that isn't a property list can't be encoded
+    ECTestAssertNil([ECTwitterRecordCoder dataWithPayload:[NSArray arrayWithObject:[NSURL URLWithString:@"http://example.com"]]]);
+}
+
+- (void)testStrings
+{
+    // known keys cost a byte, so this is the two byte header, a tag and a count,
+    // the key, and then a tag, a length and the one character string
+    NSData* data = [ECTwitterRecordCoder dataWithPayload:[NSDictionary dictionaryWithObject:@"1" forKey:@"in_reply_to_status_id_str"]];
+    ECTestAssertIntegerIsEqual([data length], 8);
+
+    // a repeated string is only written once
+    NSString* string = @"a string that isn't in the table of known strings";
+    NSUInteger once = [[ECTwitterRecordCoder dataWithPayload:[NSArray arrayWithObject:string]] length];
+    NSUInteger twice = [[ECTwitterRecordCoder dataWithPayload:[NSArray arrayWithObjects:string, string, nil]] length];
+    ECTestAssertIntegerIsEqual(twice, once + 2);
+}
+
+- (void)testPacking
+{
+    NSMutableArray* repetitive = [NSMutableArray array];
+    for (NSUInteger n = 0; n < 100; ++n)
+    {
+        [repetitive addObject:[NSString stringWithFormat:@"http://example.com/some/long/path/%ld", (long) n]];
+    }
+    NSData* data = [ECTwitterRecordCoder dataWithPayload:repetitive];
+    NSData* packed = [ECTwitterRecordCoder packedDataWithPayload:repetitive];
+    ECTestAssertTrue([packed length] < [data length] / 2);
+    ECTestAssertTrue([[ECTwitterRecordCoder payloadWithPackedData:packed] isEqual:repetitive]);
+
+    // small payloads are stored as they are
+    packed = [ECTwitterRecordCoder packedDataWithPayload:@"x"];
+    ECTestAssertIntegerIsEqual([packed length], [[ECTwitterRecordCoder dataWithPayload:@"x"] length] + 4);
+    ECTestAssertStringIsEqual([ECTwitterRecordCoder payloadWithPackedData:packed], @"x");
+}
+
+- (void)testMalformed
+{
+    NSData* data = [ECTwitterRecordCoder dataWithPayload:[self examplePayload]];
+    NSData* packed = [ECTwitterRecordCoder packedDataWithPayload:[self examplePayload]];
+    for (NSUInteger length = 0; length < [data length]; ++length)
+    {
+        ECTestAssertNil([ECTwitterRecordCoder payloadWithData:[data subdataWithRange:NSMakeRange(0, length)]]);
+    }
+    for (NSUInteger length = 0; length < [packed length]; ++length)
+    {
+        ECTestAssertNil([ECTwitterRecordCoder payloadWithPackedData:[packed subdataWithRange:NSMakeRange(0, length)]]);
+    }
+
+    // flipping bits mustn't crash, whatever it decodes to
+    NSMutableData* corrupt = [packed mutableCopy];
+    uint8_t* bytes = [corrupt mutableBytes];
+    for (NSUInteger n = 4; n < [corrupt length]; ++n)
+    {
+        bytes[n] ^= 0x5A;
+        [ECTwitterRecordCoder payloadWithPackedData:corrupt];
+        bytes[n] ^= 0x5A;
+    }
+    [corrupt release];
+
+    NSData* archive = [NSKeyedArchiver archivedDataWithRootObject:[self examplePayload]];
+    ECTestAssertFalse([ECTwitterRecordCoder isCompactData:archive]);
+    ECTestAssertNil([ECTwitterRecordCoder payloadWithData:archive]);
+    ECTestAssertNil([ECTwitterRecordCoder payloadWithPackedData:archive]);
+}
+
+- (void)testTweetRecords
+{
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+    NSArray* tweets = [cache addOrRefreshTweets:[ECTwitterFixtures tweetsWithCount:20]];
+    for (ECTwitterTweet* tweet in tweets)
+    {
+        tweet.viewed = 3;
+        NSData* record = [tweet compactRecord];
+        ECTestAssertTrue([record length] < [[NSKeyedArchiver archivedDataWithRootObject:tweet] length]);
+
+        ECTwitterTweet* copy = [ECTwitterTweet tweetWithCompactRecord:record];
+        ECTestAssertTrue([copy.twitterID isEqual:tweet.twitterID]);
+        ECTestAssertTrue([copy.data isEqual:tweet.data]);
+        ECTestAssertTrue([copy.authorID isEqual:tweet.authorID]);
+        ECTestAssertTrue((copy.mentionedNames == tweet.mentionedNames) || [copy.mentionedNames isEqual:tweet.mentionedNames]);
+        ECTestAssertTrue((copy.hashtags == tweet.hashtags) || [copy.hashtags isEqual:tweet.hashtags]);
+        ECTestAssertTrue((copy.urls == tweet.urls) || [copy.urls isEqual:tweet.urls]);
+        ECTestAssertTrue((copy.sourceName == tweet.sourceName) || [copy.sourceName isEqualToString:tweet.sourceName]);
+        ECTestAssertIntegerIsEqual(copy.viewed, 3);
+        ECTestAssertTrue([copy gotData]);
+    }
+
+    ECTestAssertNil([ECTwitterTweet tweetWithCompactRecord:[NSKeyedArchiver archivedDataWithRootObject:[tweets lastObject]]]);
+    [cache release];
+}
+
+@end
@@ -0,0 +1,74 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/ECTwitterRequestBuilder.h>
+
+@interface ECTwitterRequestBuilderTests : ECTestCase
+
+@end
+
+
+@implementation ECTwitterRequestBuilderTests
+
+- (NSString*)bodyOfRequest:(NSURLRequest*)request
+{
+    return [[[NSString alloc] initWithData:[request HTTPBody] encoding:NSUTF8StringEncoding] autorelease];
+}
+
+- (void)testQueryString
+{
+    ECTwitterRequestBuilder* builder = [[ECTwitterRequestBuilder alloc] init];
+    NSDictionary* parameters = [NSDictionary dictionaryWithObjectsAndKeys:@"elegantchaos", @"screen_name", [NSNumber numberWithInt:200], @"count", @"a b+c/d~é", @"q", nil];
+    NSURLRequest* request = [builder requestWithMethod:@"GET" URL:@"https://api.twitter.com/1/statuses/user_timeline.json" parameters:parameters];
+    ECTestAssertStringIsEqual([[request URL] absoluteString], @"https://api.twitter.com/1/statuses/user_timeline.json?count=200&q=a%20b%2Bc%2Fd~%C3%A9&screen_name=elegantchaos");
+    ECTestAssertStringIsEqual([request HTTPMethod], @"GET");
+    ECTestAssertNil([request valueForHTTPHeaderField:@"Authorization"]);
+
+    request = [builder requestWithMethod:@"POST" URL:@"https://api.twitter.com/1/statuses/update.json" parameters:[NSDictionary dictionaryWithObject:@"hello & goodbye" forKey:@"status"]];
+    ECTestAssertStringIsEqual([[request URL] absoluteString], @"https://api.twitter.com/1/statuses/update.json");
+    ECTestAssertStringIsEqual([self bodyOfRequest:request], @"status=hello%20%26%20goodbye");
+
+    request = [builder requestWithMethod:nil URL:@"https://api.twitter.com/1/help/test.json" parameters:nil];
+    ECTestAssertStringIsEqual([[request URL] absoluteString], @"https://api.twitter.com/1/help/test.json");
+    ECTestAssertStringIsEqual([request HTTPMethod], @"GET");
+
+    [builder release];
+}
+
+// --------------------------------------------------------------------------
+/// Check the signature against the worked example in twitter's
+/// "Creating a signature" documentation.
+// --------------------------------------------------------------------------
+
+- (void)testSignature
+{
+    ECTwitterRequestBuilder* builder = [[ECTwitterRequestBuilder alloc] init];
+    builder.fixedNonce = @"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg";
+    builder.fixedTimestamp = 1318622958;
+
+    NSDictionary* parameters = [NSDictionary dictionaryWithObjectsAndKeys:@"Hello Ladies + Gentlemen, a signed OAuth request!", @"status", @"true", @"include_entities", nil];
+    for (NSUInteger n = 0; n < 2; ++n)
+    {
+        // the second time round, the signing key comes from the cache
+        NSURLRequest* request = [builder requestWithMethod:@"POST" URL:@"https://api.twitter.com/1/statuses/update.json" parameters:parameters consumerKey:@"xvz1evFS4wEEPTGEFPHBog" consumerSecret:@"kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw" tokenKey:@"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb" tokenSecret:@"LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE"];
+
+        NSString* authorization = [request valueForHTTPHeaderField:@"Authorization"];
+        ECTestAssertTrue([authorization hasPrefix:@"OAuth "]);
+        ECTestAssertTrue([authorization rangeOfString:@"oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\""].location != NSNotFound);
+        ECTestAssertTrue([authorization rangeOfString:@"oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\""].location != NSNotFound);
+        ECTestAssertStringIsEqual([self bodyOfRequest:request], @"include_entities=true&status=Hello%20Ladies%20%2B%20Gentlemen%2C%20a%20signed%20OAuth%20request%21");
+    }
+
+    // a different token has to give a different signature
+    NSURLRequest* request = [builder requestWithMethod:@"POST" URL:@"https://api.twitter.com/1/statuses/update.json" parameters:parameters consumerKey:@"xvz1evFS4wEEPTGEFPHBog" consumerSecret:@"kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw" tokenKey:@"other" tokenSecret:@"other"];
+    ECTestAssertTrue([[request valueForHTTPHeaderField:@"Authorization"] rangeOfString:@"tnnArxj06cWHq44gCs1OSKk"].location == NSNotFound);
+
+    [builder release];
+}
+
+@end
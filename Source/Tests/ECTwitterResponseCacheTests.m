@@ -0,0 +1,212 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/MGTwitterEngine.h>
+#import <ECTwitter/ECTwitterResponseCache.h>
+
+#import "ECTwitterFixtures.h"
+
+// --------------------------------------------------------------------------
+/// Tests for the response cache - on its own, and as the engine uses it,
+/// with the fixture protocol answering for twitter.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterResponseCacheTests : ECTestCase<MGTwitterEngineDelegate>
+
+@property (strong, nonatomic) ECTwitterResponseCache* cache;
+@property (strong, nonatomic) MGTwitterEngine* engine;
+@property (strong, nonatomic) NSURL* folder;
+@property (strong, nonatomic) NSMutableSet* finished;
+
+@end
+
+
+@implementation ECTwitterResponseCacheTests
+
+@synthesize cache = _cache;
+@synthesize engine = _engine;
+@synthesize finished = _finished;
+@synthesize folder = _folder;
+
+static NSString *const kMethod = @"statuses/home_timeline";
+static const NSTimeInterval kTimeout = 10.0;
+
+- (void)setUp
+{
+    NSString* name = [NSString stringWithFormat:@"ECTwitterResponseCacheTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    self.finished = [NSMutableSet set];
+
+    ECTwitterResponseCache* cache = [[ECTwitterResponseCache alloc] initWithURL:self.folder];
+    self.cache = cache;
+    [cache release];
+
+    MGTwitterEngine* engine = [[MGTwitterEngine alloc] initWithDelegate:self];
+    engine.responseCache = self.cache;
+    self.engine = engine;
+    [engine release];
+
+    [ECTwitterFixtureProtocol install];
+    [ECTwitterFixtureProtocol setHeaders:[NSDictionary dictionaryWithObject:@"\"fixture\"" forKey:@"ETag"] forMethod:kMethod];
+}
+
+- (void)tearDown
+{
+    [ECTwitterFixtureProtocol uninstall];
+
+    [self.engine closeAllConnections];
+    self.engine = nil;
+    self.cache = nil;
+    self.finished = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+}
+
+#pragma mark - Delegate
+
+- (void)requestSucceeded:(NSString*)connectionIdentifier
+{
+    [self.finished addObject:connectionIdentifier];
+}
+
+- (void)requestFailed:(NSString*)connectionIdentifier withError:(NSError*)error
+{
+    [self.finished addObject:connectionIdentifier];
+}
+
+#pragma mark - Helpers
+
+// --------------------------------------------------------------------------
+/// Run the run loop until a condition is met, or we give up waiting.
+// --------------------------------------------------------------------------
+
+- (BOOL)runUntil:(BOOL (^)(void))condition timeout:(NSTimeInterval)timeout
+{
+    NSDate* limit = [NSDate dateWithTimeIntervalSinceNow:timeout];
+    while (!condition() && ([limit timeIntervalSinceNow] > 0.0))
+    {
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+
+    return condition();
+}
+
+// --------------------------------------------------------------------------
+/// Wait for the cache to finish anything it's doing on disk, then return
+/// the files it's left there.
+/// The cache's queue is serial, so once a lookup for a key it doesn't
+/// have comes back, everything before it has been done.
+// --------------------------------------------------------------------------
+
+- (NSArray*)filesOnDisk
+{
+    __block BOOL done = NO;
+    [self.cache fetchResponseForKey:@"not a key" handler:^(ECTwitterCachedResponse* response) {
+        done = YES;
+    }];
+    ECTestAssertTrue([self runUntil:^{ return done; } timeout:kTimeout]);
+
+    NSArray* keys = [NSArray arrayWithObject:NSURLFileSizeKey];
+    return [[NSFileManager defaultManager] contentsOfDirectoryAtURL:self.folder includingPropertiesForKeys:keys options:NSDirectoryEnumerationSkipsHiddenFiles error:nil];
+}
+
+// --------------------------------------------------------------------------
+/// Make a request, and wait for it to finish.
+// --------------------------------------------------------------------------
+
+- (void)request:(NSDictionary*)parameters
+{
+    NSString* identifier = [self.engine request:kMethod parameters:parameters method:nil authentication:nil];
+    ECTestAssertTrue([self runUntil:^{ return [self.finished containsObject:identifier]; } timeout:kTimeout]);
+}
+
+// --------------------------------------------------------------------------
+/// Return a response with a body of a given size.
+// --------------------------------------------------------------------------
+
+- (ECTwitterCachedResponse*)responseWithSize:(NSUInteger)size
+{
+    ECTwitterCachedResponse* response = [[[ECTwitterCachedResponse alloc] init] autorelease];
+    response.body = [NSMutableData dataWithLength:size];
+    response.etag = @"\"fixture\"";
+
+    return response;
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// Once enough has been written, the oldest responses are thrown away
+/// to keep the cache within its disk budget.
+// --------------------------------------------------------------------------
+
+- (void)testTrimToSize
+{
+    static const NSUInteger kResponseSize = 1024;
+    static const NSUInteger kResponseCount = 32;
+
+    self.cache.maxDiskBytes = kResponseSize * 8;
+    for (NSUInteger n = 0; n < kResponseCount; ++n)
+    {
+        [self.cache storeResponse:[self responseWithSize:kResponseSize] forKey:[NSString stringWithFormat:@"key %ld", (long) n]];
+    }
+
+    NSArray* files = [self filesOnDisk];
+    NSUInteger total = 0;
+    for (NSURL* file in files)
+    {
+        total += [[[file resourceValuesForKeys:[NSArray arrayWithObject:NSURLFileSizeKey] error:nil] objectForKey:NSURLFileSizeKey] unsignedIntegerValue];
+    }
+    ECTestAssertTrue([files count] < kResponseCount);
+    ECTestAssertTrue(total <= self.cache.maxDiskBytes);
+}
+
+// --------------------------------------------------------------------------
+/// Responses that are too old are thrown away, however much room there is.
+// --------------------------------------------------------------------------
+
+- (void)testTrimByAge
+{
+    [self.cache storeResponse:[self responseWithSize:16] forKey:@"key"];
+    ECTestAssertIntegerIsEqual([[self filesOnDisk] count], 1);
+
+    self.cache.maxAge = 0.0;
+    [self.cache trimDiskCache];
+    ECTestAssertIntegerIsEqual([[self filesOnDisk] count], 0);
+}
+
+// --------------------------------------------------------------------------
+/// Paging through results with since_id and friends doesn't fill up the
+/// cache; the plain request is still cached.
+// --------------------------------------------------------------------------
+
+- (void)testPagingNotCached
+{
+    [ECTwitterFixtureProtocol setResponse:[ECTwitterFixtures dataForFixture:@"timeline"] forMethod:kMethod];
+
+    [self request:[NSDictionary dictionaryWithObject:@"1234" forKey:@"since_id"]];
+    [self request:[NSDictionary dictionaryWithObject:@"1234" forKey:@"max_id"]];
+    ECTestAssertIntegerIsEqual([[self filesOnDisk] count], 0);
+
+    [self request:nil];
+    ECTestAssertIntegerIsEqual([[self filesOnDisk] count], 1);
+}
+
+// --------------------------------------------------------------------------
+/// A body that doesn't parse isn't cached, even though it has validators.
+// --------------------------------------------------------------------------
+
+- (void)testBadBodyNotCached
+{
+    [ECTwitterFixtureProtocol setResponse:[@"{ this isn't json }" dataUsingEncoding:NSUTF8StringEncoding] forMethod:kMethod];
+
+    [self request:nil];
+    ECTestAssertIntegerIsEqual([[self filesOnDisk] count], 0);
+}
+
+@end
@@ -0,0 +1,146 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+#import "ECTwitterFixtures.h"
+
+// --------------------------------------------------------------------------
+/// Tests for the user stream, with the fixture protocol standing in for
+/// the streaming server.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterStreamTests : ECTestCase
+
+@property (strong, nonatomic) ECTwitterCache* cache;
+@property (strong, nonatomic) NSURL* folder;
+
+@end
+
+
+@implementation ECTwitterStreamTests
+
+@synthesize cache = _cache;
+@synthesize folder = _folder;
+
+static const NSUInteger kStreamSize = 200;
+static const NSUInteger kMentionEvery = 10;
+
+- (void)setUp
+{
+    NSString* name = [NSString stringWithFormat:@"ECTwitterStreamTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.folder withIntermediateDirectories:YES attributes:nil error:nil];
+
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:nil];
+    cache.cacheFolder = self.folder;
+    cache.maxTweets = 0;
+    cache.maxTweetBytes = 0;
+    cache.maxUsers = 0;
+    self.cache = cache;
+    [cache release];
+
+    [ECTwitterFixtureProtocol install];
+}
+
+- (void)tearDown
+{
+    [ECTwitterFixtureProtocol uninstall];
+
+    self.cache = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+}
+
+// --------------------------------------------------------------------------
+/// Return the stream messages: a friends list, some tweets - every so
+/// often one of which mentions the user - then a deletion of the first
+/// tweet. The tweets are returned too.
+// --------------------------------------------------------------------------
+
+- (NSArray*)messagesMentioningUser:(ECTwitterUser*)user tweets:(NSArray**)tweetsOut
+{
+    NSArray* tweets = [ECTwitterFixtures tweetsWithCount:kStreamSize];
+    NSDictionary* mention = [NSDictionary dictionaryWithObjectsAndKeys:user.twitterID.string, @"id_str", user.twitterName, @"screen_name", nil];
+    NSDictionary* entities = [NSDictionary dictionaryWithObject:[NSArray arrayWithObject:mention] forKey:@"user_mentions"];
+    NSDictionary* noEntities = [NSDictionary dictionaryWithObject:[NSArray array] forKey:@"user_mentions"];
+    NSUInteger n = 0;
+    for (NSMutableDictionary* tweet in tweets)
+    {
+        [tweet setObject:((n++ % kMentionEvery) == kMentionEvery / 2) ? entities : noEntities forKey:@"entities"];
+    }
+
+    NSDictionary* deleted = [NSDictionary dictionaryWithObject:[[tweets objectAtIndex:0] objectForKey:@"id_str"] forKey:@"id_str"];
+    NSMutableArray* messages = [NSMutableArray arrayWithArray:tweets];
+    [messages insertObject:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:@"100001"] forKey:@"friends"] atIndex:0];
+    [messages addObject:[NSDictionary dictionaryWithObject:[NSDictionary dictionaryWithObject:deleted forKey:@"status"] forKey:@"delete"]];
+
+    *tweetsOut = tweets;
+    return messages;
+}
+
+// --------------------------------------------------------------------------
+/// Stream tweets into a user's timelines, spread out and in one burst.
+///
+/// The stream also has a deletion and a message we don't handle in it.
+/// The server drops the connection at the end of each pass, so we wait
+/// until the stream has reconnected, and dropped again after everything
+/// has come through twice - which shouldn't add anything twice.
+// --------------------------------------------------------------------------
+
+- (void)testStreaming
+{
+    static const double kRates[] = { 2000.0, 0.0 };
+
+    for (NSUInteger n = 0; n < sizeof(kRates) / sizeof(kRates[0]); ++n)
+    {
+        @autoreleasepool
+        {
+            ECTwitterUser* user = [self.cache addOrRefreshUserWithInfo:[[ECTwitterFixtures usersWithCount:1] objectAtIndex:0]];
+            NSArray* tweets = nil;
+            NSArray* messages = [self messagesMentioningUser:user tweets:&tweets];
+            [ECTwitterFixtureProtocol setStreamMessages:messages rate:kRates[n] forMethod:@"user"];
+
+            ECTwitterStream* stream = [[ECTwitterStream alloc] initWithUser:user];
+            stream.minimumReconnectDelay = 0.05;
+
+            NSUInteger expected = [messages count] * 2;
+            NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+            id observer = [nc addObserverForName:ECTwitterStreamDisconnected object:stream queue:nil usingBlock:^(NSNotification* notification) {
+                if (stream.messagesReceived >= expected)
+                {
+                    [self timeToExitRunLoop];
+                }
+            }];
+
+            [stream start];
+            [self runUntilTimeToExit];
+            [nc removeObserver:observer];
+            [stream stop];
+
+            ECTestAssertIntegerIsEqual(stream.messagesReceived, expected);
+            ECTestAssertIntegerIsEqual(stream.tweetsReceived, kStreamSize * 2);
+            ECTestAssertTrue(stream.reconnects >= 1);
+
+            // everything but the deleted tweet is in the timeline
+            ECTestAssertIntegerIsEqual([user.timeline count], kStreamSize - 1);
+
+            // the tweets that mention the user are in its mentions, and nothing else is
+            ECTestAssertIntegerIsEqual([user.mentions count], kStreamSize / kMentionEvery);
+            for (NSUInteger t = 0; t < kStreamSize; ++t)
+            {
+                ECTwitterTweet* tweet = [self.cache existingTweetWithID:[ECTwitterID idFromDictionary:[tweets objectAtIndex:t]]];
+                BOOL mentioned = (t % kMentionEvery) == kMentionEvery / 2;
+                ECTestAssertTrue([user.mentions containsTweet:tweet] == mentioned);
+            }
+
+            [stream release];
+        }
+    }
+}
+
+@end
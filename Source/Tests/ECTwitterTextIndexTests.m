@@ -0,0 +1,143 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+#import <ECTwitter/ECTwitterTextIndex.h>
+
+// --------------------------------------------------------------------------
+/// Tests for the full text index, on its own.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTextIndexTests : ECTestCase
+
+@property (strong, nonatomic) NSURL* folder;
+@property (strong, nonatomic) NSURL* url;
+
+@end
+
+
+@implementation ECTwitterTextIndexTests
+
+@synthesize folder = _folder;
+@synthesize url = _url;
+
+- (void)setUp
+{
+    NSString* name = [NSString stringWithFormat:@"ECTwitterTextIndexTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    self.url = [self.folder URLByAppendingPathComponent:@"index"];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+    self.url = nil;
+}
+
+#pragma mark - Helpers
+
+// --------------------------------------------------------------------------
+/// Return the IDs that match a query, as a comma separated string.
+// --------------------------------------------------------------------------
+
+static NSString* search(ECTwitterTextIndex* index, NSString* query)
+{
+    return [[[index documentIDsMatchingQuery:query] valueForKey:@"string"] componentsJoinedByString:@","];
+}
+
+// --------------------------------------------------------------------------
+/// Add a tweet.
+// --------------------------------------------------------------------------
+
+static void add(ECTwitterTextIndex* index, uint64_t value, NSString* text)
+{
+    [index addDocumentWithID:[ECTwitterID idFromValue:value] text:text];
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// A tweet that's removed and added again with different text only
+/// matches its new text - without the posting lists being rewritten
+/// until the index is saved.
+// --------------------------------------------------------------------------
+
+- (void)testReadd
+{
+    ECTwitterTextIndex* index = [[ECTwitterTextIndex alloc] initWithURL:self.url];
+    add(index, 1, @"apple banana");
+    add(index, 2, @"banana cherry");
+    [index removeDocumentWithID:[ECTwitterID idFromValue:1]];
+    add(index, 1, @"cherry date apple");
+    add(index, 1, @"this is ignored, since it's already there");
+
+    ECTestAssertStringIsEqual(search(index, @"banana"), @"2");
+    ECTestAssertStringIsEqual(search(index, @"cherry"), @"2,1");
+    ECTestAssertStringIsEqual(search(index, @"apple"), @"1");
+    ECTestAssertStringIsEqual(search(index, @"\"apple banana\""), @"");
+    ECTestAssertStringIsEqual(search(index, @"\"cherry date\""), @"1");
+    ECTestAssertStringIsEqual(search(index, @"ignored"), @"");
+
+    // the old postings are only dropped when we save
+    NSUInteger bytes = index.postingBytes;
+    [index save];
+    ECTestAssertTrue(index.postingBytes < bytes);
+    ECTestAssertStringIsEqual(search(index, @"cherry"), @"2,1");
+    ECTestAssertStringIsEqual(search(index, @"banana"), @"2");
+
+    [index release];
+}
+
+// --------------------------------------------------------------------------
+/// Changes saved after the index itself are applied when it's loaded.
+/// If the last set of changes was only partly written, just that set is
+/// lost.
+// --------------------------------------------------------------------------
+
+- (void)testSavedChanges
+{
+    @autoreleasepool
+    {
+        ECTwitterTextIndex* index = [[ECTwitterTextIndex alloc] initWithURL:self.url];
+        add(index, 1, @"morning tea");
+        add(index, 2, @"morning train");
+        add(index, 3, @"morning coffee");
+        [index save];
+
+        add(index, 4, @"evening tea");
+        [index removeDocumentWithID:[ECTwitterID idFromValue:2]];
+        add(index, 2, @"evening train");
+        [index save];
+        [index release];
+    }
+    ECTestAssertTrue([[NSFileManager defaultManager] fileExistsAtPath:[[self.url URLByAppendingPathExtension:@"log"] path]]);
+
+    @autoreleasepool
+    {
+        ECTwitterTextIndex* index = [[ECTwitterTextIndex alloc] initWithURL:self.url];
+        [index load];
+        ECTestAssertIntegerIsEqual(index.documentCount, 4);
+        ECTestAssertStringIsEqual(search(index, @"morning"), @"3,1");
+        ECTestAssertStringIsEqual(search(index, @"evening"), @"4,2");
+        ECTestAssertStringIsEqual(search(index, @"tea"), @"4,1");
+        [index release];
+    }
+
+    NSURL* logURL = [self.url URLByAppendingPathExtension:@"log"];
+    unsigned long long size = [[[NSFileManager defaultManager] attributesOfItemAtPath:[logURL path] error:nil] fileSize];
+    truncate([[logURL path] fileSystemRepresentation], (off_t) (size - 2));
+
+    ECTwitterTextIndex* index = [[ECTwitterTextIndex alloc] initWithURL:self.url];
+    [index load];
+    ECTestAssertIntegerIsEqual(index.documentCount, 3);
+    ECTestAssertStringIsEqual(search(index, @"morning"), @"3,2,1");
+    ECTestAssertStringIsEqual(search(index, @"evening"), @"");
+    [index release];
+}
+
+@end
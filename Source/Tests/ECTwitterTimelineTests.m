@@ -0,0 +1,327 @@
+// --------------------------------------------------------------------------
+//  Copyright 2012 Sam Deane, Elegant Chaos. All rights reserved.
+//  This source code is distributed under the terms of Elegant Chaos's
+//  liberal license: http://www.elegantchaos.com/license/liberal
+// --------------------------------------------------------------------------
+
+#import <ECUnitTests/ECUnitTests.h>
+#import <ECTwitter/ECTwitter.h>
+
+#import "ECTwitterFixtures.h"
+
+// --------------------------------------------------------------------------
+/// Timeline tests, against generated tweets.
+/// Fetching goes through the engine, with the fixture protocol playing
+/// the part of a server that pages through a fixed corpus.
+// --------------------------------------------------------------------------
+
+@interface ECTwitterTimelineTests : ECTestCase
+
+@property (strong, nonatomic) ECTwitterEngine* engine;
+@property (strong, nonatomic) ECTwitterCache* cache;
+@property (strong, nonatomic) NSURL* folder;
+
+@end
+
+
+@implementation ECTwitterTimelineTests
+
+@synthesize cache = _cache;
+@synthesize engine = _engine;
+@synthesize folder = _folder;
+
+- (void)setUp
+{
+    NSString* name = [NSString stringWithFormat:@"ECTwitterTimelineTests %@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    self.folder = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:name];
+    [[NSFileManager defaultManager] createDirectoryAtURL:self.folder withIntermediateDirectories:YES attributes:nil error:nil];
+
+    NSURL* url = [NSURL URLWithString:@"http://elegantchaos.github.com/ECTwitter/Documentation"];
+    ECTwitterEngine* engine = [[ECTwitterEngine alloc] initWithConsumerKey:@"fixture-key" consumerSecret:@"fixture-secret" clientName:@"ECTwitter Unit Tests" version:@"1.0" url:url];
+    self.engine = engine;
+    [engine release];
+
+    ECTwitterCache* cache = [[ECTwitterCache alloc] initWithEngine:self.engine];
+    cache.cacheFolder = self.folder;
+    self.cache = cache;
+    [cache release];
+
+    [ECTwitterFixtureProtocol install];
+}
+
+- (void)tearDown
+{
+    [ECTwitterFixtureProtocol uninstall];
+
+    self.cache = nil;
+    self.engine = nil;
+    [[NSFileManager defaultManager] removeItemAtURL:self.folder error:nil];
+    self.folder = nil;
+}
+
+#pragma mark - Helpers
+
+// --------------------------------------------------------------------------
+/// Return a new, empty timeline.
+// --------------------------------------------------------------------------
+
+- (ECTwitterTimeline*)timeline
+{
+    return [[[ECTwitterTimeline alloc] initWithCache:self.cache] autorelease];
+}
+
+// --------------------------------------------------------------------------
+/// Return the ID of a tweet's info.
+// --------------------------------------------------------------------------
+
+static ECTwitterID* idOf(NSDictionary* info)
+{
+    return [ECTwitterID idFromDictionary:info];
+}
+
+// --------------------------------------------------------------------------
+/// Check that a timeline's tweets are in ID order, newest first.
+// --------------------------------------------------------------------------
+
+- (BOOL)isNewestFirst:(ECTwitterTimeline*)timeline
+{
+    uint64_t previous = UINT64_MAX;
+    for (ECTwitterTweet* tweet in timeline.tweets)
+    {
+        uint64_t value = tweet.twitterID.value;
+        if (value >= previous)
+        {
+            return NO;
+        }
+        previous = value;
+    }
+
+    return YES;
+}
+
+// --------------------------------------------------------------------------
+/// Serve a timeline method from a corpus of tweets (newest first), paging
+/// through it with since_id, max_id and count the way twitter does.
+// --------------------------------------------------------------------------
+
+- (void)serveCorpus:(NSArray*)corpus forMethod:(NSString*)method
+{
+    [ECTwitterFixtureProtocol setResponder:^(NSDictionary* parameters) {
+        NSString* since = [parameters objectForKey:@"since_id"];
+        NSString* max = [parameters objectForKey:@"max_id"];
+        uint64_t sinceValue = since ? [ECTwitterID idFromString:since].value : 0;
+        uint64_t maxValue = max ? [ECTwitterID idFromString:max].value : UINT64_MAX;
+        NSUInteger count = [[parameters objectForKey:@"count"] integerValue];
+
+        NSMutableArray* page = [NSMutableArray array];
+        for (NSDictionary* info in corpus)
+        {
+            uint64_t value = idOf(info).value;
+            if ((value > sinceValue) && (value <= maxValue) && ([page count] < count))
+            {
+                [page addObject:info];
+            }
+        }
+
+        return [ECTwitterFixtures dataForObject:page];
+    } forMethod:method];
+}
+
+#pragma mark - Tests
+
+// --------------------------------------------------------------------------
+/// Tweets end up newest first, whatever order they're added in, and
+/// adding one twice does nothing.
+/// Sorted views keep up, and survive the tweets being replaced.
+// --------------------------------------------------------------------------
+
+- (void)testOrdering
+{
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:50];
+    NSArray* tweets = [self.cache addOrRefreshTweets:infos];
+
+    ECTwitterTimeline* timeline = [self timeline];
+    ECTwitterTimeline* byDate = [timeline sortedWithSelector:@selector(compareByDateAscending:)];
+    for (NSUInteger n = 0; n < [tweets count]; ++n)
+    {
+        // odd ones oldest first, then even ones newest first, then everything again
+        NSUInteger index = (n < 25) ? [tweets count] - 1 - (n * 2) : (n - 25) * 2;
+        [timeline addTweet:[tweets objectAtIndex:index]];
+    }
+    for (ECTwitterTweet* tweet in tweets)
+    {
+        [timeline addTweet:tweet];
+    }
+
+    ECTestAssertIntegerIsEqual([timeline count], 50);
+    ECTestAssertTrue([self isNewestFirst:timeline]);
+    ECTestAssertTrue(timeline.newestTweet == [tweets objectAtIndex:0]);
+    ECTestAssertTrue(timeline.oldestTweet == [tweets lastObject]);
+    ECTestAssertIntegerIsEqual([byDate count], 50);
+    ECTestAssertTrue([byDate.tweets objectAtIndex:0] == [tweets lastObject]);
+
+    [timeline removeTweet:[tweets objectAtIndex:0]];
+    ECTestAssertFalse([timeline containsTweet:[tweets objectAtIndex:0]]);
+    ECTestAssertFalse([byDate containsTweet:[tweets objectAtIndex:0]]);
+    ECTestAssertTrue(timeline.newestTweet == [tweets objectAtIndex:1]);
+
+    // replacing the tweets refills the view we're already holding
+    NSArray* some = [tweets subarrayWithRange:NSMakeRange(10, 5)];
+    timeline.tweets = [NSMutableArray arrayWithArray:some];
+    ECTestAssertTrue([timeline sortedWithSelector:@selector(compareByDateAscending:)] == byDate);
+    ECTestAssertIntegerIsEqual([byDate count], 5);
+    ECTestAssertTrue([byDate.tweets objectAtIndex:0] == [some lastObject]);
+    ECTestAssertTrue(timeline.oldestTweet == [some lastObject]);
+}
+
+// --------------------------------------------------------------------------
+/// Ranges follow the since_id/max_id conventions: above since, and at or
+/// below max. The IDs don't have to be in the timeline.
+// --------------------------------------------------------------------------
+
+- (void)testRanges
+{
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:10];
+    ECTwitterTimeline* timeline = [self timeline];
+    timeline.tweets = [NSMutableArray arrayWithArray:[self.cache addOrRefreshTweets:infos]];
+
+    NSArray* range = [timeline tweetsSinceID:idOf([infos objectAtIndex:7]) maxID:idOf([infos objectAtIndex:2])];
+    ECTestAssertIntegerIsEqual([range count], 5);
+    ECTestAssertTrue(((ECTwitterTweet*) [range objectAtIndex:0]).twitterID == idOf([infos objectAtIndex:2]));
+    ECTestAssertTrue(((ECTwitterTweet*) [range lastObject]).twitterID == idOf([infos objectAtIndex:6]));
+
+    ECTestAssertIntegerIsEqual([[timeline tweetsSinceID:nil maxID:idOf([infos objectAtIndex:5])] count], 5);
+    ECTestAssertIntegerIsEqual([[timeline tweetsSinceID:idOf([infos objectAtIndex:5]) maxID:nil] count], 5);
+    ECTestAssertIntegerIsEqual([[timeline tweetsSinceID:nil maxID:nil] count], 10);
+    ECTestAssertIntegerIsEqual([[timeline tweetsSinceID:idOf([infos objectAtIndex:2]) maxID:idOf([infos objectAtIndex:7])] count], 0);
+
+    ECTwitterID* between = [ECTwitterID idFromValue:idOf([infos objectAtIndex:2]).value - 1];
+    range = [timeline tweetsSinceID:nil maxID:between];
+    ECTestAssertIntegerIsEqual([range count], 7);
+    ECTestAssertTrue(((ECTwitterTweet*) [range objectAtIndex:0]).twitterID == idOf([infos objectAtIndex:3]));
+}
+
+// --------------------------------------------------------------------------
+/// A timeline only keeps its newest tweets, but the ones it drops come
+/// back from the cache, without asking the server, when older tweets
+/// are fetched.
+// --------------------------------------------------------------------------
+
+- (void)testLimitAndRestore
+{
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:200];
+    NSArray* tweets = [self.cache addOrRefreshTweets:infos];
+    ECTwitterUser* user = [self.cache addOrRefreshUserWithInfo:[[ECTwitterFixtures usersWithCount:1] objectAtIndex:0]];
+
+    ECTwitterTimeline* timeline = [self timeline];
+    timeline.maxCount = 50;
+    for (ECTwitterTweet* tweet in [tweets reverseObjectEnumerator])
+    {
+        [timeline addTweet:tweet];
+    }
+    ECTestAssertIntegerIsEqual([timeline count], 50);
+    ECTestAssertTrue(timeline.newestTweet == [tweets objectAtIndex:0]);
+    ECTestAssertTrue(timeline.oldestTweet == [tweets objectAtIndex:49]);
+
+    [timeline fetchTweetsForUser:user method:MethodHome type:FetchOlder];
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], 0);
+    ECTestAssertIntegerIsEqual([timeline count], 200);
+    ECTestAssertTrue([self isNewestFirst:timeline]);
+    ECTestAssertTrue(timeline.oldestTweet == [tweets lastObject]);
+}
+
+// --------------------------------------------------------------------------
+/// Filling the cache well past its budget, through a timeline, leaves it
+/// back within the budget - the timeline's limit stops it pinning too
+/// much. If a timeline with no limit does pin more than the budget, the
+/// cache gets back under it once the timeline has gone.
+// --------------------------------------------------------------------------
+
+- (void)testEvictionWithTimelines
+{
+    static const NSUInteger kBudget = 100;
+    static const NSUInteger kBatch = 50;
+
+    self.cache.maxTweets = kBudget;
+    NSArray* infos = [ECTwitterFixtures tweetsWithCount:1400];
+    NSUInteger fed = 0;
+
+    ECTwitterTimeline* limited = [self timeline];
+    limited.maxCount = kBudget / 2;
+    for (; fed < 1000; fed += kBatch)
+    {
+        for (ECTwitterTweet* tweet in [self.cache addOrRefreshTweets:[infos subarrayWithRange:NSMakeRange(fed, kBatch)]])
+        {
+            [limited addTweet:tweet];
+        }
+    }
+    ECTestAssertTrue(self.cache.evictedTweets > 0);
+    ECTestAssertTrue(self.cache.tweetCount <= kBudget);
+    ECTestAssertIntegerIsEqual([limited count], kBudget / 2);
+
+    @autoreleasepool
+    {
+        ECTwitterTimeline* unlimited = [self timeline];
+        unlimited.maxCount = 0;
+        for (; fed < 1300; fed += kBatch)
+        {
+            for (ECTwitterTweet* tweet in [self.cache addOrRefreshTweets:[infos subarrayWithRange:NSMakeRange(fed, kBatch)]])
+            {
+                [unlimited addTweet:tweet];
+            }
+        }
+        ECTestAssertIntegerIsEqual([unlimited count], 300);
+        ECTestAssertTrue(self.cache.tweetCount > kBudget);
+    }
+
+    for (; fed < [infos count]; fed += kBatch)
+    {
+        [self.cache addOrRefreshTweets:[infos subarrayWithRange:NSMakeRange(fed, kBatch)]];
+    }
+    ECTestAssertTrue(self.cache.tweetCount <= kBudget);
+}
+
+// --------------------------------------------------------------------------
+/// Fetching the latest tweets for a timeline that's fallen well behind
+/// gets a full page, which leaves a gap between it and what we had.
+/// The gap is then backfilled a page at a time until an empty page
+/// comes back, leaving the timeline complete and in order.
+// --------------------------------------------------------------------------
+
+- (void)testGapsAndBackfill
+{
+    static NSString *const kMethod = @"statuses/home_timeline";
+
+    NSArray* corpus = [ECTwitterFixtures tweetsWithCount:600];
+    [self serveCorpus:corpus forMethod:kMethod];
+
+    ECTwitterUser* user = [self.cache addOrRefreshUserWithInfo:[[ECTwitterFixtures usersWithCount:1] objectAtIndex:0]];
+    ECTwitterTimeline* timeline = [self timeline];
+    NSArray* old = [corpus subarrayWithRange:NSMakeRange(500, 100)];
+    for (ECTwitterTweet* tweet in [self.cache addOrRefreshTweets:old])
+    {
+        [timeline addTweet:tweet];
+    }
+
+    NSNotificationCenter* nc = [NSNotificationCenter defaultCenter];
+    id observer = [nc addObserverForName:ECTwitterTimelineUpdated object:timeline queue:nil usingBlock:^(NSNotification* notification) {
+        if ([timeline gapCount] == 0)
+        {
+            [self timeToExitRunLoop];
+        }
+    }];
+
+    [timeline fetchTweetsForUser:user method:MethodHome type:FetchLatest];
+    [self runUntilTimeToExit];
+    [nc removeObserver:observer];
+
+    // the latest page, then backfills of 200, 100 and nothing
+    ECTestAssertIntegerIsEqual([ECTwitterFixtureProtocol requestCount], 4);
+    ECTestAssertIntegerIsEqual([timeline gapCount], 0);
+    ECTestAssertIntegerIsEqual([timeline count], [corpus count]);
+    ECTestAssertTrue([self isNewestFirst:timeline]);
+    ECTestAssertTrue(timeline.newestTweet.twitterID == idOf([corpus objectAtIndex:0]));
+    ECTestAssertTrue(timeline.oldestTweet.twitterID == idOf([corpus lastObject]));
+}
+
+@end